@@ -1,50 +1,52 @@
 #ifndef BE_STATE_H
 #define BE_STATE_H
 
-/* Message types that are sent by the back-end */
-typedef enum {
-    BE_MESSAGE_TYPE_UNKNOWN = '_',
-    BE_MESSAGE_TYPE_AUTHENTICATION = 'R',
-    BE_MESSAGE_TYPE_KEY_DATA = 'K',
-    BE_MESSAGE_TYPE_BIND_COMPLETE = '2',
-    BE_MESSAGE_TYPE_CLOSE_COMPLETE = '3',
-    BE_MESSAGE_TYPE_COMMAND_COMPLETE = 'C',
-    BE_MESSAGE_TYPE_COPY_DATA = 'd',
-    BE_MESSAGE_TYPE_COPY_DONE = 'c',
-    BE_MESSAGE_TYPE_COPY_FAIL = 'f',
-    BE_MESSAGE_TYPE_COPY_IN_RESPONSE = 'G',
-    BE_MESSAGE_TYPE_COPY_OUT_RESPONSE = 'H',
-    BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE = 'W',
-    BE_MESSAGE_TYPE_DATA_ROW = 'D',
-    BE_MESSAGE_TYPE_EMPTY_QUERY_RESPONSE = 'I',
-    BE_MESSAGE_TYPE_ERROR_RESPONSE = 'E',
-    BE_MESSAGE_TYPE_FUNCTION_CALL_RESPONSE = 'V',
-    BE_MESSAGE_TYPE_NEGOTIATE_PROTOCOL_VERSION = 'v',
-    BE_MESSAGE_TYPE_NO_DATA = 'n',
-    BE_MESSAGE_TYPE_NOTICE_RESPONSE = 'N',
-    BE_MESSAGE_TYPE_NOTIFICATION_RESPONSE = 'A',
-    BE_MESSAGE_TYPE_PARAMETER_DESCRIPTION = 't',
-    BE_MESSAGE_TYPE_PARAMETER_STATUS = 'S',
-    BE_MESSAGE_TYPE_PARSE_COMPLETE = '1',
-    BE_MESSAGE_TYPE_PORTAL_SUSPENDED = 's',
-    BE_MESSAGE_TYPE_READY_FOR_QUERY = 'Z',
-    BE_MESSAGE_TYPE_ROW_DESCRIPTION = 'T',
-} be_message_type_t;
-
-
 typedef struct {
     be_message_type_t message_type;
+    /* The status byte from the latest ReadyForQuery. */
+    uint8_t transaction_status;
+    /* The request type from the latest Authentication message, e.g. 0 for AuthenticationOk. */
+    uint32_t auth_request_type;
+    /* The pid & key from the latest BackendKeyData. */
+    cancel_key_state_t key_state;
     union {
         generic_message_state_t generic;
+        error_response_state_t error_response;
     } message_state;
 } be_state_t;
 
 static void be_state_init(be_state_t *state) {
     ASSERT(state);
     state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+    state->transaction_status = 0;
+    state->auth_request_type = 0;
+    cancel_key_state_init(&state->key_state);
     generic_message_state_init(&state->message_state.generic);
 }
 
+static void be_state_print_ssl_response(uint16_t fe_port, const char *message_name, FILE *trace_fp) {
+    bool is_printed = trace_mode_is_tracing_messages() && (OUTPUT_FORMAT_NONE != global_output_format);
+    if (!is_printed && !trace_store_is_enabled(&global_trace_store)) {
+        return;
+    }
+
+    message_trace_buffer_t buf;
+    message_trace_buffer_write_start(&buf, fe_port, SENDER_TYPE_BE, message_name);
+    if (trace_store_is_enabled(&global_trace_store)) {
+        trace_store_on_message(&global_trace_store, now_epoch_nsec(), fe_port, SENDER_TYPE_BE, 0, message_name, 1, &buf);
+    }
+
+    if (!is_printed) {
+        return;
+    }
+
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_print(&buf, now_epoch_nsec(), fe_port, SENDER_TYPE_BE, 0, message_name, 1, trace_fp);
+    } else {
+        message_trace_buffer_print(&buf, trace_fp);
+    }
+}
+
 static void be_state_on_new_message(uint16_t fe_port,
                                     be_state_t *state,
                                     uint8_t byte,
@@ -54,20 +56,17 @@ static void be_state_on_new_message(uint16_t fe_port,
     ASSERT(trace_fp);
     
     /* The SSLRequest response is either N or S in a single packet.  Incredibly, these letters are used by other message types
-       so we need to give them special handling here. */
+       so we need to give them special handling here.  This is for when we missed the SSLRequest, see
+       connection_state_on_encryption_response for when we didn't.  What follows an S is picked up as TLS when the
+       front-end sends it. */
     if (1 == packet_payload_size) {
-        message_trace_buffer_t buf;
-        message_trace_buffer_init(&buf);
         if ('N' == byte) {
-            message_trace_buffer_write_start(&buf, fe_port, SENDER_TYPE_BE, "SSLResponseNo");
-            message_trace_buffer_print(&buf, trace_fp);
+            be_state_print_ssl_response(fe_port, "SSLResponseNo", trace_fp);
             return;
         }
         
         if ('S' == byte) {
-            message_trace_buffer_write_start(&buf, fe_port, SENDER_TYPE_BE, "SSLResponseYes");
-            message_trace_buffer_print(&buf, trace_fp);
-            ASSERT(false);
+            be_state_print_ssl_response(fe_port, "SSLResponseYes", trace_fp);
             return;
         }
     }
@@ -78,103 +77,112 @@ static void be_state_on_new_message(uint16_t fe_port,
             break;
         
         case BE_MESSAGE_TYPE_AUTHENTICATION:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "Authentication");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "Authentication");
+            state->auth_request_type = 0;
             break;
             
         case BE_MESSAGE_TYPE_KEY_DATA:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "BackendKeyData");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "BackendKeyData");
+            cancel_key_state_init(&state->key_state);
             break;
 
         case BE_MESSAGE_TYPE_BIND_COMPLETE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "BindComplete");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "BindComplete");
             break;
 
         case BE_MESSAGE_TYPE_CLOSE_COMPLETE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CloseComplete");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CloseComplete");
             break;
 
         case BE_MESSAGE_TYPE_COMMAND_COMPLETE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CommandComplete");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CommandComplete");
             break;
 
         case BE_MESSAGE_TYPE_COPY_DATA:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CopyData");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CopyData");
+            if (global_is_bulk_accounting_enabled || !trace_mode_is_tracing_messages()) {
+                generic_message_state_skip_payload(&state->message_state.generic);
+            }
             break;
 
         case BE_MESSAGE_TYPE_COPY_DONE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CopyDone");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CopyDone");
             break;
 
         case BE_MESSAGE_TYPE_COPY_FAIL:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CopyFail");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CopyFail");
             break;
 
         case BE_MESSAGE_TYPE_COPY_IN_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CopyIn");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CopyIn");
             break;
 
         case BE_MESSAGE_TYPE_COPY_OUT_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CopyOut");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CopyOut");
             break;
 
         case BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CopyBoth");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CopyBoth");
             break;
 
         case BE_MESSAGE_TYPE_DATA_ROW:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "DataRow");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "DataRow");
+            if (global_is_bulk_accounting_enabled || !trace_mode_is_tracing_messages()) {
+                generic_message_state_skip_payload(&state->message_state.generic);
+            }
             break;
 
         case BE_MESSAGE_TYPE_EMPTY_QUERY_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "QueryResponse");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "QueryResponse");
             break;
 
         case BE_MESSAGE_TYPE_ERROR_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "ErrorResponse");
+            error_response_state_on_new_message(&state->message_state.error_response, fe_port, SENDER_TYPE_BE, byte, "ErrorResponse");
             break;
 
         case BE_MESSAGE_TYPE_FUNCTION_CALL_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "CallResponse");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "CallResponse");
             break;
 
         case BE_MESSAGE_TYPE_NEGOTIATE_PROTOCOL_VERSION:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "NegotiateProtocolVersion");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "NegotiateProtocolVersion");
             break;
 
         case BE_MESSAGE_TYPE_NO_DATA:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "NoData");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "NoData");
             break;
 
         case BE_MESSAGE_TYPE_NOTICE_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "NoticeResponse");
+            error_response_state_on_new_message(&state->message_state.error_response, fe_port, SENDER_TYPE_BE, byte, "NoticeResponse");
             break;
 
         case BE_MESSAGE_TYPE_NOTIFICATION_RESPONSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "NotificationResponse");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "NotificationResponse");
             break;
 
         case BE_MESSAGE_TYPE_PARAMETER_DESCRIPTION:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "ParameterDescription");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "ParameterDescription");
             break;
 
         case BE_MESSAGE_TYPE_PARAMETER_STATUS:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "ParameterStatus");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "ParameterStatus");
             break;
 
         case BE_MESSAGE_TYPE_PARSE_COMPLETE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "ParseComplete");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "ParseComplete");
             break;
 
         case BE_MESSAGE_TYPE_PORTAL_SUSPENDED:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "PortalSuspended");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "PortalSuspended");
             break;
 
         case BE_MESSAGE_TYPE_READY_FOR_QUERY:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "ReadyForQuery");
+            state->transaction_status = 0;
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "ReadyForQuery");
             break;
 
         case BE_MESSAGE_TYPE_ROW_DESCRIPTION:                    
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, "RowDescription");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_BE, byte, "RowDescription");
             break;
 
         default:
@@ -185,7 +193,22 @@ static void be_state_on_new_message(uint16_t fe_port,
     state->message_type = (be_message_type_t)byte;
 }
 
-static inline void be_state_on_byte(uint16_t fe_port, be_state_t *state, uint8_t byte, size_t packet_payload_size, FILE *trace_fp) {
+static inline bool be_state_is_skipping(be_state_t *state) {
+    return (state->message_type != BE_MESSAGE_TYPE_UNKNOWN) && generic_message_state_is_skipping(&state->message_state.generic);
+}
+
+/* Skips over as much of the current message's payload as it can, see generic_message_state_skip. */
+static inline size_t be_state_skip(be_state_t *state, size_t num_bytes, bool *is_complete) {
+    size_t num_skipped = generic_message_state_skip(&state->message_state.generic, num_bytes, is_complete);
+    if (*is_complete) {
+        state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+    }
+
+    return num_skipped;
+}
+
+/* Returns true when a message has been completed. */
+static inline bool be_state_on_byte(uint16_t fe_port, be_state_t *state, uint8_t byte, size_t packet_payload_size, FILE *trace_fp) {
     ASSERT(state);
     ASSERT(trace_fp);
     
@@ -194,8 +217,6 @@ static inline void be_state_on_byte(uint16_t fe_port, be_state_t *state, uint8_t
             be_state_on_new_message(fe_port, state, byte, packet_payload_size, trace_fp);
             break;
     
-        case BE_MESSAGE_TYPE_AUTHENTICATION:
-        case BE_MESSAGE_TYPE_KEY_DATA:
         case BE_MESSAGE_TYPE_BIND_COMPLETE:
         case BE_MESSAGE_TYPE_CLOSE_COMPLETE:
         case BE_MESSAGE_TYPE_COMMAND_COMPLETE:
@@ -207,23 +228,67 @@ static inline void be_state_on_byte(uint16_t fe_port, be_state_t *state, uint8_t
         case BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE:
         case BE_MESSAGE_TYPE_DATA_ROW:
         case BE_MESSAGE_TYPE_EMPTY_QUERY_RESPONSE:
-        case BE_MESSAGE_TYPE_ERROR_RESPONSE:
         case BE_MESSAGE_TYPE_FUNCTION_CALL_RESPONSE:
         case BE_MESSAGE_TYPE_NEGOTIATE_PROTOCOL_VERSION:
         case BE_MESSAGE_TYPE_NO_DATA:
-        case BE_MESSAGE_TYPE_NOTICE_RESPONSE:
         case BE_MESSAGE_TYPE_NOTIFICATION_RESPONSE:
         case BE_MESSAGE_TYPE_PARAMETER_DESCRIPTION:
         case BE_MESSAGE_TYPE_PARAMETER_STATUS:
         case BE_MESSAGE_TYPE_PARSE_COMPLETE:
         case BE_MESSAGE_TYPE_PORTAL_SUSPENDED:
-        case BE_MESSAGE_TYPE_READY_FOR_QUERY:
         case BE_MESSAGE_TYPE_ROW_DESCRIPTION:        
             if (generic_message_state_on_byte(&state->message_state.generic, fe_port, byte, trace_fp)) {
                 state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+                return true;
+            }
+            break;
+
+        case BE_MESSAGE_TYPE_ERROR_RESPONSE:
+        case BE_MESSAGE_TYPE_NOTICE_RESPONSE:
+            if (error_response_state_on_byte(&state->message_state.error_response, fe_port, byte, trace_fp)) {
+                state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+                return true;
+            }
+            break;
+
+        case BE_MESSAGE_TYPE_AUTHENTICATION:
+            /* The payload starts with the request type, after the 4 bytes of length. */
+            if ((GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->message_state.generic.state_type) &&
+                (state->message_state.generic.message_bytes_read < 8)) {
+                state->auth_request_type = (state->auth_request_type << 8) | byte;
+            }
+
+            if (generic_message_state_on_byte(&state->message_state.generic, fe_port, byte, trace_fp)) {
+                state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+                return true;
+            }
+            break;
+
+        case BE_MESSAGE_TYPE_KEY_DATA:
+            if (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->message_state.generic.state_type) {
+                cancel_key_state_on_byte(&state->key_state, byte);
+            }
+
+            if (generic_message_state_on_byte(&state->message_state.generic, fe_port, byte, trace_fp)) {
+                state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+                return true;
+            }
+            break;
+
+        case BE_MESSAGE_TYPE_READY_FOR_QUERY:
+            /* The only payload byte is the transaction status. */
+            if (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->message_state.generic.state_type) {
+                state->transaction_status = byte;
+            }
+
+            if (generic_message_state_on_byte(&state->message_state.generic, fe_port, byte, trace_fp)) {
+                state->message_type = BE_MESSAGE_TYPE_UNKNOWN;
+                return true;
             }
             break;
     }
+
+    return false;
 }
 
 
@@ -0,0 +1,156 @@
+#ifndef BULK_TRANSFER_STATE_H
+#define BULK_TRANSFER_STATE_H
+
+/* When set, CopyData & DataRow payloads are skipped rather than traced, and each COPY or query result gets a
+   single summary line instead. */
+bool global_is_bulk_accounting_enabled;
+
+typedef enum {
+    BULK_TRANSFER_KIND_NONE,
+    BULK_TRANSFER_KIND_COPY_IN,
+    BULK_TRANSFER_KIND_COPY_OUT,
+    BULK_TRANSFER_KIND_COPY_BOTH,
+    BULK_TRANSFER_KIND_RESULT,
+} bulk_transfer_kind_t;
+
+static const char *bulk_transfer_kind_names[] = {"none", "copy_in", "copy_out", "copy_both", "result"};
+
+/* One COPY, from CopyInResponse/CopyOutResponse/CopyBothResponse, or one query result, from RowDescription or the first
+   DataRow, up to the CommandComplete (or whatever else) that ends it. */
+typedef struct {
+    bulk_transfer_kind_t kind;
+    uint64_t start_usec;
+    uint64_t num_messages;
+    /* Whole messages including their type & length. */
+    uint64_t num_bytes;
+} bulk_transfer_state_t;
+
+static void bulk_transfer_state_init(bulk_transfer_state_t *state) {
+    ASSERT(state);
+    state->kind = BULK_TRANSFER_KIND_NONE;
+    state->start_usec = 0;
+    state->num_messages = 0;
+    state->num_bytes = 0;
+}
+
+static void bulk_transfer_state_start(bulk_transfer_state_t *state, bulk_transfer_kind_t kind) {
+    ASSERT(state);
+    state->kind = kind;
+    state->start_usec = now_epoch_usec();
+    state->num_messages = 0;
+    state->num_bytes = 0;
+}
+
+static inline bool bulk_transfer_kind_is_counted(bulk_transfer_kind_t kind, sender_type_t sender_type, uint8_t message_type) {
+    switch (kind) {
+        case BULK_TRANSFER_KIND_NONE:
+            return false;
+
+        case BULK_TRANSFER_KIND_COPY_IN:
+            return (SENDER_TYPE_FE == sender_type) && (FE_MESSAGE_TYPE_COPY_DATA == message_type);
+
+        case BULK_TRANSFER_KIND_COPY_OUT:
+            return (SENDER_TYPE_BE == sender_type) && (BE_MESSAGE_TYPE_COPY_DATA == message_type);
+
+        case BULK_TRANSFER_KIND_COPY_BOTH:
+            return FE_MESSAGE_TYPE_COPY_DATA == message_type;
+
+        case BULK_TRANSFER_KIND_RESULT:
+            return (SENDER_TYPE_BE == sender_type) && (BE_MESSAGE_TYPE_DATA_ROW == message_type);
+    }
+
+    return false;
+}
+
+/* A message has completed.  length is from the message's length field. */
+static inline void bulk_transfer_state_on_data(bulk_transfer_state_t *state, sender_type_t sender_type, uint8_t message_type, int32_t length) {
+    /* Rows whose RowDescription answered an earlier Describe, or came before we joined. */
+    if ((BULK_TRANSFER_KIND_NONE == state->kind) && (SENDER_TYPE_BE == sender_type) && (BE_MESSAGE_TYPE_DATA_ROW == message_type)) {
+        bulk_transfer_state_start(state, BULK_TRANSFER_KIND_RESULT);
+    }
+
+    if (bulk_transfer_kind_is_counted(state->kind, sender_type, message_type)) {
+        state->num_messages++;
+        state->num_bytes += length + 1;
+    }
+}
+
+static void bulk_transfer_state_print(bulk_transfer_state_t *state, uint16_t fe_port, FILE *fp) {
+    if (!trace_mode_is_tracing_messages() || (OUTPUT_FORMAT_NONE == global_output_format)) {
+        return;
+    }
+
+    uint64_t duration_usec = now_epoch_usec() - state->start_usec;
+    uint64_t bytes_per_sec = (0 == duration_usec) ? 0 : state->num_bytes * 1000000 / duration_usec;
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_uint_field(&writer, "port", fe_port);
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"BulkTransfer\"");
+        message_json_writer_write_key(&writer, "kind");
+        message_json_writer_write_string(&writer,
+                                         (const uint8_t *)bulk_transfer_kind_names[state->kind],
+                                         strlen(bulk_transfer_kind_names[state->kind]));
+        message_json_writer_write_uint_field(&writer, "messages", state->num_messages);
+        message_json_writer_write_uint_field(&writer, "bytes", state->num_bytes);
+        message_json_writer_write_uint_field(&writer, "duration_usec", duration_usec);
+        message_json_writer_write_uint_field(&writer, "bytes_per_sec", bytes_per_sec);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, fp);
+        return;
+    }
+
+    LOG("bulk transfer: fe_port=%u kind=%s messages=%llu bytes=%llu duration_usec=%llu bytes_per_sec=%llu",
+        fe_port,
+        bulk_transfer_kind_names[state->kind],
+        (unsigned long long)state->num_messages,
+        (unsigned long long)state->num_bytes,
+        (unsigned long long)duration_usec,
+        (unsigned long long)bytes_per_sec);
+}
+
+/* The back-end has sent a message that might start or end a transfer. */
+static void bulk_transfer_state_on_be_message(bulk_transfer_state_t *state, uint16_t fe_port, be_message_type_t message_type, FILE *trace_fp) {
+    ASSERT(state);
+    switch (message_type) {
+        case BE_MESSAGE_TYPE_COPY_IN_RESPONSE:
+            bulk_transfer_state_start(state, BULK_TRANSFER_KIND_COPY_IN);
+            return;
+
+        case BE_MESSAGE_TYPE_COPY_OUT_RESPONSE:
+            bulk_transfer_state_start(state, BULK_TRANSFER_KIND_COPY_OUT);
+            return;
+
+        case BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE:
+            bulk_transfer_state_start(state, BULK_TRANSFER_KIND_COPY_BOTH);
+            return;
+
+        case BE_MESSAGE_TYPE_ROW_DESCRIPTION:
+            bulk_transfer_state_start(state, BULK_TRANSFER_KIND_RESULT);
+            return;
+
+        case BE_MESSAGE_TYPE_COMMAND_COMPLETE:
+        case BE_MESSAGE_TYPE_EMPTY_QUERY_RESPONSE:
+        case BE_MESSAGE_TYPE_ERROR_RESPONSE:
+        case BE_MESSAGE_TYPE_PORTAL_SUSPENDED:
+        case BE_MESSAGE_TYPE_READY_FOR_QUERY:
+            if (state->kind != BULK_TRANSFER_KIND_NONE) {
+                /* A result without rows is e.g. a Describe's RowDescription, not a transfer. */
+                if ((state->kind != BULK_TRANSFER_KIND_RESULT) || (state->num_messages > 0)) {
+                    bulk_transfer_state_print(state, fe_port, trace_fp);
+                }
+
+                bulk_transfer_state_init(state);
+            }
+            return;
+
+        default:
+            return;
+    }
+}
+
+#endif
@@ -0,0 +1,305 @@
+#ifndef BYPASS_RULES_H
+#define BYPASS_RULES_H
+
+#define BYPASS_MAX_RULES 64
+
+/* How much of the first Query's, or Parse's, text is kept to match query rules against. */
+#define BYPASS_QUERY_PREFIX_SIZE 64
+
+#define BYPASS_MAX_LINE_LENGTH 1024
+
+/* What a rule matches on.  Each is checked once per connection, when it's known. */
+typedef enum {
+    /* The client's IPv4 address, at the connection's first packet. */
+    BYPASS_MATCH_CIDR,
+    /* The StartupMessage's parameters, once it's complete. */
+    BYPASS_MATCH_USER,
+    BYPASS_MATCH_DATABASE,
+    BYPASS_MATCH_APPLICATION,
+    /* A replication parameter that asks for a walsender, physical or logical. */
+    BYPASS_MATCH_REPLICATION,
+    /* The start of the first Query or Parse's text, ignoring case and leading whitespace. */
+    BYPASS_MATCH_QUERY,
+    BYPASS_NUM_MATCHES,
+} bypass_match_t;
+
+static const char * const bypass_match_names[BYPASS_NUM_MATCHES] = {
+    "cidr", "user", "database", "application_name", "replication", "query"
+};
+
+typedef struct {
+    bypass_match_t match;
+    /* As written in the rules file. */
+    char value[BYPASS_QUERY_PREFIX_SIZE + 1];
+    size_t value_len;
+    /* In host order. */
+    uint32_t address;
+    uint32_t mask;
+} bypass_rule_t;
+
+/* Connections that we never want to parse, e.g. replication, bulk ETL & monitoring, matched once each by the rules in
+   the -I file.  Once a connection matches, its bytes are only counted and its TCP sequence numbers followed. */
+typedef struct {
+    bypass_rule_t rules[BYPASS_MAX_RULES];
+    size_t num_rules;
+    bool has_match[BYPASS_NUM_MATCHES];
+} bypass_rules_t;
+
+ENGINE_STATE(bypass_rules_t, global_bypass_rules);
+#define global_bypass_rules ENGINE_STATE_OF(global_bypass_rules)
+
+/* What's been bypassed under each rule, by rule index. */
+typedef struct {
+    uint64_t num_connections[BYPASS_MAX_RULES];
+    uint64_t num_bytes[BYPASS_MAX_RULES];
+} bypass_counts_t;
+
+/* One connection's side of the matching. */
+typedef struct {
+    /* The matching rule's index + 1, or 0 if the connection isn't bypassed. */
+    uint8_t rule_number;
+    bool is_address_checked;
+    bool is_query_checked;
+    /* The Parse's statement name is still being read, it comes before the text. */
+    bool is_in_statement_name;
+    char query_prefix[BYPASS_QUERY_PREFIX_SIZE];
+    size_t query_prefix_len;
+} bypass_connection_t;
+
+static void bypass_rules_init(bypass_rules_t *rules) {
+    ASSERT(rules);
+    memset(rules, 0, sizeof(*rules));
+}
+
+static inline bool bypass_rules_is_enabled(const bypass_rules_t *rules) {
+    return rules->num_rules > 0;
+}
+
+static inline bool bypass_rules_has_match(const bypass_rules_t *rules, bypass_match_t match) {
+    return rules->has_match[match];
+}
+
+static bool bypass_rules_parse_cidr(bypass_rule_t *rule) {
+    char address[32];
+    unsigned int prefix_len = 32;
+    const char *slash = strchr(rule->value, '/');
+    size_t address_len = slash ? (size_t)(slash - rule->value) : rule->value_len;
+    if (address_len >= sizeof(address)) {
+        return false;
+    }
+
+    memcpy(address, rule->value, address_len);
+    address[address_len] = '\0';
+    if (slash) {
+        char *end;
+        prefix_len = strtoul(slash + 1, &end, 10);
+        if ((end == slash + 1) || (*end != '\0') || (prefix_len > 32)) {
+            return false;
+        }
+    }
+
+    struct in_addr in;
+    if (inet_pton(AF_INET, address, &in) != 1) {
+        return false;
+    }
+
+    rule->mask = (0 == prefix_len) ? 0 : 0xffffffffu << (32 - prefix_len);
+    rule->address = ntohl(in.s_addr) & rule->mask;
+    return true;
+}
+
+/* Reads lines like "ignore user replicator", "ignore cidr 10.0.0.0/8", "ignore replication" or "ignore query COPY".
+   Blank lines and ones starting with # are skipped. */
+static void bypass_rules_load(bypass_rules_t *rules, const char *path) {
+    ASSERT(rules);
+    ASSERT(path);
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        FATAL("Can't open bypass rules: %s.  errno=%d", path, errno);
+    }
+
+    char line[BYPASS_MAX_LINE_LENGTH];
+    size_t line_number = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        ++line_number;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *action = strtok(line, " \t");
+        if (!action || ('#' == action[0])) {
+            continue;
+        }
+
+        char *match_name = strtok(NULL, " \t");
+        /* The rest of the line, so that a query prefix can have spaces in it. */
+        char *value = strtok(NULL, "");
+        if (value) {
+            value += strspn(value, " \t");
+        }
+
+        if ((strcmp(action, "ignore") != 0) || !match_name) {
+            FATAL("Bad bypass rule at %s:%zu, expected: ignore <match> [value]", path, line_number);
+        }
+
+        if (BYPASS_MAX_RULES == rules->num_rules) {
+            FATAL("Too many bypass rules in %s, the most is %d", path, BYPASS_MAX_RULES);
+        }
+
+        bypass_rule_t *rule = &rules->rules[rules->num_rules];
+        memset(rule, 0, sizeof(*rule));
+        for (rule->match = 0; rule->match < BYPASS_NUM_MATCHES; ++rule->match) {
+            if (strcmp(match_name, bypass_match_names[rule->match]) == 0) {
+                break;
+            }
+        }
+
+        if (BYPASS_NUM_MATCHES == rule->match) {
+            FATAL("Unknown bypass match at %s:%zu: %s", path, line_number, match_name);
+        }
+
+        bool has_value = (value && (value[0] != '\0'));
+        if (has_value != (rule->match != BYPASS_MATCH_REPLICATION)) {
+            FATAL("Bad bypass rule at %s:%zu, %s %s a value", path, line_number, match_name, has_value ? "doesn't take" : "needs");
+        }
+
+        if (has_value) {
+            rule->value_len = strlen(value);
+            size_t max_len = (BYPASS_MATCH_QUERY == rule->match) ? BYPASS_QUERY_PREFIX_SIZE : SESSION_TAG_MAX_LENGTH;
+            if (rule->value_len > max_len) {
+                FATAL("Bypass value too long at %s:%zu, the most is %zu characters", path, line_number, max_len);
+            }
+
+            memcpy(rule->value, value, rule->value_len + 1);
+        }
+
+        if ((BYPASS_MATCH_CIDR == rule->match) && !bypass_rules_parse_cidr(rule)) {
+            FATAL("Bad CIDR at %s:%zu: %s", path, line_number, rule->value);
+        }
+
+        rules->has_match[rule->match] = true;
+        rules->num_rules++;
+    }
+
+    fclose(fp);
+}
+
+/* Each of these returns the first rule of its kind that matches, as its index + 1, or 0 if none do. */
+static uint8_t bypass_rules_match_address(const bypass_rules_t *rules, uint32_t address) {
+    size_t i = 0;
+    for (; i < rules->num_rules; ++i) {
+        const bypass_rule_t *rule = &rules->rules[i];
+        if ((BYPASS_MATCH_CIDR == rule->match) && ((address & rule->mask) == rule->address)) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t bypass_rules_match_session(const bypass_rules_t *rules, const session_t *session, bool is_replication) {
+    size_t i = 0;
+    for (; i < rules->num_rules; ++i) {
+        const bypass_rule_t *rule = &rules->rules[i];
+        session_tag_id_t id;
+        switch (rule->match) {
+            case BYPASS_MATCH_USER:
+                id = session->user_id;
+                break;
+
+            case BYPASS_MATCH_DATABASE:
+                id = session->database_id;
+                break;
+
+            case BYPASS_MATCH_APPLICATION:
+                id = session->application_id;
+                break;
+
+            case BYPASS_MATCH_REPLICATION:
+                if (is_replication) {
+                    return i + 1;
+                }
+                continue;
+
+            default:
+                continue;
+        }
+
+        if ((id != SESSION_TAG_ID_UNKNOWN) && (strcmp(session_tags_name(&global_session_tags, id), rule->value) == 0)) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t bypass_rules_match_query(const bypass_rules_t *rules, const char *prefix, size_t prefix_len) {
+    size_t i = 0;
+    for (; i < rules->num_rules; ++i) {
+        const bypass_rule_t *rule = &rules->rules[i];
+        if ((BYPASS_MATCH_QUERY == rule->match) && (rule->value_len <= prefix_len) &&
+            (strncasecmp(prefix, rule->value, rule->value_len) == 0)) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static void bypass_rules_print_match(const bypass_rules_t *rules, uint16_t fe_port, uint8_t rule_number) {
+    const bypass_rule_t *rule = &rules->rules[rule_number - 1];
+    const char *match_name = bypass_match_names[rule->match];
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_uint_field(&writer, "port", fe_port);
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"Bypass\"");
+        message_json_writer_write_uint_field(&writer, "rule", rule_number);
+        message_json_writer_write_string_field(&writer, "match", (const uint8_t *)match_name, strlen(match_name));
+        message_json_writer_write_string_field(&writer, "value", (const uint8_t *)rule->value, rule->value_len);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    LOG("Bypassing connection.  fe_port=%u rule=%u match=%s value=%s", fe_port, rule_number, match_name, rule->value);
+}
+
+
+static void bypass_connection_init(bypass_connection_t *connection) {
+    ASSERT(connection);
+    connection->rule_number = 0;
+    connection->is_address_checked = false;
+    connection->is_query_checked = false;
+    connection->is_in_statement_name = false;
+    connection->query_prefix_len = 0;
+}
+
+static inline bool bypass_connection_is_bypassed(const bypass_connection_t *connection) {
+    return connection->rule_number != 0;
+}
+
+/* The front-end's first Query or Parse has started. */
+static inline void bypass_connection_on_query_start(bypass_connection_t *connection, fe_message_type_t message_type) {
+    connection->is_in_statement_name = (FE_MESSAGE_TYPE_PARSE == message_type);
+    connection->query_prefix_len = 0;
+}
+
+/* A byte of the payload of the front-end's first Query or Parse. */
+static inline void bypass_connection_on_query_byte(bypass_connection_t *connection, uint8_t byte) {
+    if (connection->is_in_statement_name) {
+        connection->is_in_statement_name = (byte != '\0');
+        return;
+    }
+
+    if ((0 == connection->query_prefix_len) && isspace(byte)) {
+        return;
+    }
+
+    if (connection->query_prefix_len < BYPASS_QUERY_PREFIX_SIZE) {
+        connection->query_prefix[connection->query_prefix_len++] = byte;
+    }
+}
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef CANCEL_KEYS_H
+#define CANCEL_KEYS_H
+
+/* A CancelRequest comes on a connection of its own, quoting the pid & secret key that the back-end it's for sent in its
+   BackendKeyData.  Each connection's key is indexed so that the connection that a CancelRequest is for can be found,
+   and cancel_state.h follows what happens to the statement that it was running. */
+
+#define CANCEL_KEYS_NUM_PORTS 0x10000
+#define CANCEL_KEYS_SLOT_BITS 17
+#define CANCEL_KEYS_NUM_SLOTS (1 << CANCEL_KEYS_SLOT_BITS)
+/* A key that can't be found a slot within this many of its own is put in its own slot, losing whatever was there. */
+#define CANCEL_KEYS_MAX_PROBES 16
+
+#define CANCEL_KEY_FNV_OFFSET_BASIS 2166136261u
+#define CANCEL_KEY_FNV_PRIME 16777619u
+
+/* A back-end's pid and its secret key.  The key is 4 bytes before protocol 3.2 and up to 256 after, so it's hashed. */
+typedef struct {
+    uint32_t pid;
+    uint32_t key_hash;
+} cancel_key_t;
+
+/* Decodes the pid & key at the start of a BackendKeyData's or CancelRequest's payload one byte at a time, whatever
+   the key's length. */
+typedef struct {
+    cancel_key_t key;
+    uint32_t offset;
+} cancel_key_state_t;
+
+static void cancel_key_state_init(cancel_key_state_t *state) {
+    ASSERT(state);
+    state->key.pid = 0;
+    state->key.key_hash = CANCEL_KEY_FNV_OFFSET_BASIS;
+    state->offset = 0;
+}
+
+static inline void cancel_key_state_on_byte(cancel_key_state_t *state, uint8_t byte) {
+    if (state->offset < 4) {
+        state->key.pid = (state->key.pid << 8) | byte;
+    } else {
+        state->key.key_hash = (state->key.key_hash ^ byte) * CANCEL_KEY_FNV_PRIME;
+    }
+
+    state->offset++;
+}
+
+/* Whether there was a pid and at least one byte of key. */
+static inline bool cancel_key_state_is_complete(const cancel_key_state_t *state) {
+    return state->offset > 4;
+}
+
+/* What became of a CancelRequest, or of a statement that was cancelled without one. */
+typedef enum {
+    /* The statement that the connection was running failed with query_canceled. */
+    CANCEL_OUTCOME_CANCELLED,
+    /* The statement finished before the cancel got to it. */
+    CANCEL_OUTCOME_TOO_LATE,
+    /* The connection wasn't running anything, so there was nothing to cancel. */
+    CANCEL_OUTCOME_IDLE,
+    /* The key wasn't from a BackendKeyData that we saw, e.g. because the connection started before we did. */
+    CANCEL_OUTCOME_UNMATCHED,
+    /* A statement failed with query_canceled without a CancelRequest, e.g. from statement_timeout or
+       pg_cancel_backend(). */
+    CANCEL_OUTCOME_SERVER,
+    CANCEL_NUM_OUTCOMES,
+} cancel_outcome_t;
+
+static const char * const cancel_outcome_names[CANCEL_NUM_OUTCOMES] = { "cancelled", "too_late", "idle", "unmatched", "server" };
+
+typedef struct {
+    uint64_t num_requests;
+    uint64_t num_outcomes[CANCEL_NUM_OUTCOMES];
+    /* From the CancelRequest to the cancelled statement's ErrorResponse. */
+    histogram_t delay_nsec;
+    /* From a cancelled statement being sent to its ErrorResponse, whether there was a CancelRequest or not. */
+    histogram_t statement_nsec;
+} cancel_stats_t;
+
+static void cancel_stats_init(cancel_stats_t *stats) {
+    ASSERT(stats);
+    memset(stats, 0, sizeof(*stats));
+    histogram_init(&stats->delay_nsec);
+    histogram_init(&stats->statement_nsec);
+}
+
+/* The key that each connection's back-end sent, and the CancelRequest for it that's still to be accounted for. */
+typedef struct {
+    cancel_key_t key;
+    bool has_key;
+    /* Where the key is indexed. */
+    uint32_t slot;
+    /* When the first CancelRequest since the connection's last ReadyForQuery came, or 0 if there hasn't been one, and
+       the port that it came on. */
+    uint64_t cancel_nsec;
+    uint16_t cancel_fe_port;
+} cancel_port_t;
+
+typedef struct {
+    cancel_port_t ports[CANCEL_KEYS_NUM_PORTS];
+    /* Open addressing, holding fe_port + 1.  0 is an empty slot, and a slot whose port's key has since changed is as
+       good as empty. */
+    uint32_t slots[CANCEL_KEYS_NUM_SLOTS];
+} cancel_keys_t;
+
+ENGINE_STATE(cancel_keys_t, global_cancel_keys);
+#define global_cancel_keys ENGINE_STATE_OF(global_cancel_keys)
+
+static void cancel_keys_init(cancel_keys_t *keys) {
+    ASSERT(keys);
+    memset(keys, 0, sizeof(*keys));
+}
+
+static inline size_t cancel_keys_home_slot(cancel_key_t key) {
+    return ((((uint64_t)key.pid << 32) ^ key.key_hash) * 11400714819323198485ULL) >> (64 - CANCEL_KEYS_SLOT_BITS);
+}
+
+static inline bool cancel_keys_is_live(const cancel_keys_t *keys, size_t slot) {
+    uint32_t entry = keys->slots[slot];
+    return (entry != 0) && keys->ports[entry - 1].has_key && (keys->ports[entry - 1].slot == slot);
+}
+
+/* The connection's back-end has sent its BackendKeyData. */
+static void cancel_keys_add(cancel_keys_t *keys, uint16_t fe_port, cancel_key_t key) {
+    ASSERT(keys);
+    cancel_port_t *port = &keys->ports[fe_port];
+    port->has_key = false;
+    size_t home = cancel_keys_home_slot(key);
+    size_t slot = home;
+    size_t i = 0;
+    for (; (i < CANCEL_KEYS_MAX_PROBES) && cancel_keys_is_live(keys, slot); ++i) {
+        slot = (slot + 1) % CANCEL_KEYS_NUM_SLOTS;
+    }
+
+    if (CANCEL_KEYS_MAX_PROBES == i) {
+        keys->ports[keys->slots[home] - 1].has_key = false;
+        slot = home;
+    }
+
+    keys->slots[slot] = fe_port + 1;
+    port->key = key;
+    port->has_key = true;
+    port->slot = slot;
+}
+
+/* Finds the connection whose back-end has the key.  Returns false if there isn't one. */
+static bool cancel_keys_find(const cancel_keys_t *keys, cancel_key_t key, uint16_t *fe_port) {
+    ASSERT(keys);
+    ASSERT(fe_port);
+    size_t slot = cancel_keys_home_slot(key);
+    size_t i = 0;
+    for (; i < CANCEL_KEYS_MAX_PROBES; ++i, slot = (slot + 1) % CANCEL_KEYS_NUM_SLOTS) {
+        if (!cancel_keys_is_live(keys, slot)) {
+            continue;
+        }
+
+        const cancel_port_t *port = &keys->ports[keys->slots[slot] - 1];
+        if ((port->key.pid == key.pid) && (port->key.key_hash == key.key_hash)) {
+            *fe_port = keys->slots[slot] - 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* The port has a new connection, whose back-end's key is still to come. */
+static inline void cancel_keys_on_open(cancel_keys_t *keys, uint16_t fe_port) {
+    keys->ports[fe_port].has_key = false;
+    keys->ports[fe_port].cancel_nsec = 0;
+}
+
+#endif
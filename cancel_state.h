@@ -0,0 +1,150 @@
+#ifndef CANCEL_STATE_H
+#define CANCEL_STATE_H
+
+/* Follows each CancelRequest to the connection that it's for, see cancel_keys.h, and says what became of the statement
+   that the connection was running: cancelled, finished first, or there wasn't one.  Statements that are cancelled
+   without a CancelRequest, e.g. by statement_timeout, are reported too. */
+
+/* query_canceled, whether by a CancelRequest, statement_timeout or pg_cancel_backend(). */
+#define CANCEL_SQLSTATE_QUERY_CANCELED "57014"
+
+typedef struct {
+    cancel_outcome_t outcome;
+    /* The connection that was cancelled, or for CANCEL_OUTCOME_UNMATCHED the CancelRequest's. */
+    uint16_t fe_port;
+    /* The cancelled back-end's, or for CANCEL_OUTCOME_UNMATCHED the one asked for.  0 if we don't know it. */
+    uint32_t pid;
+    /* The CancelRequest's connection.  Not for CANCEL_OUTCOME_SERVER. */
+    uint16_t cancel_fe_port;
+    /* From the statement being sent to its ErrorResponse, and from the CancelRequest to the ErrorResponse.  0 if they
+       don't apply. */
+    uint64_t statement_nsec;
+    uint64_t delay_nsec;
+    /* NULL unless statements are being kept, see connection_state_on_fe_message. */
+    const statement_text_t *statement;
+} cancel_event_t;
+
+static void cancel_state_print(const cancel_event_t *event) {
+    const char *outcome = cancel_outcome_names[event->outcome];
+    bool has_request = (event->outcome != CANCEL_OUTCOME_SERVER);
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_uint_field(&writer, "port", event->fe_port);
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"Cancel\"");
+        message_json_writer_write_string_field(&writer, "outcome", (const uint8_t *)outcome, strlen(outcome));
+        if (has_request) {
+            message_json_writer_write_uint_field(&writer, "cancel_port", event->cancel_fe_port);
+        }
+
+        if (event->pid != 0) {
+            message_json_writer_write_uint_field(&writer, "pid", event->pid);
+        }
+
+        if (event->statement_nsec != 0) {
+            message_json_writer_write_uint_field(&writer, "statement_nsec", event->statement_nsec);
+        }
+
+        if (CANCEL_OUTCOME_CANCELLED == event->outcome) {
+            message_json_writer_write_uint_field(&writer, "delay_nsec", event->delay_nsec);
+        }
+
+        if (event->statement) {
+            message_json_writer_write_string_field(&writer, "text", (const uint8_t *)event->statement->text,
+                                                   event->statement->length);
+        }
+
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    char text[STATEMENT_TEXT_MAX_LENGTH + 1];
+    size_t length = event->statement ? event->statement->length : 0;
+    size_t i = 0;
+    for (; i < length; ++i) {
+        uint8_t byte = (uint8_t)event->statement->text[i];
+        text[i] = ((byte < 32) || (127 == byte)) ? '.' : byte;
+    }
+
+    text[i] = '\0';
+    LOG("cancel: outcome=%s fe_port=%u cancel_port=%u pid=%u statement_usec=%llu delay_usec=%llu text=%s",
+        outcome, event->fe_port, has_request ? event->cancel_fe_port : 0, event->pid,
+        (unsigned long long)event->statement_nsec / 1000, (unsigned long long)event->delay_nsec / 1000, text);
+}
+
+static void cancel_state_on_outcome(const cancel_event_t *event) {
+    global_metrics.cancel.num_outcomes[event->outcome]++;
+    if (event->statement_nsec != 0) {
+        histogram_add(&global_metrics.cancel.statement_nsec, event->statement_nsec);
+    }
+
+    if (CANCEL_OUTCOME_CANCELLED == event->outcome) {
+        histogram_add(&global_metrics.cancel.delay_nsec, event->delay_nsec);
+    }
+
+    cancel_state_print(event);
+}
+
+/* A CancelRequest has come on fe_port.  Only the first for a connection counts until the connection's next
+   ReadyForQuery, since clients that give up waiting tend to send more. */
+static void cancel_state_on_cancel_request(uint16_t fe_port, const cancel_key_state_t *key_state) {
+    global_metrics.cancel.num_requests++;
+    uint16_t target_fe_port;
+    if (!cancel_key_state_is_complete(key_state) || !cancel_keys_find(&global_cancel_keys, key_state->key, &target_fe_port)) {
+        cancel_event_t event = { CANCEL_OUTCOME_UNMATCHED, fe_port, key_state->key.pid, fe_port, 0, 0, NULL };
+        cancel_state_on_outcome(&event);
+        return;
+    }
+
+    cancel_port_t *port = &global_cancel_keys.ports[target_fe_port];
+    if (0 == port->cancel_nsec) {
+        port->cancel_nsec = now_epoch_nsec();
+        port->cancel_fe_port = fe_port;
+    }
+}
+
+/* The connection has had an ErrorResponse with CANCEL_SQLSTATE_QUERY_CANCELED for request, which is NULL if we didn't
+   see it being sent. */
+static void cancel_state_on_query_canceled(uint16_t fe_port, const pipeline_request_t *request, const statement_text_t *statement) {
+    uint64_t now_nsec = now_epoch_nsec();
+    uint64_t statement_nsec = (request && (now_nsec > request->sent_nsec)) ? now_nsec - request->sent_nsec : 0;
+    cancel_port_t *port = &global_cancel_keys.ports[fe_port];
+    uint32_t pid = port->has_key ? port->key.pid : 0;
+    cancel_event_t event = { CANCEL_OUTCOME_SERVER, fe_port, pid, port->cancel_fe_port, statement_nsec, 0, statement };
+    if (port->cancel_nsec != 0) {
+        if (!request || (request->sent_nsec <= port->cancel_nsec)) {
+            event.outcome = CANCEL_OUTCOME_CANCELLED;
+            event.delay_nsec = now_nsec - port->cancel_nsec;
+        } else {
+            /* The statement was sent after the CancelRequest, which must have found the connection idle. */
+            cancel_event_t idle = { CANCEL_OUTCOME_IDLE, fe_port, pid, port->cancel_fe_port, 0, 0, NULL };
+            cancel_state_on_outcome(&idle);
+        }
+
+        port->cancel_nsec = 0;
+    }
+
+    cancel_state_on_outcome(&event);
+}
+
+/* The connection is ready for its next request, so a CancelRequest that hasn't cancelled anything by now never will.
+   request_start_nsec is when the connection's last request was sent, or 0 if we didn't see it. */
+static inline void cancel_state_on_ready_for_query(uint16_t fe_port, uint64_t request_start_nsec) {
+    cancel_port_t *port = &global_cancel_keys.ports[fe_port];
+    if (0 == port->cancel_nsec) {
+        return;
+    }
+
+    bool is_running = (request_start_nsec != 0) && (request_start_nsec <= port->cancel_nsec);
+    cancel_event_t event = { is_running ? CANCEL_OUTCOME_TOO_LATE : CANCEL_OUTCOME_IDLE, fe_port, port->key.pid,
+                             port->cancel_fe_port, 0, 0, NULL };
+    port->cancel_nsec = 0;
+    cancel_state_on_outcome(&event);
+}
+
+#endif
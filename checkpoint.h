@@ -0,0 +1,418 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+/* "PGTRCKPT" */
+#define CHECKPOINT_MAGIC 0x50475452434b5054ULL
+/* Bump this whenever the file layout changes. */
+#define CHECKPOINT_VERSION 1
+/* Past this the connections have very likely moved on without us, so the checkpoint is more harm than help. */
+#define CHECKPOINT_MAX_AGE_USEC (10 * 60 * (uint64_t)1000000)
+
+/* Where a stream was in its current message: nothing but its type & whatever length bytes had arrived, and how much
+   of it had been read.  That's enough to find the next message boundary without the partial payload. */
+typedef struct {
+    uint8_t message_type;
+    uint8_t length_offset;
+    int32_t length_value;
+    int32_t message_bytes_read;
+} checkpoint_framing_t;
+
+typedef struct {
+    uint16_t fe_port;
+    bool is_open;
+    uint8_t transaction_status;
+    tcp_state_channel_t fe_channel;
+    tcp_state_channel_t be_channel;
+    checkpoint_framing_t fe;
+    checkpoint_framing_t be;
+} checkpoint_connection_t;
+
+typedef struct {
+    /* Loaded, but not applied until the first packet's timestamp says whether it's still any use. */
+    bool is_pending;
+    uint64_t saved_usec;
+    uint32_t num_connections;
+    checkpoint_connection_t *connections;
+    /* Restored connections whose next payload in each direction hasn't yet been checked to carry on from exactly
+       where we stopped. */
+    bool is_fe_unchecked[0xffff];
+    bool is_be_unchecked[0xffff];
+} checkpoint_t;
+
+checkpoint_t global_checkpoint;
+
+
+/* Fixed-width big-endian fields with an FNV-1a checksum over everything. */
+typedef struct {
+    FILE *fp;
+    uint32_t checksum;
+    bool is_ok;
+} checkpoint_io_t;
+
+static void checkpoint_io_init(checkpoint_io_t *io, FILE *fp) {
+    io->fp = fp;
+    io->checksum = 2166136261u;
+    io->is_ok = true;
+}
+
+static void checkpoint_io_update_checksum(checkpoint_io_t *io, const uint8_t *bytes, size_t num_bytes) {
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        io->checksum = (io->checksum ^ bytes[i]) * 16777619u;
+    }
+}
+
+static void checkpoint_write_uint(checkpoint_io_t *io, uint64_t value, size_t num_bytes) {
+    uint8_t bytes[8];
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        bytes[i] = (uint8_t)(value >> (8 * (num_bytes - 1 - i)));
+    }
+
+    checkpoint_io_update_checksum(io, bytes, num_bytes);
+    if (fwrite(bytes, num_bytes, 1, io->fp) != 1) {
+        io->is_ok = false;
+    }
+}
+
+static uint64_t checkpoint_read_uint(checkpoint_io_t *io, size_t num_bytes) {
+    uint8_t bytes[8];
+    if (fread(bytes, num_bytes, 1, io->fp) != 1) {
+        io->is_ok = false;
+        return 0;
+    }
+
+    checkpoint_io_update_checksum(io, bytes, num_bytes);
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        value = (value << 8) | bytes[i];
+    }
+
+    return value;
+}
+
+static void checkpoint_write_framing(checkpoint_io_t *io, const checkpoint_framing_t *framing) {
+    checkpoint_write_uint(io, framing->message_type, 1);
+    checkpoint_write_uint(io, framing->length_offset, 1);
+    checkpoint_write_uint(io, (uint32_t)framing->length_value, 4);
+    checkpoint_write_uint(io, (uint32_t)framing->message_bytes_read, 4);
+}
+
+static void checkpoint_read_framing(checkpoint_io_t *io, checkpoint_framing_t *framing) {
+    framing->message_type = checkpoint_read_uint(io, 1);
+    framing->length_offset = checkpoint_read_uint(io, 1);
+    framing->length_value = (int32_t)checkpoint_read_uint(io, 4);
+    framing->message_bytes_read = (int32_t)checkpoint_read_uint(io, 4);
+    if ((framing->length_offset > 4) || (framing->message_bytes_read < 0)) {
+        io->is_ok = false;
+    }
+}
+
+static void checkpoint_write_connection(checkpoint_io_t *io, const checkpoint_connection_t *connection) {
+    checkpoint_write_uint(io, connection->fe_port, 2);
+    checkpoint_write_uint(io, connection->is_open, 1);
+    checkpoint_write_uint(io, connection->transaction_status, 1);
+    checkpoint_write_uint(io, connection->fe_channel.min_seq, 4);
+    checkpoint_write_uint(io, connection->fe_channel.max_seq, 4);
+    checkpoint_write_uint(io, connection->be_channel.min_seq, 4);
+    checkpoint_write_uint(io, connection->be_channel.max_seq, 4);
+    checkpoint_write_framing(io, &connection->fe);
+    checkpoint_write_framing(io, &connection->be);
+}
+
+static void checkpoint_read_connection(checkpoint_io_t *io, checkpoint_connection_t *connection) {
+    connection->fe_port = checkpoint_read_uint(io, 2);
+    connection->is_open = (checkpoint_read_uint(io, 1) != 0);
+    connection->transaction_status = checkpoint_read_uint(io, 1);
+    connection->fe_channel.min_seq = checkpoint_read_uint(io, 4);
+    connection->fe_channel.max_seq = checkpoint_read_uint(io, 4);
+    connection->be_channel.min_seq = checkpoint_read_uint(io, 4);
+    connection->be_channel.max_seq = checkpoint_read_uint(io, 4);
+    checkpoint_read_framing(io, &connection->fe);
+    checkpoint_read_framing(io, &connection->be);
+    if (0xffff == connection->fe_port) {
+        io->is_ok = false;
+    }
+}
+
+
+static void checkpoint_framing_init(checkpoint_framing_t *framing, uint8_t message_type, generic_message_state_t *generic) {
+    framing->message_type = message_type;
+    framing->length_offset = generic ? generic->length_state.offset : 0;
+    framing->length_value = generic ? generic->length_state.value : 0;
+    framing->message_bytes_read = generic ? generic->message_bytes_read : 0;
+}
+
+/* Only connections that we've seen traffic on, haven't seen end and are parsing are worth keeping. */
+static bool checkpoint_connection_init(checkpoint_connection_t *connection, uint16_t fe_port, tcp_state_t *tcp_state) {
+    connection_state_t *state = get_connection_state(fe_port);
+    if (state->is_closed || state->is_unparsed || ((0 == tcp_state->fe[fe_port].min_seq) && (0 == tcp_state->be[fe_port].min_seq))) {
+        return false;
+    }
+
+    connection->fe_port = fe_port;
+    connection->is_open = state->is_open;
+    connection->transaction_status = state->transaction.status;
+    connection->fe_channel = tcp_state->fe[fe_port];
+    connection->be_channel = tcp_state->be[fe_port];
+    checkpoint_framing_init(&connection->fe,
+                            state->fe.message_type,
+                            (FE_MESSAGE_TYPE_UNKNOWN == state->fe.message_type) ? NULL : fe_state_generic(&state->fe));
+    checkpoint_framing_init(&connection->be,
+                            state->be.message_type,
+                            (BE_MESSAGE_TYPE_UNKNOWN == state->be.message_type) ? NULL : &state->be.message_state.generic);
+    return true;
+}
+
+/* Writes the state of every live connection to path, by way of a temporary file so that a crash part way through
+   doesn't leave a broken checkpoint behind. */
+static void checkpoint_save(const char *path, tcp_state_t *tcp_state) {
+    ASSERT(path);
+    ASSERT(tcp_state);
+    char tmp_path[4096];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        LOG("Checkpoint path is too long: %s", path);
+        return;
+    }
+
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp) {
+        LOG("Can't open checkpoint file %s for writing, errno=%d", tmp_path, errno);
+        return;
+    }
+
+    checkpoint_connection_t connection;
+    uint32_t num_connections = 0;
+    uint32_t fe_port = 0;
+    for (; fe_port < 0xffff; ++fe_port) {
+        num_connections += checkpoint_connection_init(&connection, fe_port, tcp_state);
+    }
+
+    checkpoint_io_t io;
+    checkpoint_io_init(&io, fp);
+    checkpoint_write_uint(&io, CHECKPOINT_MAGIC, 8);
+    checkpoint_write_uint(&io, CHECKPOINT_VERSION, 4);
+    checkpoint_write_uint(&io, now_epoch_usec(), 8);
+    checkpoint_write_uint(&io, num_connections, 4);
+    for (fe_port = 0; fe_port < 0xffff; ++fe_port) {
+        if (checkpoint_connection_init(&connection, fe_port, tcp_state)) {
+            checkpoint_write_connection(&io, &connection);
+        }
+    }
+
+    uint32_t checksum = io.checksum;
+    checkpoint_write_uint(&io, checksum, 4);
+    if ((fclose(fp) != 0) || !io.is_ok) {
+        LOG("Can't write checkpoint file %s", tmp_path);
+        unlink(tmp_path);
+        return;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        LOG("Can't rename checkpoint file %s to %s, errno=%d", tmp_path, path, errno);
+        unlink(tmp_path);
+        return;
+    }
+
+    LOG("Checkpointed %u connections to %s", num_connections, path);
+}
+
+/* Reads a checkpoint written by checkpoint_save.  It's fine for there to be no checkpoint, anything else that's wrong
+   with it is logged and the checkpoint is ignored. */
+static void checkpoint_load(checkpoint_t *checkpoint, const char *path) {
+    ASSERT(checkpoint);
+    ASSERT(path);
+    checkpoint->is_pending = false;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        if (errno != ENOENT) {
+            LOG("Can't open checkpoint file %s, errno=%d", path, errno);
+        }
+        return;
+    }
+
+    checkpoint_io_t io;
+    checkpoint_io_init(&io, fp);
+    uint64_t magic = checkpoint_read_uint(&io, 8);
+    uint32_t version = checkpoint_read_uint(&io, 4);
+    if (!io.is_ok || (magic != CHECKPOINT_MAGIC) || (version != CHECKPOINT_VERSION)) {
+        LOG("Ignoring checkpoint file %s, it isn't a version %d checkpoint", path, CHECKPOINT_VERSION);
+        fclose(fp);
+        return;
+    }
+
+    checkpoint->saved_usec = checkpoint_read_uint(&io, 8);
+    checkpoint->num_connections = checkpoint_read_uint(&io, 4);
+    if (checkpoint->num_connections > 0xffff) {
+        io.is_ok = false;
+        checkpoint->num_connections = 0;
+    }
+
+    checkpoint->connections = calloc(checkpoint->num_connections + 1, sizeof(checkpoint->connections[0]));
+    if (!checkpoint->connections) {
+        FATAL("Can't allocate %u checkpointed connections", checkpoint->num_connections);
+    }
+
+    uint32_t i = 0;
+    for (; io.is_ok && (i < checkpoint->num_connections); ++i) {
+        checkpoint_read_connection(&io, &checkpoint->connections[i]);
+    }
+
+    uint32_t checksum = io.checksum;
+    if (!io.is_ok || (checkpoint_read_uint(&io, 4) != checksum) || (fgetc(fp) != EOF)) {
+        LOG("Ignoring checkpoint file %s, it's corrupt", path);
+        free(checkpoint->connections);
+        checkpoint->connections = NULL;
+        fclose(fp);
+        return;
+    }
+
+    fclose(fp);
+    checkpoint->is_pending = true;
+}
+
+
+/* Feeds the stream's message type & length bytes back through the state machine, then skips whatever part of the
+   payload had already gone by. */
+static void checkpoint_restore_fe_framing(uint16_t fe_port, connection_state_t *state, const checkpoint_framing_t *framing) {
+    if (FE_MESSAGE_TYPE_UNKNOWN == framing->message_type) {
+        return;
+    }
+
+    uint8_t header[5];
+    size_t header_length = 0;
+    /* A special message's first length byte doubles as its type. */
+    if (framing->message_type != FE_MESSAGE_TYPE_SPECIAL) {
+        header[header_length++] = framing->message_type;
+    }
+
+    size_t i = 0;
+    for (; i < framing->length_offset; ++i) {
+        header[header_length++] = (uint8_t)((uint32_t)framing->length_value >> (24 - 8 * i));
+    }
+
+    for (i = 0; i < header_length; ++i) {
+        connection_state_on_fe_bytes(fe_port, state, &header[i], 1, stdout);
+    }
+
+    generic_message_state_t *generic = fe_state_generic(&state->fe);
+    if ((state->fe.message_type != FE_MESSAGE_TYPE_UNKNOWN) &&
+        (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == generic->state_type) &&
+        (framing->message_bytes_read > generic->message_bytes_read) &&
+        (framing->message_bytes_read < int32_state_value_get(&generic->length_state))) {
+        generic_message_state_skip_rest_of_payload(generic, framing->message_bytes_read);
+    }
+}
+
+static void checkpoint_restore_be_framing(uint16_t fe_port, connection_state_t *state, const checkpoint_framing_t *framing) {
+    if (BE_MESSAGE_TYPE_UNKNOWN == framing->message_type) {
+        return;
+    }
+
+    uint8_t header[5];
+    size_t header_length = 0;
+    header[header_length++] = framing->message_type;
+    size_t i = 0;
+    for (; i < framing->length_offset; ++i) {
+        header[header_length++] = (uint8_t)((uint32_t)framing->length_value >> (24 - 8 * i));
+    }
+
+    /* The packet size isn't 1 so that the type byte isn't taken for an SSLRequest response. */
+    for (i = 0; i < header_length; ++i) {
+        connection_state_on_be_bytes(fe_port, state, &header[i], 1, sizeof(header), stdout);
+    }
+
+    generic_message_state_t *generic = &state->be.message_state.generic;
+    if ((state->be.message_type != BE_MESSAGE_TYPE_UNKNOWN) &&
+        (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == generic->state_type) &&
+        (framing->message_bytes_read > generic->message_bytes_read) &&
+        (framing->message_bytes_read < int32_state_value_get(&generic->length_state))) {
+        generic_message_state_skip_rest_of_payload(generic, framing->message_bytes_read);
+    }
+}
+
+static void checkpoint_restore_connection(checkpoint_t *checkpoint, const checkpoint_connection_t *connection, tcp_state_t *tcp_state) {
+    uint16_t fe_port = connection->fe_port;
+    connection_state_t *state = get_connection_state(fe_port);
+    connection_state_init(state);
+    state->is_open = connection->is_open;
+    state->transaction.status = connection->transaction_status;
+    checkpoint_restore_fe_framing(fe_port, state, &connection->fe);
+    checkpoint_restore_be_framing(fe_port, state, &connection->be);
+    tcp_state->fe[fe_port] = connection->fe_channel;
+    tcp_state->be[fe_port] = connection->be_channel;
+    checkpoint->is_fe_unchecked[fe_port] = true;
+    checkpoint->is_be_unchecked[fe_port] = true;
+}
+
+/* Applies a loaded checkpoint if the first packet since we started is from soon enough after it was saved. */
+static void checkpoint_on_first_packet(checkpoint_t *checkpoint, tcp_state_t *tcp_state) {
+    ASSERT(checkpoint->is_pending);
+    checkpoint->is_pending = false;
+    uint64_t now_usec = now_epoch_usec();
+    if (now_usec < checkpoint->saved_usec) {
+        LOG("Ignoring checkpoint, it was saved at %llu which is after the first packet",
+            (unsigned long long)checkpoint->saved_usec);
+    } else if (now_usec - checkpoint->saved_usec > CHECKPOINT_MAX_AGE_USEC) {
+        LOG("Ignoring checkpoint, it was saved at %llu which is too long before the first packet",
+            (unsigned long long)checkpoint->saved_usec);
+    } else {
+        uint32_t i = 0;
+        for (; i < checkpoint->num_connections; ++i) {
+            checkpoint_restore_connection(checkpoint, &checkpoint->connections[i], tcp_state);
+        }
+
+        LOG("Restored %u connections from checkpoint, gap_usec=%llu",
+            checkpoint->num_connections,
+            (unsigned long long)(now_usec - checkpoint->saved_usec));
+    }
+
+    free(checkpoint->connections);
+    checkpoint->connections = NULL;
+}
+
+/* Gives up on a restored connection because bytes went by while we weren't looking, so we don't know where its
+   messages start any more. */
+static void checkpoint_forget_connection(checkpoint_t *checkpoint, uint16_t fe_port, tcp_state_t *tcp_state) {
+    LOG("Connection on port=%u had traffic while stopped, its checkpointed state is no use", fe_port);
+    state_machine_evict(fe_port);
+    tcp_state_forget(tcp_state, fe_port);
+    checkpoint->is_fe_unchecked[fe_port] = false;
+    checkpoint->is_be_unchecked[fe_port] = false;
+}
+
+/* The port has been reused for a new connection, so there's nothing restored left to check. */
+static inline void checkpoint_on_connection_open(checkpoint_t *checkpoint, uint16_t fe_port) {
+    checkpoint->is_fe_unchecked[fe_port] = false;
+    checkpoint->is_be_unchecked[fe_port] = false;
+}
+
+/* A restored connection is only any use if its next payload in each direction starts exactly where we stopped.  An
+   earlier one is a retransmission, and tcp_state will drop it. */
+static inline void checkpoint_check_packet(checkpoint_t *checkpoint,
+                                           bool *is_unchecked,
+                                           tcp_state_channel_t *channels,
+                                           uint16_t fe_port,
+                                           u_int seq,
+                                           size_t payload_size,
+                                           tcp_state_t *tcp_state) {
+    if (!is_unchecked[fe_port] || (0 == payload_size) || (seq < channels[fe_port].min_seq)) {
+        return;
+    }
+
+    is_unchecked[fe_port] = false;
+    if (seq != channels[fe_port].min_seq) {
+        checkpoint_forget_connection(checkpoint, fe_port, tcp_state);
+    }
+}
+
+static inline void checkpoint_check_fe_packet(checkpoint_t *checkpoint, tcp_state_t *tcp_state, uint16_t fe_port, u_int seq, size_t payload_size) {
+    checkpoint_check_packet(checkpoint, checkpoint->is_fe_unchecked, tcp_state->fe, fe_port, seq, payload_size, tcp_state);
+}
+
+static inline void checkpoint_check_be_packet(checkpoint_t *checkpoint, tcp_state_t *tcp_state, uint16_t fe_port, u_int seq, size_t payload_size) {
+    checkpoint_check_packet(checkpoint, checkpoint->is_be_unchecked, tcp_state->be, fe_port, seq, payload_size, tcp_state);
+}
+
+#endif
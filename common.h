@@ -1,32 +1,102 @@
 #ifndef COMMON_H
 #define COMMON_H
 
-#define LOG(format__, ...) fprintf(stdout, PROGRAM_NAME ": %s " format__ "\n", now_epoch_usec_str(), __VA_ARGS__)
+/* Log lines go to stderr when stdout is carrying NDJSON so that the NDJSON stays parseable. */
+#define LOG(format__, ...) fprintf(log_fp(), PROGRAM_NAME ": %s " format__ "\n", now_timestamp_str(), __VA_ARGS__)
 #define FATAL(...) (LOG(__VA_ARGS__), exit(1))
 #define ASSERT(cond__) ((cond__) ? 0 : FATAL("%s", #cond__))
 
+/* The engine's state, e.g. the connections and the time.  In the programs it's plain globals, but libpgtrace gives each
+   pgtrace_t its own, and the thread that's using one points these at it, see pgtrace_use.  Each is declared with
+   ENGINE_STATE and used by its name, which ENGINE_STATE_OF defines, so that the engine reads the same either way. */
+#ifdef LIBPGTRACE
+#define ENGINE_STATE(type__, name__) __thread type__ *name__##_instance
+#define ENGINE_STATE_OF(name__) (*name__##_instance)
+#else
+#define ENGINE_STATE(type__, name__) type__ name__##_instance
+#define ENGINE_STATE_OF(name__) name__##_instance
+#endif
+
 typedef enum {
     SENDER_TYPE_FE,
     SENDER_TYPE_BE,
 } sender_type_t;
 
+typedef enum {
+    /* One line of text per message with a sanitized payload dump. */
+    OUTPUT_FORMAT_TEXT,
+    /* One JSON object per message with the protocol fields decoded. */
+    OUTPUT_FORMAT_NDJSON,
+    /* Nothing, the messages go to libpgtrace's caller instead. */
+    OUTPUT_FORMAT_NONE,
+} output_format_t;
+
+output_format_t global_output_format;
+
+/* Where log lines go instead, if it's set, e.g. by libpgtrace's caller. */
+ENGINE_STATE(FILE *, global_log_fp);
+#define global_log_fp ENGINE_STATE_OF(global_log_fp)
+
+static FILE *log_fp() {
+    if (global_log_fp) {
+        return global_log_fp;
+    }
+
+    return (OUTPUT_FORMAT_NDJSON == global_output_format) ? stderr : stdout;
+}
+
 /* Don't be tempted to use gettimeofday, we need to use the time value provided by libpcap so that savefile
-   times work. */
-struct timeval global_now;
+   times work.  Nanoseconds since the epoch, whatever precision the capture has. */
+ENGINE_STATE(uint64_t, global_now_nsec);
+#define global_now_nsec ENGINE_STATE_OF(global_now_nsec)
+
+/* Nanoseconds per unit of the capture's struct timeval tv_usec, which holds nanoseconds when the capture was opened
+   with PCAP_TSTAMP_PRECISION_NANO. */
+uint64_t global_capture_nsec_per_tick = 1000;
+
+/* Trace & log timestamps are in nanoseconds rather than microseconds. */
+bool global_is_nsec_timestamps;
 
-static uint64_t timeval_to_usec(const struct timeval *tv) {
-    uint64_t result = tv->tv_sec;
-    result *= 1000000;
-    result += tv->tv_usec;
-    return result;
+static uint64_t now_epoch_nsec() {
+    return global_now_nsec;
 }
 
 static uint64_t now_epoch_usec() {
-    return timeval_to_usec(&global_now);
+    return global_now_nsec / 1000;
 }
 
 static void set_now(const struct timeval *tv) {
-    memcpy(&global_now, tv, sizeof(global_now));
+    global_now_nsec = (uint64_t)tv->tv_sec * 1000000000 + (uint64_t)tv->tv_usec * global_capture_nsec_per_tick;
+}
+
+/* Fires once per interval of packet time, e.g. for periodic summaries.  An interval of 0 never fires. */
+typedef struct {
+    uint64_t interval_usec;
+    uint64_t next_usec;
+} interval_timer_t;
+
+static void interval_timer_init(interval_timer_t *timer, uint64_t interval_usec) {
+    timer->interval_usec = interval_usec;
+    timer->next_usec = 0;
+}
+
+static inline bool interval_timer_is_due(interval_timer_t *timer, uint64_t now_usec) {
+    if (0 == timer->interval_usec) {
+        return false;
+    }
+
+    if (0 == timer->next_usec) {
+        timer->next_usec = now_usec + timer->interval_usec;
+        return false;
+    }
+
+    if (now_usec < timer->next_usec) {
+        return false;
+    }
+
+    /* Skip over any whole intervals with no packets at all. */
+    timer->next_usec += ((now_usec - timer->next_usec) / timer->interval_usec + 1) * timer->interval_usec;
+    return true;
 }
 
 /* sprintf is too slow and strtoll does weird stuff. */
@@ -46,9 +116,55 @@ static char *uint64_to_dec_str(char *num_str, uint64_t i) {
     return num_str;
 }
 
-static const char *now_epoch_usec_str() {
-    static char s[64];
-    uint64_to_dec_str(s, now_epoch_usec());
+/* The seconds part of the last timestamp rendered, since it only changes once a second and the fraction is all
+   that needs rendering for each message. */
+typedef struct {
+    uint64_t sec;
+    size_t sec_str_length;
+    char sec_str[24];
+    /* now_timestamp_str's. */
+    char now_str[64];
+} timestamp_cache_t;
+
+ENGINE_STATE(timestamp_cache_t, global_timestamp_cache);
+#define global_timestamp_cache ENGINE_STATE_OF(global_timestamp_cache)
+
+/* Writes an epoch timestamp in microseconds, or nanoseconds if global_is_nsec_timestamps, and returns the end of it. */
+static char *timestamp_to_dec_str(char *str, uint64_t epoch_nsec) {
+    uint64_t sec = epoch_nsec / 1000000000;
+    uint64_t fraction = epoch_nsec % 1000000000;
+    size_t num_fraction_digits = 9;
+    if (!global_is_nsec_timestamps) {
+        fraction /= 1000;
+        num_fraction_digits = 6;
+    }
+
+    if (0 == sec) {
+        return uint64_to_dec_str(str, fraction);
+    }
+
+    timestamp_cache_t *cache = &global_timestamp_cache;
+    if ((sec != cache->sec) || (0 == cache->sec_str_length)) {
+        cache->sec = sec;
+        cache->sec_str_length = uint64_to_dec_str(cache->sec_str, sec) - cache->sec_str;
+    }
+
+    memcpy(str, cache->sec_str, cache->sec_str_length);
+    str += cache->sec_str_length;
+    char *p = str + num_fraction_digits;
+    while (p > str) {
+        *--p = '0' + fraction % 10;
+        fraction /= 10;
+    }
+
+    str += num_fraction_digits;
+    *str = '\0';
+    return str;
+}
+
+static const char *now_timestamp_str() {
+    char *s = global_timestamp_cache.now_str;
+    timestamp_to_dec_str(s, now_epoch_nsec());
     return s;
 }
 
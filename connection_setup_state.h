@@ -0,0 +1,132 @@
+#ifndef CONNECTION_SETUP_STATE_H
+#define CONNECTION_SETUP_STATE_H
+
+/* Times a connection's setup, phase by phase, see connection_setup_stats.h.  A connection whose SYN wasn't seen is
+   timed from its StartupMessage, and one that goes encrypted or is bypassed before its first ReadyForQuery isn't
+   timed at all. */
+
+/* The Authentication message's request type that means authentication is done. */
+#define CONNECTION_SETUP_AUTH_OK 0
+
+typedef enum {
+    /* Not setting up, or we don't know where it's up to. */
+    CONNECTION_SETUP_PHASE_NONE,
+    CONNECTION_SETUP_PHASE_SYN_SENT,
+    CONNECTION_SETUP_PHASE_SYN_ACKED,
+    /* The handshake's done and the StartupMessage is still to come. */
+    CONNECTION_SETUP_PHASE_CONNECTED,
+    /* Waiting for the first Authentication message. */
+    CONNECTION_SETUP_PHASE_STARTED,
+    CONNECTION_SETUP_PHASE_AUTHENTICATING,
+    /* Waiting for the first ReadyForQuery. */
+    CONNECTION_SETUP_PHASE_AUTHENTICATED,
+} connection_setup_phase_t;
+
+typedef struct {
+    connection_setup_phase_t phase;
+    /* When the setup started, with the SYN or the StartupMessage, and when the phase did. */
+    uint64_t start_nsec;
+    uint64_t phase_start_nsec;
+    uint32_t num_auth_round_trips;
+} connection_setup_t;
+
+static void connection_setup_init(connection_setup_t *setup) {
+    ASSERT(setup);
+    setup->phase = CONNECTION_SETUP_PHASE_NONE;
+    setup->start_nsec = 0;
+    setup->phase_start_nsec = 0;
+    setup->num_auth_round_trips = 0;
+}
+
+/* Starts the next phase, and returns how long the one before it took. */
+static uint64_t connection_setup_next_phase(connection_setup_t *setup, connection_setup_phase_t phase) {
+    uint64_t now_nsec = now_epoch_nsec();
+    uint64_t phase_nsec = now_nsec - setup->phase_start_nsec;
+    setup->phase = phase;
+    setup->phase_start_nsec = now_nsec;
+    return phase_nsec;
+}
+
+/* The front-end has sent a SYN. */
+static void connection_setup_on_syn(connection_setup_t *setup) {
+    setup->phase = CONNECTION_SETUP_PHASE_SYN_SENT;
+    setup->start_nsec = now_epoch_nsec();
+    setup->phase_start_nsec = setup->start_nsec;
+}
+
+/* The back-end has answered a SYN. */
+static void connection_setup_on_syn_ack(connection_setup_t *setup) {
+    if (CONNECTION_SETUP_PHASE_SYN_SENT == setup->phase) {
+        setup->phase = CONNECTION_SETUP_PHASE_SYN_ACKED;
+    }
+}
+
+/* The front-end has sent a packet with an ACK, which finishes the handshake if it's waiting for one. */
+static inline void connection_setup_on_fe_ack(connection_setup_t *setup) {
+    if (CONNECTION_SETUP_PHASE_SYN_ACKED == setup->phase) {
+        uint64_t handshake_nsec = connection_setup_next_phase(setup, CONNECTION_SETUP_PHASE_CONNECTED);
+        histogram_add(&global_connection_setup_stats.handshake_nsec, handshake_nsec);
+        histogram_add(&global_metrics.connection_setup.handshake_nsec, handshake_nsec);
+    }
+}
+
+static void connection_setup_on_startup_message(connection_setup_t *setup) {
+    if (CONNECTION_SETUP_PHASE_CONNECTED != setup->phase) {
+        setup->start_nsec = now_epoch_nsec();
+    }
+
+    setup->phase = CONNECTION_SETUP_PHASE_STARTED;
+    setup->phase_start_nsec = now_epoch_nsec();
+    setup->num_auth_round_trips = 0;
+}
+
+/* A PasswordMessage, which is also what carries SASL & GSSAPI responses. */
+static inline void connection_setup_on_password_message(connection_setup_t *setup) {
+    if (CONNECTION_SETUP_PHASE_AUTHENTICATING == setup->phase) {
+        setup->num_auth_round_trips++;
+    }
+}
+
+/* An Authentication message of the given request type, e.g. 10 for SASL. */
+static void connection_setup_on_authentication(connection_setup_t *setup, uint32_t request_type) {
+    if (CONNECTION_SETUP_PHASE_STARTED == setup->phase) {
+        uint64_t startup_nsec = connection_setup_next_phase(setup, (CONNECTION_SETUP_AUTH_OK == request_type) ?
+                                                                   CONNECTION_SETUP_PHASE_AUTHENTICATED :
+                                                                   CONNECTION_SETUP_PHASE_AUTHENTICATING);
+        histogram_add(&global_connection_setup_stats.startup_nsec, startup_nsec);
+        histogram_add(&global_metrics.connection_setup.startup_nsec, startup_nsec);
+    } else if ((CONNECTION_SETUP_PHASE_AUTHENTICATING == setup->phase) && (CONNECTION_SETUP_AUTH_OK == request_type)) {
+        uint64_t auth_nsec = connection_setup_next_phase(setup, CONNECTION_SETUP_PHASE_AUTHENTICATED);
+        histogram_add(&global_connection_setup_stats.auth_nsec, auth_nsec);
+        histogram_add(&global_metrics.connection_setup.auth_nsec, auth_nsec);
+        histogram_add(&global_connection_setup_stats.auth_round_trips, setup->num_auth_round_trips);
+        histogram_add(&global_metrics.connection_setup.auth_round_trips, setup->num_auth_round_trips);
+    }
+}
+
+static inline void connection_setup_on_ready_for_query(connection_setup_t *setup) {
+    if (CONNECTION_SETUP_PHASE_AUTHENTICATED != setup->phase) {
+        return;
+    }
+
+    uint64_t ready_nsec = connection_setup_next_phase(setup, CONNECTION_SETUP_PHASE_NONE);
+    histogram_add(&global_connection_setup_stats.ready_nsec, ready_nsec);
+    histogram_add(&global_metrics.connection_setup.ready_nsec, ready_nsec);
+    uint64_t total_nsec = now_epoch_nsec() - setup->start_nsec;
+    histogram_add(&global_connection_setup_stats.total_nsec, total_nsec);
+    histogram_add(&global_metrics.connection_setup.total_nsec, total_nsec);
+    global_connection_setup_stats.num_established++;
+    global_metrics.connection_setup.num_established++;
+}
+
+/* The back-end has refused the connection. */
+static void connection_setup_on_error(connection_setup_t *setup) {
+    if (setup->phase >= CONNECTION_SETUP_PHASE_STARTED) {
+        global_connection_setup_stats.num_failed++;
+        global_metrics.connection_setup.num_failed++;
+    }
+
+    setup->phase = CONNECTION_SETUP_PHASE_NONE;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef CONNECTION_SETUP_STATS_H
+#define CONNECTION_SETUP_STATS_H
+
+/* What it costs to set up connections, from the SYN to the first ReadyForQuery, in phases.  See
+   connection_setup_state.h.  The global stats are reset for each summary, the metrics' copy isn't. */
+typedef struct {
+    /* Connections that got to their first ReadyForQuery, and ones whose setup ended in an ErrorResponse, e.g. a wrong
+       password or too many connections. */
+    uint64_t num_established;
+    uint64_t num_failed;
+    /* From the front-end's SYN to its ACK of the back-end's SYN-ACK. */
+    histogram_t handshake_nsec;
+    /* From the StartupMessage to the back-end's first Authentication message. */
+    histogram_t startup_nsec;
+    /* From the first Authentication request to AuthenticationOk, when there's a request at all, and how many password,
+       SASL or GSSAPI responses the front-end sent on the way, e.g. 2 for SCRAM. */
+    histogram_t auth_nsec;
+    histogram_t auth_round_trips;
+    /* From AuthenticationOk to the first ReadyForQuery, while the back-end starts up and sends its ParameterStatus &
+       BackendKeyData. */
+    histogram_t ready_nsec;
+    /* From the SYN, or the StartupMessage if the SYN wasn't seen, to the first ReadyForQuery. */
+    histogram_t total_nsec;
+} connection_setup_stats_t;
+
+ENGINE_STATE(connection_setup_stats_t, global_connection_setup_stats);
+#define global_connection_setup_stats ENGINE_STATE_OF(global_connection_setup_stats)
+
+static void connection_setup_stats_init(connection_setup_stats_t *stats) {
+    ASSERT(stats);
+    stats->num_established = 0;
+    stats->num_failed = 0;
+    histogram_init(&stats->handshake_nsec);
+    histogram_init(&stats->startup_nsec);
+    histogram_init(&stats->auth_nsec);
+    histogram_init(&stats->auth_round_trips);
+    histogram_init(&stats->ready_nsec);
+    histogram_init(&stats->total_nsec);
+}
+
+/* interval_nsec is how long the stats were counted for, for the connection rate. */
+static void connection_setup_stats_print_summary(connection_setup_stats_t *stats, uint64_t interval_nsec, FILE *fp) {
+    ASSERT(stats);
+    uint64_t num_per_ksec = interval_nsec ? stats->num_established * 1000000000000ULL / interval_nsec : 0;
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"ConnectionSetupSummary\"");
+        message_json_writer_write_uint_field(&writer, "connections", stats->num_established);
+        message_json_writer_write_uint_field(&writer, "connections_per_ksec", num_per_ksec);
+        message_json_writer_write_uint_field(&writer, "failed", stats->num_failed);
+        histogram_write_json_field(&stats->handshake_nsec, "handshake_nsec", &writer);
+        histogram_write_json_field(&stats->startup_nsec, "startup_nsec", &writer);
+        histogram_write_json_field(&stats->auth_nsec, "auth_nsec", &writer);
+        histogram_write_json_field(&stats->auth_round_trips, "auth_round_trips", &writer);
+        histogram_write_json_field(&stats->ready_nsec, "ready_nsec", &writer);
+        histogram_write_json_field(&stats->total_nsec, "total_nsec", &writer);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, fp);
+        return;
+    }
+
+    char handshake_str[256];
+    char startup_str[256];
+    char auth_str[256];
+    char auth_round_trips_str[256];
+    char ready_str[256];
+    char total_str[256];
+    LOG("connection setup summary: connections=%llu per_sec=%llu.%03llu failed=%llu handshake_nsec=%s startup_nsec=%s "
+        "auth_nsec=%s auth_round_trips=%s ready_nsec=%s total_nsec=%s",
+        (unsigned long long)stats->num_established,
+        (unsigned long long)(num_per_ksec / 1000),
+        (unsigned long long)(num_per_ksec % 1000),
+        (unsigned long long)stats->num_failed,
+        histogram_to_str(&stats->handshake_nsec, handshake_str),
+        histogram_to_str(&stats->startup_nsec, startup_str),
+        histogram_to_str(&stats->auth_nsec, auth_str),
+        histogram_to_str(&stats->auth_round_trips, auth_round_trips_str),
+        histogram_to_str(&stats->ready_nsec, ready_str),
+        histogram_to_str(&stats->total_nsec, total_str));
+}
+
+#endif
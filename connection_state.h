@@ -4,29 +4,633 @@
 typedef struct {
     fe_state_t fe;    
     be_state_t be;
+    transaction_state_t transaction;
+    statement_state_t statement;
+    pipeline_state_t pipeline;
+    bulk_transfer_state_t bulk_transfer;
+    replay_connection_t replay;
+    pooler_leg_t pooler;
+    bypass_connection_t bypass;
+    opaque_connection_t opaque;
+    replication_connection_t replication;
+    connection_setup_t setup;
+    /* Bypassed or encrypted, so the connection's bytes are only counted. */
+    bool is_unparsed;
+    /* When we saw the connection start, or 0 if we didn't. */
+    uint64_t open_nsec;
+    /* We saw the connection start and haven't seen it end yet. */
+    bool is_open;
+    /* We saw the connection end, so there's nothing worth keeping until the port is reused. */
+    bool is_closed;
+    /* When the connection last had a packet in either direction, or 0 if it hasn't had one. */
+    uint64_t last_packet_nsec;
 } connection_state_t;
 
 static void connection_state_init(connection_state_t *connection) {
     ASSERT(connection);
     fe_state_init(&connection->fe);
     be_state_init(&connection->be);
+    transaction_state_init(&connection->transaction);
+    statement_state_init(&connection->statement);
+    pipeline_state_init(&connection->pipeline);
+    bulk_transfer_state_init(&connection->bulk_transfer);
+    replay_connection_init(&connection->replay, false);
+    pooler_leg_init(&connection->pooler);
+    bypass_connection_init(&connection->bypass);
+    opaque_connection_init(&connection->opaque);
+    replication_connection_init(&connection->replication);
+    connection_setup_init(&connection->setup);
+    connection->is_unparsed = false;
+    connection->open_nsec = 0;
+    connection->is_open = false;
+    connection->is_closed = false;
+    connection->last_packet_nsec = 0;
 }
 
-static inline void connection_state_on_fe_byte(uint16_t fe_port,
-                                               connection_state_t *state,
-                                               uint8_t byte,                                        
-                                               FILE *trace_fp) {
+static void connection_state_on_open(connection_state_t *state) {
     ASSERT(state);
-    fe_state_on_byte(fe_port, &state->fe, byte, trace_fp);
+    state->is_closed = false;
+    bypass_connection_init(&state->bypass);
+    opaque_connection_init(&state->opaque);
+    state->opaque.is_tls_possible = true;
+    replication_connection_stop(&state->replication, &global_metrics.replication);
+    state->is_unparsed = false;
+    state->open_nsec = now_epoch_nsec();
+    connection_setup_on_syn(&state->setup);
+    replay_connection_stop(&global_replay_recorder, &state->replay);
+    replay_connection_init(&state->replay,
+                           replay_recorder_is_enabled(&global_replay_recorder) &&
+                           (global_memory_budget.level < MEMORY_LEVEL_DROP_REASSEMBLY));
+    if (!state->is_open) {
+        state->is_open = true;
+        global_metrics.num_connections_opened++;
+    }
 }
 
-static inline void connection_state_on_be_byte(uint16_t fe_port,
-                                               connection_state_t *state,
-                                               uint8_t byte,
-                                               size_t packet_payload_size,
-                                               FILE *trace_fp) {
+static void connection_state_on_close(uint16_t fe_port, connection_state_t *state) {
     ASSERT(state);
-    be_state_on_byte(fe_port, &state->be, byte, packet_payload_size, trace_fp);
+    if (opaque_connection_is_opaque(&state->opaque) && !state->is_closed) {
+        uint64_t start_nsec = (state->open_nsec != 0) ? state->open_nsec : state->opaque.start_nsec;
+        uint64_t duration_nsec = now_epoch_nsec() - start_nsec;
+        histogram_add(&global_metrics.opaque.duration_nsec, duration_nsec);
+        opaque_connection_print_end(&state->opaque, fe_port, duration_nsec);
+    }
+
+    state->is_closed = true;
+    replication_connection_stop(&state->replication, &global_metrics.replication);
+    replay_connection_stop(&global_replay_recorder, &state->replay);
+    if (state->is_open) {
+        state->is_open = false;
+        global_metrics.num_connections_closed++;
+    }
+}
+
+/* Forgets everything about the connection but whether it's open and whether it's parsed, e.g. to free its memory.  If
+   it carries on then it's picked up at the next message boundary, which is where an idle connection is anyway. */
+static void connection_state_evict(connection_state_t *state) {
+    ASSERT(state);
+    bool is_open = state->is_open;
+    uint64_t open_nsec = state->open_nsec;
+    bypass_connection_t bypass = state->bypass;
+    opaque_connection_t opaque = state->opaque;
+    bool is_unparsed = state->is_unparsed;
+    replay_connection_stop(&global_replay_recorder, &state->replay);
+    replication_connection_stop(&state->replication, &global_metrics.replication);
+    connection_state_init(state);
+    state->is_open = is_open;
+    state->open_nsec = open_nsec;
+    state->bypass = bypass;
+    state->opaque = opaque;
+    state->opaque.is_tls_possible = false;
+    state->is_unparsed = is_unparsed;
+}
+
+/* Counts the bytes of a connection that isn't parsed, and returns how many it took, which is all of them. */
+static inline size_t connection_state_on_unparsed_bytes(connection_state_t *state, sender_type_t sender_type, size_t num_bytes) {
+    if (!opaque_connection_is_opaque(&state->opaque)) {
+        global_metrics.bypass.num_bytes[state->bypass.rule_number - 1] += num_bytes;
+    } else if (SENDER_TYPE_FE == sender_type) {
+        state->opaque.fe_bytes += num_bytes;
+        global_metrics.opaque.fe_bytes += num_bytes;
+    } else {
+        state->opaque.be_bytes += num_bytes;
+        global_metrics.opaque.be_bytes += num_bytes;
+    }
+
+    return num_bytes;
+}
+
+/* Whether statement texts are wanted, and so which statement each Query and Execute runs. */
+static inline bool connection_state_is_keeping_statements() {
+    return top_statements_is_enabled(&global_top_statements) || rollup_writer_is_enabled(&global_rollup_writer) ||
+           pooler_is_enabled(&global_pooler);
+}
+
+/* From now on the connection is encrypted, so its bytes are only counted. */
+static void connection_state_make_opaque(uint16_t fe_port, connection_state_t *state, opaque_reason_t reason) {
+    state->opaque.reason = reason;
+    state->opaque.start_nsec = now_epoch_nsec();
+    state->is_unparsed = true;
+    global_metrics.opaque.num_connections[reason]++;
+    replay_connection_stop(&global_replay_recorder, &state->replay);
+    opaque_connection_print_start(&state->opaque, fe_port);
+}
+
+/* From now on the connection's bytes are only counted, if a rule matched. */
+static void connection_state_bypass(uint16_t fe_port, connection_state_t *state, uint8_t rule_number) {
+    if ((0 == rule_number) || state->is_unparsed) {
+        return;
+    }
+
+    state->bypass.rule_number = rule_number;
+    state->is_unparsed = true;
+    global_metrics.bypass.num_connections[rule_number - 1]++;
+    replay_connection_stop(&global_replay_recorder, &state->replay);
+    bypass_rules_print_match(&global_bypass_rules, fe_port, rule_number);
+}
+
+/* The front-end has sent a whole message, which ends just before end, or at bytes that weren't captured if end is
+   NULL. */
+static inline void connection_state_on_fe_message(uint16_t fe_port,
+                                                  connection_state_t *state,
+                                                  fe_message_type_t message_type,
+                                                  const uint8_t *end) {
+    if (message_sink_is_enabled(&global_message_sink)) {
+        /* Not fe_state_generic, the message type has already gone back to unknown. */
+        generic_message_state_t *generic = (FE_MESSAGE_TYPE_SPECIAL == message_type) ?
+                                           &state->fe.message_state.special.generic_message_state :
+                                           &state->fe.message_state.generic;
+        message_sink_on_message(&global_message_sink, fe_port, SENDER_TYPE_FE, message_type, generic, end);
+    }
+
+    if (FE_MESSAGE_TYPE_SPECIAL == message_type) {
+        switch (state->fe.message_state.special.message_type) {
+            case SPECIAL_MESSAGE_TYPE_SSL_REQUEST:
+                state->opaque.requested_reason = OPAQUE_REASON_SSL;
+                break;
+
+            case SPECIAL_MESSAGE_TYPE_GSSENC_REQUEST:
+                state->opaque.requested_reason = OPAQUE_REASON_GSSENC;
+                break;
+
+            case SPECIAL_MESSAGE_TYPE_CANCEL_REQUEST:
+                cancel_state_on_cancel_request(fe_port, &state->fe.message_state.special.cancel_key);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if ((FE_MESSAGE_TYPE_SPECIAL == message_type) &&
+        (SPECIAL_MESSAGE_TYPE_STARTUP_MESSAGE == state->fe.message_state.special.message_type)) {
+        session_t *session = &global_sessions[fe_port];
+        *session = special_message_state_session(&state->fe.message_state.special);
+        session->breakdown_index = metrics_breakdown_index(&global_metrics, session);
+        connection_setup_on_startup_message(&state->setup);
+        if (bypass_rules_is_enabled(&global_bypass_rules)) {
+            connection_state_bypass(fe_port, state,
+                                    bypass_rules_match_session(&global_bypass_rules, session,
+                                                               state->fe.message_state.special.is_replication));
+        }
+    }
+
+    if (rollup_writer_is_enabled(&global_rollup_writer)) {
+        generic_message_state_t *generic = (FE_MESSAGE_TYPE_SPECIAL == message_type) ?
+                                           &state->fe.message_state.special.generic_message_state :
+                                           &state->fe.message_state.generic;
+        rollup_writer_on_message(&global_rollup_writer, SENDER_TYPE_FE, message_type, generic->message_name,
+                                 int32_state_value_get(&generic->length_state), global_sessions[fe_port].application_id);
+    }
+
+    if (FE_MESSAGE_TYPE_PASSWORD_MESSAGE == message_type) {
+        connection_setup_on_password_message(&state->setup);
+    }
+
+    if (!state->bypass.is_query_checked && ((FE_MESSAGE_TYPE_QUERY == message_type) || (FE_MESSAGE_TYPE_PARSE == message_type)) &&
+        bypass_rules_has_match(&global_bypass_rules, BYPASS_MATCH_QUERY)) {
+        state->bypass.is_query_checked = true;
+        connection_state_bypass(fe_port, state,
+                                bypass_rules_match_query(&global_bypass_rules, state->bypass.query_prefix, state->bypass.query_prefix_len));
+    }
+
+    if (global_is_bulk_accounting_enabled) {
+        bulk_transfer_state_on_data(&state->bulk_transfer,
+                                    SENDER_TYPE_FE,
+                                    message_type,
+                                    int32_state_value_get(&state->fe.message_state.generic.length_state));
+    }
+
+    if (replay_recorder_is_enabled(&global_replay_recorder)) {
+        replay_connection_on_fe_message(&global_replay_recorder, &state->replay, message_type);
+    }
+
+    if (!pipeline_state_is_request(message_type)) {
+        return;
+    }
+
+    bool has_statement = false;
+    uint16_t statement_ref = 0;
+    if (connection_state_is_keeping_statements()) {
+        statement_state_t *statements = &state->statement;
+        const statement_text_t *statement;
+        uint64_t name_hash;
+        switch (message_type) {
+            case FE_MESSAGE_TYPE_QUERY:
+                if ((statement = statement_message_state_statement(&state->fe.message_state.statement)) != NULL) {
+                    has_statement = true;
+                    statement_ref = statement_state_add(statements, statement);
+                }
+                break;
+
+            case FE_MESSAGE_TYPE_PARSE:
+                if (!statement_message_state_name_hash(&state->fe.message_state.statement, &name_hash)) {
+                    break;
+                }
+
+                if ((statement = statement_message_state_statement(&state->fe.message_state.statement)) != NULL) {
+                    statement_state_on_parse(statements, name_hash, statement);
+                } else {
+                    statement_state_on_unknown_parse(statements, name_hash);
+                }
+                break;
+
+            case FE_MESSAGE_TYPE_BIND:
+                if (statement_state_is_reading_names(statements)) {
+                    statement_state_on_unknown_bind(statements);
+                } else {
+                    statement_state_on_bind(statements, statements->name_hashes[0], statements->name_hashes[1]);
+                }
+                break;
+
+            case FE_MESSAGE_TYPE_EXECUTE:
+                has_statement = !statement_state_is_reading_names(statements) &&
+                                statement_state_on_execute(statements, statements->name_hashes[0], &statement_ref);
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    if (pooler_is_enabled(&global_pooler)) {
+        const statement_text_t *executed = ((FE_MESSAGE_TYPE_EXECUTE == message_type) && has_statement) ?
+                                           statement_state_get(&state->statement, statement_ref) : NULL;
+        pooler_leg_on_fe_message(&global_pooler, &state->pooler, message_type, executed, fe_state_generic(&state->fe)->start_nsec);
+    }
+
+    pipeline_state_push(&state->pipeline,
+                        message_type,
+                        has_statement,
+                        statement_ref,
+                        fe_state_generic(&state->fe)->start_nsec);
+}
+
+/* The back-end has sent a whole message, see connection_state_on_fe_message. */
+static inline void connection_state_on_be_message(uint16_t fe_port,
+                                                  connection_state_t *state,
+                                                  be_message_type_t message_type,
+                                                  const uint8_t *end,
+                                                  FILE *trace_fp) {
+    if (message_sink_is_enabled(&global_message_sink)) {
+        message_sink_on_message(&global_message_sink, fe_port, SENDER_TYPE_BE, message_type,
+                                &state->be.message_state.generic, end);
+    }
+
+    if (rollup_writer_is_enabled(&global_rollup_writer)) {
+        generic_message_state_t *generic = &state->be.message_state.generic;
+        rollup_writer_on_message(&global_rollup_writer, SENDER_TYPE_BE, message_type, generic->message_name,
+                                 int32_state_value_get(&generic->length_state), global_sessions[fe_port].application_id);
+    }
+
+    if (global_is_bulk_accounting_enabled) {
+        bulk_transfer_state_on_data(&state->bulk_transfer,
+                                    SENDER_TYPE_BE,
+                                    message_type,
+                                    int32_state_value_get(&state->be.message_state.generic.length_state));
+        bulk_transfer_state_on_be_message(&state->bulk_transfer, fe_port, message_type, trace_fp);
+    }
+
+    pipeline_request_t request;
+    uint64_t response_nsec;
+    bool is_answered = pipeline_state_on_be_message(&state->pipeline, message_type, &request, &response_nsec);
+    if (is_answered) {
+        if (FE_MESSAGE_TYPE_EXECUTE == request.message_type) {
+            histogram_add(&global_pipeline_stats.execute_nsec, response_nsec);
+            histogram_add(&global_metrics.pipeline.execute_nsec, response_nsec);
+        }
+
+        if (pooler_is_enabled(&global_pooler) && pipeline_state_is_statement(request.message_type)) {
+            pooler_leg_on_statement_response(&state->pooler, response_nsec);
+        }
+
+        const statement_text_t *statement = request.has_statement ?
+                                            statement_state_get(&state->statement, request.statement_ref) : NULL;
+        if (statement) {
+            top_statements_add(&global_top_statements, statement, response_nsec / 1000);
+        }
+
+        if (rollup_writer_is_enabled(&global_rollup_writer)) {
+            rollup_writer_on_request(&global_rollup_writer, request.message_type, response_nsec, request.is_failed, statement,
+                                     global_sessions[fe_port].application_id);
+        }
+    }
+
+    if (BE_MESSAGE_TYPE_AUTHENTICATION == message_type) {
+        connection_setup_on_authentication(&state->setup, state->be.auth_request_type);
+    } else if (BE_MESSAGE_TYPE_KEY_DATA == message_type) {
+        if (cancel_key_state_is_complete(&state->be.key_state)) {
+            cancel_keys_add(&global_cancel_keys, fe_port, state->be.key_state.key);
+        }
+    } else if (BE_MESSAGE_TYPE_ERROR_RESPONSE == message_type) {
+        connection_setup_on_error(&state->setup);
+        if (strcmp(state->be.message_state.error_response.fields.sqlstate, CANCEL_SQLSTATE_QUERY_CANCELED) == 0) {
+            /* A failed Execute has already been answered, a Query isn't answered until its ReadyForQuery. */
+            const pipeline_request_t *cancelled = is_answered ? &request :
+                                                  (state->pipeline.num_requests > 0) ? pipeline_state_oldest(&state->pipeline) :
+                                                                                       NULL;
+            const statement_text_t *statement = (cancelled && cancelled->has_statement) ?
+                                                statement_state_get(&state->statement, cancelled->statement_ref) : NULL;
+            cancel_state_on_query_canceled(fe_port, cancelled, statement);
+        }
+    }
+
+    if (BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE == message_type) {
+        replication_connection_start(&state->replication, &global_metrics.replication, fe_port,
+                                     global_sessions[fe_port].application_id);
+    } else if (replication_connection_is_streaming(&state->replication) &&
+               ((BE_MESSAGE_TYPE_COPY_DONE == message_type) || (BE_MESSAGE_TYPE_ERROR_RESPONSE == message_type) ||
+                (BE_MESSAGE_TYPE_READY_FOR_QUERY == message_type))) {
+        replication_connection_stop(&state->replication, &global_metrics.replication);
+    }
+
+    if (BE_MESSAGE_TYPE_READY_FOR_QUERY == message_type) {
+        connection_setup_on_ready_for_query(&state->setup);
+        cancel_state_on_ready_for_query(fe_port, state->transaction.request_start_nsec);
+        if (state->transaction.request_start_nsec != 0) {
+            uint64_t request_nsec = now_epoch_nsec() - state->transaction.request_start_nsec;
+            histogram_add(&global_metrics.response_nsec, request_nsec);
+            uint8_t breakdown_index = global_sessions[fe_port].breakdown_index;
+            if (breakdown_index != 0) {
+                histogram_add(&global_metrics.breakdowns[breakdown_index - 1].response_nsec, request_nsec);
+            }
+
+            if (rollup_writer_is_enabled(&global_rollup_writer)) {
+                rollup_writer_on_ready_for_query(&global_rollup_writer, request_nsec, global_sessions[fe_port].application_id);
+            }
+        }
+
+        transaction_state_on_ready_for_query(&state->transaction, state->be.transaction_status);
+    }
+}
+
+/* Gets a message that's had bytes go missing ready to skip them: what was traced of it is printed, marked as truncated,
+   and the rest is only counted.  Returns false if the num_bytes don't all fit in the payload, so there's no knowing where
+   the next message starts. */
+static bool connection_state_prepare_skip(uint16_t fe_port, generic_message_state_t *generic, size_t num_bytes, FILE *trace_fp) {
+    if ((generic->state_type != GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD) ||
+        (num_bytes > (size_t)(int32_state_value_get(&generic->length_state) - generic->message_bytes_read))) {
+        return false;
+    }
+
+    if (!generic->is_payload_skipped) {
+        generic->buf.is_truncated = true;
+        generic_message_state_print(generic, fe_port, trace_fp);
+        generic_message_state_skip_rest_of_payload(generic, generic->message_bytes_read);
+    }
+
+    return true;
+}
+
+/* Each of these gives a streaming replication connection's decoder num_bytes bytes of the CopyData payload in
+   progress, from wherever it's got to. */
+static inline void connection_state_on_fe_copy_payload(connection_state_t *state, const uint8_t *bytes, size_t num_bytes) {
+    generic_message_state_t *generic = &state->fe.message_state.generic;
+    size_t num_remaining = int32_state_value_get(&generic->length_state) - generic->message_bytes_read;
+    if (replication_decoder_on_payload(&state->replication.fe_decoder, generic->message_bytes_read - 4, bytes,
+                                       (num_bytes < num_remaining) ? num_bytes : num_remaining)) {
+        replication_on_fe_header(&global_metrics.replication, &state->replication, state->replication.fe_decoder.header);
+    }
+}
+
+/* Returns true if that completes an XLogData's header, so the WAL that follows can be skipped. */
+static inline bool connection_state_on_be_copy_payload(connection_state_t *state, const uint8_t *bytes, size_t num_bytes) {
+    generic_message_state_t *generic = &state->be.message_state.generic;
+    int32_t length = int32_state_value_get(&generic->length_state);
+    size_t num_remaining = length - generic->message_bytes_read;
+    replication_decoder_t *decoder = &state->replication.be_decoder;
+    if (!replication_decoder_on_payload(decoder, generic->message_bytes_read - 4, bytes,
+                                        (num_bytes < num_remaining) ? num_bytes : num_remaining)) {
+        return false;
+    }
+
+    replication_on_be_header(&global_metrics.replication, &state->replication, decoder->header, length);
+    return replication_decoder_is_xlog_data(decoder);
+}
+
+/* Takes the next byte, or a run of bytes if the payload is being skipped, and returns how many bytes it took. */
+static inline size_t connection_state_on_fe_bytes(uint16_t fe_port,
+                                                  connection_state_t *state,
+                                                  const uint8_t *bytes,
+                                                  size_t num_bytes,
+                                                  FILE *trace_fp) {
+    ASSERT(state);
+    fe_message_type_t message_type = state->fe.message_type;
+    if (fe_state_is_skipping(&state->fe)) {
+        if (replication_connection_is_streaming(&state->replication) && (FE_MESSAGE_TYPE_COPY_DATA == message_type)) {
+            connection_state_on_fe_copy_payload(state, bytes, num_bytes);
+        }
+
+        bool is_complete;
+        size_t num_skipped = fe_state_skip(&state->fe, num_bytes, &is_complete);
+        if (statement_state_is_reading_names(&state->statement)) {
+            statement_state_on_payload_bytes(&state->statement, bytes, num_skipped);
+        }
+
+        if (state->replay.is_recording) {
+            replay_connection_on_fe_bytes(&global_replay_recorder, &state->replay, bytes, num_skipped);
+        }
+
+        if (pooler_is_enabled(&global_pooler)) {
+            pooler_leg_on_fe_bytes(&state->pooler, false, bytes, num_skipped);
+        }
+
+        if (is_complete) {
+            connection_state_on_fe_message(fe_port, state, message_type, bytes + num_skipped);
+        }
+
+        return num_skipped;
+    }
+
+    if ((FE_MESSAGE_TYPE_UNKNOWN == message_type) && state->opaque.is_tls_possible) {
+        state->opaque.is_tls_possible = false;
+        if (opaque_is_tls_record_header(bytes, num_bytes)) {
+            connection_state_make_opaque(fe_port, state, OPAQUE_REASON_TLS);
+            return connection_state_on_unparsed_bytes(state, SENDER_TYPE_FE, num_bytes);
+        }
+    }
+
+    if (state->replay.is_recording) {
+        replay_connection_on_fe_bytes(&global_replay_recorder, &state->replay, bytes, 1);
+    }
+
+    if (pooler_is_enabled(&global_pooler)) {
+        pooler_leg_on_fe_bytes(&state->pooler, FE_MESSAGE_TYPE_UNKNOWN == message_type, bytes, 1);
+    }
+
+    bool is_query_byte = bypass_rules_has_match(&global_bypass_rules, BYPASS_MATCH_QUERY) && !state->bypass.is_query_checked &&
+                         ((FE_MESSAGE_TYPE_QUERY == message_type) || (FE_MESSAGE_TYPE_PARSE == message_type)) &&
+                         (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == fe_state_generic(&state->fe)->state_type);
+    if (is_query_byte) {
+        bypass_connection_on_query_byte(&state->bypass, *bytes);
+    }
+
+    if (statement_state_is_reading_names(&state->statement) &&
+        (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == fe_state_generic(&state->fe)->state_type)) {
+        statement_state_on_payload_bytes(&state->statement, bytes, 1);
+    }
+
+    if (replication_connection_is_streaming(&state->replication) && (FE_MESSAGE_TYPE_COPY_DATA == message_type) &&
+        (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->fe.message_state.generic.state_type)) {
+        connection_state_on_fe_copy_payload(state, bytes, 1);
+    }
+
+    if (fe_state_on_byte(fe_port, &state->fe, *bytes, trace_fp)) {
+        connection_state_on_fe_message(fe_port, state, message_type, bytes + 1);
+    } else if ((FE_MESSAGE_TYPE_UNKNOWN == message_type) && (state->fe.message_type != FE_MESSAGE_TYPE_UNKNOWN)) {
+        transaction_state_on_fe_message(&state->transaction, state->fe.message_type);
+        if (connection_state_is_keeping_statements()) {
+            statement_state_on_message_start(&state->statement, state->fe.message_type);
+        }
+
+        if (!state->bypass.is_query_checked) {
+            bypass_connection_on_query_start(&state->bypass, state->fe.message_type);
+        }
+    }
+
+    return 1;
+}
+
+/* The back-end's one byte answer to an SSLRequest or GSSENCRequest.  Returns how many bytes it took, or 0 if it isn't
+   an answer. */
+static size_t connection_state_on_encryption_response(uint16_t fe_port,
+                                                      connection_state_t *state,
+                                                      const uint8_t *bytes,
+                                                      size_t num_bytes,
+                                                      FILE *trace_fp) {
+    opaque_reason_t reason = state->opaque.requested_reason;
+    bool is_ssl = (OPAQUE_REASON_SSL == reason);
+    state->opaque.requested_reason = OPAQUE_REASON_NONE;
+    if (OPAQUE_RESPONSE_NO == *bytes) {
+        be_state_print_ssl_response(fe_port, is_ssl ? "SSLResponseNo" : "GSSENCResponseNo", trace_fp);
+        return 1;
+    }
+
+    if ((is_ssl ? OPAQUE_SSL_RESPONSE_YES : OPAQUE_GSSENC_RESPONSE_YES) == *bytes) {
+        be_state_print_ssl_response(fe_port, is_ssl ? "SSLResponseYes" : "GSSENCResponseYes", trace_fp);
+        connection_state_make_opaque(fe_port, state, reason);
+        return 1 + connection_state_on_unparsed_bytes(state, SENDER_TYPE_BE, num_bytes - 1);
+    }
+
+    /* E.g. an ErrorResponse from a server that's too old to know the request. */
+    return 0;
+}
+
+/* Takes the next byte, or a run of bytes if the payload is being skipped, and returns how many bytes it took. */
+static inline size_t connection_state_on_be_bytes(uint16_t fe_port,
+                                                  connection_state_t *state,
+                                                  const uint8_t *bytes,
+                                                  size_t num_bytes,
+                                                  size_t packet_payload_size,
+                                                  FILE *trace_fp) {
+    ASSERT(state);
+    be_message_type_t message_type = state->be.message_type;
+    if (be_state_is_skipping(&state->be)) {
+        if (replication_connection_is_streaming(&state->replication) && (BE_MESSAGE_TYPE_COPY_DATA == message_type)) {
+            connection_state_on_be_copy_payload(state, bytes, num_bytes);
+        }
+
+        bool is_complete;
+        size_t num_skipped = be_state_skip(&state->be, num_bytes, &is_complete);
+        if (is_complete) {
+            connection_state_on_be_message(fe_port, state, message_type, bytes + num_skipped, trace_fp);
+        }
+
+        return num_skipped;
+    }
+
+    if (BE_MESSAGE_TYPE_UNKNOWN == message_type) {
+        size_t num_taken;
+        if ((state->opaque.requested_reason != OPAQUE_REASON_NONE) &&
+            ((num_taken = connection_state_on_encryption_response(fe_port, state, bytes, num_bytes, trace_fp)) > 0)) {
+            return num_taken;
+        }
+
+        /* An SSLResponseYes to an SSLRequest that we missed, see be_state_on_new_message. */
+        if ((1 == packet_payload_size) && (OPAQUE_SSL_RESPONSE_YES == *bytes)) {
+            state->opaque.is_tls_possible = true;
+        }
+    }
+
+    /* An XLogData's WAL is skipped once its header's been read. */
+    bool is_wal_next = replication_connection_is_streaming(&state->replication) && (BE_MESSAGE_TYPE_COPY_DATA == message_type) &&
+                       (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->be.message_state.generic.state_type) &&
+                       connection_state_on_be_copy_payload(state, bytes, 1);
+    if (be_state_on_byte(fe_port, &state->be, *bytes, packet_payload_size, trace_fp)) {
+        connection_state_on_be_message(fe_port, state, message_type, bytes + 1, trace_fp);
+    } else if (is_wal_next) {
+        connection_state_prepare_skip(fe_port, &state->be.message_state.generic, 0, trace_fp);
+    }
+
+    return 1;
+}
+
+
+/* Each of these is for num_bytes of the stream that weren't captured, e.g. because they were past the snaplen.  They're
+   skipped if they're all in the payload of the message in progress.  Otherwise the direction starts afresh at the next
+   packet, like an evicted connection does. */
+static void connection_state_on_fe_lost(uint16_t fe_port, connection_state_t *state, size_t num_bytes, FILE *trace_fp) {
+    if (state->is_unparsed) {
+        connection_state_on_unparsed_bytes(state, SENDER_TYPE_FE, num_bytes);
+        return;
+    }
+
+    state->opaque.is_tls_possible = false;
+    replay_connection_stop(&global_replay_recorder, &state->replay);
+    fe_message_type_t message_type = state->fe.message_type;
+    if ((message_type != FE_MESSAGE_TYPE_UNKNOWN) &&
+        connection_state_prepare_skip(fe_port, fe_state_generic(&state->fe), num_bytes, trace_fp)) {
+        bool is_complete;
+        fe_state_skip(&state->fe, num_bytes, &is_complete);
+        if (is_complete) {
+            connection_state_on_fe_message(fe_port, state, message_type, NULL);
+        }
+        return;
+    }
+
+    global_metrics.num_truncation_resyncs++;
+    fe_state_init(&state->fe);
+}
+
+static void connection_state_on_be_lost(uint16_t fe_port, connection_state_t *state, size_t num_bytes, FILE *trace_fp) {
+    if (state->is_unparsed) {
+        connection_state_on_unparsed_bytes(state, SENDER_TYPE_BE, num_bytes);
+        return;
+    }
+
+    be_message_type_t message_type = state->be.message_type;
+    if ((message_type != BE_MESSAGE_TYPE_UNKNOWN) &&
+        connection_state_prepare_skip(fe_port, &state->be.message_state.generic, num_bytes, trace_fp)) {
+        bool is_complete;
+        be_state_skip(&state->be, num_bytes, &is_complete);
+        if (is_complete) {
+            connection_state_on_be_message(fe_port, state, message_type, NULL, trace_fp);
+        }
+        return;
+    }
+
+    global_metrics.num_truncation_resyncs++;
+    be_state_init(&state->be);
 }
 
 
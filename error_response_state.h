@@ -0,0 +1,134 @@
+#ifndef ERROR_RESPONSE_STATE_H
+#define ERROR_RESPONSE_STATE_H
+
+/* Long enough for all of the non-localized severities (PANIC, WARNING etc). */
+#define ERROR_FIELDS_STATE_MAX_SEVERITY_LENGTH 15
+
+typedef enum {
+    ERROR_FIELDS_STATE_TYPE_FIELD_TYPE,
+    ERROR_FIELDS_STATE_TYPE_FIELD_VALUE,
+    ERROR_FIELDS_STATE_TYPE_DONE,
+} error_fields_state_type_t;
+
+/* Decodes the field-tagged body of an ErrorResponse or NoticeResponse one byte at a time.  Only the fields that are
+   aggregated are kept, so nothing has to be buffered. */
+typedef struct {
+    error_fields_state_type_t state_type;
+    uint8_t field_type;
+    uint8_t field_value_length;
+    bool has_nonlocalized_severity;
+    char severity[ERROR_FIELDS_STATE_MAX_SEVERITY_LENGTH + 1];
+    char sqlstate[ERROR_STATS_SQLSTATE_LENGTH + 1];
+} error_fields_state_t;
+
+static void error_fields_state_init(error_fields_state_t *state) {
+    ASSERT(state);
+    state->state_type = ERROR_FIELDS_STATE_TYPE_FIELD_TYPE;
+    state->field_type = 0;
+    state->field_value_length = 0;
+    state->has_nonlocalized_severity = false;
+    state->severity[0] = '\0';
+    state->sqlstate[0] = '\0';
+}
+
+static inline void error_fields_state_on_field_value_byte(error_fields_state_t *state, uint8_t byte) {
+    switch (state->field_type) {
+        /* Severity, localized.  Only used if there's no non-localized severity, which servers before 9.6 don't send. */
+        case 'S':
+            if (state->has_nonlocalized_severity) {
+                return;
+            }
+            /* Fall through */
+
+        /* Severity, non-localized */
+        case 'V':
+            if (state->field_value_length < ERROR_FIELDS_STATE_MAX_SEVERITY_LENGTH) {
+                state->severity[state->field_value_length++] = byte;
+                state->severity[state->field_value_length] = '\0';
+            }
+            return;
+
+        /* SQLSTATE code */
+        case 'C':
+            if (state->field_value_length < ERROR_STATS_SQLSTATE_LENGTH) {
+                state->sqlstate[state->field_value_length++] = byte;
+                state->sqlstate[state->field_value_length] = '\0';
+            }
+            return;
+    }
+}
+
+static inline void error_fields_state_on_byte(error_fields_state_t *state, uint8_t byte) {
+    ASSERT(state);
+
+    switch (state->state_type) {
+        case ERROR_FIELDS_STATE_TYPE_FIELD_TYPE:
+            if ('\0' == byte) {
+                state->state_type = ERROR_FIELDS_STATE_TYPE_DONE;
+                return;
+            }
+
+            state->field_type = byte;
+            state->field_value_length = 0;
+            if ('V' == byte) {
+                state->has_nonlocalized_severity = true;
+                state->severity[0] = '\0';
+            }
+
+            state->state_type = ERROR_FIELDS_STATE_TYPE_FIELD_VALUE;
+            return;
+
+        case ERROR_FIELDS_STATE_TYPE_FIELD_VALUE:
+            if ('\0' == byte) {
+                state->state_type = ERROR_FIELDS_STATE_TYPE_FIELD_TYPE;
+                return;
+            }
+
+            error_fields_state_on_field_value_byte(state, byte);
+            return;
+
+        case ERROR_FIELDS_STATE_TYPE_DONE:
+            return;
+    }
+}
+
+
+typedef struct {
+    generic_message_state_t generic;
+    error_fields_state_t fields;
+} error_response_state_t;
+
+static void error_response_state_on_new_message(error_response_state_t *state,
+                                                uint16_t fe_port,
+                                                sender_type_t sender_type,
+                                                uint8_t message_type,
+                                                const char *message_name) {
+    ASSERT(state);
+    error_fields_state_init(&state->fields);
+    generic_message_state_on_new_message(&state->generic, fe_port, sender_type, message_type, message_name);
+}
+
+static inline bool error_response_state_on_byte(error_response_state_t *state, uint16_t fe_port, uint8_t byte, FILE *trace_fp) {
+    ASSERT(state);
+    if (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->generic.state_type) {
+        error_fields_state_on_byte(&state->fields, byte);
+    }
+
+    if (!generic_message_state_on_byte(&state->generic, fe_port, byte, trace_fp)) {
+        return false;
+    }
+
+    /* If the fields didn't finish then the message was cut short, probably because we're out of sync. */
+    if (state->fields.state_type != ERROR_FIELDS_STATE_TYPE_DONE) {
+        return true;
+    }
+
+    error_stats_on_message(&global_error_stats,
+                           fe_port,
+                           BE_MESSAGE_TYPE_ERROR_RESPONSE == state->generic.message_type,
+                           state->fields.severity,
+                           state->fields.sqlstate);
+    return true;
+}
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef ERROR_STATS_H
+#define ERROR_STATS_H
+
+/* The SQLSTATE field is always 5 characters. */
+#define ERROR_STATS_SQLSTATE_LENGTH 5
+
+/* Must be a power of 2.  There are only a few hundred SQLSTATEs defined, and far fewer seen in practice. */
+#define ERROR_STATS_MAX_SQLSTATES 512
+
+/* The summary only names the connections with the most errors. */
+#define ERROR_STATS_MAX_SUMMARY_CONNECTIONS 10
+
+typedef struct {
+    char sqlstate[ERROR_STATS_SQLSTATE_LENGTH + 1];
+    uint32_t count;
+} error_stats_sqlstate_t;
+
+typedef struct {
+    uint16_t fe_port;
+    uint32_t count;
+} error_stats_connection_t;
+
+/* ErrorResponse & NoticeResponse counts since the last summary. */
+typedef struct {
+    uint64_t error_count;
+    uint64_t notice_count;
+    /* Errors with FATAL or PANIC severity, i.e. the ones that end the session. */
+    uint64_t fatal_count;
+    /* Messages whose SQLSTATE didn't fit in the table. */
+    uint64_t overflow_count;
+    error_stats_sqlstate_t sqlstates[ERROR_STATS_MAX_SQLSTATES];
+    uint32_t connection_counts[0xffff];
+} error_stats_t;
+
+ENGINE_STATE(error_stats_t, global_error_stats);
+#define global_error_stats ENGINE_STATE_OF(global_error_stats)
+
+static void error_stats_reset(error_stats_t *stats) {
+    ASSERT(stats);
+    stats->error_count = 0;
+    stats->notice_count = 0;
+    stats->fatal_count = 0;
+    stats->overflow_count = 0;
+    memset(stats->sqlstates, 0, sizeof(stats->sqlstates));
+    memset(stats->connection_counts, 0, sizeof(stats->connection_counts));
+}
+
+static void error_stats_init(error_stats_t *stats) {
+    ASSERT(stats);
+    error_stats_reset(stats);
+}
+
+static uint32_t error_stats_sqlstate_hash(const char *sqlstate) {
+    uint64_t key = 0;
+    for (; *sqlstate; ++sqlstate) {
+        key = (key << 8) | (uint8_t)*sqlstate;
+    }
+
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static error_stats_sqlstate_t *error_stats_find_sqlstate(error_stats_t *stats, const char *sqlstate) {
+    uint32_t i = error_stats_sqlstate_hash(sqlstate);
+    uint32_t num_probes = 0;
+    for (; num_probes < ERROR_STATS_MAX_SQLSTATES; ++num_probes, ++i) {
+        error_stats_sqlstate_t *entry = &stats->sqlstates[i & (ERROR_STATS_MAX_SQLSTATES - 1)];
+        if ('\0' == entry->sqlstate[0]) {
+            strcpy(entry->sqlstate, sqlstate);
+            return entry;
+        }
+
+        if (strcmp(entry->sqlstate, sqlstate) == 0) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void error_stats_on_message(error_stats_t *stats,
+                                   uint16_t fe_port,
+                                   bool is_error,
+                                   const char *severity,
+                                   const char *sqlstate) {
+    ASSERT(stats);
+    ASSERT(severity);
+    ASSERT(sqlstate);
+
+    if (is_error) {
+        stats->error_count++;
+        if ((strcmp(severity, "FATAL") == 0) || (strcmp(severity, "PANIC") == 0)) {
+            stats->fatal_count++;
+        }
+    } else {
+        stats->notice_count++;
+    }
+
+    stats->connection_counts[fe_port]++;
+
+    if ('\0' == sqlstate[0]) {
+        return;
+    }
+
+    error_stats_sqlstate_t *entry = error_stats_find_sqlstate(stats, sqlstate);
+    if (entry) {
+        entry->count++;
+    } else {
+        stats->overflow_count++;
+    }
+}
+
+static int error_stats_compare_sqlstates(const void *a, const void *b) {
+    const error_stats_sqlstate_t *sa = a;
+    const error_stats_sqlstate_t *sb = b;
+    return (sa->count < sb->count) - (sa->count > sb->count);
+}
+
+/* Sorts the non-empty SQLSTATEs by count, most first, into sorted and returns how many there are. */
+static size_t error_stats_sort_sqlstates(error_stats_t *stats, error_stats_sqlstate_t *sorted) {
+    size_t num_sorted = 0;
+    size_t i = 0;
+    for (; i < ERROR_STATS_MAX_SQLSTATES; ++i) {
+        if (stats->sqlstates[i].count > 0) {
+            sorted[num_sorted++] = stats->sqlstates[i];
+        }
+    }
+
+    qsort(sorted, num_sorted, sizeof(*sorted), error_stats_compare_sqlstates);
+    return num_sorted;
+}
+
+/* Finds the connections with the most messages, most first, and returns how many there are. */
+static size_t error_stats_top_connections(error_stats_t *stats, error_stats_connection_t *top) {
+    size_t num_top = 0;
+    uint32_t fe_port = 0;
+    for (; fe_port < 0xffff; ++fe_port) {
+        uint32_t count = stats->connection_counts[fe_port];
+        if ((0 == count) ||
+            ((ERROR_STATS_MAX_SUMMARY_CONNECTIONS == num_top) && (count <= top[num_top - 1].count))) {
+            continue;
+        }
+
+        size_t i = (num_top < ERROR_STATS_MAX_SUMMARY_CONNECTIONS) ? num_top++ : num_top - 1;
+        for (; (i > 0) && (top[i - 1].count < count); --i) {
+            top[i] = top[i - 1];
+        }
+
+        top[i].fe_port = fe_port;
+        top[i].count = count;
+    }
+
+    return num_top;
+}
+
+static void error_stats_print_text(error_stats_t *stats,
+                                   const error_stats_sqlstate_t *sqlstates,
+                                   size_t num_sqlstates,
+                                   const error_stats_connection_t *connections,
+                                   size_t num_connections) {
+    /* 5 chars + ':' + 10 digits + ',' per SQLSTATE. */
+    char sqlstates_str[ERROR_STATS_MAX_SQLSTATES * 17 + 1];
+    char *p = sqlstates_str;
+    size_t i = 0;
+    for (; i < num_sqlstates; ++i) {
+        if (i > 0) {
+            *p++ = ',';
+        }
+
+        p += sprintf(p, "%s:%u", sqlstates[i].sqlstate, sqlstates[i].count);
+    }
+
+    *p = '\0';
+
+    char connections_str[ERROR_STATS_MAX_SUMMARY_CONNECTIONS * 17 + 1];
+    p = connections_str;
+    for (i = 0; i < num_connections; ++i) {
+        if (i > 0) {
+            *p++ = ',';
+        }
+
+        p += sprintf(p, "%u:%u", connections[i].fe_port, connections[i].count);
+    }
+
+    *p = '\0';
+
+    LOG("error summary: errors=%llu notices=%llu fatal=%llu overflow=%llu sqlstates=%s connections=%s",
+            (unsigned long long)stats->error_count,
+            (unsigned long long)stats->notice_count,
+            (unsigned long long)stats->fatal_count,
+            (unsigned long long)stats->overflow_count,
+            sqlstates_str,
+            connections_str);
+}
+
+static void error_stats_print_json(error_stats_t *stats,
+                                   const error_stats_sqlstate_t *sqlstates,
+                                   size_t num_sqlstates,
+                                   const error_stats_connection_t *connections,
+                                   size_t num_connections,
+                                   FILE *fp) {
+    message_json_writer_t writer;
+    message_json_writer_init(&writer);
+    message_json_writer_write_raw(&writer, "{\"ts\":");
+    message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+    message_json_writer_write_key(&writer, "type");
+    message_json_writer_write_raw(&writer, "\"ErrorSummary\"");
+    message_json_writer_write_uint_field(&writer, "errors", stats->error_count);
+    message_json_writer_write_uint_field(&writer, "notices", stats->notice_count);
+    message_json_writer_write_uint_field(&writer, "fatal", stats->fatal_count);
+    message_json_writer_write_uint_field(&writer, "overflow", stats->overflow_count);
+
+    message_json_writer_write_key(&writer, "sqlstates");
+    *writer.p++ = '{';
+    size_t i = 0;
+    for (; i < num_sqlstates; ++i) {
+        if (i > 0) {
+            *writer.p++ = ',';
+        }
+
+        message_json_writer_write_string(&writer, (const uint8_t *)sqlstates[i].sqlstate, strlen(sqlstates[i].sqlstate));
+        *writer.p++ = ':';
+        message_json_writer_write_uint(&writer, sqlstates[i].count);
+    }
+
+    *writer.p++ = '}';
+
+    message_json_writer_write_key(&writer, "connections");
+    *writer.p++ = '{';
+    for (i = 0; i < num_connections; ++i) {
+        if (i > 0) {
+            *writer.p++ = ',';
+        }
+
+        *writer.p++ = '"';
+        message_json_writer_write_uint(&writer, connections[i].fe_port);
+        *writer.p++ = '"';
+        *writer.p++ = ':';
+        message_json_writer_write_uint(&writer, connections[i].count);
+    }
+
+    *writer.p++ = '}';
+    *writer.p++ = '}';
+    *writer.p++ = '\n';
+    fwrite(writer.data, writer.p - writer.data, 1, fp);
+}
+
+static void error_stats_print_summary(error_stats_t *stats, FILE *fp) {
+    ASSERT(stats);
+    error_stats_sqlstate_t sqlstates[ERROR_STATS_MAX_SQLSTATES];
+    size_t num_sqlstates = error_stats_sort_sqlstates(stats, sqlstates);
+    error_stats_connection_t connections[ERROR_STATS_MAX_SUMMARY_CONNECTIONS];
+    size_t num_connections = error_stats_top_connections(stats, connections);
+
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        error_stats_print_json(stats, sqlstates, num_sqlstates, connections, num_connections, fp);
+    } else {
+        error_stats_print_text(stats, sqlstates, num_sqlstates, connections, num_connections);
+    }
+}
+
+#endif
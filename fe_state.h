@@ -1,33 +1,12 @@
 #ifndef FE_STATE_H
 #define FE_STATE_H
 
-/* Message types that are sent by the front-end */
-typedef enum {
-    FE_MESSAGE_TYPE_UNKNOWN = '_',
-    /* There is no message type for "special" messages, they just start with a length int32, the first (high) byte of which is 0. */
-    FE_MESSAGE_TYPE_SPECIAL = 0,
-    FE_MESSAGE_TYPE_BIND = 'B',    
-    FE_MESSAGE_TYPE_CLOSE = 'C',
-    FE_MESSAGE_TYPE_COPY_DATA = 'd',
-    FE_MESSAGE_TYPE_COPY_DONE = 'c',
-    FE_MESSAGE_TYPE_COPY_FAIL = 'f',
-    FE_MESSAGE_TYPE_DESCRIBE = 'D',
-    FE_MESSAGE_TYPE_EXECUTE = 'E',
-    FE_MESSAGE_TYPE_FLUSH = 'H',
-    FE_MESSAGE_TYPE_FUNCTION_CALL = 'F',
-    FE_MESSAGE_TYPE_PARSE = 'P',
-    FE_MESSAGE_TYPE_PASSWORD_MESSAGE = 'p',
-    FE_MESSAGE_TYPE_QUERY = 'Q',
-    FE_MESSAGE_TYPE_SYNC = 'S',
-    FE_MESSAGE_TYPE_TERMINATE = 'X',
-} fe_message_type_t;
-
-
 typedef struct {
     fe_message_type_t message_type;
     union {
         generic_message_state_t generic;
         special_message_state_t special;
+        statement_message_state_t statement;
     } message_state;
 } fe_state_t;
 
@@ -49,59 +28,62 @@ static void fe_state_on_new_message(uint16_t fe_port, fe_state_t *state, uint8_t
             break;
 
         case FE_MESSAGE_TYPE_BIND:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Bind");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Bind");
             break;
         
         case FE_MESSAGE_TYPE_CLOSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Close");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Close");
             break;
 
         case FE_MESSAGE_TYPE_COPY_DATA:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "CopyData");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "CopyData");
+            if (global_is_bulk_accounting_enabled || !trace_mode_is_tracing_messages()) {
+                generic_message_state_skip_payload(&state->message_state.generic);
+            }
             break;
 
         case FE_MESSAGE_TYPE_COPY_DONE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "CopyDone");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "CopyDone");
             break;
 
         case FE_MESSAGE_TYPE_COPY_FAIL:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "CopyFail");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "CopyFail");
             break;
 
         case FE_MESSAGE_TYPE_DESCRIBE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Describe");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Describe");
             break;
 
         case FE_MESSAGE_TYPE_EXECUTE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Execute");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Execute");
             break;
 
         case FE_MESSAGE_TYPE_FLUSH:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Flush");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Flush");
             break;
 
         case FE_MESSAGE_TYPE_FUNCTION_CALL:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Call");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Call");
             break;
 
         case FE_MESSAGE_TYPE_PARSE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Parse");
+            statement_message_state_on_new_message(&state->message_state.statement, fe_port, SENDER_TYPE_FE, byte, "Parse");
             break;
 
         case FE_MESSAGE_TYPE_PASSWORD_MESSAGE:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "PasswordMessage");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "PasswordMessage");
             break;
 
         case FE_MESSAGE_TYPE_QUERY:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Query");
+            statement_message_state_on_new_message(&state->message_state.statement, fe_port, SENDER_TYPE_FE, byte, "Query");
             break;
         
         case FE_MESSAGE_TYPE_SYNC:
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Sync");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Sync");
             break;
 
         case FE_MESSAGE_TYPE_TERMINATE:            
-            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, "Terminate");
+            generic_message_state_on_new_message(&state->message_state.generic, fe_port, SENDER_TYPE_FE, byte, "Terminate");
             break;
             
         default:
@@ -112,7 +94,29 @@ static void fe_state_on_new_message(uint16_t fe_port, fe_state_t *state, uint8_t
     state->message_type = (fe_message_type_t)byte;
 }
 
-static inline void fe_state_on_byte(uint16_t fe_port, fe_state_t *state, uint8_t byte, FILE *trace_fp) {
+/* The generic state of the message in progress, whatever type it is. */
+static inline generic_message_state_t *fe_state_generic(fe_state_t *state) {
+    return (FE_MESSAGE_TYPE_SPECIAL == state->message_type) ?
+        &state->message_state.special.generic_message_state :
+        &state->message_state.generic;
+}
+
+static inline bool fe_state_is_skipping(fe_state_t *state) {
+    return (state->message_type != FE_MESSAGE_TYPE_UNKNOWN) && generic_message_state_is_skipping(fe_state_generic(state));
+}
+
+/* Skips over as much of the current message's payload as it can, see generic_message_state_skip. */
+static inline size_t fe_state_skip(fe_state_t *state, size_t num_bytes, bool *is_complete) {
+    size_t num_skipped = generic_message_state_skip(fe_state_generic(state), num_bytes, is_complete);
+    if (*is_complete) {
+        state->message_type = FE_MESSAGE_TYPE_UNKNOWN;
+    }
+
+    return num_skipped;
+}
+
+/* Returns true when a message has been completed. */
+static inline bool fe_state_on_byte(uint16_t fe_port, fe_state_t *state, uint8_t byte, FILE *trace_fp) {
     ASSERT(state);
     ASSERT(trace_fp);
     
@@ -124,6 +128,15 @@ static inline void fe_state_on_byte(uint16_t fe_port, fe_state_t *state, uint8_t
         case FE_MESSAGE_TYPE_SPECIAL:
             if (special_message_state_on_byte(&state->message_state.special, fe_port, byte, trace_fp)) {
                 state->message_type = FE_MESSAGE_TYPE_UNKNOWN;
+                return true;
+            }
+            break;
+
+        case FE_MESSAGE_TYPE_PARSE:
+        case FE_MESSAGE_TYPE_QUERY:
+            if (statement_message_state_on_byte(&state->message_state.statement, fe_port, byte, trace_fp)) {
+                state->message_type = FE_MESSAGE_TYPE_UNKNOWN;
+                return true;
             }
             break;
         
@@ -136,16 +149,17 @@ static inline void fe_state_on_byte(uint16_t fe_port, fe_state_t *state, uint8_t
         case FE_MESSAGE_TYPE_EXECUTE:
         case FE_MESSAGE_TYPE_FLUSH:
         case FE_MESSAGE_TYPE_FUNCTION_CALL:
-        case FE_MESSAGE_TYPE_PARSE:
         case FE_MESSAGE_TYPE_PASSWORD_MESSAGE:
-        case FE_MESSAGE_TYPE_QUERY:
         case FE_MESSAGE_TYPE_SYNC:
         case FE_MESSAGE_TYPE_TERMINATE:
             if (generic_message_state_on_byte(&state->message_state.generic, fe_port, byte, trace_fp)) {
                 state->message_type = FE_MESSAGE_TYPE_UNKNOWN;                
+                return true;
             }
             break;
     }
+
+    return false;
 }
 
 
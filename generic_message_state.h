@@ -15,6 +15,12 @@ typedef struct {
     generic_message_state_type_t state_type;
     int32_state_t length_state;
     int32_t message_bytes_read;
+    sender_type_t sender_type;
+    uint8_t message_type;
+    const char *message_name;
+    uint64_t start_nsec;
+    /* The payload is only counted, it isn't buffered, decoded or printed. */
+    bool is_payload_skipped;
     message_trace_buffer_t buf;
 } generic_message_state_t;
 
@@ -23,19 +29,94 @@ static void generic_message_state_init(generic_message_state_t *state) {
     state->state_type = GENERIC_MESSAGE_STATE_TYPE_BEFORE_MESSAGE;
     int32_state_init(&state->length_state);
     state->message_bytes_read = 0;
+    state->sender_type = SENDER_TYPE_FE;
+    state->message_type = 0;
+    state->message_name = "";
+    state->start_nsec = 0;
+    state->is_payload_skipped = false;
     message_trace_buffer_init(&state->buf);
 }
 
 static void generic_message_state_on_new_message(generic_message_state_t *state,
                                                  uint16_t fe_port,
                                                  sender_type_t sender_type,
+                                                 uint8_t message_type,
                                                  const char *message_name) {
     ASSERT(state);
     generic_message_state_init(state);
     state->state_type = GENERIC_MESSAGE_STATE_TYPE_IN_LENGTH;
+    state->sender_type = sender_type;
+    state->message_type = message_type;
+    state->message_name = message_name;
+    state->start_nsec = now_epoch_nsec();
+    metrics_on_message(&global_metrics, sender_type, message_type, message_name);
     message_trace_buffer_write_start(&state->buf, fe_port, sender_type, message_name);
 }
 
+/* Must be called straight after generic_message_state_on_new_message. */
+static void generic_message_state_skip_payload(generic_message_state_t *state) {
+    ASSERT(state);
+    state->is_payload_skipped = true;
+}
+
+/* Skips the rest of a payload that's already part way through, e.g. one that was in flight when the parser state was
+   checkpointed. */
+static void generic_message_state_skip_rest_of_payload(generic_message_state_t *state, int32_t message_bytes_read) {
+    ASSERT(state);
+    ASSERT(GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->state_type);
+    ASSERT(message_bytes_read < int32_state_value_get(&state->length_state));
+    state->is_payload_skipped = true;
+    state->message_bytes_read = message_bytes_read;
+}
+
+static inline bool generic_message_state_is_skipping(const generic_message_state_t *state) {
+    return state->is_payload_skipped && (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->state_type);
+}
+
+/* Skips over as much of a skipped payload as there is in the next num_bytes bytes at once, and returns how many
+   bytes that was. */
+static inline size_t generic_message_state_skip(generic_message_state_t *state, size_t num_bytes, bool *is_complete) {
+    ASSERT(generic_message_state_is_skipping(state));
+    ASSERT(is_complete);
+    size_t num_remaining = int32_state_value_get(&state->length_state) - state->message_bytes_read;
+    size_t num_skipped = (num_bytes < num_remaining) ? num_bytes : num_remaining;
+    state->message_bytes_read += num_skipped;
+    *is_complete = (num_skipped == num_remaining);
+    return num_skipped;
+}
+
+static void generic_message_state_print(generic_message_state_t *state, uint16_t fe_port, FILE *trace_fp) {
+    ASSERT(state);
+    /* Before printing, which makes the payload printable in place. */
+    if (trace_store_is_enabled(&global_trace_store)) {
+        trace_store_on_message(&global_trace_store,
+                               state->start_nsec,
+                               fe_port,
+                               state->sender_type,
+                               state->message_type,
+                               state->message_name,
+                               int32_state_value_get(&state->length_state),
+                               &state->buf);
+    }
+
+    if (!trace_mode_is_tracing_messages() || (OUTPUT_FORMAT_NONE == global_output_format)) {
+        return;
+    }
+
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_print(&state->buf,
+                                  state->start_nsec,
+                                  fe_port,
+                                  state->sender_type,
+                                  state->message_type,
+                                  state->message_name,
+                                  int32_state_value_get(&state->length_state),
+                                  trace_fp);
+    } else {
+        message_trace_buffer_print(&state->buf, trace_fp);
+    }
+}
+
 static bool generic_message_state_on_length_complete(generic_message_state_t *state, uint16_t fe_port, FILE *trace_fp) {
     ASSERT(state);
     ASSERT(trace_fp);
@@ -55,7 +136,7 @@ static bool generic_message_state_on_length_complete(generic_message_state_t *st
         return true;
     }
     
-    message_trace_buffer_write_space(&state->buf);
+    message_trace_buffer_write_payload_start(&state->buf);
     return false;
 }
 
@@ -82,10 +163,15 @@ static inline bool generic_message_state_on_byte(generic_message_state_t *state,
             return false;
         
         case GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD:
-            message_trace_buffer_write_byte_as_safe_char(&state->buf, byte);
+            if (state->is_payload_skipped) {
+                state->message_bytes_read++;
+                return state->message_bytes_read >= int32_state_value_get(&state->length_state);
+            }
+
+            message_trace_buffer_write_byte(&state->buf, byte);
             state->message_bytes_read++;
             if (state->message_bytes_read >= int32_state_value_get(&state->length_state)) {
-                message_trace_buffer_print(&state->buf, trace_fp);
+                generic_message_state_print(state, fe_port, trace_fp);
                 return true;
             }
             
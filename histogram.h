@@ -0,0 +1,90 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/* Bucket 0 holds zeros and bucket i holds values in [2^(i-1), 2^i), so 48 buckets covers nanosecond durations
+   up to about 39 hours.  Anything longer lands in the last bucket. */
+#define HISTOGRAM_NUM_BUCKETS 48
+
+typedef struct {
+    uint64_t buckets[HISTOGRAM_NUM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} histogram_t;
+
+static void histogram_init(histogram_t *histogram) {
+    ASSERT(histogram);
+    memset(histogram, 0, sizeof(*histogram));
+}
+
+static inline size_t histogram_bucket_index(uint64_t value) {
+    if (0 == value) {
+        return 0;
+    }
+
+    size_t i = 64 - __builtin_clzll(value);
+    return (i < HISTOGRAM_NUM_BUCKETS) ? i : HISTOGRAM_NUM_BUCKETS - 1;
+}
+
+/* The largest value that lands in bucket i. */
+static inline uint64_t histogram_bucket_upper_bound(size_t i) {
+    return (0 == i) ? 0 : ((uint64_t)1 << i) - 1;
+}
+
+static inline void histogram_add(histogram_t *histogram, uint64_t value) {
+    histogram->buckets[histogram_bucket_index(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+/* An upper bound for the given percentile, accurate to within a factor of 2. */
+static uint64_t histogram_percentile(const histogram_t *histogram, unsigned int percentile) {
+    ASSERT(histogram);
+    ASSERT(percentile <= 100);
+    if (0 == histogram->count) {
+        return 0;
+    }
+
+    uint64_t rank = (histogram->count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    size_t i = 0;
+    for (; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if ((seen >= rank) && (seen > 0)) {
+            uint64_t upper_bound = histogram_bucket_upper_bound(i);
+            return (upper_bound < histogram->max) ? upper_bound : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+/* e.g. "count:12,p50:1023,p90:4095,p99:8191,max:5000" */
+static char *histogram_to_str(const histogram_t *histogram, char *str) {
+    ASSERT(histogram);
+    sprintf(str, "count:%llu,p50:%llu,p90:%llu,p99:%llu,max:%llu",
+            (unsigned long long)histogram->count,
+            (unsigned long long)histogram_percentile(histogram, 50),
+            (unsigned long long)histogram_percentile(histogram, 90),
+            (unsigned long long)histogram_percentile(histogram, 99),
+            (unsigned long long)histogram->max);
+    return str;
+}
+
+static void histogram_write_json_field(const histogram_t *histogram, const char *key, message_json_writer_t *writer) {
+    ASSERT(histogram);
+    message_json_writer_write_key(writer, key);
+    *writer->p++ = '{';
+    message_json_writer_write_raw(writer, "\"count\":");
+    message_json_writer_write_uint(writer, histogram->count);
+    message_json_writer_write_uint_field(writer, "p50", histogram_percentile(histogram, 50));
+    message_json_writer_write_uint_field(writer, "p90", histogram_percentile(histogram, 90));
+    message_json_writer_write_uint_field(writer, "p99", histogram_percentile(histogram, 99));
+    message_json_writer_write_uint_field(writer, "max", histogram->max);
+    *writer->p++ = '}';
+}
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdint.h>
+/* Only for pcap's types, the caller does the capturing. */
+#include <pcap/pcap.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#define PROGRAM_NAME "libpgtrace"
+#define LIBPGTRACE_EXPORT __attribute__((visibility("default")))
+/* Each pgtrace_t has its own engine state, see ENGINE_STATE. */
+#define LIBPGTRACE
+#include "common.h"
+#include "state_machine.h"
+#include "tcp_state.h"
+#include "checkpoint.h"
+#include "packet_processor.h"
+
+struct pgtrace {
+    /* Where log lines go when the caller doesn't want them. */
+    FILE *null_fp;
+    /* The engine's state, see ENGINE_STATE.  The state that only pgtrace's own options use, e.g. the checkpoint, is
+       left as the process's, since it's never set up here. */
+    FILE *log_fp;
+    uint64_t now_nsec;
+    timestamp_cache_t timestamp_cache;
+    pgtrace_state_t state;
+    tcp_state_t tcp_state;
+    packet_batch_t packet_batch;
+    interval_timer_t summary_timer;
+    interval_timer_t eviction_timer;
+    message_sink_t message_sink;
+    memory_budget_t memory_budget;
+    overload_controller_t overload_controller;
+    trace_mode_t trace_mode;
+    metrics_t metrics;
+    error_stats_t error_stats;
+    transaction_stats_t transaction_stats;
+    pipeline_stats_t pipeline_stats;
+    connection_setup_stats_t connection_setup_stats;
+    pooler_stats_t pooler_stats;
+    pooler_t pooler;
+    session_tags_t session_tags;
+    session_table_t sessions;
+    cancel_keys_t cancel_keys;
+    bypass_rules_t bypass_rules;
+    top_statements_t top_statements;
+};
+
+/* The one that the calling thread's engine state is pointed at. */
+static __thread pgtrace_t *global_used_pgtrace;
+
+/* Points the engine's state at pgtrace's for the calling thread. */
+static void pgtrace_use(pgtrace_t *pgtrace) {
+    if (pgtrace == global_used_pgtrace) {
+        return;
+    }
+
+    global_used_pgtrace = pgtrace;
+    global_log_fp_instance = &pgtrace->log_fp;
+    global_now_nsec_instance = &pgtrace->now_nsec;
+    global_timestamp_cache_instance = &pgtrace->timestamp_cache;
+    global_state_instance = &pgtrace->state;
+    global_tcp_state_instance = &pgtrace->tcp_state;
+    global_packet_batch_instance = &pgtrace->packet_batch;
+    global_summary_timer_instance = &pgtrace->summary_timer;
+    global_eviction_timer_instance = &pgtrace->eviction_timer;
+    global_message_sink_instance = &pgtrace->message_sink;
+    global_memory_budget_instance = &pgtrace->memory_budget;
+    global_overload_controller_instance = &pgtrace->overload_controller;
+    global_trace_mode_instance = &pgtrace->trace_mode;
+    global_metrics_instance = &pgtrace->metrics;
+    global_error_stats_instance = &pgtrace->error_stats;
+    global_transaction_stats_instance = &pgtrace->transaction_stats;
+    global_pipeline_stats_instance = &pgtrace->pipeline_stats;
+    global_connection_setup_stats_instance = &pgtrace->connection_setup_stats;
+    global_pooler_stats_instance = &pgtrace->pooler_stats;
+    global_pooler_instance = &pgtrace->pooler;
+    global_session_tags_instance = &pgtrace->session_tags;
+    global_sessions_instance = &pgtrace->sessions;
+    global_cancel_keys_instance = &pgtrace->cancel_keys;
+    global_bypass_rules_instance = &pgtrace->bypass_rules;
+    global_top_statements_instance = &pgtrace->top_statements;
+}
+
+static pthread_once_t global_settings_once = PTHREAD_ONCE_INIT;
+
+/* The process's settings, which are the same for every pgtrace_t. */
+static void init_settings() {
+    global_output_format = OUTPUT_FORMAT_NONE;
+    /* Timestamps are always given in nanoseconds. */
+    global_capture_nsec_per_tick = 1;
+    global_is_nsec_timestamps = true;
+}
+
+static void set_now_nsec(uint64_t ts_nsec) {
+    struct timeval tv;
+    tv.tv_sec = ts_nsec / 1000000000;
+    tv.tv_usec = ts_nsec % 1000000000;
+    set_now(&tv);
+}
+
+LIBPGTRACE_EXPORT pgtrace_t *pgtrace_open(const pgtrace_options_t *options) {
+    pgtrace_t *pgtrace = calloc(1, sizeof(*pgtrace));
+    if (!pgtrace) {
+        return NULL;
+    }
+
+    pgtrace_use(pgtrace);
+    ASSERT(options);
+    if (!options->log_fp && !(pgtrace->null_fp = fopen("/dev/null", "w"))) {
+        global_used_pgtrace = NULL;
+        free(pgtrace);
+        return NULL;
+    }
+
+    pthread_once(&global_settings_once, init_settings);
+    global_log_fp = options->log_fp ? options->log_fp : pgtrace->null_fp;
+    message_sink_init(&global_message_sink, options->on_message, options->arg);
+    tcp_state_init(&global_tcp_state);
+    interval_timer_init(&global_summary_timer, 0);
+    interval_timer_init(&global_eviction_timer, MEMORY_BUDGET_EVICTION_INTERVAL_USEC);
+    memory_budget_init(&global_memory_budget, 0);
+    overload_controller_init(&global_overload_controller, false);
+    error_stats_init(&global_error_stats);
+    transaction_stats_init(&global_transaction_stats);
+    pipeline_stats_init(&global_pipeline_stats);
+    connection_setup_stats_init(&global_connection_setup_stats);
+    pooler_stats_init(&global_pooler_stats);
+    pooler_init(&global_pooler, options->pooler_port);
+    session_tags_init(&global_session_tags);
+    cancel_keys_init(&global_cancel_keys);
+    bypass_rules_init(&global_bypass_rules);
+    top_statements_init(&global_top_statements, 0);
+    state_machine_init();
+    metrics_init(&global_metrics);
+    return pgtrace;
+}
+
+LIBPGTRACE_EXPORT void pgtrace_close(pgtrace_t *pgtrace) {
+    pgtrace_use(pgtrace);
+    flush_packet_batch(&global_packet_batch);
+    if (pgtrace->null_fp) {
+        fclose(pgtrace->null_fp);
+    }
+
+    global_used_pgtrace = NULL;
+    free(pgtrace);
+}
+
+LIBPGTRACE_EXPORT void pgtrace_feed_packet(pgtrace_t *pgtrace, uint64_t ts_nsec, const uint8_t *frame, size_t caplen, size_t wire_len) {
+    pgtrace_use(pgtrace);
+    ASSERT(frame);
+    struct pcap_pkthdr header;
+    header.ts.tv_sec = ts_nsec / 1000000000;
+    header.ts.tv_usec = ts_nsec % 1000000000;
+    header.caplen = caplen;
+    header.len = wire_len;
+    on_packet(NULL, &header, frame);
+    /* So that the callbacks are done with by the time this returns. */
+    flush_packet_batch(&global_packet_batch);
+}
+
+LIBPGTRACE_EXPORT void pgtrace_connection_start(pgtrace_t *pgtrace, uint64_t ts_nsec, const pgtrace_connection_key_t *key) {
+    pgtrace_use(pgtrace);
+    ASSERT(key);
+    set_now_nsec(ts_nsec);
+    state_machine_on_connection_open(key->fe_port);
+}
+
+LIBPGTRACE_EXPORT void pgtrace_feed_segment(pgtrace_t *pgtrace,
+                                            uint64_t ts_nsec,
+                                            const pgtrace_connection_key_t *key,
+                                            pgtrace_direction_t direction,
+                                            const uint8_t *bytes,
+                                            size_t size) {
+    pgtrace_use(pgtrace);
+    set_now_nsec(ts_nsec);
+    on_segment(key, PGTRACE_DIRECTION_BE_TO_FE == direction, bytes, size);
+}
+
+LIBPGTRACE_EXPORT void pgtrace_connection_end(pgtrace_t *pgtrace, uint64_t ts_nsec, const pgtrace_connection_key_t *key) {
+    pgtrace_use(pgtrace);
+    ASSERT(key);
+    set_now_nsec(ts_nsec);
+    state_machine_on_connection_close(key->fe_port);
+}
@@ -0,0 +1,88 @@
+#ifndef LIBPGTRACE_H
+#define LIBPGTRACE_H
+
+/* pgtrace's engine as a library, for programs that want the messages themselves rather than pgtrace's text or NDJSON.
+   Build libpgtrace.a with make lib and link it with -pthread.
+
+   Each pgtrace_t has its own state, so any number can be open at once, e.g. one per capture thread.  Each can be used
+   from any thread, but from only one at a time.  Each has its own copy of pgtrace's connection tables, which are
+   several hundred MB, and like pgtrace it exits the process on a fatal error. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pgtrace pgtrace_t;
+
+typedef enum {
+    PGTRACE_DIRECTION_FE_TO_BE,
+    PGTRACE_DIRECTION_BE_TO_FE,
+} pgtrace_direction_t;
+
+/* Addresses are IPv4 in host order. */
+typedef struct {
+    uint32_t fe_address;
+    uint32_t be_address;
+    uint16_t fe_port;
+    uint16_t be_port;
+} pgtrace_connection_key_t;
+
+/* A whole message.  payload points into the packet or segment that was being fed when the message ended, if all of
+   it's there, so it's only good until the callback returns.  A message that spans packets gets as much of its payload
+   as was traced, with is_payload_complete 0 if that isn't all of it. */
+typedef struct {
+    pgtrace_connection_key_t key;
+    pgtrace_direction_t direction;
+    /* The type byte, or 0 for a front-end message without one, e.g. a StartupMessage. */
+    uint8_t type;
+    /* As sent, i.e. including the length field itself. */
+    int32_t length;
+    const uint8_t *payload;
+    size_t payload_size;
+    int is_payload_complete;
+    /* From the packet timestamps, in nanoseconds since the epoch. */
+    uint64_t start_nsec;
+    uint64_t end_nsec;
+} pgtrace_message_t;
+
+typedef void (*pgtrace_message_callback_t)(const pgtrace_message_t *message, void *arg);
+
+typedef struct {
+    pgtrace_message_callback_t on_message;
+    void *arg;
+    /* Where the engine's log lines go, or NULL to drop them. */
+    FILE *log_fp;
+    /* As for pgtrace -P, or 0. */
+    uint16_t pooler_port;
+} pgtrace_options_t;
+
+/* Returns NULL if there isn't the memory for another one. */
+pgtrace_t *pgtrace_open(const pgtrace_options_t *options);
+
+void pgtrace_close(pgtrace_t *pgtrace);
+
+/* An Ethernet frame, as libpcap would give it.  wire_len is its length before any was cut off by the snaplen. */
+void pgtrace_feed_packet(pgtrace_t *pgtrace, uint64_t ts_nsec, const uint8_t *frame, size_t caplen, size_t wire_len);
+
+/* For callers that do their own TCP reassembly: the next bytes of the stream in one direction, in order and without
+   gaps.  pgtrace_connection_start and pgtrace_connection_end say where each connection's streams begin and end. */
+void pgtrace_connection_start(pgtrace_t *pgtrace, uint64_t ts_nsec, const pgtrace_connection_key_t *key);
+
+void pgtrace_feed_segment(pgtrace_t *pgtrace,
+                          uint64_t ts_nsec,
+                          const pgtrace_connection_key_t *key,
+                          pgtrace_direction_t direction,
+                          const uint8_t *bytes,
+                          size_t size);
+
+void pgtrace_connection_end(pgtrace_t *pgtrace, uint64_t ts_nsec, const pgtrace_connection_key_t *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
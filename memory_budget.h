@@ -0,0 +1,146 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+/* Connections that haven't sent or received anything for this long are evicted at MEMORY_LEVEL_EVICT_IDLE. */
+#define MEMORY_BUDGET_IDLE_NSEC (60 * (uint64_t)1000000000)
+
+/* How often idle connections are looked for while at MEMORY_LEVEL_EVICT_IDLE or above. */
+#define MEMORY_BUDGET_EVICTION_INTERVAL_USEC (10 * 1000000)
+
+/* A level is only left once usage is this many percent of the headroom below where it was entered, so that we don't
+   flap between levels. */
+#define MEMORY_BUDGET_HYSTERESIS_PERCENT 10
+
+typedef enum {
+    MEMORY_SUBSYSTEM_CONNECTIONS,
+    /* Whole messages that are put back together from their packets, i.e. the replay recorder's buffers. */
+    MEMORY_SUBSYSTEM_REASSEMBLY,
+    MEMORY_SUBSYSTEM_MESSAGE_BUFFERS,
+    MEMORY_SUBSYSTEM_AGGREGATION,
+    MEMORY_NUM_SUBSYSTEMS,
+} memory_subsystem_t;
+
+/* The load that's shed as usage grows, in order, each for the memory that it gives back.  Each level also sheds
+   everything that the levels below it do.  Only rollup columns and replay buffers grow, everything else is a table
+   that's allocated at startup. */
+typedef enum {
+    MEMORY_LEVEL_NORMAL,
+    /* Each interval's rollups are written as a block of their own, and the columns freed. */
+    MEMORY_LEVEL_FLUSH_ROLLUPS,
+    /* Idle connections are forgotten, which frees their replay buffers. */
+    MEMORY_LEVEL_EVICT_IDLE,
+    /* Replay recording stops, which frees every replay buffer. */
+    MEMORY_LEVEL_DROP_REASSEMBLY,
+    MEMORY_NUM_LEVELS,
+} memory_level_t;
+
+static const char * const memory_subsystem_names[MEMORY_NUM_SUBSYSTEMS] = {
+    "connections", "reassembly", "message_buffers", "aggregation"
+};
+
+static const char * const memory_level_names[MEMORY_NUM_LEVELS] = {
+    "normal", "flush_rollups", "evict_idle", "drop_reassembly"
+};
+
+/* The percentage of the headroom, what the limit leaves after the startup tables, that the memory allocated since
+   has to fill for each level to be entered. */
+static const uint64_t memory_level_percents[MEMORY_NUM_LEVELS] = { 0, 70, 80, 90 };
+
+/* Everything that pgtrace allocates, by subsystem, against the -M limit.  The big tables are allocated once at
+   startup and are charged then, growth is charged as it happens and is refused past the limit. */
+typedef struct {
+    /* 0 if there's no limit. */
+    uint64_t limit_bytes;
+    uint64_t used_bytes[MEMORY_NUM_SUBSYSTEMS];
+    /* Of used_bytes, what was charged at startup. */
+    uint64_t fixed_bytes;
+    memory_level_t level;
+    /* The level whose shedding has been done, see apply_memory_level. */
+    memory_level_t applied_level;
+    /* How many times each level has been entered from below. */
+    uint64_t num_escalations[MEMORY_NUM_LEVELS];
+    uint64_t num_refused_allocations;
+    uint64_t num_evicted_connections;
+} memory_budget_t;
+
+ENGINE_STATE(memory_budget_t, global_memory_budget);
+#define global_memory_budget ENGINE_STATE_OF(global_memory_budget)
+
+static void memory_budget_init(memory_budget_t *budget, uint64_t limit_bytes) {
+    ASSERT(budget);
+    memset(budget, 0, sizeof(*budget));
+    budget->limit_bytes = limit_bytes;
+    budget->level = MEMORY_LEVEL_NORMAL;
+    budget->applied_level = MEMORY_LEVEL_NORMAL;
+}
+
+static inline bool memory_budget_is_limited(const memory_budget_t *budget) {
+    return budget->limit_bytes != 0;
+}
+
+static uint64_t memory_budget_used(const memory_budget_t *budget) {
+    uint64_t used = 0;
+    size_t i = 0;
+    for (; i < MEMORY_NUM_SUBSYSTEMS; ++i) {
+        used += budget->used_bytes[i];
+    }
+
+    return used;
+}
+
+static void memory_budget_update_level(memory_budget_t *budget) {
+    if (!memory_budget_is_limited(budget)) {
+        return;
+    }
+
+    uint64_t used = memory_budget_used(budget);
+    uint64_t headroom = (budget->limit_bytes > budget->fixed_bytes) ? budget->limit_bytes - budget->fixed_bytes : 0;
+    uint64_t used_percent = (headroom > 0) ? (used - budget->fixed_bytes) * 100 / headroom : 100;
+    memory_level_t level = budget->level;
+    while ((level + 1 < MEMORY_NUM_LEVELS) && (used_percent >= memory_level_percents[level + 1])) {
+        ++level;
+        budget->num_escalations[level]++;
+    }
+
+    while ((level > MEMORY_LEVEL_NORMAL) &&
+           (used_percent + MEMORY_BUDGET_HYSTERESIS_PERCENT < memory_level_percents[level])) {
+        --level;
+    }
+
+    if (level != budget->level) {
+        LOG("Memory level changed from %s to %s.  used_bytes=%llu fixed_bytes=%llu limit_bytes=%llu",
+            memory_level_names[budget->level], memory_level_names[level], (unsigned long long)used,
+            (unsigned long long)budget->fixed_bytes, (unsigned long long)budget->limit_bytes);
+        budget->level = level;
+    }
+}
+
+/* For the tables that are allocated at startup.  They're never freed, and the caller checks that they fit and then
+   updates the level. */
+static void memory_budget_charge_fixed(memory_budget_t *budget, memory_subsystem_t subsystem, uint64_t size) {
+    ASSERT(budget);
+    budget->used_bytes[subsystem] += size;
+    budget->fixed_bytes += size;
+}
+
+/* Returns false, and charges nothing, if size more bytes would take us over the limit. */
+static bool memory_budget_try_charge(memory_budget_t *budget, memory_subsystem_t subsystem, uint64_t size) {
+    ASSERT(budget);
+    if (memory_budget_is_limited(budget) && (memory_budget_used(budget) + size > budget->limit_bytes)) {
+        budget->num_refused_allocations++;
+        return false;
+    }
+
+    budget->used_bytes[subsystem] += size;
+    memory_budget_update_level(budget);
+    return true;
+}
+
+static void memory_budget_release(memory_budget_t *budget, memory_subsystem_t subsystem, uint64_t size) {
+    ASSERT(budget);
+    ASSERT(budget->used_bytes[subsystem] >= size);
+    budget->used_bytes[subsystem] -= size;
+    memory_budget_update_level(budget);
+}
+
+#endif
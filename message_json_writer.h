@@ -0,0 +1,438 @@
+#ifndef MESSAGE_JSON_WRITER_H
+#define MESSAGE_JSON_WRITER_H
+
+/* How each byte is written inside a JSON string: 0 means as-is, 'u' means as a \u00XX escape, and anything else
+   is the character to put after a backslash.  Text fields are assumed to be UTF-8 so bytes from 0x60 up are written
+   as-is. */
+static const char message_json_writer_text_escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+/* Undecoded payloads are often binary, so everything that isn't printable ASCII is escaped to keep the output valid
+   UTF-8.  Each byte becomes the code point with the same value. */
+static const char message_json_writer_binary_escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+};
+
+static const char message_json_writer_hex_digits[] = "0123456789abcdef";
+
+typedef struct {
+    /* Big enough for a whole trace buffer's payload with every byte escaped to \u00XX, plus the decoded field names. */
+    char data[sizeof(((message_trace_buffer_t *)0)->data) * 6 + 1024];
+    char *p;
+} message_json_writer_t;
+
+static void message_json_writer_init(message_json_writer_t *writer) {
+    ASSERT(writer);
+    writer->p = writer->data;
+}
+
+static inline void message_json_writer_write_raw(message_json_writer_t *writer, const char *s) {
+    size_t len = strlen(s);
+    memcpy(writer->p, s, len);
+    writer->p += len;
+}
+
+static inline void message_json_writer_write_uint(message_json_writer_t *writer, uint64_t i) {
+    writer->p = uint64_to_dec_str(writer->p, i);
+}
+
+static inline void message_json_writer_write_timestamp(message_json_writer_t *writer, uint64_t epoch_nsec) {
+    writer->p = timestamp_to_dec_str(writer->p, epoch_nsec);
+}
+
+static inline void message_json_writer_write_escaped(message_json_writer_t *writer,
+                                                     const char *escapes,
+                                                     const uint8_t *s,
+                                                     size_t len) {
+    const uint8_t *s_end = s + len;
+    char *p = writer->p;
+    *p++ = '"';
+    for (; s < s_end; ++s) {
+        char escape = escapes[*s];
+        if (0 == escape) {
+            *p++ = *s;
+        } else if ('u' == escape) {
+            memcpy(p, "\\u00", 4);
+            p[4] = message_json_writer_hex_digits[*s >> 4];
+            p[5] = message_json_writer_hex_digits[*s & 0xf];
+            p += 6;
+        } else {
+            *p++ = '\\';
+            *p++ = escape;
+        }
+    }
+
+    *p++ = '"';
+    writer->p = p;
+}
+
+static inline void message_json_writer_write_string(message_json_writer_t *writer, const uint8_t *s, size_t len) {
+    message_json_writer_write_escaped(writer, message_json_writer_text_escapes, s, len);
+}
+
+static inline void message_json_writer_write_key(message_json_writer_t *writer, const char *key) {
+    *writer->p++ = ',';
+    *writer->p++ = '"';
+    message_json_writer_write_raw(writer, key);
+    *writer->p++ = '"';
+    *writer->p++ = ':';
+}
+
+static inline void message_json_writer_write_string_field(message_json_writer_t *writer,
+                                                          const char *key,
+                                                          const uint8_t *s,
+                                                          size_t len) {
+    message_json_writer_write_key(writer, key);
+    message_json_writer_write_string(writer, s, len);
+}
+
+static inline void message_json_writer_write_uint_field(message_json_writer_t *writer, const char *key, uint64_t i) {
+    message_json_writer_write_key(writer, key);
+    message_json_writer_write_uint(writer, i);
+}
+
+/* Query: the SQL string. */
+static bool message_json_writer_write_query(message_json_writer_t *writer, payload_reader_t *reader) {
+    const uint8_t *query;
+    size_t query_len;
+    bool is_complete = payload_reader_read_cstring(reader, &query, &query_len);
+    message_json_writer_write_string_field(writer, "query", query, query_len);
+    return is_complete;
+}
+
+/* Parse: statement name, SQL and parameter type OIDs. */
+static bool message_json_writer_write_parse(message_json_writer_t *writer, payload_reader_t *reader) {
+    const uint8_t *s;
+    size_t s_len;
+    bool is_complete = payload_reader_read_cstring(reader, &s, &s_len);
+    message_json_writer_write_string_field(writer, "statement", s, s_len);
+    if (!is_complete) {
+        return false;
+    }
+
+    is_complete = payload_reader_read_cstring(reader, &s, &s_len);
+    message_json_writer_write_string_field(writer, "query", s, s_len);
+    if (!is_complete) {
+        return false;
+    }
+
+    int16_t num_param_types;
+    if (!payload_reader_read_int16(reader, &num_param_types)) {
+        return false;
+    }
+
+    message_json_writer_write_key(writer, "param_types");
+    *writer->p++ = '[';
+    int16_t i = 0;
+    for (; i < num_param_types; ++i) {
+        int32_t oid;
+        if (!payload_reader_read_int32(reader, &oid)) {
+            break;
+        }
+
+        if (i > 0) {
+            *writer->p++ = ',';
+        }
+
+        message_json_writer_write_uint(writer, (uint32_t)oid);
+    }
+
+    *writer->p++ = ']';
+    return (i == num_param_types);
+}
+
+/* Bind: portal, statement and parameter count.  The parameter values themselves aren't written. */
+static bool message_json_writer_write_bind(message_json_writer_t *writer, payload_reader_t *reader) {
+    const uint8_t *s;
+    size_t s_len;
+    bool is_complete = payload_reader_read_cstring(reader, &s, &s_len);
+    message_json_writer_write_string_field(writer, "portal", s, s_len);
+    if (!is_complete) {
+        return false;
+    }
+
+    is_complete = payload_reader_read_cstring(reader, &s, &s_len);
+    message_json_writer_write_string_field(writer, "statement", s, s_len);
+    if (!is_complete) {
+        return false;
+    }
+
+    int16_t num_format_codes;
+    int16_t num_params;
+    if (!payload_reader_read_int16(reader, &num_format_codes) ||
+        (num_format_codes < 0) ||
+        !payload_reader_skip(reader, num_format_codes * 2) ||
+        !payload_reader_read_int16(reader, &num_params)) {
+        return false;
+    }
+
+    message_json_writer_write_uint_field(writer, "param_count", (uint16_t)num_params);
+    return true;
+}
+
+/* CommandComplete: the tag, and the row count when the tag ends in one (e.g. "INSERT 0 5", "SELECT 3"). */
+static bool message_json_writer_write_command_complete(message_json_writer_t *writer, payload_reader_t *reader) {
+    const uint8_t *tag;
+    size_t tag_len;
+    bool is_complete = payload_reader_read_cstring(reader, &tag, &tag_len);
+    message_json_writer_write_string_field(writer, "tag", tag, tag_len);
+    if (!is_complete) {
+        return false;
+    }
+
+    const uint8_t *tag_end = tag + tag_len;
+    const uint8_t *digits = tag_end;
+    while ((digits > tag) && isdigit(digits[-1])) {
+        --digits;
+    }
+
+    if ((digits < tag_end) && (digits > tag) && (' ' == digits[-1])) {
+        uint64_t rows = 0;
+        for (; digits < tag_end; ++digits) {
+            rows = rows * 10 + (*digits - '0');
+        }
+
+        message_json_writer_write_uint_field(writer, "rows", rows);
+    }
+
+    return true;
+}
+
+/* ErrorResponse & NoticeResponse: severity, SQLSTATE and message out of the field-tagged body. */
+static bool message_json_writer_write_error_fields(message_json_writer_t *writer, payload_reader_t *reader) {
+    const uint8_t *severity = NULL;
+    size_t severity_len = 0;
+    bool has_nonlocalized_severity = false;
+    const uint8_t *sqlstate = NULL;
+    size_t sqlstate_len = 0;
+    const uint8_t *message = NULL;
+    size_t message_len = 0;
+    bool is_complete = false;
+
+    uint8_t field_type;
+    while (payload_reader_read_byte(reader, &field_type)) {
+        if ('\0' == field_type) {
+            is_complete = true;
+            break;
+        }
+
+        const uint8_t *value;
+        size_t value_len;
+        bool is_value_complete = payload_reader_read_cstring(reader, &value, &value_len);
+        switch (field_type) {
+            case 'S':
+                if (!has_nonlocalized_severity) {
+                    severity = value;
+                    severity_len = value_len;
+                }
+                break;
+
+            case 'V':
+                severity = value;
+                severity_len = value_len;
+                has_nonlocalized_severity = true;
+                break;
+
+            case 'C':
+                sqlstate = value;
+                sqlstate_len = value_len;
+                break;
+
+            case 'M':
+                message = value;
+                message_len = value_len;
+                break;
+        }
+
+        if (!is_value_complete) {
+            break;
+        }
+    }
+
+    if (severity) {
+        message_json_writer_write_string_field(writer, "severity", severity, severity_len);
+    }
+
+    if (sqlstate) {
+        message_json_writer_write_string_field(writer, "sqlstate", sqlstate, sqlstate_len);
+    }
+
+    if (message) {
+        message_json_writer_write_string_field(writer, "message", message, message_len);
+    }
+
+    return is_complete;
+}
+
+/* ReadyForQuery: the transaction status, 'I', 'T' or 'E'. */
+static bool message_json_writer_write_ready_for_query(message_json_writer_t *writer, payload_reader_t *reader) {
+    uint8_t status;
+    if (!payload_reader_read_byte(reader, &status)) {
+        return false;
+    }
+
+    message_json_writer_write_string_field(writer, "status", &status, 1);
+    return true;
+}
+
+static bool message_json_writer_write_payload(message_json_writer_t *writer, payload_reader_t *reader) {
+    message_json_writer_write_key(writer, "payload");
+    message_json_writer_write_escaped(writer, message_json_writer_binary_escapes, reader->p, reader->end - reader->p);
+    return true;
+}
+
+/* StartupMessage, SSLRequest, CancelRequest etc: the request code, and the StartupMessage's parameters. */
+static bool message_json_writer_write_special(message_json_writer_t *writer, payload_reader_t *reader) {
+    int32_t code;
+    if (!payload_reader_read_int32(reader, &code)) {
+        return false;
+    }
+
+    message_json_writer_write_uint_field(writer, "code", (uint32_t)code);
+    if ((code >> 16) != 3) {
+        return true;
+    }
+
+    message_json_writer_write_key(writer, "parameters");
+    *writer->p++ = '{';
+    bool is_first = true;
+    for (;;) {
+        const uint8_t *name;
+        size_t name_len;
+        if (!payload_reader_read_cstring(reader, &name, &name_len)) {
+            *writer->p++ = '}';
+            return false;
+        }
+
+        if (0 == name_len) {
+            break;
+        }
+
+        const uint8_t *value;
+        size_t value_len;
+        bool is_complete = payload_reader_read_cstring(reader, &value, &value_len);
+        if (!is_first) {
+            *writer->p++ = ',';
+        }
+
+        is_first = false;
+        message_json_writer_write_string(writer, name, name_len);
+        *writer->p++ = ':';
+        message_json_writer_write_string(writer, value, value_len);
+        if (!is_complete) {
+            *writer->p++ = '}';
+            return false;
+        }
+    }
+
+    *writer->p++ = '}';
+    return true;
+}
+
+static bool message_json_writer_write_decoded_fields(message_json_writer_t *writer,
+                                                     sender_type_t sender_type,
+                                                     uint8_t message_type,
+                                                     payload_reader_t *reader) {
+    if (SENDER_TYPE_FE == sender_type) {
+        switch ((fe_message_type_t)message_type) {
+            case FE_MESSAGE_TYPE_QUERY:
+                return message_json_writer_write_query(writer, reader);
+
+            case FE_MESSAGE_TYPE_PARSE:
+                return message_json_writer_write_parse(writer, reader);
+
+            case FE_MESSAGE_TYPE_BIND:
+                return message_json_writer_write_bind(writer, reader);
+
+            case FE_MESSAGE_TYPE_SPECIAL:
+                return message_json_writer_write_special(writer, reader);
+
+            default:
+                return message_json_writer_write_payload(writer, reader);
+        }
+    }
+
+    switch ((be_message_type_t)message_type) {
+        case BE_MESSAGE_TYPE_COMMAND_COMPLETE:
+            return message_json_writer_write_command_complete(writer, reader);
+
+        case BE_MESSAGE_TYPE_ERROR_RESPONSE:
+        case BE_MESSAGE_TYPE_NOTICE_RESPONSE:
+            return message_json_writer_write_error_fields(writer, reader);
+
+        case BE_MESSAGE_TYPE_READY_FOR_QUERY:
+            return message_json_writer_write_ready_for_query(writer, reader);
+
+        default:
+            return message_json_writer_write_payload(writer, reader);
+    }
+}
+
+/* Writes one NDJSON record for a message whose payload (or as much of it as fitted) is in buffer. */
+static void message_json_writer_print(message_trace_buffer_t *buffer,
+                                      uint64_t start_nsec,
+                                      uint16_t fe_port,
+                                      sender_type_t sender_type,
+                                      uint8_t message_type,
+                                      const char *message_name,
+                                      int32_t length,
+                                      FILE *fp) {
+    ASSERT(buffer);
+    ASSERT(message_name);
+
+    message_json_writer_t writer;
+    message_json_writer_init(&writer);
+
+    message_json_writer_write_raw(&writer, "{\"ts\":");
+    message_json_writer_write_timestamp(&writer, start_nsec);
+    message_json_writer_write_uint_field(&writer, "port", fe_port);
+    const session_t *session = &global_sessions[fe_port];
+    if (session->user_id != SESSION_TAG_ID_UNKNOWN) {
+        message_json_writer_write_uint_field(&writer, "user_id", session->user_id);
+        message_json_writer_write_uint_field(&writer, "database_id", session->database_id);
+        if (session->application_id != SESSION_TAG_ID_UNKNOWN) {
+            message_json_writer_write_uint_field(&writer, "application_id", session->application_id);
+        }
+    }
+
+    message_json_writer_write_key(&writer, "sender");
+    message_json_writer_write_raw(&writer, (SENDER_TYPE_FE == sender_type) ? "\"fe\"" : "\"be\"");
+    message_json_writer_write_string_field(&writer, "type", (const uint8_t *)message_name, strlen(message_name));
+    message_json_writer_write_uint_field(&writer, "length", (uint32_t)length);
+
+    payload_reader_t reader;
+    payload_reader_init(&reader, message_trace_buffer_payload(buffer), message_trace_buffer_payload_size(buffer));
+    bool is_complete = message_json_writer_write_decoded_fields(&writer, sender_type, message_type, &reader);
+    if (!is_complete || buffer->is_truncated) {
+        message_json_writer_write_key(&writer, "truncated");
+        message_json_writer_write_raw(&writer, "true");
+    }
+
+    *writer.p++ = '}';
+    *writer.p++ = '\n';
+    ASSERT(writer.p <= writer.data + sizeof(writer.data));
+    fwrite(writer.data, writer.p - writer.data, 1, fp);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef MESSAGE_SINK_H
+#define MESSAGE_SINK_H
+
+#include "libpgtrace.h"
+
+/* Hands each whole message to libpgtrace's caller.  pgtrace itself never sets one up. */
+typedef struct {
+    pgtrace_message_callback_t on_message;
+    void *arg;
+    /* The bytes being fed, so that a message that ends in them and started in them can be passed without a copy. */
+    const uint8_t *segment_start;
+    uint32_t fe_address;
+    uint32_t be_address;
+    uint16_t be_port;
+} message_sink_t;
+
+ENGINE_STATE(message_sink_t, global_message_sink);
+#define global_message_sink ENGINE_STATE_OF(global_message_sink)
+
+static void message_sink_init(message_sink_t *sink, pgtrace_message_callback_t on_message, void *arg) {
+    ASSERT(sink);
+    memset(sink, 0, sizeof(*sink));
+    sink->on_message = on_message;
+    sink->arg = arg;
+}
+
+static inline bool message_sink_is_enabled(const message_sink_t *sink) {
+    return sink->on_message != NULL;
+}
+
+/* The connection's bytes from start on are about to be fed. */
+static inline void message_sink_on_segment(message_sink_t *sink,
+                                           const uint8_t *start,
+                                           uint32_t fe_address,
+                                           uint32_t be_address,
+                                           uint16_t be_port) {
+    sink->segment_start = start;
+    sink->fe_address = fe_address;
+    sink->be_address = be_address;
+    sink->be_port = be_port;
+}
+
+/* A whole message, whose last byte is just before end, or NULL if its last bytes weren't captured. */
+static void message_sink_on_message(message_sink_t *sink,
+                                    uint16_t fe_port,
+                                    sender_type_t sender_type,
+                                    uint8_t message_type,
+                                    generic_message_state_t *generic,
+                                    const uint8_t *end) {
+    pgtrace_message_t message;
+    message.key.fe_address = sink->fe_address;
+    message.key.be_address = sink->be_address;
+    message.key.fe_port = fe_port;
+    message.key.be_port = sink->be_port;
+    message.direction = (SENDER_TYPE_FE == sender_type) ? PGTRACE_DIRECTION_FE_TO_BE : PGTRACE_DIRECTION_BE_TO_FE;
+    message.type = message_type;
+    message.length = int32_state_value_get(&generic->length_state);
+    size_t payload_size = (message.length > 4) ? message.length - 4 : 0;
+    if (end && ((size_t)(end - sink->segment_start) >= payload_size)) {
+        message.payload = end - payload_size;
+        message.payload_size = payload_size;
+        message.is_payload_complete = 1;
+    } else {
+        message.payload = message_trace_buffer_payload(&generic->buf);
+        message.payload_size = message_trace_buffer_payload_size(&generic->buf);
+        message.is_payload_complete = (message.payload_size == payload_size) && !generic->buf.is_truncated &&
+                                      !generic->is_payload_skipped;
+    }
+
+    message.start_nsec = generic->start_nsec;
+    message.end_nsec = now_epoch_nsec();
+    sink->on_message(&message, sink->arg);
+}
+
+#endif
@@ -7,32 +7,41 @@ typedef struct {
     /* This must be long enough to hold all possible message prefixes including all known message names and message lengths. */
     char data[4096];
     char *p;
+    /* The raw message payload starts here, after the text prefix.  It's only made safe for printing when it's printed
+       so that the decoders can see the original bytes. */
+    char *payload;
+    bool is_truncated;
 } message_trace_buffer_t;
 
+/* Payload bytes past this many aren't traced, e.g. when memory is short.  SIZE_MAX traces as much as fits. */
+size_t global_max_trace_payload_size = SIZE_MAX;
 
 static void message_trace_buffer_init(message_trace_buffer_t *buffer) {
     ASSERT(buffer);
     buffer->data[0] = '\0';
     buffer->p = buffer->data;
+    buffer->payload = buffer->data;
+    buffer->is_truncated = false;
 }
 
 static inline const char *message_trace_buffer_data_end(message_trace_buffer_t *buffer) {
-    return buffer->data + sizeof(buffer->data) - 4;  /* -4 for elipsis then NUL */
+    return buffer->data + sizeof(buffer->data) - 4;  /* -4 for elipsis then newline */
 }
 
-static inline void message_trace_buffer_write_byte_as_safe_char(message_trace_buffer_t *buffer, uint8_t byte) {
+static inline void message_trace_buffer_write_byte(message_trace_buffer_t *buffer, uint8_t byte) {
     ASSERT(buffer);
-    char c = (((byte <= 32) || (byte >= 127)) && (byte != ' ')) ? '.' : byte;
-    if (buffer->p < message_trace_buffer_data_end(buffer)) {
-        *buffer->p++ = c;
-        *buffer->p = '\0';        
+    if ((buffer->p < message_trace_buffer_data_end(buffer)) &&
+        ((size_t)(buffer->p - buffer->payload) < global_max_trace_payload_size)) {
+        *buffer->p++ = byte;
     } else {
-        strcpy(buffer->p, "...");
+        buffer->is_truncated = true;
     }
 }
 
-static inline void message_trace_buffer_write_space(message_trace_buffer_t *buffer) {
-    message_trace_buffer_write_byte_as_safe_char(buffer, ' ');
+static inline void message_trace_buffer_write_payload_start(message_trace_buffer_t *buffer) {
+    ASSERT(buffer);
+    *buffer->p++ = ' ';
+    buffer->payload = buffer->p;
 }
 
 static inline void message_trace_buffer_write_start(message_trace_buffer_t *buffer,
@@ -44,7 +53,7 @@ static inline void message_trace_buffer_write_start(message_trace_buffer_t *buff
     
     message_trace_buffer_init(buffer);
     
-    buffer->p = uint64_to_dec_str(buffer->p, now_epoch_usec());
+    buffer->p = timestamp_to_dec_str(buffer->p, now_epoch_nsec());
     *buffer->p++ = ' ';
     buffer->p = uint64_to_dec_str(buffer->p, fe_port);
     *buffer->p++ = ' ';
@@ -60,6 +69,7 @@ static inline void message_trace_buffer_write_start(message_trace_buffer_t *buff
     size_t name_len = strlen(message_name);
     memcpy(buffer->p, message_name, name_len + 1);
     buffer->p += name_len;
+    buffer->payload = buffer->p;
 }
  
 static inline void message_trace_buffer_write_length_field(message_trace_buffer_t *buffer, int32_t length) {
@@ -67,13 +77,37 @@ static inline void message_trace_buffer_write_length_field(message_trace_buffer_
     
     *buffer->p++ = ' ';    
     buffer->p = uint64_to_dec_str(buffer->p, length);
+    buffer->payload = buffer->p;
+}
+
+static inline const uint8_t *message_trace_buffer_payload(message_trace_buffer_t *buffer) {
+    ASSERT(buffer);
+    return (const uint8_t *)buffer->payload;
+}
+
+static inline size_t message_trace_buffer_payload_size(message_trace_buffer_t *buffer) {
+    ASSERT(buffer);
+    return buffer->p - buffer->payload;
 }
 
 
 static inline void message_trace_buffer_print(message_trace_buffer_t *buffer, FILE *fp) {
     ASSERT(buffer);
-    fwrite(buffer->data, strlen(buffer->data), 1, fp);
-    putc('\n', fp);
+    char *c = buffer->payload;
+    for (; c < buffer->p; ++c) {
+        uint8_t byte = (uint8_t)*c;
+        if (((byte <= 32) || (byte >= 127)) && (byte != ' ')) {
+            *c = '.';
+        }
+    }
+
+    if (buffer->is_truncated) {
+        memcpy(buffer->p, "...", 3);
+        buffer->p += 3;
+    }
+
+    *buffer->p++ = '\n';
+    fwrite(buffer->data, buffer->p - buffer->data, 1, fp);
 }
 
 #endif
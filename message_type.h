@@ -0,0 +1,55 @@
+#ifndef MESSAGE_TYPE_H
+#define MESSAGE_TYPE_H
+
+/* Message types that are sent by the front-end */
+typedef enum {
+    FE_MESSAGE_TYPE_UNKNOWN = '_',
+    /* There is no message type for "special" messages, they just start with a length int32, the first (high) byte of which is 0. */
+    FE_MESSAGE_TYPE_SPECIAL = 0,
+    FE_MESSAGE_TYPE_BIND = 'B',    
+    FE_MESSAGE_TYPE_CLOSE = 'C',
+    FE_MESSAGE_TYPE_COPY_DATA = 'd',
+    FE_MESSAGE_TYPE_COPY_DONE = 'c',
+    FE_MESSAGE_TYPE_COPY_FAIL = 'f',
+    FE_MESSAGE_TYPE_DESCRIBE = 'D',
+    FE_MESSAGE_TYPE_EXECUTE = 'E',
+    FE_MESSAGE_TYPE_FLUSH = 'H',
+    FE_MESSAGE_TYPE_FUNCTION_CALL = 'F',
+    FE_MESSAGE_TYPE_PARSE = 'P',
+    FE_MESSAGE_TYPE_PASSWORD_MESSAGE = 'p',
+    FE_MESSAGE_TYPE_QUERY = 'Q',
+    FE_MESSAGE_TYPE_SYNC = 'S',
+    FE_MESSAGE_TYPE_TERMINATE = 'X',
+} fe_message_type_t;
+
+/* Message types that are sent by the back-end */
+typedef enum {
+    BE_MESSAGE_TYPE_UNKNOWN = '_',
+    BE_MESSAGE_TYPE_AUTHENTICATION = 'R',
+    BE_MESSAGE_TYPE_KEY_DATA = 'K',
+    BE_MESSAGE_TYPE_BIND_COMPLETE = '2',
+    BE_MESSAGE_TYPE_CLOSE_COMPLETE = '3',
+    BE_MESSAGE_TYPE_COMMAND_COMPLETE = 'C',
+    BE_MESSAGE_TYPE_COPY_DATA = 'd',
+    BE_MESSAGE_TYPE_COPY_DONE = 'c',
+    BE_MESSAGE_TYPE_COPY_FAIL = 'f',
+    BE_MESSAGE_TYPE_COPY_IN_RESPONSE = 'G',
+    BE_MESSAGE_TYPE_COPY_OUT_RESPONSE = 'H',
+    BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE = 'W',
+    BE_MESSAGE_TYPE_DATA_ROW = 'D',
+    BE_MESSAGE_TYPE_EMPTY_QUERY_RESPONSE = 'I',
+    BE_MESSAGE_TYPE_ERROR_RESPONSE = 'E',
+    BE_MESSAGE_TYPE_FUNCTION_CALL_RESPONSE = 'V',
+    BE_MESSAGE_TYPE_NEGOTIATE_PROTOCOL_VERSION = 'v',
+    BE_MESSAGE_TYPE_NO_DATA = 'n',
+    BE_MESSAGE_TYPE_NOTICE_RESPONSE = 'N',
+    BE_MESSAGE_TYPE_NOTIFICATION_RESPONSE = 'A',
+    BE_MESSAGE_TYPE_PARAMETER_DESCRIPTION = 't',
+    BE_MESSAGE_TYPE_PARAMETER_STATUS = 'S',
+    BE_MESSAGE_TYPE_PARSE_COMPLETE = '1',
+    BE_MESSAGE_TYPE_PORTAL_SUSPENDED = 's',
+    BE_MESSAGE_TYPE_READY_FOR_QUERY = 'Z',
+    BE_MESSAGE_TYPE_ROW_DESCRIPTION = 'T',
+} be_message_type_t;
+
+#endif
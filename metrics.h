@@ -0,0 +1,159 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+/* Aggregates are broken down by database & application for the first this many pairs that are seen. */
+#define METRICS_MAX_BREAKDOWNS 32
+
+typedef struct {
+    session_tag_id_t database_id;
+    session_tag_id_t application_id;
+    histogram_t response_nsec;
+} metrics_breakdown_t;
+
+/* Counters that only ever go up, for the metrics endpoint.  Only the packet thread touches these, the metrics server
+   thread only sees the published snapshots. */
+typedef struct {
+    uint64_t num_packets;
+    /* Packets that the capture cut short, and the times that that lost us our place in a stream. */
+    uint64_t num_truncated_packets;
+    uint64_t num_truncation_resyncs;
+    /* Messages published to the -R ring, and the ones whose payloads didn't fit in a slot. */
+    uint64_t num_ring_records;
+    uint64_t num_ring_truncated_payloads;
+    /* Rollup blocks & rows written to the -w file, and series or rows that there wasn't room for. */
+    uint64_t num_rollup_blocks;
+    uint64_t num_rollup_rows;
+    uint64_t num_rollup_dropped;
+    /* Blocks & messages written to the -x trace store, and the bytes of records before and after compression. */
+    uint64_t num_trace_store_blocks;
+    uint64_t num_trace_store_records;
+    uint64_t num_trace_store_raw_bytes;
+    uint64_t num_trace_store_stored_bytes;
+    uint64_t fe_message_counts[256];
+    uint64_t be_message_counts[256];
+    const char *fe_message_names[256];
+    const char *be_message_names[256];
+    /* From the first front-end message after a ReadyForQuery to the next ReadyForQuery. */
+    histogram_t response_nsec;
+    transaction_stats_t transactions;
+    pipeline_stats_t pipeline;
+    pooler_stats_t pooler;
+    connection_setup_stats_t connection_setup;
+    cancel_stats_t cancel;
+    /* A copy of global_memory_budget as of the last publish. */
+    memory_budget_t memory;
+    /* Copies of global_overload_controller & global_trace_mode as of the last publish. */
+    overload_controller_t overload;
+    trace_mode_t trace_mode;
+    uint64_t num_connections_opened;
+    uint64_t num_connections_closed;
+    /* Indexed by a session's breakdown_index - 1. */
+    metrics_breakdown_t breakdowns[METRICS_MAX_BREAKDOWNS];
+    size_t num_breakdowns;
+    bypass_counts_t bypass;
+    opaque_stats_t opaque;
+    replication_stats_t replication;
+} metrics_t;
+
+ENGINE_STATE(metrics_t, global_metrics);
+#define global_metrics ENGINE_STATE_OF(global_metrics)
+
+static void metrics_init(metrics_t *metrics) {
+    ASSERT(metrics);
+    memset(metrics, 0, sizeof(*metrics));
+    histogram_init(&metrics->response_nsec);
+    transaction_stats_init(&metrics->transactions);
+    pipeline_stats_init(&metrics->pipeline);
+    pooler_stats_init(&metrics->pooler);
+    connection_setup_stats_init(&metrics->connection_setup);
+    cancel_stats_init(&metrics->cancel);
+    opaque_stats_init(&metrics->opaque);
+    replication_stats_init(&metrics->replication);
+    size_t i = 0;
+    for (; i < METRICS_MAX_BREAKDOWNS; ++i) {
+        histogram_init(&metrics->breakdowns[i].response_nsec);
+    }
+}
+
+/* The session's breakdown_index, which is 0 if there's no room for another breakdown. */
+static uint8_t metrics_breakdown_index(metrics_t *metrics, const session_t *session) {
+    ASSERT(metrics);
+    ASSERT(session);
+    size_t i = 0;
+    for (; i < metrics->num_breakdowns; ++i) {
+        if ((metrics->breakdowns[i].database_id == session->database_id) &&
+            (metrics->breakdowns[i].application_id == session->application_id)) {
+            return i + 1;
+        }
+    }
+
+    if (METRICS_MAX_BREAKDOWNS == metrics->num_breakdowns) {
+        return 0;
+    }
+
+    metrics_breakdown_t *breakdown = &metrics->breakdowns[metrics->num_breakdowns++];
+    breakdown->database_id = session->database_id;
+    breakdown->application_id = session->application_id;
+    return metrics->num_breakdowns;
+}
+
+static inline void metrics_on_message(metrics_t *metrics, sender_type_t sender_type, uint8_t message_type, const char *message_name) {
+    if (SENDER_TYPE_FE == sender_type) {
+        metrics->fe_message_counts[message_type]++;
+        metrics->fe_message_names[message_type] = message_name;
+    } else {
+        metrics->be_message_counts[message_type]++;
+        metrics->be_message_names[message_type] = message_name;
+    }
+}
+
+
+typedef struct {
+    bool has_capture_stats;
+    struct pcap_stat capture_stats;
+    metrics_t metrics;
+} metrics_snapshot_t;
+
+/* A seqlock around the latest snapshot.  The packet thread never waits for a reader, a reader that races with a
+   publish just copies the snapshot again. */
+typedef struct {
+    uint32_t sequence;
+    metrics_snapshot_t snapshot;
+} metrics_exposition_t;
+
+metrics_exposition_t global_metrics_exposition;
+
+static void metrics_exposition_publish(metrics_exposition_t *exposition, const struct pcap_stat *capture_stats, const metrics_t *metrics) {
+    ASSERT(exposition);
+    ASSERT(metrics);
+    uint32_t sequence = __atomic_load_n(&exposition->sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&exposition->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    exposition->snapshot.has_capture_stats = (capture_stats != NULL);
+    if (capture_stats) {
+        exposition->snapshot.capture_stats = *capture_stats;
+    }
+
+    exposition->snapshot.metrics = *metrics;
+    __atomic_store_n(&exposition->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void metrics_exposition_read(metrics_exposition_t *exposition, metrics_snapshot_t *snapshot) {
+    ASSERT(exposition);
+    ASSERT(snapshot);
+    for (;;) {
+        uint32_t sequence_before = __atomic_load_n(&exposition->sequence, __ATOMIC_ACQUIRE);
+        if (sequence_before & 1) {
+            continue;
+        }
+
+        memcpy(snapshot, &exposition->snapshot, sizeof(*snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&exposition->sequence, __ATOMIC_RELAXED) == sequence_before) {
+            return;
+        }
+    }
+}
+
+#endif
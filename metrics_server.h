@@ -0,0 +1,587 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Big enough for every message type and every histogram bucket. */
+#define METRICS_SERVER_MAX_RESPONSE_SIZE (1024 * 1024)
+#define METRICS_SERVER_MAX_REQUEST_SIZE 4096
+#define METRICS_SERVER_IO_TIMEOUT_SEC 2
+
+/* Buckets past this one (about 19 hours in nanoseconds) are only counted in +Inf. */
+#define METRICS_SERVER_MAX_HISTOGRAM_BUCKETS 46
+
+typedef struct {
+    char data[METRICS_SERVER_MAX_RESPONSE_SIZE];
+    char *p;
+} metrics_server_text_t;
+
+static void metrics_server_printf(metrics_server_text_t *text, const char *format, ...) {
+    size_t remaining = text->data + sizeof(text->data) - text->p;
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(text->p, remaining, format, args);
+    va_end(args);
+    if ((len > 0) && ((size_t)len < remaining)) {
+        text->p += len;
+    }
+}
+
+static void metrics_server_write_header(metrics_server_text_t *text, const char *name, const char *type, const char *help) {
+    metrics_server_printf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metrics_server_write_counter(metrics_server_text_t *text, const char *name, const char *help, uint64_t value) {
+    metrics_server_write_header(text, name, "counter", help);
+    metrics_server_printf(text, "%s %llu\n", name, (unsigned long long)value);
+}
+
+static void metrics_server_write_gauge(metrics_server_text_t *text, const char *name, const char *help, int64_t value) {
+    metrics_server_write_header(text, name, "gauge", help);
+    metrics_server_printf(text, "%s %lld\n", name, (long long)value);
+}
+
+/* One labelled series of a histogram, e.g. labels of database="shop",application="web", or "" for none.  Our
+   histograms are in nanoseconds but Prometheus wants seconds, unless the histogram is of a plain count. */
+static void metrics_server_write_histogram_series(metrics_server_text_t *text,
+                                                  const char *name,
+                                                  const char *labels,
+                                                  const histogram_t *histogram,
+                                                  bool is_nsec) {
+    const char *separator = ('\0' == labels[0]) ? "" : ",";
+    uint64_t cumulative_count = 0;
+    size_t i = 0;
+    for (; i < METRICS_SERVER_MAX_HISTOGRAM_BUCKETS; ++i) {
+        cumulative_count += histogram->buckets[i];
+        uint64_t upper_bound = histogram_bucket_upper_bound(i);
+        if (is_nsec) {
+            metrics_server_printf(text, "%s_bucket{%s%sle=\"%.9f\"} %llu\n",
+                                  name, labels, separator, upper_bound / 1e9, (unsigned long long)cumulative_count);
+        } else {
+            metrics_server_printf(text, "%s_bucket{%s%sle=\"%llu\"} %llu\n",
+                                  name, labels, separator, (unsigned long long)upper_bound, (unsigned long long)cumulative_count);
+        }
+    }
+
+    metrics_server_printf(text, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, separator, (unsigned long long)histogram->count);
+    const char *open = ('\0' == labels[0]) ? "" : "{";
+    const char *close = ('\0' == labels[0]) ? "" : "}";
+    if (is_nsec) {
+        metrics_server_printf(text, "%s_sum%s%s%s %.9f\n", name, open, labels, close, histogram->sum / 1e9);
+    } else {
+        metrics_server_printf(text, "%s_sum%s%s%s %llu\n", name, open, labels, close, (unsigned long long)histogram->sum);
+    }
+
+    metrics_server_printf(text, "%s_count%s%s%s %llu\n", name, open, labels, close, (unsigned long long)histogram->count);
+}
+
+static void metrics_server_write_histogram(metrics_server_text_t *text,
+                                           const char *name,
+                                           const char *help,
+                                           const histogram_t *histogram,
+                                           bool is_nsec) {
+    metrics_server_write_header(text, name, "histogram", help);
+    metrics_server_write_histogram_series(text, name, "", histogram, is_nsec);
+}
+
+/* Writes s as a label value, escaped as Prometheus wants, and returns the end. */
+static char *metrics_server_write_label_value(char *p, const char *s) {
+    for (; *s; ++s) {
+        if (('\\' == *s) || ('"' == *s)) {
+            *p++ = '\\';
+            *p++ = *s;
+        } else if ('\n' == *s) {
+            *p++ = '\\';
+            *p++ = 'n';
+        } else {
+            *p++ = *s;
+        }
+    }
+
+    return p;
+}
+
+static void metrics_server_write_breakdowns(metrics_server_text_t *text, const metrics_t *metrics) {
+    const char *name = "pgtrace_session_response_seconds";
+    metrics_server_write_header(text, name, "histogram", "pgtrace_response_seconds by database and application_name.");
+    size_t i = 0;
+    for (; i < metrics->num_breakdowns; ++i) {
+        const metrics_breakdown_t *breakdown = &metrics->breakdowns[i];
+        /* Room for both names with every character escaped. */
+        char labels[4 * SESSION_TAG_MAX_LENGTH + 64];
+        char *p = labels;
+        p += sprintf(p, "database=\"");
+        p = metrics_server_write_label_value(p, session_tags_name(&global_session_tags, breakdown->database_id));
+        p += sprintf(p, "\",application=\"");
+        p = metrics_server_write_label_value(p, session_tags_name(&global_session_tags, breakdown->application_id));
+        sprintf(p, "\"");
+        metrics_server_write_histogram_series(text, name, labels, &breakdown->response_nsec, true);
+    }
+}
+
+static void metrics_server_write_message_counts(metrics_server_text_t *text,
+                                                const char *sender,
+                                                const uint64_t *counts,
+                                                const char * const *names) {
+    size_t i = 0;
+    for (; i < 256; ++i) {
+        if (counts[i] > 0) {
+            metrics_server_printf(text, "pgtrace_messages_total{sender=\"%s\",type=\"%s\"} %llu\n",
+                                  sender, names[i], (unsigned long long)counts[i]);
+        }
+    }
+}
+
+static void metrics_server_write_memory(metrics_server_text_t *text, const memory_budget_t *memory) {
+    metrics_server_write_gauge(text, "pgtrace_memory_limit_bytes", "The -M memory limit, or 0 if there isn't one.",
+                               (int64_t)memory->limit_bytes);
+    metrics_server_write_header(text, "pgtrace_memory_used_bytes", "gauge", "Memory charged to the budget by subsystem.");
+    size_t i = 0;
+    for (; i < MEMORY_NUM_SUBSYSTEMS; ++i) {
+        metrics_server_printf(text, "pgtrace_memory_used_bytes{subsystem=\"%s\"} %llu\n",
+                              memory_subsystem_names[i], (unsigned long long)memory->used_bytes[i]);
+    }
+
+    metrics_server_write_gauge(text, "pgtrace_memory_level", "How much load is being shed to stay under the memory limit, from 0.",
+                               memory->level);
+    metrics_server_write_header(text, "pgtrace_memory_escalations_total", "counter", "Times that each load shedding step was taken.");
+    for (i = MEMORY_LEVEL_NORMAL + 1; i < MEMORY_NUM_LEVELS; ++i) {
+        metrics_server_printf(text, "pgtrace_memory_escalations_total{step=\"%s\"} %llu\n",
+                              memory_level_names[i], (unsigned long long)memory->num_escalations[i]);
+    }
+
+    metrics_server_write_counter(text, "pgtrace_memory_refused_allocations_total", "Allocations refused because of the memory limit.",
+                                 memory->num_refused_allocations);
+    metrics_server_write_counter(text, "pgtrace_memory_evicted_connections_total", "Idle connections forgotten to free their replay buffers.",
+                                 memory->num_evicted_connections);
+}
+
+static void metrics_server_write_bypass(metrics_server_text_t *text, const bypass_counts_t *bypass) {
+    const char *names[] = { "pgtrace_bypassed_connections_total", "pgtrace_bypassed_bytes_total" };
+    const char *helps[] = { "Connections that matched each -I rule and weren't parsed.", "Bytes on connections that weren't parsed, by -I rule." };
+    const uint64_t *counts[] = { bypass->num_connections, bypass->num_bytes };
+    if (!bypass_rules_is_enabled(&global_bypass_rules)) {
+        return;
+    }
+
+    size_t i = 0;
+    for (; i < 2; ++i) {
+        metrics_server_write_header(text, names[i], "counter", helps[i]);
+        size_t j = 0;
+        for (; j < global_bypass_rules.num_rules; ++j) {
+            const bypass_rule_t *rule = &global_bypass_rules.rules[j];
+            char value[2 * BYPASS_QUERY_PREFIX_SIZE + 1];
+            *metrics_server_write_label_value(value, rule->value) = '\0';
+            metrics_server_printf(text, "%s{rule=\"%zu\",match=\"%s\",value=\"%s\"} %llu\n",
+                                  names[i], j + 1, bypass_match_names[rule->match], value, (unsigned long long)counts[i][j]);
+        }
+    }
+}
+
+static void metrics_server_write_connection_setup(metrics_server_text_t *text, const connection_setup_stats_t *setup) {
+    metrics_server_write_counter(text, "pgtrace_connections_established_total",
+                                 "Connections that were seen to get to their first ReadyForQuery.", setup->num_established);
+    metrics_server_write_counter(text, "pgtrace_connection_setup_failures_total",
+                                 "Connections whose setup ended in an ErrorResponse.", setup->num_failed);
+    metrics_server_write_histogram(text, "pgtrace_connection_handshake_seconds",
+                                   "From a connection's SYN to the front-end's ACK of the SYN-ACK.", &setup->handshake_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_connection_startup_seconds",
+                                   "From the StartupMessage to the back-end's first Authentication message.",
+                                   &setup->startup_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_connection_auth_seconds",
+                                   "From the first Authentication request to AuthenticationOk.", &setup->auth_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_connection_auth_round_trips",
+                                   "Password, SASL or GSSAPI responses per authentication.", &setup->auth_round_trips, false);
+    metrics_server_write_histogram(text, "pgtrace_connection_ready_seconds",
+                                   "From AuthenticationOk to the first ReadyForQuery.", &setup->ready_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_connection_setup_seconds",
+                                   "From the SYN, or the StartupMessage if the SYN wasn't seen, to the first ReadyForQuery.",
+                                   &setup->total_nsec, true);
+}
+
+static void metrics_server_write_cancel(metrics_server_text_t *text, const cancel_stats_t *cancel) {
+    metrics_server_write_counter(text, "pgtrace_cancel_requests_total", "CancelRequests.", cancel->num_requests);
+    metrics_server_write_header(text, "pgtrace_cancels_total", "counter",
+                                "What became of CancelRequests, and statements cancelled without one (outcome=\"server\").");
+    size_t i = 0;
+    for (; i < CANCEL_NUM_OUTCOMES; ++i) {
+        metrics_server_printf(text, "pgtrace_cancels_total{outcome=\"%s\"} %llu\n",
+                              cancel_outcome_names[i], (unsigned long long)cancel->num_outcomes[i]);
+    }
+
+    metrics_server_write_histogram(text, "pgtrace_cancel_delay_seconds",
+                                   "From a CancelRequest to the cancelled statement's ErrorResponse.", &cancel->delay_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_cancelled_statement_seconds",
+                                   "From a cancelled statement being sent to its ErrorResponse.", &cancel->statement_nsec, true);
+}
+
+static void metrics_server_write_opaque(metrics_server_text_t *text, const opaque_stats_t *opaque) {
+    metrics_server_write_header(text, "pgtrace_encrypted_connections_total", "counter",
+                                "Connections that turned out to be encrypted, by how we could tell.");
+    size_t i = OPAQUE_REASON_NONE + 1;
+    for (; i < OPAQUE_NUM_REASONS; ++i) {
+        metrics_server_printf(text, "pgtrace_encrypted_connections_total{reason=\"%s\"} %llu\n",
+                              opaque_reason_names[i], (unsigned long long)opaque->num_connections[i]);
+    }
+
+    metrics_server_write_header(text, "pgtrace_encrypted_bytes_total", "counter", "Bytes on encrypted connections.");
+    metrics_server_printf(text, "pgtrace_encrypted_bytes_total{sender=\"fe\"} %llu\n", (unsigned long long)opaque->fe_bytes);
+    metrics_server_printf(text, "pgtrace_encrypted_bytes_total{sender=\"be\"} %llu\n", (unsigned long long)opaque->be_bytes);
+    metrics_server_write_counter(text, "pgtrace_encrypted_packets_total", "Packets on encrypted connections.", opaque->num_packets);
+    metrics_server_write_histogram(text, "pgtrace_encrypted_connection_duration_seconds",
+                                   "How long encrypted connections that were seen to end lasted.", &opaque->duration_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_encrypted_rtt_seconds",
+                                   "From a back-end segment on an encrypted connection to the front-end's ACK of it.",
+                                   &opaque->rtt_nsec, true);
+}
+
+/* A replica's application & port as labels. */
+static void metrics_server_write_replica_labels(char *labels, const replication_replica_t *replica) {
+    char *p = labels;
+    p += sprintf(p, "application=\"");
+    p = metrics_server_write_label_value(p, session_tags_name(&global_session_tags, replica->application_id));
+    sprintf(p, "\",port=\"%u\"", replica->fe_port);
+}
+
+/* A per-replica family, of the uint64_t at field_offset in each replica that's streaming. */
+static void metrics_server_write_replica_values(metrics_server_text_t *text,
+                                                const char *name,
+                                                const char *type,
+                                                const char *help,
+                                                const replication_stats_t *replication,
+                                                size_t field_offset) {
+    metrics_server_write_header(text, name, type, help);
+    size_t i = 0;
+    for (; i < REPLICATION_MAX_REPLICAS; ++i) {
+        const replication_replica_t *replica = &replication->replicas[i];
+        if (replica->is_active) {
+            /* Room for the name with every character escaped. */
+            char labels[2 * SESSION_TAG_MAX_LENGTH + 64];
+            metrics_server_write_replica_labels(labels, replica);
+            metrics_server_printf(text, "%s{%s} %llu\n", name, labels,
+                                  (unsigned long long)*(const uint64_t *)((const char *)replica + field_offset));
+        }
+    }
+}
+
+static void metrics_server_write_replication(metrics_server_text_t *text, const replication_stats_t *replication) {
+    metrics_server_write_counter(text, "pgtrace_replication_untracked_total",
+                                 "Replication connections that started streaming when there was no room to track them.",
+                                 replication->num_untracked);
+    metrics_server_write_replica_values(text, "pgtrace_replication_sent_lsn", "gauge",
+                                        "The end of the WAL sent to each streaming replica.",
+                                        replication, offsetof(replication_replica_t, sent_lsn));
+    metrics_server_write_replica_values(text, "pgtrace_replication_wal_bytes_total", "counter",
+                                        "WAL bytes sent to each streaming replica.",
+                                        replication, offsetof(replication_replica_t, num_wal_bytes));
+    metrics_server_write_replica_values(text, "pgtrace_replication_status_updates_total", "counter",
+                                        "Standby Status Updates from each streaming replica.",
+                                        replication, offsetof(replication_replica_t, num_status_updates));
+
+    metrics_server_write_header(text, "pgtrace_replication_lag_bytes", "gauge",
+                                "WAL sent to each streaming replica that it hasn't yet reported written, flushed or applied.");
+    size_t i = 0;
+    for (; i < REPLICATION_MAX_REPLICAS; ++i) {
+        const replication_replica_t *replica = &replication->replicas[i];
+        if (replica->is_active) {
+            char labels[2 * SESSION_TAG_MAX_LENGTH + 64];
+            metrics_server_write_replica_labels(labels, replica);
+            size_t j = 0;
+            for (; j < REPLICATION_NUM_POSITIONS; ++j) {
+                metrics_server_printf(text, "pgtrace_replication_lag_bytes{%s,position=\"%s\"} %llu\n", labels,
+                                      replication_position_names[j], (unsigned long long)replication_replica_lag_bytes(replica, j));
+            }
+        }
+    }
+
+    metrics_server_write_header(text, "pgtrace_replication_lag_seconds", "gauge",
+                                "From sending WAL to each streaming replica to it reporting it written, flushed or applied.");
+    for (i = 0; i < REPLICATION_MAX_REPLICAS; ++i) {
+        const replication_replica_t *replica = &replication->replicas[i];
+        if (replica->is_active) {
+            char labels[2 * SESSION_TAG_MAX_LENGTH + 64];
+            metrics_server_write_replica_labels(labels, replica);
+            size_t j = 0;
+            for (; j < REPLICATION_NUM_POSITIONS; ++j) {
+                metrics_server_printf(text, "pgtrace_replication_lag_seconds{%s,position=\"%s\"} %.9f\n", labels,
+                                      replication_position_names[j], replica->lag_nsec[j] / 1e9);
+            }
+        }
+    }
+}
+
+/* Renders the snapshot in the Prometheus text exposition format. */
+static void metrics_server_write_snapshot(metrics_server_text_t *text, const metrics_snapshot_t *snapshot) {
+    const metrics_t *metrics = &snapshot->metrics;
+    if (snapshot->has_capture_stats) {
+        metrics_server_write_counter(text, "pgtrace_capture_received_packets_total",
+                                     "Packets received by the capture (pcap ps_recv).", snapshot->capture_stats.ps_recv);
+        metrics_server_write_counter(text, "pgtrace_capture_dropped_packets_total",
+                                     "Packets dropped because the capture buffer was full (pcap ps_drop).",
+                                     snapshot->capture_stats.ps_drop);
+        metrics_server_write_counter(text, "pgtrace_capture_interface_dropped_packets_total",
+                                     "Packets dropped by the network interface (pcap ps_ifdrop).", snapshot->capture_stats.ps_ifdrop);
+    }
+
+    metrics_server_write_counter(text, "pgtrace_packets_total", "Packets processed.", metrics->num_packets);
+    metrics_server_write_counter(text, "pgtrace_truncated_packets_total", "TCP packets that the capture cut short, see -S.",
+                                 metrics->num_truncated_packets);
+    metrics_server_write_counter(text, "pgtrace_truncation_resyncs_total",
+                                 "Times that bytes lost to truncation weren't all in one message, so parsing started afresh.",
+                                 metrics->num_truncation_resyncs);
+    metrics_server_write_counter(text, "pgtrace_ring_records_total", "Messages published to the shared-memory ring, see -R.",
+                                 metrics->num_ring_records);
+    metrics_server_write_counter(text, "pgtrace_ring_truncated_payloads_total",
+                                 "Messages published to the shared-memory ring with only the start of their payload.",
+                                 metrics->num_ring_truncated_payloads);
+    metrics_server_write_counter(text, "pgtrace_rollup_blocks_total", "Blocks of rollups written, see -w.",
+                                 metrics->num_rollup_blocks);
+    metrics_server_write_counter(text, "pgtrace_rollup_rows_total", "Rollup rows written, one per series per interval.",
+                                 metrics->num_rollup_rows);
+    metrics_server_write_counter(text, "pgtrace_rollup_dropped_total",
+                                 "Rollup series and rows that didn't fit in their block or the memory budget.",
+                                 metrics->num_rollup_dropped);
+    metrics_server_write_counter(text, "pgtrace_trace_store_blocks_total", "Blocks written to the trace store, see -x.",
+                                 metrics->num_trace_store_blocks);
+    metrics_server_write_counter(text, "pgtrace_trace_store_records_total", "Messages written to the trace store.",
+                                 metrics->num_trace_store_records);
+    metrics_server_write_counter(text, "pgtrace_trace_store_raw_bytes_total",
+                                 "Bytes of trace store records before compression.", metrics->num_trace_store_raw_bytes);
+    metrics_server_write_counter(text, "pgtrace_trace_store_stored_bytes_total",
+                                 "Bytes of trace store blocks written, headers included.", metrics->num_trace_store_stored_bytes);
+
+    metrics_server_write_header(text, "pgtrace_messages_total", "counter", "Protocol messages by sender and type.");
+    metrics_server_write_message_counts(text, "fe", metrics->fe_message_counts, metrics->fe_message_names);
+    metrics_server_write_message_counts(text, "be", metrics->be_message_counts, metrics->be_message_names);
+
+    metrics_server_write_histogram(text, "pgtrace_response_seconds",
+                                   "From the first front-end message after a ReadyForQuery to the next ReadyForQuery.",
+                                   &metrics->response_nsec, true);
+    metrics_server_write_breakdowns(text, metrics);
+
+    metrics_server_write_counter(text, "pgtrace_transactions_total", "Explicit transactions that have ended.",
+                                 metrics->transactions.num_transactions);
+    metrics_server_write_counter(text, "pgtrace_aborted_transactions_total", "Explicit transactions that ended after failing.",
+                                 metrics->transactions.num_aborted_transactions);
+    metrics_server_write_histogram(text, "pgtrace_transaction_duration_seconds", "Duration of explicit transactions.",
+                                   &metrics->transactions.duration_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_transaction_statements", "Query and Execute messages per explicit transaction.",
+                                   &metrics->transactions.num_statements, false);
+    metrics_server_write_histogram(text, "pgtrace_idle_in_transaction_seconds",
+                                   "Time between a ReadyForQuery in a transaction and the front-end's next message.",
+                                   &metrics->transactions.idle_in_transaction_nsec, true);
+
+    metrics_server_write_histogram(text, "pgtrace_execute_seconds",
+                                   "From when the back-end could start on an Execute to the end of its result.",
+                                   &metrics->pipeline.execute_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_pipeline_depth", "Executes and Queries awaiting their results as each is sent.",
+                                   &metrics->pipeline.depth, false);
+    metrics_server_write_counter(text, "pgtrace_pipeline_desyncs_total",
+                                 "Responses that didn't match the oldest outstanding request.",
+                                 metrics->pipeline.num_desyncs);
+
+    metrics_server_write_histogram(text, "pgtrace_pooler_queue_seconds",
+                                   "From a client sending a statement to a pooler to the pooler sending it to the server.",
+                                   &metrics->pooler.queue_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_pooler_server_seconds", "Statement response times on connections to the server.",
+                                   &metrics->pooler.server_nsec, true);
+    metrics_server_write_histogram(text, "pgtrace_pooler_client_seconds", "Statement response times on connections to the pooler.",
+                                   &metrics->pooler.client_nsec, true);
+    metrics_server_write_counter(text, "pgtrace_pooler_matched_total", "Client statements that were matched with a server statement.",
+                                 metrics->pooler.num_matched);
+    metrics_server_write_counter(text, "pgtrace_pooler_unmatched_total", "Client statements that were never seen going to the server.",
+                                 metrics->pooler.num_unmatched);
+
+    metrics_server_write_counter(text, "pgtrace_connections_opened_total", "Connections that were seen to start.",
+                                 metrics->num_connections_opened);
+    metrics_server_write_counter(text, "pgtrace_connections_closed_total", "Connections that were seen to start and then end.",
+                                 metrics->num_connections_closed);
+    metrics_server_write_gauge(text, "pgtrace_connections_active", "Connections that were seen to start and haven't ended.",
+                               (int64_t)(metrics->num_connections_opened - metrics->num_connections_closed));
+    metrics_server_write_connection_setup(text, &metrics->connection_setup);
+    metrics_server_write_cancel(text, &metrics->cancel);
+
+    metrics_server_write_memory(text, &metrics->memory);
+    metrics_server_write_bypass(text, &metrics->bypass);
+    metrics_server_write_opaque(text, &metrics->opaque);
+    metrics_server_write_replication(text, &metrics->replication);
+
+    metrics_server_write_gauge(text, "pgtrace_trace_mode", "How much of each message is traced: 0 full, 1 headers, 2 aggregates only.",
+                               metrics->trace_mode);
+    metrics_server_write_header(text, "pgtrace_trace_mode_changes_total", "counter", "Times that each trace mode was entered under -a.");
+    size_t i = 0;
+    for (; i < TRACE_NUM_MODES; ++i) {
+        metrics_server_printf(text, "pgtrace_trace_mode_changes_total{mode=\"%s\"} %llu\n",
+                              trace_mode_names[i], (unsigned long long)metrics->overload.num_mode_changes[i]);
+    }
+}
+
+static bool metrics_server_send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += sent;
+        size -= sent;
+    }
+
+    return true;
+}
+
+/* Reads the request head.  The path is all that matters, and anything bigger than a request head is ignored. */
+static bool metrics_server_read_request(int fd, char *request, size_t request_size) {
+    size_t len = 0;
+    while (len < request_size - 1) {
+        ssize_t received = recv(fd, request + len, request_size - 1 - len, 0);
+        if (received < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            return false;
+        }
+
+        if (0 == received) {
+            break;
+        }
+
+        len += received;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) {
+            break;
+        }
+    }
+
+    request[len] = '\0';
+    return (len > 0);
+}
+
+/* Only touched by the metrics server thread. */
+metrics_server_text_t global_metrics_server_text;
+metrics_snapshot_t global_metrics_server_snapshot;
+
+static void metrics_server_serve(int fd) {
+    struct timeval timeout = { METRICS_SERVER_IO_TIMEOUT_SEC, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char request[METRICS_SERVER_MAX_REQUEST_SIZE];
+    if (!metrics_server_read_request(fd, request, sizeof(request))) {
+        return;
+    }
+
+    if ((strncmp(request, "GET /metrics ", 13) != 0) && (strncmp(request, "GET / ", 6) != 0)) {
+        const char *not_found = "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\n\r\nNot found\n";
+        metrics_server_send_all(fd, not_found, strlen(not_found));
+        return;
+    }
+
+    metrics_exposition_read(&global_metrics_exposition, &global_metrics_server_snapshot);
+    metrics_server_text_t *text = &global_metrics_server_text;
+    text->p = text->data;
+    metrics_server_write_snapshot(text, &global_metrics_server_snapshot);
+
+    char header[256];
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n",
+                              (size_t)(text->p - text->data));
+    if (metrics_server_send_all(fd, header, header_len)) {
+        metrics_server_send_all(fd, text->data, text->p - text->data);
+    }
+}
+
+static void *metrics_server_run(void *arg) {
+    int listen_fd = *(int *)arg;
+    for (;;) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (EINTR != errno) {
+                fprintf(stderr, PROGRAM_NAME ": metrics server accept failed, errno=%d\n", errno);
+                sleep(1);
+            }
+            continue;
+        }
+
+        metrics_server_serve(fd);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/* address is either the path of a Unix socket (anything with a '/' in it) or a TCP port on localhost. */
+static int metrics_server_listen(const char *address) {
+    ASSERT(address);
+    int fd;
+    if (strchr(address, '/')) {
+        struct sockaddr_un sun;
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(sun.sun_path)) {
+            FATAL("Metrics socket path is too long: %s", address);
+        }
+
+        strcpy(sun.sun_path, address);
+        unlink(address);
+        if (((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) || (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0)) {
+            FATAL("Can't bind metrics socket %s, errno=%d", address, errno);
+        }
+    } else {
+        char *end;
+        unsigned long port = strtoul(address, &end, 10);
+        if ((end == address) || (*end != '\0') || (0 == port) || (port > 0xffff)) {
+            FATAL("Invalid metrics port: %s", address);
+        }
+
+        struct sockaddr_in sin;
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_port = htons((uint16_t)port);
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        int reuse = 1;
+        if (((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+            (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) ||
+            (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) != 0)) {
+            FATAL("Can't bind metrics port %lu, errno=%d", port, errno);
+        }
+    }
+
+    if (listen(fd, 16) != 0) {
+        FATAL("Can't listen on metrics address %s, errno=%d", address, errno);
+    }
+
+    return fd;
+}
+
+int global_metrics_server_listen_fd = -1;
+
+static void metrics_server_start(const char *address) {
+    global_metrics_server_listen_fd = metrics_server_listen(address);
+
+    /* Signals are for the packet thread, so the server thread starts with them all blocked. */
+    sigset_t all_signals;
+    sigset_t old_signals;
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+
+    pthread_t thread;
+    int result = pthread_create(&thread, NULL, metrics_server_run, &global_metrics_server_listen_fd);
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+    if (result != 0) {
+        FATAL("pthread_create failed for the metrics server, result=%d", result);
+    }
+
+    pthread_detach(thread);
+    LOG("Metrics server listening on %s", address);
+}
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef OPAQUE_STATE_H
+#define OPAQUE_STATE_H
+
+/* A TLS record header is a content type (ChangeCipherSpec, Alert, Handshake or ApplicationData), a 3.x protocol
+   version and a length, which is at most 2^14 plus what compression or encryption may add. */
+#define OPAQUE_TLS_RECORD_HEADER_SIZE 5
+#define OPAQUE_TLS_RECORD_TYPE_MIN 0x14
+#define OPAQUE_TLS_RECORD_TYPE_MAX 0x17
+#define OPAQUE_TLS_MAJOR_VERSION 0x03
+#define OPAQUE_TLS_MAX_RECORD_LENGTH (16384 + 2048)
+
+/* The back-end's answers to an SSLRequest or GSSENCRequest that say that encryption follows. */
+#define OPAQUE_SSL_RESPONSE_YES 'S'
+#define OPAQUE_GSSENC_RESPONSE_YES 'G'
+#define OPAQUE_RESPONSE_NO 'N'
+
+/* How we know that a connection is encrypted. */
+typedef enum {
+    OPAQUE_REASON_NONE,
+    /* The back-end said yes to an SSLRequest. */
+    OPAQUE_REASON_SSL,
+    /* The back-end said yes to a GSSENCRequest. */
+    OPAQUE_REASON_GSSENC,
+    /* A TLS record where the front-end's first message should be, e.g. PG17's direct TLS. */
+    OPAQUE_REASON_TLS,
+    OPAQUE_NUM_REASONS,
+} opaque_reason_t;
+
+static const char * const opaque_reason_names[OPAQUE_NUM_REASONS] = { "", "ssl", "gssenc", "tls" };
+
+/* Encrypted connections, which are only counted and timed. */
+typedef struct {
+    uint64_t num_connections[OPAQUE_NUM_REASONS];
+    uint64_t fe_bytes;
+    uint64_t be_bytes;
+    uint64_t num_packets;
+    /* Of the connections that we saw end. */
+    histogram_t duration_nsec;
+    histogram_t rtt_nsec;
+} opaque_stats_t;
+
+/* One connection's encryption, and what's kept about it once it's encrypted. */
+typedef struct {
+    /* The front-end has asked to encrypt, and the back-end hasn't answered yet. */
+    opaque_reason_t requested_reason;
+    /* The front-end's next bytes are its first since we saw the connection start, or its first after an
+       SSLResponseYes, so they may be a TLS record.  Nowhere else is checked, a resync can land anywhere. */
+    bool is_tls_possible;
+    opaque_reason_t reason;
+    uint64_t start_nsec;
+    uint64_t fe_bytes;
+    uint64_t be_bytes;
+    uint64_t num_packets;
+    /* One back-end segment at a time is timed until the front-end acknowledges it, which is a round trip as seen from
+       where we're capturing, delayed ACKs and all. */
+    bool is_timing;
+    uint32_t timed_seq;
+    uint64_t timed_nsec;
+    /* Smoothed like TCP's SRTT.  0 until there's a sample. */
+    uint64_t srtt_nsec;
+} opaque_connection_t;
+
+static void opaque_stats_init(opaque_stats_t *stats) {
+    ASSERT(stats);
+    memset(stats, 0, sizeof(*stats));
+    histogram_init(&stats->duration_nsec);
+    histogram_init(&stats->rtt_nsec);
+}
+
+static void opaque_connection_init(opaque_connection_t *connection) {
+    ASSERT(connection);
+    memset(connection, 0, sizeof(*connection));
+}
+
+static inline bool opaque_connection_is_opaque(const opaque_connection_t *connection) {
+    return connection->reason != OPAQUE_REASON_NONE;
+}
+
+/* Whether bytes start with a TLS record header.  A header that's split across segments isn't recognised. */
+static inline bool opaque_is_tls_record_header(const uint8_t *bytes, size_t num_bytes) {
+    if (num_bytes < OPAQUE_TLS_RECORD_HEADER_SIZE) {
+        return false;
+    }
+
+    uint32_t length = ((uint32_t)bytes[3] << 8) | bytes[4];
+    return (bytes[0] >= OPAQUE_TLS_RECORD_TYPE_MIN) && (bytes[0] <= OPAQUE_TLS_RECORD_TYPE_MAX) &&
+           (OPAQUE_TLS_MAJOR_VERSION == bytes[1]) && (length <= OPAQUE_TLS_MAX_RECORD_LENGTH);
+}
+
+/* Returns the round trip that the packet completes, or 0. */
+static inline uint64_t opaque_connection_on_packet(opaque_connection_t *connection,
+                                                   bool is_from_be,
+                                                   uint32_t seq,
+                                                   uint32_t ack,
+                                                   bool has_ack,
+                                                   size_t size_payload) {
+    connection->num_packets++;
+    if (is_from_be) {
+        if ((size_payload > 0) && !connection->is_timing) {
+            connection->is_timing = true;
+            connection->timed_seq = seq + size_payload;
+            connection->timed_nsec = now_epoch_nsec();
+        }
+        return 0;
+    }
+
+    if (!connection->is_timing || !has_ack || ((int32_t)(ack - connection->timed_seq) < 0)) {
+        return 0;
+    }
+
+    connection->is_timing = false;
+    uint64_t rtt_nsec = now_epoch_nsec() - connection->timed_nsec;
+    connection->srtt_nsec = (0 == connection->srtt_nsec) ? rtt_nsec : (7 * connection->srtt_nsec + rtt_nsec) / 8;
+    return rtt_nsec;
+}
+
+static void opaque_connection_print_start(const opaque_connection_t *connection, uint16_t fe_port) {
+    const char *reason = opaque_reason_names[connection->reason];
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_uint_field(&writer, "port", fe_port);
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"Encrypted\"");
+        message_json_writer_write_string_field(&writer, "reason", (const uint8_t *)reason, strlen(reason));
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    LOG("Connection is encrypted, not parsing it.  fe_port=%u reason=%s", fe_port, reason);
+}
+
+static void opaque_connection_print_end(const opaque_connection_t *connection, uint16_t fe_port, uint64_t duration_nsec) {
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_uint_field(&writer, "port", fe_port);
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"EncryptedEnd\"");
+        message_json_writer_write_uint_field(&writer, "duration_nsec", duration_nsec);
+        message_json_writer_write_uint_field(&writer, "fe_bytes", connection->fe_bytes);
+        message_json_writer_write_uint_field(&writer, "be_bytes", connection->be_bytes);
+        message_json_writer_write_uint_field(&writer, "packets", connection->num_packets);
+        message_json_writer_write_uint_field(&writer, "srtt_nsec", connection->srtt_nsec);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    LOG("Encrypted connection ended.  fe_port=%u duration_usec=%llu fe_bytes=%llu be_bytes=%llu packets=%llu srtt_usec=%llu",
+        fe_port, (unsigned long long)duration_nsec / 1000, (unsigned long long)connection->fe_bytes,
+        (unsigned long long)connection->be_bytes, (unsigned long long)connection->num_packets,
+        (unsigned long long)connection->srtt_nsec / 1000);
+}
+
+#endif
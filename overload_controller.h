@@ -0,0 +1,147 @@
+#ifndef OVERLOAD_CONTROLLER_H
+#define OVERLOAD_CONTROLLER_H
+
+/* A capture that's lagging the wall clock by this much has this much waiting in the kernel's ring. */
+#define OVERLOAD_MAX_CAPTURE_LAG_NSEC (1000 * (uint64_t)1000000)
+
+/* The percentage of the output pipe that's unread when its reader is falling behind. */
+#define OVERLOAD_MAX_OUTPUT_FILL_PERCENT 75
+
+/* Below these, i.e. half of the maxima, with no drops, things are calm.  In between, the mode is kept. */
+#define OVERLOAD_CALM_CAPTURE_LAG_NSEC (OVERLOAD_MAX_CAPTURE_LAG_NSEC / 2)
+#define OVERLOAD_CALM_OUTPUT_FILL_PERCENT 25
+
+/* How many checks in a row have to be calm before stepping back up to a fuller mode. */
+#define OVERLOAD_NUM_CALM_CHECKS 30
+
+/* How much of each message is traced.  Everything is still parsed and counted in all of them. */
+typedef enum {
+    TRACE_MODE_FULL,
+    /* Each message's line, without its payload. */
+    TRACE_MODE_HEADERS,
+    /* No per-message output, just the summaries and metrics. */
+    TRACE_MODE_AGGREGATES,
+    TRACE_NUM_MODES,
+} trace_mode_t;
+
+static const char * const trace_mode_names[TRACE_NUM_MODES] = { "full", "headers", "aggregates" };
+
+ENGINE_STATE(trace_mode_t, global_trace_mode);
+#define global_trace_mode ENGINE_STATE_OF(global_trace_mode)
+
+static inline bool trace_mode_is_tracing_messages() {
+    return global_trace_mode != TRACE_MODE_AGGREGATES;
+}
+
+/* What the controller saw at one check.  A signal that can't be measured is 0. */
+typedef struct {
+    uint64_t num_dropped_packets;
+    uint64_t capture_lag_nsec;
+    uint64_t output_fill_percent;
+} overload_signals_t;
+
+/* Steps the trace mode down when the capture or the output is falling behind, and back up once they've been calm for
+   a while. */
+typedef struct {
+    bool is_enabled;
+    bool has_ps_drop;
+    u_int last_ps_drop;
+    size_t num_calm_checks;
+    /* How many times each mode has been entered. */
+    uint64_t num_mode_changes[TRACE_NUM_MODES];
+} overload_controller_t;
+
+ENGINE_STATE(overload_controller_t, global_overload_controller);
+#define global_overload_controller ENGINE_STATE_OF(global_overload_controller)
+
+static void overload_controller_init(overload_controller_t *controller, bool is_enabled) {
+    ASSERT(controller);
+    memset(controller, 0, sizeof(*controller));
+    controller->is_enabled = is_enabled;
+    global_trace_mode = TRACE_MODE_FULL;
+}
+
+/* ps_drop is pcap's cumulative count, which wraps. */
+static uint64_t overload_controller_on_ps_drop(overload_controller_t *controller, u_int ps_drop) {
+    u_int num_dropped = controller->has_ps_drop ? ps_drop - controller->last_ps_drop : 0;
+    controller->has_ps_drop = true;
+    controller->last_ps_drop = ps_drop;
+    return num_dropped;
+}
+
+static void overload_controller_print_mode_change(trace_mode_t from, const char *reason, const overload_signals_t *signals) {
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"TraceMode\"");
+        message_json_writer_write_string_field(&writer, "mode", (const uint8_t *)trace_mode_names[global_trace_mode],
+                                               strlen(trace_mode_names[global_trace_mode]));
+        message_json_writer_write_string_field(&writer, "from", (const uint8_t *)trace_mode_names[from], strlen(trace_mode_names[from]));
+        message_json_writer_write_string_field(&writer, "reason", (const uint8_t *)reason, strlen(reason));
+        message_json_writer_write_uint_field(&writer, "dropped_packets", signals->num_dropped_packets);
+        message_json_writer_write_uint_field(&writer, "capture_lag_nsec", signals->capture_lag_nsec);
+        message_json_writer_write_uint_field(&writer, "output_fill_percent", signals->output_fill_percent);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+    }
+
+    LOG("Trace mode changed from %s to %s because %s.  dropped_packets=%llu capture_lag_nsec=%llu output_fill_percent=%llu",
+        trace_mode_names[from], trace_mode_names[global_trace_mode], reason,
+        (unsigned long long)signals->num_dropped_packets,
+        (unsigned long long)signals->capture_lag_nsec,
+        (unsigned long long)signals->output_fill_percent);
+}
+
+static void overload_controller_set_mode(overload_controller_t *controller,
+                                         trace_mode_t mode,
+                                         const char *reason,
+                                         const overload_signals_t *signals) {
+    trace_mode_t from = global_trace_mode;
+    global_trace_mode = mode;
+    controller->num_mode_changes[mode]++;
+    controller->num_calm_checks = 0;
+    overload_controller_print_mode_change(from, reason, signals);
+}
+
+/* Called about once a second.  Returns true if the mode changed. */
+static bool overload_controller_check(overload_controller_t *controller, const overload_signals_t *signals) {
+    ASSERT(controller);
+    ASSERT(signals);
+    const char *reason = NULL;
+    if (signals->num_dropped_packets > 0) {
+        reason = "the capture dropped packets";
+    } else if (signals->capture_lag_nsec > OVERLOAD_MAX_CAPTURE_LAG_NSEC) {
+        reason = "the capture is lagging";
+    } else if (signals->output_fill_percent > OVERLOAD_MAX_OUTPUT_FILL_PERCENT) {
+        reason = "the output isn't being read fast enough";
+    }
+
+    if (reason) {
+        controller->num_calm_checks = 0;
+        if (global_trace_mode + 1 < TRACE_NUM_MODES) {
+            overload_controller_set_mode(controller, global_trace_mode + 1, reason, signals);
+            return true;
+        }
+
+        return false;
+    }
+
+    if ((signals->capture_lag_nsec >= OVERLOAD_CALM_CAPTURE_LAG_NSEC) ||
+        (signals->output_fill_percent >= OVERLOAD_CALM_OUTPUT_FILL_PERCENT)) {
+        controller->num_calm_checks = 0;
+        return false;
+    }
+
+    if ((global_trace_mode > TRACE_MODE_FULL) && (++controller->num_calm_checks >= OVERLOAD_NUM_CALM_CHECKS)) {
+        overload_controller_set_mode(controller, global_trace_mode - 1, "it has been calm", signals);
+        return true;
+    }
+
+    return false;
+}
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef PACKET_PROCESSOR_H
+#define PACKET_PROCESSOR_H
+
+/* Turns captured packets into calls on the state machine, for pgtrace and for libpgtrace. */
+
+/* Big enough for GRO & TSO super-segments, which can be well over 64KB, and the most that libpcap allows. */
+#define DEFAULT_SNAPLEN (256 * 1024)
+
+/* Ethernet header */
+struct sniff_ethernet {
+    u_char  ether_dhost[6];    /* destination host address */
+    u_char  ether_shost[6];    /* source host address */
+    u_short ether_type;        /* IP? ARP? RARP? etc */
+};
+
+/* IP header */
+struct sniff_ip {
+    u_char  ip_vhl;                   /* version << 4 | header length >> 2 */
+    u_char  ip_tos;                   /* type of service */
+    u_short ip_len;                   /* total length */
+    u_short ip_id;                    /* identification */
+    u_short ip_off;                   /* fragment offset field */
+#define PACKET_CAPTURE_SNIFF_IP_RF 0x8000 /* reserved fragment flag */
+#define PACKET_CAPTURE_SNIFF_IP_DF 0x4000 /* dont fragment flag */
+#define PACKET_CAPTURE_SNIFF_IP_MF 0x2000 /* more fragments flag */
+#define PACKET_CAPTURE_SNIFF_IP_OFFMASK 0x1fff /* mask for fragmenting bits */
+    u_char  ip_ttl;                   /* time to live */
+    u_char  ip_p;                     /* protocol */
+    u_short ip_sum;                   /* checksum */
+    struct  in_addr ip_src,ip_dst;    /* source and dest address */
+};
+
+#define PACKET_CAPTURE_IP_HL(ip)               (((ip)->ip_vhl) & 0x0f)
+#define PACKET_CAPTURE_IP_V(ip)                (((ip)->ip_vhl) >> 4)
+
+/* TCP header */
+typedef u_int tcp_seq;
+
+struct sniff_tcp {
+    u_short th_sport;               /* source port */
+    u_short th_dport;               /* destination port */
+    tcp_seq th_seq;                 /* sequence number */
+    tcp_seq th_ack;                 /* acknowledgement number */
+    u_char  th_offx2;               /* data offset, rsvd */
+#define PACKET_CAPTURE_TH_OFF(th)      (((th)->th_offx2 & 0xf0) >> 4)
+    u_char  th_flags;
+#define PACKET_CAPTURE_TH_FIN  0x01
+#define PACKET_CAPTURE_TH_SYN  0x02
+#define PACKET_CAPTURE_TH_RST  0x04
+#define PACKET_CAPTURE_TH_PUSH 0x08
+#define PACKET_CAPTURE_TH_ACK  0x10
+#define PACKET_CAPTURE_TH_URG  0x20
+#define PACKET_CAPTURE_TH_ECE  0x40
+#define PACKET_CAPTURE_TH_CWR  0x80
+    u_short th_win;                 /* window */
+    u_short th_sum;                 /* checksum */
+    u_short th_urp;                 /* urgent pointer */
+};
+
+ENGINE_STATE(tcp_state_t, global_tcp_state);
+#define global_tcp_state ENGINE_STATE_OF(global_tcp_state)
+
+ENGINE_STATE(interval_timer_t, global_summary_timer);
+#define global_summary_timer ENGINE_STATE_OF(global_summary_timer)
+ENGINE_STATE(interval_timer_t, global_eviction_timer);
+#define global_eviction_timer ENGINE_STATE_OF(global_eviction_timer)
+
+/* Prints each of the periodic summaries and starts counting afresh. */
+static void print_summaries() {
+    error_stats_print_summary(&global_error_stats, stdout);
+    error_stats_reset(&global_error_stats);
+    transaction_stats_print_summary(&global_transaction_stats, stdout);
+    transaction_stats_init(&global_transaction_stats);
+    pipeline_stats_print_summary(&global_pipeline_stats, stdout);
+    pipeline_stats_init(&global_pipeline_stats);
+    connection_setup_stats_print_summary(&global_connection_setup_stats, global_summary_timer.interval_usec * 1000, stdout);
+    connection_setup_stats_init(&global_connection_setup_stats);
+    if (pooler_is_enabled(&global_pooler)) {
+        pooler_stats_print_summary(&global_pooler_stats, stdout);
+        pooler_stats_init(&global_pooler_stats);
+    }
+    replication_stats_print_summary(&global_metrics.replication, stdout);
+    top_statements_print(&global_top_statements, stdout);
+}
+
+
+static void evict_idle_connections() {
+    uint32_t fe_port = 0;
+    for (; fe_port < 0xffff; ++fe_port) {
+        if (state_machine_is_idle(fe_port, MEMORY_BUDGET_IDLE_NSEC)) {
+            state_machine_evict(fe_port);
+            tcp_state_forget(&global_tcp_state, fe_port);
+            global_memory_budget.num_evicted_connections++;
+        }
+    }
+}
+
+/* The most of each payload that the trace mode allows. */
+static void update_max_trace_payload_size() {
+    global_max_trace_payload_size = (TRACE_MODE_FULL == global_trace_mode) ? SIZE_MAX : 0;
+}
+
+/* Sheds whatever the memory budget's level says to, see memory_budget.h.  Rollups are flushed by the rollup writer
+   itself. */
+static void apply_memory_level() {
+    memory_level_t level = global_memory_budget.level;
+    bool is_changed = (level != global_memory_budget.applied_level);
+    if (is_changed) {
+        if (level >= MEMORY_LEVEL_DROP_REASSEMBLY) {
+            state_machine_drop_reassembly();
+        }
+
+        global_memory_budget.applied_level = level;
+    }
+
+    if ((level >= MEMORY_LEVEL_EVICT_IDLE) && (interval_timer_is_due(&global_eviction_timer, now_epoch_usec()) || is_changed)) {
+        evict_idle_connections();
+    }
+}
+
+
+/* The parts of a packet that the protocol step needs. */
+typedef struct {
+    struct timeval ts;
+    /* Only TCP packets with sane headers go any further than counting and the timers. */
+    bool is_tcp;
+    /* In host order. */
+    uint32_t source_address;
+    uint32_t dest_address;
+    uint16_t source_port;
+    uint16_t dest_port;
+    tcp_seq seq;
+    tcp_seq ack;
+    u_short window;
+    u_char flags;
+    const u_char *payload;
+    /* On the wire, which is what the sequence numbers count. */
+    int size_payload;
+    /* What the capture kept, which is less than size_payload if the packet was cut short by the snaplen. */
+    int size_captured;
+} decoded_packet_t;
+
+/* Packets are taken a batch at a time, like DPDK takes bursts.  Each packet's headers are decoded and its connection's
+   state is prefetched as it's added, and the protocol step is run over the whole batch afterwards, so the state has
+   had time to arrive from memory.  pcap reuses its buffers, so the packets are copied. */
+#define PACKET_BATCH_SIZE 32
+#define PACKET_BATCH_DATA_SIZE DEFAULT_SNAPLEN
+
+typedef struct {
+    decoded_packet_t packets[PACKET_BATCH_SIZE];
+    size_t num_packets;
+    u_char data[PACKET_BATCH_DATA_SIZE];
+    size_t data_size;
+} packet_batch_t;
+
+ENGINE_STATE(packet_batch_t, global_packet_batch);
+#define global_packet_batch ENGINE_STATE_OF(global_packet_batch)
+
+/* Returns false if the packet isn't TCP or is malformed.  wire_len is the packet's length before it was captured. */
+static bool decode_packet(const u_char *packet, bpf_u_int32 caplen, bpf_u_int32 wire_len, decoded_packet_t *decoded) {
+    /* declare pointers to packet headers */
+    const struct sniff_ip *ip;              /* The IP header */
+    const struct sniff_tcp *tcp;            /* The TCP header */
+
+    int size_ip;
+    int size_tcp;
+
+    /* define/compute ip header offset */
+    ASSERT(sizeof(struct sniff_ethernet) == 14);
+    if (caplen < sizeof(struct sniff_ethernet) + 20) {
+        return false;
+    }
+
+    ip = (struct sniff_ip*)(packet + sizeof(struct sniff_ethernet));
+    size_ip = PACKET_CAPTURE_IP_HL(ip)*4;
+    if (size_ip < 20) {
+        // Invalid IP header length.
+        return false;
+    }
+
+    if (caplen < sizeof(struct sniff_ethernet) + size_ip + 20) {
+        return false;
+    }
+
+    /* determine protocol */
+    switch (ip->ip_p) {
+        case IPPROTO_TCP:
+          break;
+  
+        case IPPROTO_UDP:
+          // Not supported yet (HTTP/3?!)
+          return false;
+  
+        case IPPROTO_ICMP:
+        case IPPROTO_IP:
+        default:
+          return false;
+    }
+
+    /* OK, this packet is TCP. */
+    /* define/compute tcp header offset */
+    tcp = (struct sniff_tcp*)(packet + sizeof(struct sniff_ethernet) + size_ip);
+    size_tcp = PACKET_CAPTURE_TH_OFF(tcp)*4;
+    if (size_tcp < 20) {
+        // Invalid TCP header length.
+        return false;
+    }
+
+    /* NOTE that this code doesn't support ipv6. */
+    decoded->source_address = ntohl(ip->ip_src.s_addr);
+    decoded->dest_address = ntohl(ip->ip_dst.s_addr);
+    decoded->source_port = ntohs(tcp->th_sport);
+    decoded->dest_port = ntohs(tcp->th_dport);
+
+    /* define/compute tcp payload (segment) offset */
+    decoded->payload = (u_char *)(packet + sizeof(struct sniff_ethernet) + size_ip + size_tcp);
+
+    /* compute tcp payload (segment) size */
+    int headers_size = sizeof(struct sniff_ethernet) + size_ip + size_tcp;
+    if (0 == ip->ip_len) {
+        /* A GRO or TSO super-segment that's too big for ip_len, so it's left at 0. */
+        decoded->size_payload = (int)wire_len - headers_size;
+    } else {
+        decoded->size_payload = ntohs(ip->ip_len) - (size_ip + size_tcp);
+    }
+
+    if (decoded->size_payload < 0) {
+        /* ip_len is invalid. */        
+        return false;
+    }
+
+    /* The copy in the batch stops at caplen, and the rest is left to process_packet. */
+    int size_captured = (caplen > (bpf_u_int32)headers_size) ? (int)caplen - headers_size : 0;
+    decoded->size_captured = (size_captured < decoded->size_payload) ? size_captured : decoded->size_payload;
+
+    decoded->seq = ntohl(tcp->th_seq);
+    decoded->ack = ntohl(tcp->th_ack);
+    decoded->window = ntohs(tcp->th_win);
+    decoded->flags = tcp->th_flags;
+    return true;
+}
+
+/* The server's port, or the pooler's if we're watching one, since the pooler is the back-end to its clients. */
+static inline bool is_be_port(uint16_t port) {
+    return (5432 == port) || (pooler_is_enabled(&global_pooler) && (port == global_pooler.port));
+}
+
+/* Gets the memory that the protocol step is going to need for the packet on its way. */
+static inline void prefetch_packet_state(const decoded_packet_t *decoded) {
+    uint16_t fe_port = is_be_port(decoded->source_port) ? decoded->dest_port : decoded->source_port;
+    connection_state_t *state = get_connection_state(fe_port);
+    __builtin_prefetch(&global_tcp_state.fe[fe_port], 1);
+    __builtin_prefetch(&global_tcp_state.be[fe_port], 1);
+    __builtin_prefetch(state, 1);
+    __builtin_prefetch(&state->fe, 1);
+    __builtin_prefetch(&state->be, 1);
+    if (decoded->size_captured > 0) {
+        __builtin_prefetch(decoded->payload);
+    }
+}
+
+/* The protocol step for one packet. */
+static void process_packet(const decoded_packet_t *decoded) {
+    set_now(&decoded->ts);
+    if (global_checkpoint.is_pending) {
+        checkpoint_on_first_packet(&global_checkpoint, &global_tcp_state);
+    }
+
+    if (interval_timer_is_due(&global_summary_timer, now_epoch_usec())) {
+        print_summaries();
+    }
+
+    if (rollup_writer_is_enabled(&global_rollup_writer)) {
+        rollup_writer_on_time(&global_rollup_writer, now_epoch_nsec());
+    }
+
+    if (trace_store_is_enabled(&global_trace_store)) {
+        trace_store_on_time(&global_trace_store, now_epoch_nsec());
+    }
+
+    if (memory_budget_is_limited(&global_memory_budget)) {
+        apply_memory_level();
+    }
+    
+    global_metrics.num_packets++;
+    if (!decoded->is_tcp) {
+        return;
+    }
+
+    uint16_t source_port = decoded->source_port;
+    uint16_t dest_port = decoded->dest_port;
+    tcp_seq seq = decoded->seq;
+    tcp_seq ack = decoded->ack;
+    u_short window = decoded->window;
+    int size_payload = decoded->size_payload;
+    LOG("source_port=%u dest_port=%u seq=%u ack=%u window=%u size_payload=%d flags=0x%02x",
+        source_port, dest_port, seq, ack, window, size_payload, decoded->flags); 
+    
+    const u_char *payload_end = decoded->payload + decoded->size_captured;
+    size_t num_lost = size_payload - decoded->size_captured;
+    if (num_lost > 0) {
+        global_metrics.num_truncated_packets++;
+    }
+
+    const u_char *payload_p = decoded->payload;
+    /*TODO: a fancier means of figuring out who the server is. */
+    bool is_from_be = is_be_port(source_port);
+    state_machine_on_packet(is_from_be ? dest_port : source_port, is_from_be, seq, ack,
+                            (decoded->flags & PACKET_CAPTURE_TH_ACK) != 0, size_payload);
+    bool is_address_matched = bypass_rules_has_match(&global_bypass_rules, BYPASS_MATCH_CIDR);
+    if (message_sink_is_enabled(&global_message_sink)) {
+        message_sink_on_segment(&global_message_sink, payload_p,
+                                is_from_be ? decoded->dest_address : decoded->source_address,
+                                is_from_be ? decoded->source_address : decoded->dest_address,
+                                is_from_be ? source_port : dest_port);
+    }
+
+    if ((decoded->flags & (PACKET_CAPTURE_TH_FIN | PACKET_CAPTURE_TH_RST)) != 0) {
+        state_machine_on_connection_close(is_from_be ? dest_port : source_port);
+    }
+    
+    if (is_from_be) {
+        if ((decoded->flags & PACKET_CAPTURE_TH_SYN) != 0) {
+            /* It's the first packet in a connection. */
+            tcp_state_set_be_seq_range(&global_tcp_state, dest_port, seq, 0);
+            state_machine_on_syn_ack(dest_port);
+        }
+        
+        if (is_address_matched) {
+            state_machine_on_client_address(dest_port, decoded->dest_address);
+        }
+
+        checkpoint_check_be_packet(&global_checkpoint, &global_tcp_state, dest_port, seq, size_payload);
+        if (tcp_state_is_be_packet_in_sequence(&global_tcp_state, dest_port, seq, size_payload)) {
+            while (payload_p < payload_end) {
+                payload_p += state_machine_be_next(source_port, dest_port, payload_p, payload_end - payload_p, size_payload, stdout);
+            }
+
+            if (num_lost > 0) {
+                state_machine_be_lost(dest_port, num_lost, stdout);
+            }
+        }
+        
+        if ((decoded->flags & PACKET_CAPTURE_TH_ACK) != 0) {
+            tcp_state_set_fe_seq_range(&global_tcp_state, dest_port, ack, window);
+        }
+    } else {
+        if ((decoded->flags & PACKET_CAPTURE_TH_SYN) != 0) {
+            /* It's the first packet in a connection. */
+            tcp_state_set_fe_seq_range(&global_tcp_state, source_port, seq, 0);
+            state_machine_on_connection_open(source_port);
+            checkpoint_on_connection_open(&global_checkpoint, source_port);
+        }
+        
+        /* After the SYN, which starts the connection afresh. */
+        if (is_address_matched) {
+            state_machine_on_client_address(source_port, decoded->source_address);
+        }
+
+        checkpoint_check_fe_packet(&global_checkpoint, &global_tcp_state, source_port, seq, size_payload);
+        if (tcp_state_is_fe_packet_in_sequence(&global_tcp_state, source_port, seq, size_payload)) {
+            while (payload_p < payload_end) {
+                payload_p += state_machine_fe_next(source_port, dest_port, payload_p, payload_end - payload_p, size_payload, stdout);
+            }
+
+            if (num_lost > 0) {
+                state_machine_fe_lost(source_port, num_lost, stdout);
+            }
+        }
+        
+        if ((decoded->flags & PACKET_CAPTURE_TH_ACK) != 0) {
+            tcp_state_set_be_seq_range(&global_tcp_state, source_port, ack, window);
+        }
+    }
+}
+
+/* Runs the protocol step over the batch so far. */
+static void flush_packet_batch(packet_batch_t *batch) {
+    size_t i = 0;
+    for (; i < batch->num_packets; ++i) {
+        process_packet(&batch->packets[i]);
+    }
+
+    batch->num_packets = 0;
+    batch->data_size = 0;
+}
+
+/* The next bytes of a connection's stream in one direction, in order and without gaps, for callers that do their own
+   TCP reassembly.  The time must already be set. */
+static void on_segment(const pgtrace_connection_key_t *key, bool is_from_be, const uint8_t *bytes, size_t size) {
+    ASSERT(key);
+    state_machine_on_packet(key->fe_port, is_from_be, 0, 0, false, size);
+    message_sink_on_segment(&global_message_sink, bytes, key->fe_address, key->be_address, key->be_port);
+    const uint8_t *p = bytes;
+    const uint8_t *end = bytes + size;
+    while (p < end) {
+        if (is_from_be) {
+            p += state_machine_be_next(key->be_port, key->fe_port, p, end - p, size, stdout);
+        } else {
+            p += state_machine_fe_next(key->fe_port, key->be_port, p, end - p, size, stdout);
+        }
+    }
+}
+
+static void on_packet(u_char *ctx_uc, const struct pcap_pkthdr *header, const u_char *packet) {
+    packet_batch_t *batch = &global_packet_batch;
+    bpf_u_int32 caplen = (header->caplen < PACKET_BATCH_DATA_SIZE) ? header->caplen : PACKET_BATCH_DATA_SIZE;
+    if ((PACKET_BATCH_SIZE == batch->num_packets) || (batch->data_size + caplen > PACKET_BATCH_DATA_SIZE)) {
+        flush_packet_batch(batch);
+    }
+
+    u_char *data = batch->data + batch->data_size;
+    memcpy(data, packet, caplen);
+    batch->data_size += caplen;
+
+    decoded_packet_t *decoded = &batch->packets[batch->num_packets++];
+    decoded->ts = header->ts;
+    decoded->is_tcp = decode_packet(data, caplen, header->len, decoded);
+    if (decoded->is_tcp) {
+        prefetch_packet_state(decoded);
+    }
+}
+
+#endif
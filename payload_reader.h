@@ -0,0 +1,86 @@
+#ifndef PAYLOAD_READER_H
+#define PAYLOAD_READER_H
+
+/* Reads protocol fields out of a (possibly truncated) message payload.  Every read fails rather than running off
+   the end, so a decoder can emit whatever it managed to get before the truncation point. */
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} payload_reader_t;
+
+static void payload_reader_init(payload_reader_t *reader, const uint8_t *payload, size_t payload_size) {
+    ASSERT(reader);
+    reader->p = payload;
+    reader->end = payload + payload_size;
+}
+
+static inline bool payload_reader_is_at_end(const payload_reader_t *reader) {
+    return reader->p >= reader->end;
+}
+
+/* Finds the next NUL-terminated string.  If there's no NUL before the end then the string is returned anyway, and
+   false says that it's incomplete. */
+static inline bool payload_reader_read_cstring(payload_reader_t *reader, const uint8_t **str, size_t *str_len) {
+    ASSERT(reader);
+    ASSERT(str);
+    ASSERT(str_len);
+
+    *str = reader->p;
+    const uint8_t *nul = memchr(reader->p, '\0', reader->end - reader->p);
+    if (!nul) {
+        *str_len = reader->end - reader->p;
+        reader->p = reader->end;
+        return false;
+    }
+
+    *str_len = nul - reader->p;
+    reader->p = nul + 1;
+    return true;
+}
+
+static inline bool payload_reader_read_byte(payload_reader_t *reader, uint8_t *value) {
+    ASSERT(reader);
+    if (reader->p >= reader->end) {
+        return false;
+    }
+
+    *value = *reader->p++;
+    return true;
+}
+
+static inline bool payload_reader_read_int16(payload_reader_t *reader, int16_t *value) {
+    ASSERT(reader);
+    if (reader->end - reader->p < 2) {
+        reader->p = reader->end;
+        return false;
+    }
+
+    *value = (int16_t)((reader->p[0] << 8) | reader->p[1]);
+    reader->p += 2;
+    return true;
+}
+
+static inline bool payload_reader_read_int32(payload_reader_t *reader, int32_t *value) {
+    ASSERT(reader);
+    if (reader->end - reader->p < 4) {
+        reader->p = reader->end;
+        return false;
+    }
+
+    *value = (int32_t)(((uint32_t)reader->p[0] << 24) | ((uint32_t)reader->p[1] << 16) | ((uint32_t)reader->p[2] << 8) | reader->p[3]);
+    reader->p += 4;
+    return true;
+}
+
+static inline bool payload_reader_skip(payload_reader_t *reader, size_t n) {
+    ASSERT(reader);
+    if ((size_t)(reader->end - reader->p) < n) {
+        reader->p = reader->end;
+        return false;
+    }
+
+    reader->p += n;
+    return true;
+}
+
+#endif
@@ -0,0 +1,731 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define PROGRAM_NAME "pgreplay"
+/* We only want some of pgtrace's helpers. */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "common.h"
+#include "message_type.h"
+#include "message_trace_buffer.h"
+#include "payload_reader.h"
+#include "session_tags.h"
+#include "message_json_writer.h"
+#include "histogram.h"
+#include "replay_script.h"
+
+/* Replays a pgtrace -r script against a PostgreSQL server: each recorded connection gets its own connection, which
+   sends the recorded front-end messages and waits for the server wherever the client must have waited, i.e. for
+   ReadyForQuery after a Query, Sync or FunctionCall. */
+
+#define REPLAY_SOCKET_BUFFER_SIZE (64 * 1024)
+#define REPLAY_WORKER_STACK_SIZE (256 * 1024)
+
+typedef struct {
+    uint32_t connection_id;
+    size_t num_messages;
+    size_t capacity;
+    /* Record headers in the loaded script, so that each message's timestamp is to hand. */
+    const uint8_t **messages;
+} replay_connection_script_t;
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *user;
+    const char *database;
+    const char *password;
+    /* 1 for the captured timing, 2 for twice as fast etc, or 0 for as fast as the server will go. */
+    double speed;
+    uint64_t num_copies;
+} replay_options_t;
+
+replay_options_t global_options;
+
+/* The capture's first timestamp and when we started replaying it, so that each message can be sent at the same
+   point in the replay as it was in the capture. */
+uint64_t global_capture_start_nsec;
+uint64_t global_replay_start_nsec;
+
+typedef struct {
+    /* From sending the first message after a ReadyForQuery to the next ReadyForQuery. */
+    histogram_t round_trip_nsec;
+    uint64_t num_messages;
+    uint64_t num_bytes;
+    /* ErrorResponses from the server, which may be expected if the capture had them too. */
+    uint64_t num_errors;
+    uint64_t num_failed_connections;
+} replay_stats_t;
+
+typedef struct {
+    const replay_connection_script_t *script;
+    pthread_t thread;
+    replay_stats_t stats;
+    char error[256];
+} replay_worker_t;
+
+typedef struct {
+    int fd;
+    uint8_t data[REPLAY_SOCKET_BUFFER_SIZE];
+    size_t start;
+    size_t end;
+} replay_socket_t;
+
+
+static uint64_t monotonic_nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* LOG's timestamps come from global_now_nsec, which is packet time in pgtrace. */
+static void set_now_from_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    global_now_nsec = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until_nsec(uint64_t target_nsec) {
+    uint64_t now_nsec;
+    while ((now_nsec = monotonic_nsec()) < target_nsec) {
+        uint64_t delay_nsec = target_nsec - now_nsec;
+        struct timespec ts = { delay_nsec / 1000000000, delay_nsec % 1000000000 };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* When a message that was sent at ts_nsec in the capture is due in the replay. */
+static uint64_t replay_due_nsec(uint64_t ts_nsec) {
+    uint64_t capture_offset_nsec = (ts_nsec > global_capture_start_nsec) ? ts_nsec - global_capture_start_nsec : 0;
+    return global_replay_start_nsec + (uint64_t)(capture_offset_nsec / global_options.speed);
+}
+
+
+static void replay_worker_fail(replay_worker_t *worker, const char *reason, const char *detail) {
+    if ('\0' == worker->error[0]) {
+        snprintf(worker->error, sizeof(worker->error), "%s%s%s", reason, detail ? ": " : "", detail ? detail : "");
+    }
+}
+
+static bool replay_socket_connect(replay_socket_t *sock, replay_worker_t *worker) {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses;
+    int result = getaddrinfo(global_options.host, global_options.port, &hints, &addresses);
+    if (result != 0) {
+        replay_worker_fail(worker, "Can't resolve the server's address", gai_strerror(result));
+        return false;
+    }
+
+    sock->fd = -1;
+    sock->start = 0;
+    sock->end = 0;
+    struct addrinfo *address = addresses;
+    for (; address && (sock->fd < 0); address = address->ai_next) {
+        sock->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if ((sock->fd >= 0) && (connect(sock->fd, address->ai_addr, address->ai_addrlen) != 0)) {
+            close(sock->fd);
+            sock->fd = -1;
+        }
+    }
+
+    freeaddrinfo(addresses);
+    if (sock->fd < 0) {
+        replay_worker_fail(worker, "Can't connect to the server", strerror(errno));
+        return false;
+    }
+
+    /* Messages are written as they come due, so don't let Nagle hold them back. */
+    int is_nodelay = 1;
+    setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &is_nodelay, sizeof(is_nodelay));
+    return true;
+}
+
+/* A server that's gone away fails this session's write rather than killing every session with SIGPIPE. */
+static bool replay_socket_write(replay_socket_t *sock, const uint8_t *data, size_t num_bytes) {
+    while (num_bytes > 0) {
+        ssize_t result = send(sock->fd, data, num_bytes, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+
+            return false;
+        }
+
+        data += result;
+        num_bytes -= result;
+    }
+
+    return true;
+}
+
+/* Reads exactly num_bytes into bytes, or discards them if bytes is NULL. */
+static bool replay_socket_read(replay_socket_t *sock, uint8_t *bytes, size_t num_bytes) {
+    while (num_bytes > 0) {
+        if (sock->start == sock->end) {
+            ssize_t result = read(sock->fd, sock->data, sizeof(sock->data));
+            if (result < 0) {
+                if (EINTR == errno) {
+                    continue;
+                }
+
+                return false;
+            }
+
+            if (0 == result) {
+                return false;
+            }
+
+            sock->start = 0;
+            sock->end = result;
+        }
+
+        size_t num_available = sock->end - sock->start;
+        size_t num_copied = (num_bytes < num_available) ? num_bytes : num_available;
+        if (bytes) {
+            memcpy(bytes, sock->data + sock->start, num_copied);
+            bytes += num_copied;
+        }
+
+        sock->start += num_copied;
+        num_bytes -= num_copied;
+    }
+
+    return true;
+}
+
+/* Reads the next message from the server, keeping as much of its payload as fits in payload. */
+static bool replay_socket_read_message(replay_socket_t *sock,
+                                       uint8_t *message_type,
+                                       uint8_t *payload,
+                                       size_t payload_capacity,
+                                       size_t *payload_size) {
+    uint8_t header[5];
+    if (!replay_socket_read(sock, header, sizeof(header))) {
+        return false;
+    }
+
+    *message_type = header[0];
+    int32_t length = (int32_t)replay_script_get_uint(header + 1, 4);
+    if (length < 4) {
+        return false;
+    }
+
+    size_t size = length - 4;
+    size_t num_kept = (size < payload_capacity) ? size : payload_capacity;
+    *payload_size = num_kept;
+    return replay_socket_read(sock, payload, num_kept) && replay_socket_read(sock, NULL, size - num_kept);
+}
+
+/* The M field of an ErrorResponse, for reporting why we couldn't connect. */
+static const char *replay_error_response_message(uint8_t *payload, size_t payload_size) {
+    size_t i = 0;
+    while ((i < payload_size) && (payload[i] != '\0')) {
+        size_t end = i + 1;
+        while ((end < payload_size) && (payload[end] != '\0')) {
+            ++end;
+        }
+
+        if (end == payload_size) {
+            break;
+        }
+
+        if ('M' == payload[i]) {
+            return (const char *)payload + i + 1;
+        }
+
+        i = end + 1;
+    }
+
+    return "unknown error";
+}
+
+static size_t replay_append_cstr(uint8_t *p, const char *s) {
+    size_t size = strlen(s) + 1;
+    memcpy(p, s, size);
+    return size;
+}
+
+/* Does the startup & authentication exchange that the recorded connection did against its own server. */
+static bool replay_socket_start(replay_socket_t *sock, replay_worker_t *worker) {
+    uint8_t message[1024];
+    size_t size = 8;
+    if (strlen(global_options.user) + strlen(global_options.database) + 64 > sizeof(message)) {
+        replay_worker_fail(worker, "User or database name is too long", NULL);
+        return false;
+    }
+
+    size += replay_append_cstr(message + size, "user");
+    size += replay_append_cstr(message + size, global_options.user);
+    size += replay_append_cstr(message + size, "database");
+    size += replay_append_cstr(message + size, global_options.database);
+    size += replay_append_cstr(message + size, "application_name");
+    size += replay_append_cstr(message + size, PROGRAM_NAME);
+    message[size++] = '\0';
+    replay_script_put_uint(message, size, 4);
+    replay_script_put_uint(message + 4, 196608, 4);
+    if (!replay_socket_write(sock, message, size)) {
+        replay_worker_fail(worker, "Can't send the startup message", strerror(errno));
+        return false;
+    }
+
+    for (;;) {
+        uint8_t message_type;
+        uint8_t payload[1024];
+        size_t payload_size;
+        if (!replay_socket_read_message(sock, &message_type, payload, sizeof(payload) - 1, &payload_size)) {
+            replay_worker_fail(worker, "The server closed the connection during startup", NULL);
+            return false;
+        }
+
+        payload[payload_size] = '\0';
+        switch (message_type) {
+            case BE_MESSAGE_TYPE_AUTHENTICATION: {
+                uint32_t code = (payload_size >= 4) ? (uint32_t)replay_script_get_uint(payload, 4) : 0xffffffff;
+                if (0 == code) {
+                    break;
+                }
+
+                /* Cleartext password.  Anything stronger would need the password hashing that we leave to a real
+                   client library, so point the replay at a server that trusts it or asks for a password. */
+                if ((code != 3) || !global_options.password) {
+                    char detail[128];
+                    snprintf(detail, sizeof(detail), "code=%u, use trust or password authentication with PGPASSWORD", code);
+                    replay_worker_fail(worker, "Unsupported authentication", detail);
+                    return false;
+                }
+
+                size_t password_size = strlen(global_options.password) + 1;
+                if (password_size + 5 > sizeof(message)) {
+                    replay_worker_fail(worker, "PGPASSWORD is too long", NULL);
+                    return false;
+                }
+
+                message[0] = FE_MESSAGE_TYPE_PASSWORD_MESSAGE;
+                replay_script_put_uint(message + 1, password_size + 4, 4);
+                memcpy(message + 5, global_options.password, password_size);
+                if (!replay_socket_write(sock, message, password_size + 5)) {
+                    replay_worker_fail(worker, "Can't send the password", strerror(errno));
+                    return false;
+                }
+                break;
+            }
+
+            case BE_MESSAGE_TYPE_ERROR_RESPONSE:
+                replay_worker_fail(worker, "The server refused the connection", replay_error_response_message(payload, payload_size));
+                return false;
+
+            case BE_MESSAGE_TYPE_READY_FOR_QUERY:
+                return true;
+
+            default:
+                break;
+        }
+    }
+}
+
+/* Reads the server's responses until it's ready for the next request, or wants COPY data from us.  Returns false if
+   the connection failed. */
+static bool replay_socket_await_ready(replay_socket_t *sock, replay_worker_t *worker, bool *is_ready) {
+    for (;;) {
+        uint8_t message_type;
+        size_t payload_size;
+        if (!replay_socket_read_message(sock, &message_type, NULL, 0, &payload_size)) {
+            replay_worker_fail(worker, "The server closed the connection", NULL);
+            return false;
+        }
+
+        switch (message_type) {
+            case BE_MESSAGE_TYPE_ERROR_RESPONSE:
+                worker->stats.num_errors++;
+                break;
+
+            case BE_MESSAGE_TYPE_COPY_IN_RESPONSE:
+            case BE_MESSAGE_TYPE_COPY_BOTH_RESPONSE:
+                *is_ready = false;
+                return true;
+
+            case BE_MESSAGE_TYPE_READY_FOR_QUERY:
+                *is_ready = true;
+                return true;
+
+            default:
+                break;
+        }
+    }
+}
+
+static inline bool replay_is_sync_point(uint8_t message_type) {
+    return (FE_MESSAGE_TYPE_QUERY == message_type) ||
+           (FE_MESSAGE_TYPE_SYNC == message_type) ||
+           (FE_MESSAGE_TYPE_FUNCTION_CALL == message_type);
+}
+
+static void replay_worker_run(replay_worker_t *worker) {
+    const replay_connection_script_t *script = worker->script;
+    if (global_options.speed > 0) {
+        sleep_until_nsec(replay_due_nsec(replay_script_get_uint(script->messages[0] + 5, 8)));
+    }
+
+    replay_socket_t *sock = malloc(sizeof(*sock));
+    if (!sock) {
+        replay_worker_fail(worker, "Out of memory", NULL);
+        return;
+    }
+
+    if (!replay_socket_connect(sock, worker)) {
+        free(sock);
+        return;
+    }
+
+    bool is_ok = replay_socket_start(sock, worker);
+    bool is_terminated = false;
+    /* Requests that the server hasn't said it's ready after, which is more than one if it was sent COPY data. */
+    size_t num_unready = 0;
+    uint64_t round_trip_start_nsec = 0;
+    size_t i = 0;
+    for (; is_ok && (i < script->num_messages); ++i) {
+        const uint8_t *record = script->messages[i];
+        uint64_t ts_nsec = replay_script_get_uint(record + 5, 8);
+        size_t size = replay_script_get_uint(record + 13, 4);
+        const uint8_t *message = record + REPLAY_RECORD_HEADER_SIZE;
+        if (global_options.speed > 0) {
+            sleep_until_nsec(replay_due_nsec(ts_nsec));
+        }
+
+        if (0 == round_trip_start_nsec) {
+            round_trip_start_nsec = monotonic_nsec();
+        }
+
+        if (!replay_socket_write(sock, message, size)) {
+            replay_worker_fail(worker, "Can't send to the server", strerror(errno));
+            is_ok = false;
+            break;
+        }
+
+        worker->stats.num_messages++;
+        worker->stats.num_bytes += size;
+        if (FE_MESSAGE_TYPE_TERMINATE == message[0]) {
+            is_terminated = true;
+            break;
+        }
+
+        if (replay_is_sync_point(message[0])) {
+            num_unready++;
+        } else if ((message[0] != FE_MESSAGE_TYPE_COPY_DONE) && (message[0] != FE_MESSAGE_TYPE_COPY_FAIL)) {
+            continue;
+        }
+
+        while (is_ok && (num_unready > 0)) {
+            bool is_ready;
+            is_ok = replay_socket_await_ready(sock, worker, &is_ready);
+            if (!is_ok || !is_ready) {
+                break;
+            }
+
+            num_unready--;
+            histogram_add(&worker->stats.round_trip_nsec, monotonic_nsec() - round_trip_start_nsec);
+            round_trip_start_nsec = 0;
+        }
+    }
+
+    if (is_ok && !is_terminated) {
+        uint8_t terminate[5] = { FE_MESSAGE_TYPE_TERMINATE, 0, 0, 0, 4 };
+        replay_socket_write(sock, terminate, sizeof(terminate));
+    }
+
+    if (!is_ok) {
+        worker->stats.num_failed_connections++;
+    }
+
+    close(sock->fd);
+    free(sock);
+}
+
+static void *replay_worker_main(void *arg) {
+    replay_worker_run((replay_worker_t *)arg);
+    return NULL;
+}
+
+
+/* Splits the script into one list of messages per connection.  The script stays loaded since the lists point into
+   it. */
+static replay_connection_script_t *load_scripts(const char *path, size_t *num_scripts) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        FATAL("Can't open replay script: %s.  errno=%d", path, errno);
+    }
+
+    if ((fseek(fp, 0, SEEK_END) != 0) || (ftell(fp) < 0)) {
+        FATAL("Can't read replay script: %s.  errno=%d", path, errno);
+    }
+
+    size_t size = ftell(fp);
+    rewind(fp);
+    uint8_t *data = malloc(size ? size : 1);
+    if (!data || (fread(data, 1, size, fp) != size)) {
+        FATAL("Can't read replay script: %s.  errno=%d", path, errno);
+    }
+
+    fclose(fp);
+    if ((size < REPLAY_SCRIPT_HEADER_SIZE) ||
+        (memcmp(data, REPLAY_SCRIPT_MAGIC, REPLAY_SCRIPT_MAGIC_SIZE) != 0) ||
+        (replay_script_get_uint(data + REPLAY_SCRIPT_MAGIC_SIZE, 4) != REPLAY_SCRIPT_VERSION)) {
+        FATAL("Not a version %d replay script: %s", REPLAY_SCRIPT_VERSION, path);
+    }
+
+    replay_connection_script_t *scripts = NULL;
+    size_t num_allocated = 0;
+    *num_scripts = 0;
+    const uint8_t *p = data + REPLAY_SCRIPT_HEADER_SIZE;
+    const uint8_t *end = data + size;
+    while (p < end) {
+        if ((size_t)(end - p) < REPLAY_RECORD_HEADER_SIZE) {
+            LOG("Replay script ends part way through a record: %s", path);
+            break;
+        }
+
+        uint8_t kind = p[0];
+        uint32_t connection_id = (uint32_t)replay_script_get_uint(p + 1, 4);
+        uint64_t ts_nsec = replay_script_get_uint(p + 5, 8);
+        size_t message_size = replay_script_get_uint(p + 13, 4);
+        if ((size_t)(end - p) - REPLAY_RECORD_HEADER_SIZE < message_size) {
+            LOG("Replay script ends part way through a record: %s", path);
+            break;
+        }
+
+        if ((REPLAY_RECORD_KIND_MESSAGE == kind) && (message_size >= 5) && (connection_id > 0)) {
+            if ((0 == global_capture_start_nsec) || (ts_nsec < global_capture_start_nsec)) {
+                global_capture_start_nsec = ts_nsec;
+            }
+
+            /* Connections are numbered in order so each one's script is at connection_id - 1. */
+            if (connection_id > num_allocated) {
+                size_t new_num_allocated = num_allocated ? num_allocated : 64;
+                while (new_num_allocated < connection_id) {
+                    new_num_allocated *= 2;
+                }
+
+                scripts = realloc(scripts, new_num_allocated * sizeof(*scripts));
+                if (!scripts) {
+                    FATAL("Can't allocate %zu connection scripts", new_num_allocated);
+                }
+
+                memset(scripts + num_allocated, 0, (new_num_allocated - num_allocated) * sizeof(*scripts));
+                num_allocated = new_num_allocated;
+            }
+
+            replay_connection_script_t *script = &scripts[connection_id - 1];
+            script->connection_id = connection_id;
+            if (script->num_messages == script->capacity) {
+                script->capacity = script->capacity ? script->capacity * 2 : 16;
+                script->messages = realloc(script->messages, script->capacity * sizeof(*script->messages));
+                if (!script->messages) {
+                    FATAL("Can't allocate %zu messages for connection %u", script->capacity, connection_id);
+                }
+            }
+
+            script->messages[script->num_messages++] = p;
+            if (connection_id > *num_scripts) {
+                *num_scripts = connection_id;
+            }
+        }
+
+        p += REPLAY_RECORD_HEADER_SIZE + message_size;
+    }
+
+    return scripts;
+}
+
+static void print_summary(const replay_stats_t *stats, size_t num_workers, uint64_t duration_nsec) {
+    double duration_sec = (duration_nsec ? duration_nsec : 1) / 1e9;
+    set_now_from_clock();
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"ReplaySummary\"");
+        message_json_writer_write_uint_field(&writer, "connections", num_workers);
+        message_json_writer_write_uint_field(&writer, "failed", stats->num_failed_connections);
+        message_json_writer_write_uint_field(&writer, "messages", stats->num_messages);
+        message_json_writer_write_uint_field(&writer, "bytes", stats->num_bytes);
+        message_json_writer_write_uint_field(&writer, "errors", stats->num_errors);
+        message_json_writer_write_uint_field(&writer, "duration_nsec", duration_nsec);
+        histogram_write_json_field(&stats->round_trip_nsec, "round_trip_nsec", &writer);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    char round_trip_str[256];
+    LOG("replay summary: connections=%zu failed=%llu messages=%llu bytes=%llu errors=%llu duration_sec=%.3f "
+        "round_trips_per_sec=%.1f messages_per_sec=%.1f round_trip_nsec=%s",
+        num_workers,
+        (unsigned long long)stats->num_failed_connections,
+        (unsigned long long)stats->num_messages,
+        (unsigned long long)stats->num_bytes,
+        (unsigned long long)stats->num_errors,
+        duration_sec,
+        stats->round_trip_nsec.count / duration_sec,
+        stats->num_messages / duration_sec,
+        histogram_to_str(&stats->round_trip_nsec, round_trip_str));
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: %s [options] replay_script\n", PROGRAM_NAME);
+    fprintf(stderr, "Replays the connections in a script written by pgtrace -r against a PostgreSQL server.\n");
+    fprintf(stderr, "  -h host      Server host.  Default 127.0.0.1.\n");
+    fprintf(stderr, "  -p port      Server port.  Default 5432.\n");
+    fprintf(stderr, "  -U user      User to connect as.  Default postgres.  PGPASSWORD is used if a password is asked for.\n");
+    fprintf(stderr, "  -d database  Database to connect to.  Default postgres.\n");
+    fprintf(stderr, "  -s speed     How many times faster than captured to send messages, or max for no waiting.  Default 1.\n");
+    fprintf(stderr, "  -c copies    Replay each connection this many times at once.  Default 1.\n");
+    fprintf(stderr, "  -j           Write the summary as a JSON object.\n");
+}
+
+int main(int argc, char *argv[]) {
+    global_options.host = "127.0.0.1";
+    global_options.port = "5432";
+    global_options.user = "postgres";
+    global_options.database = "postgres";
+    global_options.password = getenv("PGPASSWORD");
+    global_options.speed = 1;
+    global_options.num_copies = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:h:jp:s:U:")) != -1) {
+        char *end;
+        switch (opt) {
+            case 'c':
+                global_options.num_copies = strtoull(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (0 == global_options.num_copies)) {
+                    fprintf(stderr, "Invalid value for -c: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'd':
+                global_options.database = optarg;
+                break;
+
+            case 'h':
+                global_options.host = optarg;
+                break;
+
+            case 'j':
+                global_output_format = OUTPUT_FORMAT_NDJSON;
+                break;
+
+            case 'p':
+                global_options.port = optarg;
+                break;
+
+            case 's':
+                if (strcmp(optarg, "max") == 0) {
+                    global_options.speed = 0;
+                    break;
+                }
+
+                global_options.speed = strtod(optarg, &end);
+                if ((end == optarg) || (*end != '\0') || !(global_options.speed > 0)) {
+                    fprintf(stderr, "Invalid value for -s: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'U':
+                global_options.user = optarg;
+                break;
+
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    if (argc - optind != 1) {
+        print_usage();
+        return 1;
+    }
+
+    set_now_from_clock();
+    size_t num_scripts;
+    replay_connection_script_t *scripts = load_scripts(argv[optind], &num_scripts);
+    size_t num_workers = 0;
+    replay_worker_t *workers = calloc(num_scripts * global_options.num_copies + 1, sizeof(*workers));
+    if (!workers) {
+        FATAL("Can't allocate %zu workers", num_scripts * global_options.num_copies);
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, REPLAY_WORKER_STACK_SIZE);
+    global_replay_start_nsec = monotonic_nsec();
+    size_t i = 0;
+    for (; i < num_scripts; ++i) {
+        if (0 == scripts[i].num_messages) {
+            continue;
+        }
+
+        uint64_t j = 0;
+        for (; j < global_options.num_copies; ++j) {
+            replay_worker_t *worker = &workers[num_workers];
+            worker->script = &scripts[i];
+            histogram_init(&worker->stats.round_trip_nsec);
+            int result = pthread_create(&worker->thread, &attr, replay_worker_main, worker);
+            if (result != 0) {
+                FATAL("pthread_create failed, result=%d", result);
+            }
+
+            num_workers++;
+        }
+    }
+
+    replay_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    histogram_init(&stats.round_trip_nsec);
+    for (i = 0; i < num_workers; ++i) {
+        replay_worker_t *worker = &workers[i];
+        pthread_join(worker->thread, NULL);
+        size_t j = 0;
+        for (; j < HISTOGRAM_NUM_BUCKETS; ++j) {
+            stats.round_trip_nsec.buckets[j] += worker->stats.round_trip_nsec.buckets[j];
+        }
+
+        stats.round_trip_nsec.count += worker->stats.round_trip_nsec.count;
+        stats.round_trip_nsec.sum += worker->stats.round_trip_nsec.sum;
+        if (worker->stats.round_trip_nsec.max > stats.round_trip_nsec.max) {
+            stats.round_trip_nsec.max = worker->stats.round_trip_nsec.max;
+        }
+
+        stats.num_messages += worker->stats.num_messages;
+        stats.num_bytes += worker->stats.num_bytes;
+        stats.num_errors += worker->stats.num_errors;
+        stats.num_failed_connections += worker->stats.num_failed_connections;
+        if (worker->error[0] != '\0') {
+            set_now_from_clock();
+            LOG("connection %u failed: %s", worker->script->connection_id, worker->error);
+        }
+    }
+
+    uint64_t duration_nsec = monotonic_nsec() - global_replay_start_nsec;
+    print_summary(&stats, num_workers, duration_nsec);
+    return (stats.num_failed_connections > 0) ? 1 : 0;
+}
@@ -0,0 +1,630 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "pgrollup"
+/* We only want some of pgtrace's helpers. */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "common.h"
+#include "message_type.h"
+#include "message_trace_buffer.h"
+#include "payload_reader.h"
+#include "session_tags.h"
+#include "message_json_writer.h"
+#include "histogram.h"
+#include "rollup_format.h"
+#include "time_arg.h"
+
+/* Answers "what happened between 14:02 and 14:05" from a pgtrace -w rollup file: the index says which blocks overlap
+   the range, and only those are read. */
+
+/* A series' totals over the range.  Applications are matched by name, since their keys are only good for one run of
+   pgtrace. */
+typedef struct {
+    uint8_t kind;
+    uint64_t key;
+    uint8_t name_length;
+    char name[256];
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t errors;
+    histogram_t latency_nsec;
+} rollup_total_t;
+
+typedef struct {
+    rollup_total_t *totals;
+    size_t num_totals;
+    size_t capacity;
+    /* Open addressing, holding indexes + 1 into totals. */
+    size_t *slots;
+    size_t num_slots;
+} rollup_totals_t;
+
+typedef struct {
+    uint64_t from_nsec;
+    uint64_t to_nsec;
+    /* Kinds to report, e.g. "MS", or NULL for all of them. */
+    const char *kinds;
+    /* Print each interval's rows rather than totals. */
+    bool is_each_interval;
+    /* The most series of each kind to report, or 0 for all of them. */
+    size_t max_series;
+} rollup_query_t;
+
+typedef struct {
+    uint64_t num_blocks;
+    uint64_t num_blocks_read;
+    uint64_t num_rows;
+    /* What the blocks that were read cover of the range. */
+    uint64_t start_nsec;
+    uint64_t end_nsec;
+} rollup_read_stats_t;
+
+static const char *rollup_kind_name(uint8_t kind) {
+    switch (kind) {
+        case ROLLUP_SERIES_KIND_MESSAGE:
+            return "message";
+
+        case ROLLUP_SERIES_KIND_STATEMENT:
+            return "statement";
+
+        case ROLLUP_SERIES_KIND_APPLICATION:
+            return "application";
+
+        default:
+            return "unknown";
+    }
+}
+
+static uint64_t rollup_total_hash(uint8_t kind, uint64_t key, const char *name, size_t name_length) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = (hash ^ kind) * 1099511628211ULL;
+    size_t i = 0;
+    for (; i < 8; ++i) {
+        hash = (hash ^ (uint8_t)(key >> (8 * i))) * 1099511628211ULL;
+    }
+
+    for (i = 0; i < name_length; ++i) {
+        hash = (hash ^ (uint8_t)name[i]) * 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static void rollup_totals_rehash(rollup_totals_t *totals, size_t num_slots) {
+    free(totals->slots);
+    totals->num_slots = num_slots;
+    if ((totals->slots = calloc(num_slots, sizeof(*totals->slots))) == NULL) {
+        FATAL("Can't allocate %zu slots", num_slots);
+    }
+
+    size_t i = 0;
+    for (; i < totals->num_totals; ++i) {
+        const rollup_total_t *total = &totals->totals[i];
+        size_t slot = rollup_total_hash(total->kind, total->key, total->name, total->name_length) % num_slots;
+        for (; totals->slots[slot] != 0; slot = (slot + 1) % num_slots) {
+        }
+
+        totals->slots[slot] = i + 1;
+    }
+}
+
+/* The totals for the series, which are added if they're new. */
+static size_t rollup_totals_find(rollup_totals_t *totals, uint8_t kind, uint64_t key, const char *name, size_t name_length) {
+    if (ROLLUP_SERIES_KIND_APPLICATION == kind) {
+        key = 0;
+    }
+
+    if (2 * (totals->num_totals + 1) > totals->num_slots) {
+        rollup_totals_rehash(totals, totals->num_slots ? 2 * totals->num_slots : 1024);
+    }
+
+    size_t slot = rollup_total_hash(kind, key, name, name_length) % totals->num_slots;
+    for (; totals->slots[slot] != 0; slot = (slot + 1) % totals->num_slots) {
+        const rollup_total_t *total = &totals->totals[totals->slots[slot] - 1];
+        if ((total->kind == kind) && (total->key == key) && (total->name_length == name_length) &&
+            (memcmp(total->name, name, name_length) == 0)) {
+            return totals->slots[slot] - 1;
+        }
+    }
+
+    if (totals->num_totals == totals->capacity) {
+        totals->capacity = totals->capacity ? 2 * totals->capacity : 256;
+        if ((totals->totals = realloc(totals->totals, totals->capacity * sizeof(*totals->totals))) == NULL) {
+            FATAL("Can't allocate %zu series totals", totals->capacity);
+        }
+    }
+
+    rollup_total_t *total = &totals->totals[totals->num_totals];
+    memset(total, 0, sizeof(*total));
+    total->kind = kind;
+    total->key = key;
+    total->name_length = name_length;
+    memcpy(total->name, name, name_length);
+    histogram_init(&total->latency_nsec);
+    totals->slots[slot] = ++totals->num_totals;
+    return totals->num_totals - 1;
+}
+
+static void rollup_histogram_merge(histogram_t *into, const histogram_t *histogram) {
+    size_t i = 0;
+    for (; i < HISTOGRAM_NUM_BUCKETS; ++i) {
+        into->buckets[i] += histogram->buckets[i];
+    }
+
+    into->count += histogram->count;
+    into->sum += histogram->sum;
+    if (histogram->max > into->max) {
+        into->max = histogram->max;
+    }
+}
+
+/* The name with anything unprintable made a dot, for text lines. */
+static const char *rollup_printable_name(const char *name, size_t name_length, char *str) {
+    size_t i = 0;
+    for (; i < name_length; ++i) {
+        uint8_t byte = (uint8_t)name[i];
+        str[i] = ((byte < 32) || (127 == byte)) ? '.' : byte;
+    }
+
+    str[i] = '\0';
+    return str;
+}
+
+static void rollup_print_series(uint8_t kind,
+                                uint64_t key,
+                                const char *name,
+                                size_t name_length,
+                                uint64_t count,
+                                uint64_t bytes,
+                                uint64_t errors,
+                                const histogram_t *latency_nsec) {
+    const char *sender = (ROLLUP_SERIES_KIND_MESSAGE != kind) ? NULL : ((key >> 8) ? "be" : "fe");
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"Rollup\"");
+        message_json_writer_write_key(&writer, "kind");
+        message_json_writer_write_string(&writer, (const uint8_t *)rollup_kind_name(kind), strlen(rollup_kind_name(kind)));
+        if (sender) {
+            message_json_writer_write_key(&writer, "sender");
+            message_json_writer_write_string(&writer, (const uint8_t *)sender, 2);
+        }
+
+        message_json_writer_write_key(&writer, "name");
+        message_json_writer_write_string(&writer, (const uint8_t *)name, name_length);
+        message_json_writer_write_uint_field(&writer, "count", count);
+        message_json_writer_write_uint_field(&writer, "bytes", bytes);
+        message_json_writer_write_uint_field(&writer, "errors", errors);
+        message_json_writer_write_uint_field(&writer, "latency_sum_nsec", latency_nsec->sum);
+        histogram_write_json_field(latency_nsec, "latency_nsec", &writer);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    char name_str[256];
+    char latency_str[256];
+    LOG("rollup: kind=%s%s%s count=%llu bytes=%llu errors=%llu latency_sum_nsec=%llu latency_nsec=%s name=%s",
+        rollup_kind_name(kind),
+        sender ? " sender=" : "",
+        sender ? sender : "",
+        (unsigned long long)count,
+        (unsigned long long)bytes,
+        (unsigned long long)errors,
+        (unsigned long long)latency_nsec->sum,
+        histogram_to_str(latency_nsec, latency_str),
+        rollup_printable_name(name, name_length, name_str));
+}
+
+static void *rollup_read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        FATAL("Can't open rollup file: %s.  errno=%d", path, errno);
+    }
+
+    if ((fseek(fp, 0, SEEK_END) != 0) || (ftell(fp) < 0)) {
+        FATAL("Can't read rollup file: %s.  errno=%d", path, errno);
+    }
+
+    *size = ftell(fp);
+    rewind(fp);
+    uint8_t *data = malloc(*size ? *size : 1);
+    if (!data || (fread(data, 1, *size, fp) != *size)) {
+        FATAL("Can't read rollup file: %s.  errno=%d", path, errno);
+    }
+
+    fclose(fp);
+    return data;
+}
+
+/* One series' dictionary entry in the block being read. */
+typedef struct {
+    uint8_t kind;
+    uint64_t key;
+    const char *name;
+    size_t name_length;
+    bool is_wanted;
+    /* Into the totals, when they're being kept. */
+    size_t total_index;
+} rollup_block_series_t;
+
+/* Reads the block at p, which is size bytes long at most, into totals or prints its rows.  Returns false if it isn't
+   a whole block. */
+static bool rollup_read_block(const uint8_t *p,
+                              size_t size,
+                              uint64_t interval_nsec,
+                              const rollup_query_t *query,
+                              rollup_totals_t *totals,
+                              rollup_read_stats_t *stats) {
+    if (size < ROLLUP_BLOCK_HEADER_SIZE) {
+        return false;
+    }
+
+    uint64_t start_nsec = rollup_format_get_uint(p, 8);
+    size_t num_series = rollup_format_get_uint(p + 16, 4);
+    size_t num_rows = rollup_format_get_uint(p + 20, 4);
+    size_t dictionary_size = rollup_format_get_uint(p + 24, 4);
+    const uint8_t *sections[1 + ROLLUP_NUM_COLUMNS + 1];
+    sections[0] = p + ROLLUP_BLOCK_HEADER_SIZE;
+    size_t num_left = size - ROLLUP_BLOCK_HEADER_SIZE;
+    size_t i = 0;
+    for (; i <= ROLLUP_NUM_COLUMNS; ++i) {
+        size_t section_size = (0 == i) ? dictionary_size : rollup_format_get_uint(p + 28 + 4 * (i - 1), 4);
+        if (section_size > num_left) {
+            return false;
+        }
+
+        sections[i + 1] = sections[i] + section_size;
+        num_left -= section_size;
+    }
+
+    rollup_block_series_t *series = calloc(num_series + 1, sizeof(*series));
+    if (!series) {
+        FATAL("Can't allocate %zu series", num_series);
+    }
+
+    bool is_ok = true;
+    const uint8_t *q = sections[0];
+    for (i = 0; is_ok && (i < num_series); ++i) {
+        uint64_t name_length;
+        is_ok = (q < sections[1]) && ((series[i].kind = *q++) != 0) &&
+                ((q = rollup_format_get_varint(q, sections[1], &series[i].key)) != NULL) &&
+                ((q = rollup_format_get_varint(q, sections[1], &name_length)) != NULL) &&
+                (name_length <= (uint64_t)(sections[1] - q)) && (name_length < sizeof(((rollup_total_t *)0)->name));
+        if (is_ok) {
+            series[i].name = (const char *)q;
+            series[i].name_length = name_length;
+            q += name_length;
+            series[i].is_wanted = !query->kinds || strchr(query->kinds, series[i].kind);
+            if (series[i].is_wanted && !query->is_each_interval) {
+                series[i].total_index = rollup_totals_find(totals, series[i].kind, series[i].key, series[i].name, name_length);
+            }
+        }
+    }
+
+    const uint8_t *columns[ROLLUP_NUM_COLUMNS];
+    for (i = 0; i < ROLLUP_NUM_COLUMNS; ++i) {
+        columns[i] = sections[i + 1];
+    }
+
+    uint64_t interval = 0;
+    size_t series_index = 0;
+    size_t row = 0;
+    for (; is_ok && (row < num_rows); ++row) {
+        uint64_t values[ROLLUP_COLUMN_BUCKETS];
+        for (i = 0; is_ok && (i < ROLLUP_COLUMN_BUCKETS); ++i) {
+            is_ok = (columns[i] = rollup_format_get_varint(columns[i], sections[i + 2], &values[i])) != NULL;
+        }
+
+        histogram_t latency_nsec;
+        histogram_init(&latency_nsec);
+        uint64_t num_buckets = 0;
+        const uint8_t *buckets_end = sections[1 + ROLLUP_NUM_COLUMNS];
+        is_ok = is_ok && ((columns[ROLLUP_COLUMN_BUCKETS] =
+                           rollup_format_get_varint(columns[ROLLUP_COLUMN_BUCKETS], buckets_end, &num_buckets)) != NULL);
+        uint64_t bucket = 0;
+        for (i = 0; is_ok && (i < num_buckets); ++i) {
+            uint64_t bucket_delta, bucket_count;
+            is_ok = ((columns[ROLLUP_COLUMN_BUCKETS] =
+                      rollup_format_get_varint(columns[ROLLUP_COLUMN_BUCKETS], buckets_end, &bucket_delta)) != NULL) &&
+                    ((columns[ROLLUP_COLUMN_BUCKETS] =
+                      rollup_format_get_varint(columns[ROLLUP_COLUMN_BUCKETS], buckets_end, &bucket_count)) != NULL) &&
+                    ((bucket += bucket_delta) < HISTOGRAM_NUM_BUCKETS);
+            if (is_ok) {
+                latency_nsec.buckets[bucket] = bucket_count;
+                latency_nsec.count += bucket_count;
+            }
+        }
+
+        if (!is_ok) {
+            break;
+        }
+
+        latency_nsec.sum = values[ROLLUP_COLUMN_LATENCY_SUM];
+        latency_nsec.max = values[ROLLUP_COLUMN_LATENCY_MAX];
+        interval += values[ROLLUP_COLUMN_INTERVAL];
+        series_index = (0 == values[ROLLUP_COLUMN_INTERVAL]) && (row > 0) ? series_index + values[ROLLUP_COLUMN_SERIES] :
+                                                                             values[ROLLUP_COLUMN_SERIES];
+        if (series_index >= num_series) {
+            is_ok = false;
+            break;
+        }
+
+        uint64_t row_start_nsec = start_nsec + interval * interval_nsec;
+        const rollup_block_series_t *row_series = &series[series_index];
+        if ((row_start_nsec < query->from_nsec) || (row_start_nsec >= query->to_nsec) || !row_series->is_wanted) {
+            continue;
+        }
+
+        stats->num_rows++;
+        if (query->is_each_interval) {
+            global_now_nsec = row_start_nsec;
+            rollup_print_series(row_series->kind, row_series->key, row_series->name, row_series->name_length,
+                                values[ROLLUP_COLUMN_COUNT], values[ROLLUP_COLUMN_BYTES], values[ROLLUP_COLUMN_ERRORS],
+                                &latency_nsec);
+            continue;
+        }
+
+        rollup_total_t *total = &totals->totals[row_series->total_index];
+        total->count += values[ROLLUP_COLUMN_COUNT];
+        total->bytes += values[ROLLUP_COLUMN_BYTES];
+        total->errors += values[ROLLUP_COLUMN_ERRORS];
+        rollup_histogram_merge(&total->latency_nsec, &latency_nsec);
+    }
+
+    free(series);
+    return is_ok;
+}
+
+/* Heaviest first by total latency and then by count, within each kind. */
+static int rollup_compare_totals(const void *a, const void *b) {
+    const rollup_total_t *ta = a;
+    const rollup_total_t *tb = b;
+    if (ta->kind != tb->kind) {
+        return (ta->kind < tb->kind) ? -1 : 1;
+    }
+
+    if (ta->latency_nsec.sum != tb->latency_nsec.sum) {
+        return (ta->latency_nsec.sum < tb->latency_nsec.sum) ? 1 : -1;
+    }
+
+    return (ta->count < tb->count) - (ta->count > tb->count);
+}
+
+static void rollup_query_file(const char *path, const rollup_query_t *query) {
+    size_t index_path_size = strlen(path) + sizeof(ROLLUP_INDEX_SUFFIX);
+    char *index_path = malloc(index_path_size);
+    if (!index_path) {
+        FATAL("Can't allocate the path of %s's index", path);
+    }
+
+    snprintf(index_path, index_path_size, "%s%s", path, ROLLUP_INDEX_SUFFIX);
+    size_t index_size;
+    uint8_t *index = rollup_read_file(index_path, &index_size);
+    if ((index_size < ROLLUP_INDEX_HEADER_SIZE) || (memcmp(index, ROLLUP_INDEX_MAGIC, ROLLUP_MAGIC_SIZE) != 0) ||
+        (rollup_format_get_uint(index + ROLLUP_MAGIC_SIZE, 4) != ROLLUP_VERSION)) {
+        FATAL("Not a version %d rollup index: %s", ROLLUP_VERSION, index_path);
+    }
+
+    FILE *fp = fopen(path, "rb");
+    uint8_t header[ROLLUP_FILE_HEADER_SIZE];
+    if (!fp || (fread(header, sizeof(header), 1, fp) != 1) || (memcmp(header, ROLLUP_FILE_MAGIC, ROLLUP_MAGIC_SIZE) != 0) ||
+        (rollup_format_get_uint(header + ROLLUP_MAGIC_SIZE, 4) != ROLLUP_VERSION)) {
+        FATAL("Not a version %d rollup file: %s", ROLLUP_VERSION, path);
+    }
+
+    uint64_t interval_nsec = rollup_format_get_uint(header + ROLLUP_MAGIC_SIZE + 4, 8);
+    rollup_totals_t totals;
+    memset(&totals, 0, sizeof(totals));
+    rollup_read_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.start_nsec = query->to_nsec;
+    stats.end_nsec = query->from_nsec;
+    uint8_t *block = NULL;
+    size_t block_capacity = 0;
+    const uint8_t *entry = index + ROLLUP_INDEX_HEADER_SIZE;
+    for (; entry + ROLLUP_INDEX_ENTRY_SIZE <= index + index_size; entry += ROLLUP_INDEX_ENTRY_SIZE) {
+        stats.num_blocks++;
+        uint64_t start_nsec = rollup_format_get_uint(entry, 8);
+        uint64_t end_nsec = rollup_format_get_uint(entry + 8, 8);
+        uint64_t offset = rollup_format_get_uint(entry + 16, 8);
+        if ((end_nsec <= query->from_nsec) || (start_nsec >= query->to_nsec)) {
+            continue;
+        }
+
+        uint8_t block_header[ROLLUP_BLOCK_HEADER_SIZE];
+        if ((fseek(fp, offset, SEEK_SET) != 0) || (fread(block_header, sizeof(block_header), 1, fp) != 1)) {
+            FATAL("Can't read the rollup block at %llu in %s", (unsigned long long)offset, path);
+        }
+
+        size_t block_size = sizeof(block_header) + rollup_format_get_uint(block_header + 24, 4);
+        size_t i = 0;
+        for (; i < ROLLUP_NUM_COLUMNS; ++i) {
+            block_size += rollup_format_get_uint(block_header + 28 + 4 * i, 4);
+        }
+
+        if (block_size > block_capacity) {
+            block_capacity = block_size;
+            if ((block = realloc(block, block_capacity)) == NULL) {
+                FATAL("Can't allocate %zu bytes for a rollup block", block_capacity);
+            }
+        }
+
+        memcpy(block, block_header, sizeof(block_header));
+        if ((fread(block + sizeof(block_header), block_size - sizeof(block_header), 1, fp) != 1) ||
+            !rollup_read_block(block, block_size, interval_nsec, query, &totals, &stats)) {
+            FATAL("The rollup block at %llu in %s is damaged", (unsigned long long)offset, path);
+        }
+
+        stats.num_blocks_read++;
+        if (start_nsec < stats.start_nsec) {
+            stats.start_nsec = (start_nsec > query->from_nsec) ? start_nsec : query->from_nsec;
+        }
+
+        if (end_nsec > stats.end_nsec) {
+            stats.end_nsec = (end_nsec < query->to_nsec) ? end_nsec : query->to_nsec;
+        }
+    }
+
+    fclose(fp);
+    if (0 == stats.num_blocks_read) {
+        stats.start_nsec = query->from_nsec;
+        stats.end_nsec = (UINT64_MAX == query->to_nsec) ? query->from_nsec : query->to_nsec;
+    }
+
+    global_now_nsec = stats.start_nsec;
+    if (!query->is_each_interval) {
+        qsort(totals.totals, totals.num_totals, sizeof(*totals.totals), rollup_compare_totals);
+        size_t num_of_kind = 0;
+        size_t i = 0;
+        for (; i < totals.num_totals; ++i) {
+            const rollup_total_t *total = &totals.totals[i];
+            num_of_kind = ((i > 0) && (total->kind == totals.totals[i - 1].kind)) ? num_of_kind + 1 : 1;
+            if ((total->count + total->latency_nsec.count + total->errors > 0) &&
+                ((0 == query->max_series) || (num_of_kind <= query->max_series))) {
+                rollup_print_series(total->kind, total->key, total->name, total->name_length, total->count, total->bytes,
+                                    total->errors, &total->latency_nsec);
+            }
+        }
+    }
+
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"RollupRange\"");
+        message_json_writer_write_key(&writer, "to");
+        message_json_writer_write_timestamp(&writer, stats.end_nsec);
+        message_json_writer_write_uint_field(&writer, "interval_nsec", interval_nsec);
+        message_json_writer_write_uint_field(&writer, "blocks", stats.num_blocks);
+        message_json_writer_write_uint_field(&writer, "blocks_read", stats.num_blocks_read);
+        message_json_writer_write_uint_field(&writer, "rows", stats.num_rows);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+    } else {
+        char to_str[64];
+        timestamp_to_dec_str(to_str, stats.end_nsec);
+        LOG("rollup range: to=%s interval_nsec=%llu blocks=%llu blocks_read=%llu rows=%llu",
+            to_str,
+            (unsigned long long)interval_nsec,
+            (unsigned long long)stats.num_blocks,
+            (unsigned long long)stats.num_blocks_read,
+            (unsigned long long)stats.num_rows);
+    }
+
+    free(block);
+    free(index);
+    free(index_path);
+}
+
+/* The end of the last block in the file's index, or 0 if there isn't one. */
+static uint64_t rollup_last_end_nsec(const char *path) {
+    size_t index_path_size = strlen(path) + sizeof(ROLLUP_INDEX_SUFFIX);
+    char *index_path = malloc(index_path_size);
+    if (!index_path) {
+        FATAL("Can't allocate the path of %s's index", path);
+    }
+
+    snprintf(index_path, index_path_size, "%s%s", path, ROLLUP_INDEX_SUFFIX);
+    size_t index_size;
+    uint8_t *index = rollup_read_file(index_path, &index_size);
+    uint64_t end_nsec = 0;
+    const uint8_t *entry = index + ROLLUP_INDEX_HEADER_SIZE;
+    for (; entry + ROLLUP_INDEX_ENTRY_SIZE <= index + index_size; entry += ROLLUP_INDEX_ENTRY_SIZE) {
+        uint64_t entry_end_nsec = rollup_format_get_uint(entry + 8, 8);
+        if (entry_end_nsec > end_nsec) {
+            end_nsec = entry_end_nsec;
+        }
+    }
+
+    free(index);
+    free(index_path);
+    return end_nsec;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: %s [options] rollup_file [from [to]]\n", PROGRAM_NAME);
+    fprintf(stderr, "Reports what happened between from and to in a rollup file written by pgtrace -w.  Each is epoch\n");
+    fprintf(stderr, "seconds, local 'YYYY-MM-DD HH:MM[:SS]', or local HH:MM[:SS] on the day of the file's last rollup.\n");
+    fprintf(stderr, "They default to the start and end of the file.\n");
+    fprintf(stderr, "  -k kinds     Only report these kinds of series: M for message types, S for statements and A for\n");
+    fprintf(stderr, "               applications, e.g. -k SA.  Default all of them.\n");
+    fprintf(stderr, "  -n count     Report at most this many series of each kind, those with the most total latency.\n");
+    fprintf(stderr, "  -e           Report each interval's rows rather than totals over the range.\n");
+    fprintf(stderr, "  -j           Write one JSON object per series (NDJSON).\n");
+}
+
+int main(int argc, char *argv[]) {
+    rollup_query_t query;
+    memset(&query, 0, sizeof(query));
+    int opt;
+    while ((opt = getopt(argc, argv, "ejk:n:")) != -1) {
+        char *end;
+        switch (opt) {
+            case 'e':
+                query.is_each_interval = true;
+                break;
+
+            case 'j':
+                global_output_format = OUTPUT_FORMAT_NDJSON;
+                break;
+
+            case 'k':
+                query.kinds = optarg;
+                if (strspn(optarg, "MSA") != strlen(optarg)) {
+                    fprintf(stderr, "Invalid value for -k: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'n':
+                query.max_series = strtoull(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (0 == query.max_series)) {
+                    fprintf(stderr, "Invalid value for -n: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    int num_args = argc - optind;
+    if ((num_args < 1) || (num_args > 3)) {
+        print_usage();
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    uint64_t last_end_nsec = rollup_last_end_nsec(path);
+    query.from_nsec = 0;
+    query.to_nsec = UINT64_MAX;
+    if ((num_args > 1) && !time_arg_parse(argv[optind + 1], last_end_nsec, &query.from_nsec)) {
+        fprintf(stderr, "Invalid from time: '%s'\n", argv[optind + 1]);
+        return 1;
+    }
+
+    if ((num_args > 2) && !time_arg_parse(argv[optind + 2], last_end_nsec, &query.to_nsec)) {
+        fprintf(stderr, "Invalid to time: '%s'\n", argv[optind + 2]);
+        return 1;
+    }
+
+    rollup_query_file(path, &query);
+    return 0;
+}
@@ -10,72 +10,30 @@
 #include <ctype.h>
 #include <signal.h>
 #include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 
 #define PROGRAM_NAME "pgtrace"
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+/* Linux's default, for when we can't ask. */
+#define OUTPUT_PIPE_DEFAULT_CAPACITY (64 * 1024)
 #include "common.h"
 #include "state_machine.h"
 #include "tcp_state.h"
+#include "checkpoint.h"
+#include "packet_processor.h"
+#include "ring_output.h"
+#include "metrics_server.h"
 #include "test.h"
 
-/* Ethernet header */
-struct sniff_ethernet {
-    u_char  ether_dhost[6];    /* destination host address */
-    u_char  ether_shost[6];    /* source host address */
-    u_short ether_type;        /* IP? ARP? RARP? etc */
-};
-
-/* IP header */
-struct sniff_ip {
-    u_char  ip_vhl;                   /* version << 4 | header length >> 2 */
-    u_char  ip_tos;                   /* type of service */
-    u_short ip_len;                   /* total length */
-    u_short ip_id;                    /* identification */
-    u_short ip_off;                   /* fragment offset field */
-#define PACKET_CAPTURE_SNIFF_IP_RF 0x8000 /* reserved fragment flag */
-#define PACKET_CAPTURE_SNIFF_IP_DF 0x4000 /* dont fragment flag */
-#define PACKET_CAPTURE_SNIFF_IP_MF 0x2000 /* more fragments flag */
-#define PACKET_CAPTURE_SNIFF_IP_OFFMASK 0x1fff /* mask for fragmenting bits */
-    u_char  ip_ttl;                   /* time to live */
-    u_char  ip_p;                     /* protocol */
-    u_short ip_sum;                   /* checksum */
-    struct  in_addr ip_src,ip_dst;    /* source and dest address */
-};
-
-#define PACKET_CAPTURE_IP_HL(ip)               (((ip)->ip_vhl) & 0x0f)
-#define PACKET_CAPTURE_IP_V(ip)                (((ip)->ip_vhl) >> 4)
-
-/* TCP header */
-typedef u_int tcp_seq;
-
-struct sniff_tcp {
-    u_short th_sport;               /* source port */
-    u_short th_dport;               /* destination port */
-    tcp_seq th_seq;                 /* sequence number */
-    tcp_seq th_ack;                 /* acknowledgement number */
-    u_char  th_offx2;               /* data offset, rsvd */
-#define PACKET_CAPTURE_TH_OFF(th)      (((th)->th_offx2 & 0xf0) >> 4)
-    u_char  th_flags;
-#define PACKET_CAPTURE_TH_FIN  0x01
-#define PACKET_CAPTURE_TH_SYN  0x02
-#define PACKET_CAPTURE_TH_RST  0x04
-#define PACKET_CAPTURE_TH_PUSH 0x08
-#define PACKET_CAPTURE_TH_ACK  0x10
-#define PACKET_CAPTURE_TH_URG  0x20
-#define PACKET_CAPTURE_TH_ECE  0x40
-#define PACKET_CAPTURE_TH_CWR  0x80
-    u_short th_win;                 /* window */
-    u_short th_sum;                 /* checksum */
-    u_short th_urp;                 /* urgent pointer */
-};
-
-tcp_state_t global_tcp_state;
-
-
 static pcap_t *open_pcap_handle_from_file(const char *file_name) {
     ASSERT(file_name);
     char errbuf[PCAP_ERRBUF_SIZE];
     
-    pcap_t *handle = pcap_open_offline(file_name, errbuf);
+    /* libpcap scales microsecond savefiles up, so the time base is always nanoseconds. */
+    pcap_t *handle = pcap_open_offline_with_tstamp_precision(file_name, PCAP_TSTAMP_PRECISION_NANO, errbuf);
     if (!handle) {
         FATAL("Can't open file: %s.  Error: %s", file_name, errbuf);        
     }
@@ -83,7 +41,8 @@ static pcap_t *open_pcap_handle_from_file(const char *file_name) {
     return handle;
 }
 
-static pcap_t *open_pcap_handle_from_device(const char *device) {
+/* tstamp_type is the name of an adapter timestamp type, e.g. "adapter_unsynced", or NULL for the default. */
+static pcap_t *open_pcap_handle_from_device(const char *device, const char *tstamp_type, int snaplen) {
     ASSERT(device);    
     char errbuf[PCAP_ERRBUF_SIZE];    
     
@@ -101,7 +60,7 @@ static pcap_t *open_pcap_handle_from_device(const char *device) {
         FATAL("pcap_set_timeout failed, result=%d", result);
     }
     
-    if ((result = pcap_set_snaplen(handle, 0xffff)) != 0) {
+    if ((result = pcap_set_snaplen(handle, snaplen)) != 0) {
         FATAL("pcap_set_snaplen failed, result=%d", result);
     }
     
@@ -110,8 +69,26 @@ static pcap_t *open_pcap_handle_from_device(const char *device) {
         FATAL("pcap_set_buffer_size failed.  buffer_size=%zu, result=%d", buffer_size, result);
     }
     
-    if ((result = pcap_activate(handle)) != 0) {
+    if ((result = pcap_set_tstamp_precision(handle, PCAP_TSTAMP_PRECISION_NANO)) != 0) {
+        LOG("Nanosecond timestamps aren't supported on %s, using microseconds.  result=%d", device, result);
+    }
+
+    if (tstamp_type) {
+        int tstamp_type_val = pcap_tstamp_type_name_to_val(tstamp_type);
+        if (tstamp_type_val < 0) {
+            FATAL("Unknown timestamp type: %s", tstamp_type);
+        }
+
+        if ((result = pcap_set_tstamp_type(handle, tstamp_type_val)) != 0) {
+            LOG("Timestamp type %s isn't supported on %s, using the default.  result=%d", tstamp_type, device, result);
+        }
+    }
+
+    /* Warnings, e.g. that the timestamp type wasn't supported after all, still leave us with a working handle. */
+    if ((result = pcap_activate(handle)) < 0) {
         FATAL("pcap_activate failed, result=%d", result);
+    } else if (result > 0) {
+        LOG("pcap_activate warning, result=%d", result);
     }
     
     return handle;
@@ -142,117 +119,90 @@ static void set_bpf_filter(pcap_t *pcap_handle, const char *device, const char *
 }
 
 
-static void on_packet(u_char *ctx_uc, const struct pcap_pkthdr *header, const u_char *packet) {
-    set_now(&header->ts);
-    
-    /* declare pointers to packet headers */
-    const struct sniff_ip *ip;              /* The IP header */
-    const struct sniff_tcp *tcp;            /* The TCP header */
-    const u_char *payload;                  /* Packet payload */
-
-    int size_ip;
-    int size_tcp;
-    int size_payload;
-
-    /* define/compute ip header offset */
-    ASSERT(sizeof(struct sniff_ethernet) == 14);
-    ip = (struct sniff_ip*)(packet + sizeof(struct sniff_ethernet));
-    size_ip = PACKET_CAPTURE_IP_HL(ip)*4;
-    if (size_ip < 20) {
-        // Invalid IP header length.
-        return;
-    }
-
-    /* determine protocol */
-    switch (ip->ip_p) {
-        case IPPROTO_TCP:
-          break;
-  
-        case IPPROTO_UDP:
-          // Not supported yet (HTTP/3?!)
-          return;
-  
-        case IPPROTO_ICMP:
-        case IPPROTO_IP:
-        default:
-          return;
-    }
-
-    /* OK, this packet is TCP. */
-    /* define/compute tcp header offset */
-    tcp = (struct sniff_tcp*)(packet + sizeof(struct sniff_ethernet) + size_ip);
-    size_tcp = PACKET_CAPTURE_TH_OFF(tcp)*4;
-    if (size_tcp < 20) {
-        // Invalid TCP header length.
-        return;
-    }
-
-    /* NOTE that this code doesn't support ipv6. */
-    char source_address[INET_ADDRSTRLEN + 1];
-    char dest_address[INET_ADDRSTRLEN + 1];
-    memset(source_address, 0, sizeof(source_address));
-    memset(dest_address, 0, sizeof(dest_address));
-
-    inet_ntop(AF_INET, &ip->ip_src, source_address, sizeof(source_address) - 1);
-    inet_ntop(AF_INET, &ip->ip_dst, dest_address, sizeof(dest_address) - 1);
-
-    uint16_t source_port = ntohs(tcp->th_sport);
-    uint16_t dest_port = ntohs(tcp->th_dport);
-
-    /* define/compute tcp payload (segment) offset */
-    payload = (u_char *)(packet + sizeof(struct sniff_ethernet) + size_ip + size_tcp);
-
-    /* compute tcp payload (segment) size */
-    size_payload = ntohs(ip->ip_len) - (size_ip + size_tcp);
-    if (size_payload < 0) {
-        /* ip_len is invalid. */        
-        return;
-    }
-
-    tcp_seq seq = ntohl(tcp->th_seq);
-    tcp_seq ack = ntohl(tcp->th_ack);
-    u_short window = ntohs(tcp->th_win);
-    LOG("source_port=%u dest_port=%u seq=%u ack=%u window=%u size_payload=%d flags=0x%02x",
-        source_port, dest_port, seq, ack, window, size_payload, tcp->th_flags); 
-    
-    const u_char *payload_end = payload + size_payload;
-    const u_char *payload_p = payload;
-    /*TODO: a fancier means of figuring out who the server is. */
-    if (5432 == source_port) {
-        if ((tcp->th_flags & PACKET_CAPTURE_TH_SYN) != 0) {
-            /* It's the first packet in a connection. */
-            tcp_state_set_be_seq_range(&global_tcp_state, dest_port, seq, 0);
-        }
-        
-        if (tcp_state_is_be_packet_in_sequence(&global_tcp_state, dest_port, seq, size_payload)) {
-            for (; payload_p < payload_end; ++payload_p) {        
-                state_machine_be_next(source_port, dest_port, *payload_p, size_payload, stdout);
-            }
-        }
-        
-        if ((tcp->th_flags & PACKET_CAPTURE_TH_ACK) != 0) {
-            tcp_state_set_fe_seq_range(&global_tcp_state, dest_port, ack, window);
-        }
-    } else {
-        if ((tcp->th_flags & PACKET_CAPTURE_TH_SYN) != 0) {
-            /* It's the first packet in a connection. */
-            tcp_state_set_fe_seq_range(&global_tcp_state, source_port, seq, 0);
-        }
-        
-        if (tcp_state_is_fe_packet_in_sequence(&global_tcp_state, source_port, seq, size_payload)) {
-            for (; payload_p < payload_end; ++payload_p) {        
-                state_machine_fe_next(source_port, dest_port, *payload_p, size_payload, stdout);
-            }
-        }
-        
-        if ((tcp->th_flags & PACKET_CAPTURE_TH_ACK) != 0) {
-            tcp_state_set_be_seq_range(&global_tcp_state, source_port, ack, window);
-        }
+/* Charges the tables that are allocated up front to the memory budget, and makes sure that they fit.  The trace store
+   isn't open yet, see main. */
+static void charge_fixed_memory(bool is_trace_store_enabled) {
+    uint64_t trace_buffers_size = 2 * (sizeof(global_state.connections) / sizeof(global_state.connections[0])) *
+                                  sizeof(message_trace_buffer_t);
+    memory_budget_charge_fixed(&global_memory_budget,
+                               MEMORY_SUBSYSTEM_CONNECTIONS,
+                               sizeof(global_state) - trace_buffers_size + sizeof(global_tcp_state) + sizeof(global_checkpoint) +
+                               sizeof(global_sessions) + sizeof(global_cancel_keys));
+    memory_budget_charge_fixed(&global_memory_budget,
+                               MEMORY_SUBSYSTEM_MESSAGE_BUFFERS,
+                               trace_buffers_size + OUTPUT_BUFFER_SIZE + global_ring_output.size +
+                               (is_trace_store_enabled ? sizeof(global_trace_store) : 0));
+    memory_budget_charge_fixed(&global_memory_budget,
+                               MEMORY_SUBSYSTEM_AGGREGATION,
+                               sizeof(global_error_stats) + sizeof(global_top_statements) + sizeof(global_pooler) +
+                               sizeof(global_metrics) + sizeof(global_metrics_exposition) + sizeof(global_session_tags) +
+                               (rollup_writer_is_enabled(&global_rollup_writer) ? sizeof(global_rollup_writer) : 0));
+
+    uint64_t used = memory_budget_used(&global_memory_budget);
+    if (memory_budget_is_limited(&global_memory_budget) && (used > global_memory_budget.limit_bytes)) {
+        FATAL("The memory limit is less than the %llu MB that's allocated at startup", (unsigned long long)(used >> 20) + 1);
     }
+
+    memory_budget_update_level(&global_memory_budget);
 }
 
 pcap_t *global_pcap_handle;
 
+/* Makes the latest metrics visible to the metrics server thread. */
+static void publish_metrics() {
+    struct pcap_stat ps;
+    bool has_capture_stats = (pcap_stats(global_pcap_handle, &ps) == 0);
+    global_metrics.memory = global_memory_budget;
+    global_metrics.overload = global_overload_controller;
+    global_metrics.trace_mode = global_trace_mode;
+    metrics_exposition_publish(&global_metrics_exposition, has_capture_stats ? &ps : NULL, &global_metrics);
+}
+
+/* How much of the pipe that stdout writes to hasn't been read yet, or 0 if stdout isn't a pipe. */
+static uint64_t get_output_fill_percent() {
+    struct stat st;
+    int num_unread;
+    if ((fstat(STDOUT_FILENO, &st) != 0) || !S_ISFIFO(st.st_mode) || (ioctl(STDOUT_FILENO, FIONREAD, &num_unread) != 0)) {
+        return 0;
+    }
+
+    int capacity = OUTPUT_PIPE_DEFAULT_CAPACITY;
+#ifdef F_GETPIPE_SZ
+    int pipe_size = fcntl(STDOUT_FILENO, F_GETPIPE_SZ);
+    if (pipe_size > 0) {
+        capacity = pipe_size;
+    }
+#endif
+    return (uint64_t)num_unread * 100 / capacity;
+}
+
+/* How far behind the wall clock the packet that we've just processed is, i.e. how long it sat in the capture ring. */
+static uint64_t get_capture_lag_nsec() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
+        return 0;
+    }
+
+    uint64_t wall_nsec = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return (wall_nsec > now_epoch_nsec()) ? wall_nsec - now_epoch_nsec() : 0;
+}
+
+static void check_overload(uint64_t capture_lag_nsec) {
+    overload_signals_t signals;
+    signals.num_dropped_packets = 0;
+    signals.capture_lag_nsec = capture_lag_nsec;
+    signals.output_fill_percent = get_output_fill_percent();
+    struct pcap_stat ps;
+    if (pcap_stats(global_pcap_handle, &ps) == 0) {
+        signals.num_dropped_packets = overload_controller_on_ps_drop(&global_overload_controller, ps.ps_drop);
+    }
+
+    if (overload_controller_check(&global_overload_controller, &signals)) {
+        update_max_trace_payload_size();
+        fflush(stdout);
+    }
+}
+
 static void print_stats() {
     struct pcap_stat ps;
     if (pcap_stats(global_pcap_handle, &ps) != 0) {
@@ -262,13 +212,35 @@ static void print_stats() {
     }
 }
 
+/* Set by SIGUSR1 and acted on in the capture loop, where it's safe to look at the statement sketches. */
+volatile sig_atomic_t global_is_top_statements_requested;
+
 static void signal_handler(int sig, siginfo_t *siginfo, void *context) {
 	if (SIGUSR1 == sig) {
         print_stats();
+        global_is_top_statements_requested = 1;
         fflush(stdout);
     } 
 }
 
+/* Set by SIGTERM & SIGINT when there's a checkpoint, replay script, rollups or stored messages to save, so that we stop
+   cleanly rather than just dying. */
+volatile sig_atomic_t global_is_stop_requested;
+
+static void stop_signal_handler(int sig) {
+    global_is_stop_requested = 1;
+    pcap_breakloop(global_pcap_handle);
+}
+
+static void install_stop_signal_handler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stop_signal_handler;
+    if ((sigaction(SIGTERM, &sa, NULL) < 0) || (sigaction(SIGINT, &sa, NULL) < 0)) {
+        FATAL("sigaction failed, errno=%d", errno);
+    }
+}
+
 static void install_signal_handler() {
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -280,37 +252,234 @@ static void install_signal_handler() {
 }
 
 static void set_big_output_buffer() {
-    if (setvbuf(stdout, NULL, _IOFBF, 256 * 1024) != 0) {
+    if (setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER_SIZE) != 0) {
         FATAL("setvbuf failed, errno=%d", errno);
     }
 }
 
-int main(const int argc, const char *argv[]) {
-    if ((argc != 2) && (argc != 3)) {
-        fprintf(stderr, "Usage: %s device_to_sniff pcap_filter_string\n", PROGRAM_NAME);
-        fprintf(stderr, "OR:    %s pcap_file\n", PROGRAM_NAME);
-        fprintf(stderr, "Use kill -SIGUSR1 to tell it to print stats & flush its output buffer.\n");
+static void print_usage() {
+    fprintf(stderr, "Usage: %s [options] device_to_sniff pcap_filter_string\n", PROGRAM_NAME);
+    fprintf(stderr, "OR:    %s [options] pcap_file\n", PROGRAM_NAME);
+    fprintf(stderr, "  -j          Write one JSON object per message (NDJSON) with decoded protocol fields instead of text lines.\n");
+    fprintf(stderr, "  -R path     Publish each message as a fixed-size binary record to a shared-memory ring in this file, for\n");
+    fprintf(stderr, "              local readers, instead of printing it.  See shm_ring.h.\n");
+    fprintf(stderr, "  -i seconds  Print summaries of errors by SQLSTATE & connection, and of transaction & Execute timings, this often.\n");
+    fprintf(stderr, "  -w path     Append per-interval rollups of each message type, statement & application to this file,\n");
+    fprintf(stderr, "              for pgrollup.  See rollup_format.h.\n");
+    fprintf(stderr, "  -W seconds  The rollup interval.  Defaults to 1.\n");
+    fprintf(stderr, "  -x path     Append each traced message to a compressed store in this file that's indexed by time &\n");
+    fprintf(stderr, "              connection, for pgtracequery.  See trace_store_format.h.\n");
+    fprintf(stderr, "  -m address  Serve Prometheus metrics over HTTP on this Unix socket path, or TCP port on localhost.\n");
+    fprintf(stderr, "  -b          Don't trace CopyData & DataRow messages, just print a line per COPY & query result with\n");
+    fprintf(stderr, "              its message count, bytes, duration & throughput.\n");
+    fprintf(stderr, "  -t count    Track the statements with the most total time & the most calls over the last 1, 5 & 15 minutes,\n");
+    fprintf(stderr, "              and print the top count of each with the summaries and on SIGUSR1.  At most %d.\n", TOP_STATEMENTS_CAPACITY);
+    fprintf(stderr, "  -s path     Save the parser state of live connections to this file on SIGTERM, SIGINT or the end of a\n");
+    fprintf(stderr, "              pcap_file, and pick up from it at startup.\n");
+    fprintf(stderr, "  -r path     Write the front-end messages of each connection that starts to this file, for pgreplay.\n");
+    fprintf(stderr, "  -P port     Also trace clients of a connection pooler, e.g. pgbouncer, listening on this port on the same\n");
+    fprintf(stderr, "              host, and report how long their Queries & Executes wait in the pooler with the summaries.\n");
+    fprintf(stderr, "  -n          Print trace & log timestamps in nanoseconds rather than microseconds.\n");
+    fprintf(stderr, "  -M mb       Keep memory use under this many megabytes.  As what's allocated after startup fills what the\n");
+    fprintf(stderr, "              limit leaves, rollups are written every interval, then idle connections are forgotten, then\n");
+    fprintf(stderr, "              replay recording stops.\n");
+    fprintf(stderr, "  -a          When capturing from device_to_sniff, trace just message headers and then nothing but the\n");
+    fprintf(stderr, "              summaries if packets are dropped or the capture or output falls behind.\n");
+    fprintf(stderr, "  -I path     Don't parse connections that match the rules in this file, just count their bytes.  Each line\n");
+    fprintf(stderr, "              is ignore followed by cidr, user, database or application_name and a value, by query and\n");
+    fprintf(stderr, "              the start of the first statement, or by replication alone.\n");
+    fprintf(stderr, "  -S bytes    Capture this much of each packet from device_to_sniff, at most %d.  Defaults to the most.\n",
+            DEFAULT_SNAPLEN);
+    fprintf(stderr, "  -T type     Use this adapter timestamp type, e.g. adapter_unsynced, if device_to_sniff supports it.\n");
+    fprintf(stderr, "Use kill -SIGUSR1 to tell it to print stats (and top statements) & flush its output buffer.\n");
+}
+
+static uint64_t parse_uint_option(int opt, const char *value) {
+    char *end;
+    errno = 0;
+    unsigned long long result = strtoull(value, &end, 10);
+    if ((errno != 0) || (end == value) || (*end != '\0') || (value[0] == '-')) {
+        fprintf(stderr, "Invalid value for -%c: '%s'\n", opt, value);
+        exit(1);
+    }
+
+    return result;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t summary_interval_sec = 0;
+    const char *metrics_address = NULL;
+    const char *checkpoint_path = NULL;
+    const char *replay_path = NULL;
+    uint64_t num_top_statements = 0;
+    const char *tstamp_type = NULL;
+    uint64_t pooler_port = 0;
+    uint64_t memory_limit_mb = 0;
+    bool is_adaptive = false;
+    const char *bypass_rules_path = NULL;
+    const char *ring_path = NULL;
+    const char *rollup_path = NULL;
+    uint64_t rollup_interval_sec = 1;
+    const char *trace_store_path = NULL;
+    uint64_t snaplen = DEFAULT_SNAPLEN;
+    int opt;
+    while ((opt = getopt(argc, argv, "abjni:I:m:M:P:r:R:s:S:t:T:w:W:x:")) != -1) {
+        switch (opt) {
+            case 'a':
+                is_adaptive = true;
+                break;
+
+            case 'b':
+                global_is_bulk_accounting_enabled = true;
+                break;
+
+            case 'j':
+                global_output_format = OUTPUT_FORMAT_NDJSON;
+                break;
+
+            case 'n':
+                global_is_nsec_timestamps = true;
+                break;
+
+            case 'i':
+                summary_interval_sec = parse_uint_option(opt, optarg);
+                break;
+
+            case 'I':
+                bypass_rules_path = optarg;
+                break;
+
+            case 'm':
+                metrics_address = optarg;
+                break;
+
+            case 'M':
+                memory_limit_mb = parse_uint_option(opt, optarg);
+                break;
+
+            case 'P':
+                pooler_port = parse_uint_option(opt, optarg);
+                if ((0 == pooler_port) || (pooler_port > 0xffff) || (5432 == pooler_port)) {
+                    fprintf(stderr, "Invalid value for -P: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'r':
+                replay_path = optarg;
+                break;
+
+            case 'R':
+                ring_path = optarg;
+                break;
+
+            case 's':
+                checkpoint_path = optarg;
+                break;
+
+            case 'S':
+                snaplen = parse_uint_option(opt, optarg);
+                if ((snaplen < 128) || (snaplen > DEFAULT_SNAPLEN)) {
+                    fprintf(stderr, "Invalid value for -S: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'T':
+                tstamp_type = optarg;
+                break;
+
+            case 'w':
+                rollup_path = optarg;
+                break;
+
+            case 'W':
+                rollup_interval_sec = parse_uint_option(opt, optarg);
+                if (0 == rollup_interval_sec) {
+                    fprintf(stderr, "Invalid value for -W: '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'x':
+                trace_store_path = optarg;
+                break;
+
+            case 't':
+                num_top_statements = parse_uint_option(opt, optarg);
+                if (num_top_statements > TOP_STATEMENTS_CAPACITY) {
+                    fprintf(stderr, "Invalid value for -t: at most %d statements can be tracked\n", TOP_STATEMENTS_CAPACITY);
+                    return 1;
+                }
+                break;
+
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    int num_args = argc - optind;
+    if ((num_args != 1) && (num_args != 2)) {
+        print_usage();
         return 1;
     }
     
-    const char *device_or_file = argv[1];
-    const char *filter = (argc < 3) ? NULL : argv[2];
+    const char *device_or_file = argv[optind];
+    const char *filter = (num_args < 2) ? NULL : argv[optind + 1];
     
+    message_sink_init(&global_message_sink, NULL, NULL);
+    if (ring_path) {
+        ring_output_open(&global_ring_output, ring_path, RING_OUTPUT_DEFAULT_NUM_SLOTS);
+        message_sink_init(&global_message_sink, ring_output_on_message, &global_ring_output);
+        global_output_format = OUTPUT_FORMAT_NONE;
+    }
+
+    if (rollup_path) {
+        rollup_writer_open(&global_rollup_writer, rollup_path, rollup_interval_sec * 1000000000);
+    }
+
     tcp_state_init(&global_tcp_state);
+    interval_timer_init(&global_summary_timer, summary_interval_sec * 1000000);
+    interval_timer_init(&global_eviction_timer, MEMORY_BUDGET_EVICTION_INTERVAL_USEC);
+    memory_budget_init(&global_memory_budget, memory_limit_mb << 20);
+    overload_controller_init(&global_overload_controller, is_adaptive && filter);
+    charge_fixed_memory(trace_store_path != NULL);
+    error_stats_init(&global_error_stats);
+    transaction_stats_init(&global_transaction_stats);
+    pipeline_stats_init(&global_pipeline_stats);
+    connection_setup_stats_init(&global_connection_setup_stats);
+    pooler_stats_init(&global_pooler_stats);
+    pooler_init(&global_pooler, pooler_port);
+    session_tags_init(&global_session_tags);
+    cancel_keys_init(&global_cancel_keys);
+    bypass_rules_init(&global_bypass_rules);
+    if (bypass_rules_path) {
+        bypass_rules_load(&global_bypass_rules, bypass_rules_path);
+    }
+    top_statements_init(&global_top_statements, num_top_statements);
     install_signal_handler();
     set_big_output_buffer();
     
     test();    
     LOG("Self-test complete. device_or_file='%s' filter='%s'", device_or_file, filter);    
+    /* Not until now, so that the self-test's messages aren't stored. */
+    if (trace_store_path) {
+        trace_store_open(&global_trace_store, trace_store_path);
+    }
 
     struct bpf_program bpf;
     
     if (filter) {
-        global_pcap_handle = open_pcap_handle_from_device(device_or_file);
+        global_pcap_handle = open_pcap_handle_from_device(device_or_file, tstamp_type, snaplen);
         set_bpf_filter(global_pcap_handle, device_or_file, filter, &bpf);
     } else {
         global_pcap_handle = open_pcap_handle_from_file(device_or_file);
     }
+
+    if (pcap_get_tstamp_precision(global_pcap_handle) == PCAP_TSTAMP_PRECISION_NANO) {
+        global_capture_nsec_per_tick = 1;
+    }
     
     int link_layer_header_type = pcap_datalink(global_pcap_handle);
     if (link_layer_header_type != DLT_EN10MB) {
@@ -318,11 +487,89 @@ int main(const int argc, const char *argv[]) {
     }
     
     state_machine_init();
+    metrics_init(&global_metrics);
+    if (checkpoint_path) {
+        checkpoint_load(&global_checkpoint, checkpoint_path);
+    }
+
+    if (replay_path) {
+        replay_recorder_open(&global_replay_recorder, replay_path);
+    }
+
+    if (checkpoint_path || replay_path || rollup_path || trace_store_path) {
+        install_stop_signal_handler();
+    }
+    
+    if (metrics_address) {
+        publish_metrics();
+        metrics_server_start(metrics_address);
+    }
     
+    /* pcap_dispatch rather than pcap_loop so that the metrics are published even when no packets are arriving. */
     int max_num_packets = -1;
     u_char *context = NULL;
-    if (pcap_loop(global_pcap_handle, max_num_packets, on_packet, context) == -1) {
-        FATAL("pcap_loop failed.  Error: %s", pcap_geterr(global_pcap_handle));
+    time_t last_check_time = time(NULL);
+    /* Adapter timestamps needn't be anything like the wall clock. */
+    bool is_capture_lag_measured = global_overload_controller.is_enabled && !tstamp_type;
+    uint64_t max_capture_lag_nsec = 0;
+    int result = 0;
+    while (!global_is_stop_requested &&
+           ((result = pcap_dispatch(global_pcap_handle, max_num_packets, on_packet, context)) >= 0)) {
+        flush_packet_batch(&global_packet_batch);
+        if (is_capture_lag_measured && (result > 0)) {
+            uint64_t capture_lag_nsec = get_capture_lag_nsec();
+            if (capture_lag_nsec > max_capture_lag_nsec) {
+                max_capture_lag_nsec = capture_lag_nsec;
+            }
+        }
+
+        if (time(NULL) != last_check_time) {
+            if (global_overload_controller.is_enabled) {
+                check_overload(max_capture_lag_nsec);
+                max_capture_lag_nsec = 0;
+            }
+
+            if (metrics_address) {
+                publish_metrics();
+            }
+
+            last_check_time = time(NULL);
+        }
+        
+        if (global_is_top_statements_requested) {
+            global_is_top_statements_requested = 0;
+            top_statements_print(&global_top_statements, stdout);
+            fflush(stdout);
+        }
+        
+        /* A savefile is done when there's nothing left in it. */
+        if (!filter && (0 == result)) {
+            break;
+        }
+    }
+    
+    flush_packet_batch(&global_packet_batch);
+    if (-1 == result) {
+        FATAL("pcap_dispatch failed.  Error: %s", pcap_geterr(global_pcap_handle));
+    }
+    
+    if (metrics_address) {
+        publish_metrics();
+    }
+    
+    if (checkpoint_path) {
+        checkpoint_save(checkpoint_path, &global_tcp_state);
+    }
+
+    replay_recorder_close(&global_replay_recorder);
+    ring_output_close(&global_ring_output);
+    rollup_writer_close(&global_rollup_writer);
+    trace_store_close(&global_trace_store);
+    
+    if (summary_interval_sec > 0) {
+        print_summaries();
+    } else {
+        top_statements_print(&global_top_statements, stdout);
     }
     
     if (filter) {
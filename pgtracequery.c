@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define PROGRAM_NAME "pgtracequery"
+/* We only want some of pgtrace's helpers. */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "common.h"
+#include "message_type.h"
+#include "message_trace_buffer.h"
+#include "payload_reader.h"
+#include "session_tags.h"
+#include "message_json_writer.h"
+#include "rollup_format.h"
+#include "trace_store_format.h"
+#include "time_arg.h"
+
+/* Answers "what did connection 51234 send around 14:02" from a pgtrace -x trace store: the index says which blocks
+   overlap the range and have the connection's messages, and only those are read.  Messages are printed as pgtrace
+   traced them, except that NDJSON records don't have the session's tag ids. */
+
+typedef struct {
+    uint64_t from_nsec;
+    uint64_t to_nsec;
+    /* Only this connection's messages, if is_port_wanted. */
+    bool is_port_wanted;
+    uint16_t fe_port;
+} trace_query_t;
+
+typedef struct {
+    uint64_t num_blocks;
+    uint64_t num_blocks_read;
+    uint64_t num_messages;
+} trace_read_stats_t;
+
+static void *trace_read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        FATAL("Can't open trace store: %s.  errno=%d", path, errno);
+    }
+
+    if ((fseek(fp, 0, SEEK_END) != 0) || (ftell(fp) < 0)) {
+        FATAL("Can't read trace store: %s.  errno=%d", path, errno);
+    }
+
+    *size = ftell(fp);
+    rewind(fp);
+    uint8_t *data = malloc(*size ? *size : 1);
+    if (!data || (fread(data, 1, *size, fp) != *size)) {
+        FATAL("Can't read trace store: %s.  errno=%d", path, errno);
+    }
+
+    fclose(fp);
+    return data;
+}
+
+static void trace_check_header(const uint8_t *header, size_t size, const char *magic, const char *path) {
+    if ((size < TRACE_STORE_HEADER_SIZE) || (memcmp(header, magic, TRACE_STORE_MAGIC_SIZE) != 0) ||
+        (rollup_format_get_uint(header + TRACE_STORE_MAGIC_SIZE, 4) != TRACE_STORE_VERSION)) {
+        FATAL("Not a version %d trace store: %s", TRACE_STORE_VERSION, path);
+    }
+}
+
+/* Whether the index entry's ports, which are ports_size bytes at p, have port. */
+static bool trace_has_port(const uint8_t *p, size_t ports_size, uint16_t port) {
+    const uint8_t *end = p + ports_size;
+    uint64_t entry_port = 0;
+    while (p < end) {
+        uint64_t delta;
+        if ((p = rollup_format_get_varint(p, end, &delta)) == NULL) {
+            return false;
+        }
+
+        entry_port += delta;
+        if (entry_port >= port) {
+            return entry_port == port;
+        }
+    }
+
+    return false;
+}
+
+static void trace_print_message(uint64_t start_nsec,
+                                uint16_t fe_port,
+                                uint8_t flags,
+                                uint8_t message_type,
+                                int32_t length,
+                                const char *name,
+                                const uint8_t *payload,
+                                size_t payload_size) {
+    sender_type_t sender_type = (flags & TRACE_STORE_FLAG_BE) ? SENDER_TYPE_BE : SENDER_TYPE_FE;
+    message_trace_buffer_t buf;
+    global_now_nsec = start_nsec;
+    message_trace_buffer_write_start(&buf, fe_port, sender_type, name);
+    /* A lone byte, e.g. SSLResponseYes, is traced without a length. */
+    if (length >= 4) {
+        message_trace_buffer_write_length_field(&buf, length);
+    }
+
+    if (length > 4) {
+        message_trace_buffer_write_payload_start(&buf);
+        size_t num_room = message_trace_buffer_data_end(&buf) - buf.p;
+        if (payload_size > num_room) {
+            payload_size = num_room;
+            flags |= TRACE_STORE_FLAG_TRUNCATED;
+        }
+
+        memcpy(buf.p, payload, payload_size);
+        buf.p += payload_size;
+    }
+
+    buf.is_truncated = (flags & TRACE_STORE_FLAG_TRUNCATED) != 0;
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_print(&buf, start_nsec, fe_port, sender_type, message_type, name, length, stdout);
+    } else {
+        message_trace_buffer_print(&buf, stdout);
+    }
+}
+
+/* Prints the wanted messages in the raw_size bytes of records at p, from a block that starts at start_nsec.  Returns
+   false if they don't all make sense. */
+static bool trace_read_records(const uint8_t *p,
+                               size_t raw_size,
+                               size_t num_records,
+                               uint64_t start_nsec,
+                               const trace_query_t *query,
+                               trace_read_stats_t *stats) {
+    const uint8_t *end = p + raw_size;
+    uint64_t previous_nsec = start_nsec;
+    size_t i = 0;
+    for (; i < num_records; ++i) {
+        uint64_t delta, length, payload_size;
+        if (((p = rollup_format_get_varint(p, end, &delta)) == NULL) || (end - p < 5)) {
+            return false;
+        }
+
+        uint64_t message_nsec = previous_nsec + trace_store_unzigzag(delta);
+        previous_nsec = message_nsec;
+        uint16_t fe_port = rollup_format_get_uint(p, 2);
+        uint8_t flags = p[2];
+        uint8_t message_type = p[3];
+        p += 4;
+        if (((p = rollup_format_get_varint(p, end, &length)) == NULL) || (p == end) || (*p >= end - p)) {
+            return false;
+        }
+
+        char name[256];
+        size_t name_length = *p++;
+        memcpy(name, p, name_length);
+        name[name_length] = '\0';
+        p += name_length;
+        if (((p = rollup_format_get_varint(p, end, &payload_size)) == NULL) || (payload_size > (uint64_t)(end - p))) {
+            return false;
+        }
+
+        const uint8_t *payload = p;
+        p += payload_size;
+        if ((message_nsec < query->from_nsec) || (message_nsec >= query->to_nsec) ||
+            (query->is_port_wanted && (fe_port != query->fe_port))) {
+            continue;
+        }
+
+        stats->num_messages++;
+        trace_print_message(message_nsec, fe_port, flags, message_type, (int32_t)length, name, payload, payload_size);
+    }
+
+    return p == end;
+}
+
+static void trace_query_file(const char *path, const trace_query_t *query) {
+    size_t index_path_size = strlen(path) + sizeof(TRACE_STORE_INDEX_SUFFIX);
+    char *index_path = malloc(index_path_size);
+    if (!index_path) {
+        FATAL("Can't allocate the path of %s's index", path);
+    }
+
+    snprintf(index_path, index_path_size, "%s%s", path, TRACE_STORE_INDEX_SUFFIX);
+    size_t index_size;
+    uint8_t *index = trace_read_file(index_path, &index_size);
+    trace_check_header(index, index_size, TRACE_STORE_INDEX_MAGIC, index_path);
+    FILE *fp = fopen(path, "rb");
+    uint8_t header[TRACE_STORE_HEADER_SIZE];
+    if (!fp || (fread(header, sizeof(header), 1, fp) != 1)) {
+        FATAL("Can't read trace store: %s.  errno=%d", path, errno);
+    }
+
+    trace_check_header(header, sizeof(header), TRACE_STORE_FILE_MAGIC, path);
+    trace_read_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    uint8_t *stored = malloc(TRACE_STORE_BLOCK_SIZE);
+    uint8_t *raw = malloc(TRACE_STORE_BLOCK_SIZE);
+    if (!stored || !raw) {
+        FATAL("Can't allocate %d bytes for trace store blocks", 2 * TRACE_STORE_BLOCK_SIZE);
+    }
+
+    const uint8_t *index_end = index + index_size;
+    const uint8_t *entry = index + TRACE_STORE_HEADER_SIZE;
+    while (entry + TRACE_STORE_INDEX_ENTRY_HEADER_SIZE <= index_end) {
+        uint64_t start_nsec = rollup_format_get_uint(entry, 8);
+        uint64_t end_nsec = rollup_format_get_uint(entry + 8, 8);
+        uint64_t offset = rollup_format_get_uint(entry + 16, 8);
+        size_t ports_size = rollup_format_get_uint(entry + 24, 4);
+        const uint8_t *ports = entry + TRACE_STORE_INDEX_ENTRY_HEADER_SIZE;
+        if (ports_size > (size_t)(index_end - ports)) {
+            /* The entry is still being written. */
+            break;
+        }
+
+        entry = ports + ports_size;
+        stats.num_blocks++;
+        if ((end_nsec < query->from_nsec) || (start_nsec >= query->to_nsec) ||
+            (query->is_port_wanted && !trace_has_port(ports, ports_size, query->fe_port))) {
+            continue;
+        }
+
+        uint8_t block_header[TRACE_STORE_BLOCK_HEADER_SIZE];
+        if ((fseek(fp, offset, SEEK_SET) != 0) || (fread(block_header, sizeof(block_header), 1, fp) != 1)) {
+            FATAL("Can't read the trace store block at %llu in %s", (unsigned long long)offset, path);
+        }
+
+        size_t num_records = rollup_format_get_uint(block_header + 16, 4);
+        size_t raw_size = rollup_format_get_uint(block_header + 20, 4);
+        size_t stored_size = rollup_format_get_uint(block_header + 24, 4);
+        uint8_t compression = block_header[28];
+        bool is_ok = (raw_size <= TRACE_STORE_BLOCK_SIZE) && (stored_size <= TRACE_STORE_BLOCK_SIZE) &&
+                     (fread(stored, stored_size, 1, fp) == 1);
+        if (is_ok && (TRACE_STORE_COMPRESSION_LZ == compression)) {
+            is_ok = trace_store_decompress(stored, stored_size, raw, raw_size);
+        } else if (is_ok && (TRACE_STORE_COMPRESSION_NONE == compression)) {
+            is_ok = (stored_size == raw_size);
+            memcpy(raw, stored, raw_size);
+        } else {
+            is_ok = false;
+        }
+
+        if (!is_ok || !trace_read_records(raw, raw_size, num_records, start_nsec, query, &stats)) {
+            FATAL("The trace store block at %llu in %s is damaged", (unsigned long long)offset, path);
+        }
+
+        stats.num_blocks_read++;
+    }
+
+    fclose(fp);
+    global_now_nsec = query->from_nsec;
+    uint64_t to_nsec = (UINT64_MAX == query->to_nsec) ? query->from_nsec : query->to_nsec;
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"TraceStoreRange\"");
+        message_json_writer_write_key(&writer, "to");
+        message_json_writer_write_timestamp(&writer, to_nsec);
+        message_json_writer_write_uint_field(&writer, "blocks", stats.num_blocks);
+        message_json_writer_write_uint_field(&writer, "blocks_read", stats.num_blocks_read);
+        message_json_writer_write_uint_field(&writer, "messages", stats.num_messages);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+    } else {
+        char to_str[64];
+        timestamp_to_dec_str(to_str, to_nsec);
+        LOG("trace store range: to=%s blocks=%llu blocks_read=%llu messages=%llu",
+            to_str,
+            (unsigned long long)stats.num_blocks,
+            (unsigned long long)stats.num_blocks_read,
+            (unsigned long long)stats.num_messages);
+    }
+
+    free(raw);
+    free(stored);
+    free(index);
+    free(index_path);
+}
+
+/* The latest message time in the file's index, or 0 if there isn't one. */
+static uint64_t trace_last_end_nsec(const char *path) {
+    size_t index_path_size = strlen(path) + sizeof(TRACE_STORE_INDEX_SUFFIX);
+    char *index_path = malloc(index_path_size);
+    if (!index_path) {
+        FATAL("Can't allocate the path of %s's index", path);
+    }
+
+    snprintf(index_path, index_path_size, "%s%s", path, TRACE_STORE_INDEX_SUFFIX);
+    size_t index_size;
+    uint8_t *index = trace_read_file(index_path, &index_size);
+    uint64_t end_nsec = 0;
+    const uint8_t *entry = index + TRACE_STORE_HEADER_SIZE;
+    while (entry + TRACE_STORE_INDEX_ENTRY_HEADER_SIZE <= index + index_size) {
+        uint64_t entry_end_nsec = rollup_format_get_uint(entry + 8, 8);
+        if (entry_end_nsec > end_nsec) {
+            end_nsec = entry_end_nsec;
+        }
+
+        entry += TRACE_STORE_INDEX_ENTRY_HEADER_SIZE + rollup_format_get_uint(entry + 24, 4);
+    }
+
+    free(index);
+    free(index_path);
+    return end_nsec;
+}
+
+static void print_usage() {
+    fprintf(stderr, "Usage: %s [options] trace_store_file [from [to]]\n", PROGRAM_NAME);
+    fprintf(stderr, "Prints the messages in a pgtrace -x trace store from from (inclusive) to to (exclusive), which are\n");
+    fprintf(stderr, "epoch seconds, local \"YYYY-MM-DD HH:MM[:SS]\" or local \"HH:MM[:SS]\" on the day of the last message.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p port      Only the messages of the connection from this front-end port.\n");
+    fprintf(stderr, "  -j           Write one JSON object per message (NDJSON).\n");
+}
+
+int main(int argc, char *argv[]) {
+    trace_query_t query;
+    memset(&query, 0, sizeof(query));
+    int opt;
+    while ((opt = getopt(argc, argv, "jp:")) != -1) {
+        char *end;
+        unsigned long long port;
+        switch (opt) {
+            case 'j':
+                global_output_format = OUTPUT_FORMAT_NDJSON;
+                break;
+
+            case 'p':
+                port = strtoull(optarg, &end, 10);
+                if ((end == optarg) || (*end != '\0') || (port > 0xffff)) {
+                    fprintf(stderr, "Invalid value for -p: '%s'\n", optarg);
+                    return 1;
+                }
+
+                query.is_port_wanted = true;
+                query.fe_port = (uint16_t)port;
+                break;
+
+            default:
+                print_usage();
+                return 1;
+        }
+    }
+
+    int num_args = argc - optind;
+    if ((num_args < 1) || (num_args > 3)) {
+        print_usage();
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    uint64_t last_end_nsec = trace_last_end_nsec(path);
+    query.from_nsec = 0;
+    query.to_nsec = UINT64_MAX;
+    if ((num_args > 1) && !time_arg_parse(argv[optind + 1], last_end_nsec, &query.from_nsec)) {
+        fprintf(stderr, "Invalid from time: '%s'\n", argv[optind + 1]);
+        return 1;
+    }
+
+    if ((num_args > 2) && !time_arg_parse(argv[optind + 2], last_end_nsec, &query.to_nsec)) {
+        fprintf(stderr, "Invalid to time: '%s'\n", argv[optind + 2]);
+        return 1;
+    }
+
+    trace_query_file(path, &query);
+    return 0;
+}
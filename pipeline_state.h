@@ -0,0 +1,215 @@
+#ifndef PIPELINE_STATE_H
+#define PIPELINE_STATE_H
+
+/* Drivers that pipeline send a whole batch of Parse/Bind/Describe/Execute before their Sync.  Past this many
+   outstanding requests we assume that we've lost track of the oldest. */
+#define PIPELINE_STATE_MAX_REQUESTS 64
+
+typedef struct {
+    uint8_t message_type;
+    /* For a Query or Execute, whether statement_ref says which of the connection's statements it runs. */
+    bool has_statement;
+    uint16_t statement_ref;
+    uint64_t sent_nsec;
+    /* Once it's been answered, whether the answer included an ErrorResponse. */
+    bool is_failed;
+} pipeline_request_t;
+
+/* The front-end's requests that the back-end hasn't answered yet, oldest first.  The back-end answers them strictly
+   in order, so each response belongs to the oldest. */
+typedef struct {
+    pipeline_request_t requests[PIPELINE_STATE_MAX_REQUESTS];
+    uint8_t first;
+    uint8_t num_requests;
+    /* Queries and Executes amongst the requests. */
+    uint8_t num_statements;
+    /* When the back-end answered the last Query, Execute or FunctionCall, since it can't start on the next request
+       before then.  Not other requests' answers: the back-end sends a Parse's or Bind's with the Execute's at the Sync,
+       so they'd leave the Execute no time of its own. */
+    uint64_t last_response_nsec;
+    /* The oldest request is a Query or FunctionCall that's had an ErrorResponse. */
+    bool is_oldest_failed;
+} pipeline_state_t;
+
+static void pipeline_state_init(pipeline_state_t *state) {
+    ASSERT(state);
+    state->first = 0;
+    state->num_requests = 0;
+    state->num_statements = 0;
+    state->last_response_nsec = 0;
+    state->is_oldest_failed = false;
+}
+
+static inline bool pipeline_state_is_request(fe_message_type_t message_type) {
+    switch (message_type) {
+        case FE_MESSAGE_TYPE_BIND:
+        case FE_MESSAGE_TYPE_CLOSE:
+        case FE_MESSAGE_TYPE_DESCRIBE:
+        case FE_MESSAGE_TYPE_EXECUTE:
+        case FE_MESSAGE_TYPE_FUNCTION_CALL:
+        case FE_MESSAGE_TYPE_PARSE:
+        case FE_MESSAGE_TYPE_QUERY:
+        case FE_MESSAGE_TYPE_SYNC:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+static inline bool pipeline_state_is_statement(uint8_t message_type) {
+    return (FE_MESSAGE_TYPE_EXECUTE == message_type) || (FE_MESSAGE_TYPE_QUERY == message_type);
+}
+
+/* Whether the response is the whole answer to a request of the given type. */
+static inline bool pipeline_state_is_answer(uint8_t request_type, be_message_type_t response_type) {
+    switch (response_type) {
+        case BE_MESSAGE_TYPE_PARSE_COMPLETE:
+            return FE_MESSAGE_TYPE_PARSE == request_type;
+
+        case BE_MESSAGE_TYPE_BIND_COMPLETE:
+            return FE_MESSAGE_TYPE_BIND == request_type;
+
+        case BE_MESSAGE_TYPE_CLOSE_COMPLETE:
+            return FE_MESSAGE_TYPE_CLOSE == request_type;
+
+        case BE_MESSAGE_TYPE_ROW_DESCRIPTION:
+        case BE_MESSAGE_TYPE_NO_DATA:
+            return FE_MESSAGE_TYPE_DESCRIBE == request_type;
+
+        case BE_MESSAGE_TYPE_COMMAND_COMPLETE:
+        case BE_MESSAGE_TYPE_EMPTY_QUERY_RESPONSE:
+        case BE_MESSAGE_TYPE_PORTAL_SUSPENDED:
+            return FE_MESSAGE_TYPE_EXECUTE == request_type;
+
+        case BE_MESSAGE_TYPE_READY_FOR_QUERY:
+            return (FE_MESSAGE_TYPE_SYNC == request_type) ||
+                   (FE_MESSAGE_TYPE_QUERY == request_type) ||
+                   (FE_MESSAGE_TYPE_FUNCTION_CALL == request_type);
+
+        default:
+            return false;
+    }
+}
+
+static inline bool pipeline_state_is_any_answer(be_message_type_t response_type) {
+    return pipeline_state_is_answer(FE_MESSAGE_TYPE_PARSE, response_type) ||
+           pipeline_state_is_answer(FE_MESSAGE_TYPE_BIND, response_type) ||
+           pipeline_state_is_answer(FE_MESSAGE_TYPE_CLOSE, response_type) ||
+           pipeline_state_is_answer(FE_MESSAGE_TYPE_DESCRIBE, response_type) ||
+           pipeline_state_is_answer(FE_MESSAGE_TYPE_EXECUTE, response_type) ||
+           pipeline_state_is_answer(FE_MESSAGE_TYPE_SYNC, response_type);
+}
+
+static void pipeline_state_on_desync() {
+    global_pipeline_stats.num_desyncs++;
+    global_metrics.pipeline.num_desyncs++;
+}
+
+static inline const pipeline_request_t *pipeline_state_oldest(const pipeline_state_t *state) {
+    return &state->requests[state->first];
+}
+
+static void pipeline_state_pop(pipeline_state_t *state, pipeline_request_t *request) {
+    ASSERT(state->num_requests > 0);
+    *request = *pipeline_state_oldest(state);
+    state->first = (state->first + 1) % PIPELINE_STATE_MAX_REQUESTS;
+    state->num_requests--;
+    if (pipeline_state_is_statement(request->message_type)) {
+        state->num_statements--;
+    }
+}
+
+static void pipeline_state_push(pipeline_state_t *state,
+                                uint8_t message_type,
+                                bool has_statement,
+                                uint16_t statement_ref,
+                                uint64_t sent_nsec) {
+    ASSERT(state);
+    if (PIPELINE_STATE_MAX_REQUESTS == state->num_requests) {
+        /* Drop only the oldest, so the requests that are still to be answered keep their timings. */
+        pipeline_request_t dropped;
+        pipeline_state_pop(state, &dropped);
+        state->is_oldest_failed = false;
+        pipeline_state_on_desync();
+    }
+
+    pipeline_request_t *request = &state->requests[(state->first + state->num_requests) % PIPELINE_STATE_MAX_REQUESTS];
+    request->message_type = message_type;
+    request->has_statement = has_statement;
+    request->statement_ref = statement_ref;
+    request->sent_nsec = sent_nsec;
+    request->is_failed = false;
+    state->num_requests++;
+    if (pipeline_state_is_statement(message_type)) {
+        state->num_statements++;
+        histogram_add(&global_pipeline_stats.depth, state->num_statements);
+        histogram_add(&global_metrics.pipeline.depth, state->num_statements);
+    }
+}
+
+/* Matches a response from the back-end with the request that it answers.  Returns true if it finishes a request, in
+   which case request is that request and response_nsec is how long the back-end spent on it. */
+static bool pipeline_state_on_be_message(pipeline_state_t *state,
+                                         be_message_type_t message_type,
+                                         pipeline_request_t *request,
+                                         uint64_t *response_nsec) {
+    ASSERT(state);
+    ASSERT(request);
+    ASSERT(response_nsec);
+    if (0 == state->num_requests) {
+        return false;
+    }
+
+    uint8_t oldest_type = pipeline_state_oldest(state)->message_type;
+    if ((FE_MESSAGE_TYPE_QUERY == oldest_type) || (FE_MESSAGE_TYPE_FUNCTION_CALL == oldest_type)) {
+        /* Everything up to the ReadyForQuery is part of the answer, even errors. */
+        if (message_type != BE_MESSAGE_TYPE_READY_FOR_QUERY) {
+            state->is_oldest_failed |= (BE_MESSAGE_TYPE_ERROR_RESPONSE == message_type);
+            return false;
+        }
+
+        pipeline_state_pop(state, request);
+        request->is_failed = state->is_oldest_failed;
+        state->is_oldest_failed = false;
+    } else if (BE_MESSAGE_TYPE_ERROR_RESPONSE == message_type) {
+        if (FE_MESSAGE_TYPE_SYNC == oldest_type) {
+            return false;
+        }
+
+        /* The back-end ignores everything after a failed request until the next Sync. */
+        pipeline_state_pop(state, request);
+        request->is_failed = true;
+        pipeline_request_t ignored;
+        while ((state->num_requests > 0) && (pipeline_state_oldest(state)->message_type != FE_MESSAGE_TYPE_SYNC)) {
+            pipeline_state_pop(state, &ignored);
+        }
+    } else {
+        if (!pipeline_state_is_any_answer(message_type)) {
+            return false;
+        }
+
+        /* If the oldest request isn't the one being answered then we've missed something, so catch up. */
+        while (!pipeline_state_is_answer(pipeline_state_oldest(state)->message_type, message_type)) {
+            pipeline_request_t missed;
+            pipeline_state_pop(state, &missed);
+            pipeline_state_on_desync();
+            if (0 == state->num_requests) {
+                return false;
+            }
+        }
+
+        pipeline_state_pop(state, request);
+    }
+
+    uint64_t now_nsec = now_epoch_nsec();
+    uint64_t start_nsec = (request->sent_nsec > state->last_response_nsec) ? request->sent_nsec : state->last_response_nsec;
+    *response_nsec = (now_nsec > start_nsec) ? now_nsec - start_nsec : 0;
+    if (pipeline_state_is_statement(request->message_type) || (FE_MESSAGE_TYPE_FUNCTION_CALL == request->message_type)) {
+        state->last_response_nsec = now_nsec;
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+/* Extended-protocol requests matched up with their responses.  The global stats are reset for each summary, the
+   metrics' copy isn't. */
+typedef struct {
+    /* From when the back-end could have started on an Execute, i.e. once it was sent and the request before it had
+       been answered, to its CommandComplete, PortalSuspended, EmptyQueryResponse or ErrorResponse. */
+    histogram_t execute_nsec;
+    /* Executes and Queries that were still waiting for their answers, including the new one, each time one was
+       sent. */
+    histogram_t depth;
+    /* Responses that didn't match the oldest outstanding request, or requests that didn't fit. */
+    uint64_t num_desyncs;
+} pipeline_stats_t;
+
+ENGINE_STATE(pipeline_stats_t, global_pipeline_stats);
+#define global_pipeline_stats ENGINE_STATE_OF(global_pipeline_stats)
+
+static void pipeline_stats_init(pipeline_stats_t *stats) {
+    ASSERT(stats);
+    histogram_init(&stats->execute_nsec);
+    histogram_init(&stats->depth);
+    stats->num_desyncs = 0;
+}
+
+static void pipeline_stats_print_summary(pipeline_stats_t *stats, FILE *fp) {
+    ASSERT(stats);
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"PipelineSummary\"");
+        histogram_write_json_field(&stats->execute_nsec, "execute_nsec", &writer);
+        histogram_write_json_field(&stats->depth, "depth", &writer);
+        message_json_writer_write_uint_field(&writer, "desyncs", stats->num_desyncs);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, fp);
+        return;
+    }
+
+    char execute_str[256];
+    char depth_str[256];
+    LOG("pipeline summary: execute_nsec=%s depth=%s desyncs=%llu",
+        histogram_to_str(&stats->execute_nsec, execute_str),
+        histogram_to_str(&stats->depth, depth_str),
+        (unsigned long long)stats->num_desyncs);
+}
+
+#endif
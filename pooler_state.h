@@ -0,0 +1,244 @@
+#ifndef POOLER_STATE_H
+#define POOLER_STATE_H
+
+/* Client statements that are waiting to be seen on a server connection.  More than this many means the pooler is
+   rewriting them or we're missing the server side, so the oldest are given up on. */
+#define POOLER_MAX_PENDING 4096
+
+/* Pending statements are chained by the hash of their key, oldest first, so a server statement only looks at the
+   ones it might be. */
+#define POOLER_NUM_BUCKETS 4096
+#define POOLER_NO_PENDING 0xffff
+
+/* A client statement that hasn't reached the server after this long isn't going to be matched. */
+#define POOLER_MAX_QUEUE_NSEC (10 * (uint64_t)1000000000)
+
+#define POOLER_FNV_OFFSET_BASIS 14695981039346656037ULL
+#define POOLER_FNV_PRIME 1099511628211ULL
+
+typedef struct {
+    /* The hash of the statement's messages, see pooler_leg_on_fe_message. */
+    uint64_t key;
+    uint64_t sent_nsec;
+    bool is_matched;
+    /* The next unmatched statement in the same bucket, or POOLER_NO_PENDING. */
+    uint16_t next;
+} pooler_pending_t;
+
+/* Matches statements on clients' connections to a pooler with the same statements on the pooler's connections to the
+   server, by the hash of their messages.  A pooler forwards statements in the order they arrive, so identical
+   statements are matched oldest first. */
+typedef struct {
+    /* The port that the pooler listens on, or 0 if we're not watching a pooler. */
+    uint16_t port;
+    pooler_pending_t pending[POOLER_MAX_PENDING];
+    size_t first;
+    size_t num_pending;
+    /* Each bucket's oldest and newest unmatched statements, or POOLER_NO_PENDING. */
+    uint16_t bucket_first[POOLER_NUM_BUCKETS];
+    uint16_t bucket_last[POOLER_NUM_BUCKETS];
+} pooler_t;
+
+ENGINE_STATE(pooler_t, global_pooler);
+#define global_pooler ENGINE_STATE_OF(global_pooler)
+
+/* One connection's side of the correlation. */
+typedef struct {
+    /* The connection is from a client to the pooler rather than from the pooler (or anything else) to the server. */
+    bool is_client;
+    uint64_t message_hash;
+    /* The hash of the last Bind, which says with which parameters an Execute runs.  Not its length or its portal and
+       statement names, since poolers can rename prepared statements. */
+    uint64_t bind_hash;
+    /* Bytes and then names of the message in progress that are left out of message_hash. */
+    uint8_t num_unhashed_bytes;
+    uint8_t num_unhashed_names;
+} pooler_leg_t;
+
+static void pooler_init(pooler_t *pooler, uint16_t port) {
+    ASSERT(pooler);
+    pooler->port = port;
+    pooler->first = 0;
+    pooler->num_pending = 0;
+    memset(pooler->bucket_first, 0xff, sizeof(pooler->bucket_first));
+    memset(pooler->bucket_last, 0xff, sizeof(pooler->bucket_last));
+}
+
+static inline bool pooler_is_enabled(const pooler_t *pooler) {
+    return pooler->port != 0;
+}
+
+static inline pooler_pending_t *pooler_oldest(pooler_t *pooler) {
+    return &pooler->pending[pooler->first];
+}
+
+static inline size_t pooler_bucket(uint64_t key) {
+    return (size_t)(key ^ (key >> 32)) & (POOLER_NUM_BUCKETS - 1);
+}
+
+static void pooler_drop_oldest(pooler_t *pooler) {
+    pooler_pending_t *oldest = pooler_oldest(pooler);
+    if (!oldest->is_matched) {
+        /* Being the oldest of all, it's the oldest in its bucket too. */
+        size_t bucket = pooler_bucket(oldest->key);
+        ASSERT(pooler->bucket_first[bucket] == pooler->first);
+        pooler->bucket_first[bucket] = oldest->next;
+        if (POOLER_NO_PENDING == oldest->next) {
+            pooler->bucket_last[bucket] = POOLER_NO_PENDING;
+        }
+
+        global_pooler_stats.num_unmatched++;
+        global_metrics.pooler.num_unmatched++;
+    }
+
+    pooler->first = (pooler->first + 1) % POOLER_MAX_PENDING;
+    pooler->num_pending--;
+}
+
+/* Drops matched statements, and ones that have waited too long, from the front. */
+static void pooler_expire(pooler_t *pooler, uint64_t now_nsec) {
+    while ((pooler->num_pending > 0) &&
+           (pooler_oldest(pooler)->is_matched || (pooler_oldest(pooler)->sent_nsec + POOLER_MAX_QUEUE_NSEC < now_nsec))) {
+        pooler_drop_oldest(pooler);
+    }
+}
+
+/* A client has sent a statement to the pooler. */
+static void pooler_on_client_statement(pooler_t *pooler, uint64_t key, uint64_t sent_nsec) {
+    ASSERT(pooler);
+    pooler_expire(pooler, sent_nsec);
+    if (POOLER_MAX_PENDING == pooler->num_pending) {
+        pooler_drop_oldest(pooler);
+    }
+
+    uint16_t index = (pooler->first + pooler->num_pending) % POOLER_MAX_PENDING;
+    pooler_pending_t *pending = &pooler->pending[index];
+    pending->key = key;
+    pending->sent_nsec = sent_nsec;
+    pending->is_matched = false;
+    pending->next = POOLER_NO_PENDING;
+    pooler->num_pending++;
+
+    size_t bucket = pooler_bucket(key);
+    if (POOLER_NO_PENDING == pooler->bucket_last[bucket]) {
+        pooler->bucket_first[bucket] = index;
+    } else {
+        pooler->pending[pooler->bucket_last[bucket]].next = index;
+    }
+    pooler->bucket_last[bucket] = index;
+}
+
+/* The pooler has sent a statement to the server. */
+static void pooler_on_server_statement(pooler_t *pooler, uint64_t key, uint64_t sent_nsec) {
+    ASSERT(pooler);
+    size_t bucket = pooler_bucket(key);
+    uint16_t previous = POOLER_NO_PENDING;
+    uint16_t index = pooler->bucket_first[bucket];
+    for (; index != POOLER_NO_PENDING; previous = index, index = pooler->pending[index].next) {
+        pooler_pending_t *pending = &pooler->pending[index];
+        if ((pending->key != key) || (pending->sent_nsec > sent_nsec)) {
+            continue;
+        }
+
+        pending->is_matched = true;
+        if (POOLER_NO_PENDING == previous) {
+            pooler->bucket_first[bucket] = pending->next;
+        } else {
+            pooler->pending[previous].next = pending->next;
+        }
+
+        if (pooler->bucket_last[bucket] == index) {
+            pooler->bucket_last[bucket] = previous;
+        }
+
+        uint64_t queue_nsec = sent_nsec - pending->sent_nsec;
+        histogram_add(&global_pooler_stats.queue_nsec, queue_nsec);
+        histogram_add(&global_metrics.pooler.queue_nsec, queue_nsec);
+        global_pooler_stats.num_matched++;
+        global_metrics.pooler.num_matched++;
+        break;
+    }
+
+    pooler_expire(pooler, sent_nsec);
+}
+
+
+static void pooler_leg_init(pooler_leg_t *leg) {
+    ASSERT(leg);
+    leg->is_client = false;
+    leg->message_hash = POOLER_FNV_OFFSET_BASIS;
+    leg->bind_hash = POOLER_FNV_OFFSET_BASIS;
+    leg->num_unhashed_bytes = 0;
+    leg->num_unhashed_names = 0;
+}
+
+/* Hashes bytes of the message that the front-end is sending. */
+static inline void pooler_leg_on_fe_bytes(pooler_leg_t *leg, bool is_message_start, const uint8_t *bytes, size_t num_bytes) {
+    size_t i = 0;
+    if (is_message_start) {
+        leg->message_hash = (POOLER_FNV_OFFSET_BASIS ^ bytes[0]) * POOLER_FNV_PRIME;
+        bool is_bind = (FE_MESSAGE_TYPE_BIND == bytes[0]);
+        leg->num_unhashed_bytes = is_bind ? sizeof(int32_t) : 0;
+        leg->num_unhashed_names = is_bind ? 2 : 0;
+        i = 1;
+    }
+
+    for (; i < num_bytes; ++i) {
+        if (leg->num_unhashed_bytes > 0) {
+            leg->num_unhashed_bytes--;
+        } else if (leg->num_unhashed_names > 0) {
+            if ('\0' == bytes[i]) {
+                leg->num_unhashed_names--;
+            }
+        } else {
+            leg->message_hash = (leg->message_hash ^ bytes[i]) * POOLER_FNV_PRIME;
+        }
+    }
+}
+
+/* The front-end has sent a whole message.  A Query is identified by its own bytes and an Execute by its Bind's
+   parameters and the text of the statement that it runs too, since the portal and statement names alone don't say
+   much.  statement is an Execute's statement, or NULL if it isn't an Execute or we don't know what it runs. */
+static void pooler_leg_on_fe_message(pooler_t *pooler,
+                                     pooler_leg_t *leg,
+                                     fe_message_type_t message_type,
+                                     const statement_text_t *statement,
+                                     uint64_t sent_nsec) {
+    uint64_t key;
+    switch (message_type) {
+        case FE_MESSAGE_TYPE_BIND:
+            leg->bind_hash = leg->message_hash;
+            return;
+
+        case FE_MESSAGE_TYPE_QUERY:
+            key = leg->message_hash;
+            break;
+
+        case FE_MESSAGE_TYPE_EXECUTE:
+            key = (((leg->bind_hash ^ leg->message_hash) * POOLER_FNV_PRIME) ^
+                   (statement ? statement->hash : POOLER_FNV_OFFSET_BASIS)) * POOLER_FNV_PRIME;
+            break;
+
+        default:
+            return;
+    }
+
+    if (leg->is_client) {
+        pooler_on_client_statement(pooler, key, sent_nsec);
+    } else {
+        pooler_on_server_statement(pooler, key, sent_nsec);
+    }
+}
+
+/* A Query or Execute on this connection has finished. */
+static inline void pooler_leg_on_statement_response(const pooler_leg_t *leg, uint64_t response_nsec) {
+    if (leg->is_client) {
+        histogram_add(&global_pooler_stats.client_nsec, response_nsec);
+        histogram_add(&global_metrics.pooler.client_nsec, response_nsec);
+    } else {
+        histogram_add(&global_pooler_stats.server_nsec, response_nsec);
+        histogram_add(&global_metrics.pooler.server_nsec, response_nsec);
+    }
+}
+
+#endif
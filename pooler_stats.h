@@ -0,0 +1,61 @@
+#ifndef POOLER_STATS_H
+#define POOLER_STATS_H
+
+/* Queries & Executes through a connection pooler, split into the time they waited in the pooler and the time the
+   server took.  The global stats are reset for each summary, the metrics' copy isn't. */
+typedef struct {
+    /* From the client sending a statement to the pooler to the pooler sending the same statement to the server. */
+    histogram_t queue_nsec;
+    /* Statement response times on the pooler's connections to the server, and on the clients' connections to the
+       pooler. */
+    histogram_t server_nsec;
+    histogram_t client_nsec;
+    uint64_t num_matched;
+    /* Client statements that we never saw go to the server, e.g. because the pooler rewrote them. */
+    uint64_t num_unmatched;
+} pooler_stats_t;
+
+ENGINE_STATE(pooler_stats_t, global_pooler_stats);
+#define global_pooler_stats ENGINE_STATE_OF(global_pooler_stats)
+
+static void pooler_stats_init(pooler_stats_t *stats) {
+    ASSERT(stats);
+    histogram_init(&stats->queue_nsec);
+    histogram_init(&stats->server_nsec);
+    histogram_init(&stats->client_nsec);
+    stats->num_matched = 0;
+    stats->num_unmatched = 0;
+}
+
+static void pooler_stats_print_summary(pooler_stats_t *stats, FILE *fp) {
+    ASSERT(stats);
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"PoolerSummary\"");
+        message_json_writer_write_uint_field(&writer, "matched", stats->num_matched);
+        message_json_writer_write_uint_field(&writer, "unmatched", stats->num_unmatched);
+        histogram_write_json_field(&stats->queue_nsec, "queue_nsec", &writer);
+        histogram_write_json_field(&stats->server_nsec, "server_nsec", &writer);
+        histogram_write_json_field(&stats->client_nsec, "client_nsec", &writer);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, fp);
+        return;
+    }
+
+    char queue_str[256];
+    char server_str[256];
+    char client_str[256];
+    LOG("pooler summary: matched=%llu unmatched=%llu queue_nsec=%s server_nsec=%s client_nsec=%s",
+        (unsigned long long)stats->num_matched,
+        (unsigned long long)stats->num_unmatched,
+        histogram_to_str(&stats->queue_nsec, queue_str),
+        histogram_to_str(&stats->server_nsec, server_str),
+        histogram_to_str(&stats->client_nsec, client_str));
+}
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef REPLAY_RECORDER_H
+#define REPLAY_RECORDER_H
+
+/* Writes the front-end's messages to a replay script for pgreplay, see replay_script.h. */
+typedef struct {
+    /* NULL if we're not recording. */
+    FILE *fp;
+    const char *path;
+    uint32_t next_connection_id;
+} replay_recorder_t;
+
+replay_recorder_t global_replay_recorder;
+
+/* The message that a connection's front-end is part way through sending.  The buffer is only allocated once the
+   connection sends something. */
+typedef struct {
+    /* 0 until the first message has been recorded. */
+    uint32_t connection_id;
+    /* Only connections that we saw start are recorded, since we need all of their state. */
+    bool is_recording;
+    uint64_t start_nsec;
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} replay_connection_t;
+
+static inline bool replay_recorder_is_enabled(const replay_recorder_t *recorder) {
+    return recorder->fp != NULL;
+}
+
+static void replay_recorder_open(replay_recorder_t *recorder, const char *path) {
+    ASSERT(recorder);
+    ASSERT(path);
+    if ((recorder->fp = fopen(path, "wb")) == NULL) {
+        FATAL("Can't open replay script: %s.  errno=%d", path, errno);
+    }
+
+    uint8_t header[REPLAY_SCRIPT_HEADER_SIZE];
+    memcpy(header, REPLAY_SCRIPT_MAGIC, REPLAY_SCRIPT_MAGIC_SIZE);
+    replay_script_put_uint(header + REPLAY_SCRIPT_MAGIC_SIZE, REPLAY_SCRIPT_VERSION, 4);
+    if (fwrite(header, sizeof(header), 1, recorder->fp) != 1) {
+        FATAL("Can't write replay script: %s.  errno=%d", path, errno);
+    }
+
+    recorder->path = path;
+    recorder->next_connection_id = 1;
+}
+
+static void replay_recorder_close(replay_recorder_t *recorder) {
+    ASSERT(recorder);
+    if (recorder->fp && (fclose(recorder->fp) != 0)) {
+        LOG("Can't write replay script: %s.  errno=%d", recorder->path, errno);
+    }
+
+    recorder->fp = NULL;
+}
+
+static void replay_recorder_write_record(replay_recorder_t *recorder,
+                                         replay_record_kind_t kind,
+                                         uint32_t connection_id,
+                                         uint64_t ts_nsec,
+                                         const uint8_t *message,
+                                         size_t message_size) {
+    uint8_t header[REPLAY_RECORD_HEADER_SIZE];
+    header[0] = kind;
+    replay_script_put_uint(header + 1, connection_id, 4);
+    replay_script_put_uint(header + 5, ts_nsec, 8);
+    replay_script_put_uint(header + 13, message_size, 4);
+    if ((fwrite(header, sizeof(header), 1, recorder->fp) != 1) ||
+        ((message_size > 0) && (fwrite(message, message_size, 1, recorder->fp) != 1))) {
+        LOG("Can't write replay script: %s.  errno=%d.  Stopped recording.", recorder->path, errno);
+        fclose(recorder->fp);
+        recorder->fp = NULL;
+    }
+}
+
+static void replay_connection_free(replay_connection_t *connection) {
+    free(connection->data);
+    if (connection->capacity > 0) {
+        memory_budget_release(&global_memory_budget, MEMORY_SUBSYSTEM_REASSEMBLY, connection->capacity);
+    }
+
+    connection->data = NULL;
+    connection->size = 0;
+    connection->capacity = 0;
+}
+
+/* Forgets the connection's script so far, and starts a new one if is_recording. */
+static void replay_connection_init(replay_connection_t *connection, bool is_recording) {
+    ASSERT(connection);
+    replay_connection_free(connection);
+    connection->connection_id = 0;
+    connection->is_recording = is_recording;
+    connection->start_nsec = 0;
+}
+
+/* Ends the connection's script, e.g. because it ended or because it sent something we couldn't keep. */
+static void replay_connection_stop(replay_recorder_t *recorder, replay_connection_t *connection) {
+    if (replay_recorder_is_enabled(recorder) && (connection->connection_id != 0) && connection->is_recording) {
+        replay_recorder_write_record(recorder, REPLAY_RECORD_KIND_CLOSE, connection->connection_id, now_epoch_nsec(), NULL, 0);
+    }
+
+    replay_connection_free(connection);
+    connection->is_recording = false;
+}
+
+/* Keeps bytes of the message that the front-end is sending. */
+static inline void replay_connection_on_fe_bytes(replay_recorder_t *recorder,
+                                                 replay_connection_t *connection,
+                                                 const uint8_t *bytes,
+                                                 size_t num_bytes) {
+    if (!connection->is_recording) {
+        return;
+    }
+
+    if (0 == connection->size) {
+        connection->start_nsec = now_epoch_nsec();
+    }
+
+    if (connection->size + num_bytes > connection->capacity) {
+        if (connection->size + num_bytes > REPLAY_SCRIPT_MAX_MESSAGE_SIZE) {
+            replay_connection_stop(recorder, connection);
+            return;
+        }
+
+        size_t capacity = connection->capacity ? connection->capacity : 256;
+        while (capacity < connection->size + num_bytes) {
+            capacity *= 2;
+        }
+
+        if ((global_memory_budget.level >= MEMORY_LEVEL_DROP_REASSEMBLY) ||
+            !memory_budget_try_charge(&global_memory_budget, MEMORY_SUBSYSTEM_REASSEMBLY, capacity - connection->capacity)) {
+            replay_connection_stop(recorder, connection);
+            return;
+        }
+
+        uint8_t *data = realloc(connection->data, capacity);
+        if (!data) {
+            FATAL("Can't allocate %zu bytes for a replay message", capacity);
+        }
+
+        connection->data = data;
+        connection->capacity = capacity;
+    }
+
+    memcpy(connection->data + connection->size, bytes, num_bytes);
+    connection->size += num_bytes;
+}
+
+/* The front-end has sent a whole message, all of whose bytes we've been given. */
+static void replay_connection_on_fe_message(replay_recorder_t *recorder,
+                                            replay_connection_t *connection,
+                                            fe_message_type_t message_type) {
+    if (!connection->is_recording) {
+        return;
+    }
+
+    if (replay_script_is_replayable(message_type)) {
+        if (0 == connection->connection_id) {
+            connection->connection_id = recorder->next_connection_id++;
+        }
+
+        replay_recorder_write_record(recorder,
+                                     REPLAY_RECORD_KIND_MESSAGE,
+                                     connection->connection_id,
+                                     connection->start_nsec,
+                                     connection->data,
+                                     connection->size);
+    }
+
+    connection->size = 0;
+}
+
+#endif
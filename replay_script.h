@@ -0,0 +1,48 @@
+#ifndef REPLAY_SCRIPT_H
+#define REPLAY_SCRIPT_H
+
+/* The workload file that pgtrace -r writes and pgreplay reads: each front-end message of each connection that we saw
+   start, in capture order, with when it was sent.  Connections are numbered from 1 in the order that they sent their
+   first recorded message.
+
+   After the header, each record is kind(1) connection_id(4) ts_nsec(8) size(4) and then size bytes of message,
+   type & length included, for REPLAY_RECORD_KIND_MESSAGE.  All fields are big-endian. */
+#define REPLAY_SCRIPT_MAGIC "PGTRRPLY"
+#define REPLAY_SCRIPT_MAGIC_SIZE 8
+#define REPLAY_SCRIPT_VERSION 1
+#define REPLAY_SCRIPT_HEADER_SIZE (REPLAY_SCRIPT_MAGIC_SIZE + 4)
+#define REPLAY_RECORD_HEADER_SIZE 17
+
+/* Longer messages, e.g. big CopyData, aren't kept and their connection isn't recorded any further. */
+#define REPLAY_SCRIPT_MAX_MESSAGE_SIZE (1024 * 1024)
+
+typedef enum {
+    REPLAY_RECORD_KIND_MESSAGE = 'M',
+    /* The connection ended, or stopped being recorded. */
+    REPLAY_RECORD_KIND_CLOSE = 'C',
+} replay_record_kind_t;
+
+static inline void replay_script_put_uint(uint8_t *p, uint64_t value, size_t num_bytes) {
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        p[i] = (uint8_t)(value >> (8 * (num_bytes - 1 - i)));
+    }
+}
+
+static inline uint64_t replay_script_get_uint(const uint8_t *p, size_t num_bytes) {
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        value = (value << 8) | p[i];
+    }
+
+    return value;
+}
+
+/* Whether a front-end message can be sent again as-is.  The startup & authentication exchange depends on the
+   target, so pgreplay does its own. */
+static inline bool replay_script_is_replayable(uint8_t message_type) {
+    return (message_type != FE_MESSAGE_TYPE_SPECIAL) && (message_type != FE_MESSAGE_TYPE_PASSWORD_MESSAGE);
+}
+
+#endif
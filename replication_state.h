@@ -0,0 +1,310 @@
+#ifndef REPLICATION_STATE_H
+#define REPLICATION_STATE_H
+
+/* Streaming replication connections, physical or logical, that get their own lag figures.  Past this many at once the
+   rest are only counted. */
+#define REPLICATION_MAX_REPLICAS 16
+
+/* WAL sends whose acknowledgement is being waited for, per replica, like the walsender's LagTracker. */
+#define REPLICATION_NUM_LAG_SAMPLES 64
+
+/* The CopyData sub-messages that are decoded.  Only their fixed-size headers are read, the WAL after an XLogData's is
+   skipped. */
+#define REPLICATION_MESSAGE_XLOG_DATA 'w'
+#define REPLICATION_MESSAGE_KEEPALIVE 'k'
+#define REPLICATION_MESSAGE_STANDBY_STATUS_UPDATE 'r'
+#define REPLICATION_XLOG_DATA_HEADER_SIZE 25
+#define REPLICATION_KEEPALIVE_SIZE 18
+#define REPLICATION_STANDBY_STATUS_UPDATE_SIZE 34
+#define REPLICATION_MAX_HEADER_SIZE REPLICATION_STANDBY_STATUS_UPDATE_SIZE
+
+/* The positions that a standby reports, in the order that a Standby Status Update has them. */
+typedef enum {
+    REPLICATION_POSITION_WRITE,
+    REPLICATION_POSITION_FLUSH,
+    REPLICATION_POSITION_APPLY,
+    REPLICATION_NUM_POSITIONS,
+} replication_position_t;
+
+static const char * const replication_position_names[REPLICATION_NUM_POSITIONS] = { "write", "flush", "apply" };
+
+typedef struct {
+    uint64_t lsn;
+    uint64_t sent_nsec;
+} replication_lag_sample_t;
+
+/* One replica's connection, as seen from the wire.  Times are ours, from the capture, so the lags include the network
+   both ways, as pg_stat_replication's do. */
+typedef struct {
+    bool is_active;
+    uint16_t fe_port;
+    session_tag_id_t application_id;
+    /* The end of the WAL that's been sent. */
+    uint64_t sent_lsn;
+    uint64_t positions[REPLICATION_NUM_POSITIONS];
+    /* From sending WAL to the standby reporting it written, flushed or applied.  0 once it's caught up with no more to
+       send. */
+    uint64_t lag_nsec[REPLICATION_NUM_POSITIONS];
+    uint64_t num_wal_bytes;
+    uint64_t num_status_updates;
+    replication_lag_sample_t samples[REPLICATION_NUM_LAG_SAMPLES];
+    size_t sample_write_index;
+    size_t sample_read_indexes[REPLICATION_NUM_POSITIONS];
+    /* A position that fell so far behind that the samples lapped it only has the oldest sample that it hadn't reached,
+       until it reaches it and carries on from the oldest sample left. */
+    bool is_overflowed[REPLICATION_NUM_POSITIONS];
+    replication_lag_sample_t overflowed[REPLICATION_NUM_POSITIONS];
+} replication_replica_t;
+
+typedef struct {
+    replication_replica_t replicas[REPLICATION_MAX_REPLICAS];
+    uint64_t num_untracked;
+} replication_stats_t;
+
+/* The header of the CopyData that's coming in one direction. */
+typedef struct {
+    uint8_t header[REPLICATION_MAX_HEADER_SIZE];
+    size_t size;
+} replication_decoder_t;
+
+/* One connection's side of it. */
+typedef struct {
+    /* The replica's index + 1, or 0 if the connection isn't streaming or isn't tracked. */
+    uint8_t replica_number;
+    replication_decoder_t fe_decoder;
+    replication_decoder_t be_decoder;
+} replication_connection_t;
+
+static void replication_stats_init(replication_stats_t *stats) {
+    ASSERT(stats);
+    memset(stats, 0, sizeof(*stats));
+}
+
+static void replication_connection_init(replication_connection_t *connection) {
+    ASSERT(connection);
+    connection->replica_number = 0;
+    connection->fe_decoder.size = 0;
+    connection->be_decoder.size = 0;
+}
+
+static inline bool replication_connection_is_streaming(const replication_connection_t *connection) {
+    return connection->replica_number != 0;
+}
+
+/* The back-end has sent a CopyBothResponse, so the connection is streaming from now on. */
+static void replication_connection_start(replication_connection_t *connection,
+                                         replication_stats_t *stats,
+                                         uint16_t fe_port,
+                                         session_tag_id_t application_id) {
+    replication_connection_init(connection);
+    size_t i = 0;
+    for (; i < REPLICATION_MAX_REPLICAS; ++i) {
+        replication_replica_t *replica = &stats->replicas[i];
+        if (!replica->is_active) {
+            memset(replica, 0, sizeof(*replica));
+            replica->is_active = true;
+            replica->fe_port = fe_port;
+            replica->application_id = application_id;
+            connection->replica_number = i + 1;
+            return;
+        }
+    }
+
+    stats->num_untracked++;
+}
+
+static void replication_connection_stop(replication_connection_t *connection, replication_stats_t *stats) {
+    if (replication_connection_is_streaming(connection)) {
+        stats->replicas[connection->replica_number - 1].is_active = false;
+        connection->replica_number = 0;
+    }
+}
+
+static inline uint64_t replication_get_uint64(const uint8_t *p) {
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < 8; ++i) {
+        value = (value << 8) | p[i];
+    }
+
+    return value;
+}
+
+static inline size_t replication_header_size(uint8_t kind) {
+    switch (kind) {
+        case REPLICATION_MESSAGE_XLOG_DATA:
+            return REPLICATION_XLOG_DATA_HEADER_SIZE;
+
+        case REPLICATION_MESSAGE_KEEPALIVE:
+            return REPLICATION_KEEPALIVE_SIZE;
+
+        case REPLICATION_MESSAGE_STANDBY_STATUS_UPDATE:
+            return REPLICATION_STANDBY_STATUS_UPDATE_SIZE;
+
+        default:
+            return 1;
+    }
+}
+
+/* Takes what it needs of num_bytes bytes of a CopyData payload, from offset, and returns true when that completes the
+   header.  Anything that isn't contiguous with what it already has is ignored. */
+static inline bool replication_decoder_on_payload(replication_decoder_t *decoder, size_t offset, const uint8_t *bytes, size_t num_bytes) {
+    if (0 == offset) {
+        decoder->size = 0;
+    } else if (offset != decoder->size) {
+        return false;
+    }
+
+    size_t header_size = replication_header_size((0 == decoder->size) ? bytes[0] : decoder->header[0]);
+    if (decoder->size >= header_size) {
+        return false;
+    }
+
+    size_t num_taken = header_size - decoder->size;
+    if (num_taken > num_bytes) {
+        num_taken = num_bytes;
+    }
+
+    memcpy(decoder->header + decoder->size, bytes, num_taken);
+    decoder->size += num_taken;
+    return decoder->size == header_size;
+}
+
+/* Whether the back-end's CopyData is an XLogData, so that the WAL after the header can be skipped. */
+static inline bool replication_decoder_is_xlog_data(const replication_decoder_t *decoder) {
+    return REPLICATION_MESSAGE_XLOG_DATA == decoder->header[0];
+}
+
+static void replication_replica_add_sample(replication_replica_t *replica, uint64_t lsn) {
+    size_t next_index = (replica->sample_write_index + 1) % REPLICATION_NUM_LAG_SAMPLES;
+    size_t i = 0;
+    for (; i < REPLICATION_NUM_POSITIONS; ++i) {
+        /* Each position overflows on its own, so that one that's never reported, e.g. pg_receivewal's apply, doesn't
+           hold up the others. */
+        if (!replica->is_overflowed[i] && (next_index == replica->sample_read_indexes[i])) {
+            replica->overflowed[i] = replica->samples[replica->sample_read_indexes[i]];
+            replica->is_overflowed[i] = true;
+        }
+    }
+
+    replica->samples[replica->sample_write_index].lsn = lsn;
+    replica->samples[replica->sample_write_index].sent_nsec = now_epoch_nsec();
+    replica->sample_write_index = next_index;
+}
+
+/* The back-end's CopyData header, and the length of the CopyData. */
+static void replication_on_be_header(replication_stats_t *stats, const replication_connection_t *connection, const uint8_t *header, int32_t length) {
+    replication_replica_t *replica = &stats->replicas[connection->replica_number - 1];
+    if (REPLICATION_MESSAGE_XLOG_DATA == header[0]) {
+        uint64_t num_wal_bytes = (length > 4 + REPLICATION_XLOG_DATA_HEADER_SIZE) ? length - 4 - REPLICATION_XLOG_DATA_HEADER_SIZE : 0;
+        uint64_t end_lsn = replication_get_uint64(header + 1) + num_wal_bytes;
+        replica->num_wal_bytes += num_wal_bytes;
+        if (end_lsn > replica->sent_lsn) {
+            replica->sent_lsn = end_lsn;
+            replication_replica_add_sample(replica, end_lsn);
+        }
+    } else if (REPLICATION_MESSAGE_KEEPALIVE == header[0]) {
+        uint64_t wal_end = replication_get_uint64(header + 1);
+        if (wal_end > replica->sent_lsn) {
+            replica->sent_lsn = wal_end;
+        }
+    }
+}
+
+/* The front-end's CopyData header. */
+static void replication_on_fe_header(replication_stats_t *stats, const replication_connection_t *connection, const uint8_t *header) {
+    if (header[0] != REPLICATION_MESSAGE_STANDBY_STATUS_UPDATE) {
+        return;
+    }
+
+    replication_replica_t *replica = &stats->replicas[connection->replica_number - 1];
+    replica->num_status_updates++;
+    size_t i = 0;
+    for (; i < REPLICATION_NUM_POSITIONS; ++i) {
+        uint64_t lsn = replication_get_uint64(header + 1 + 8 * i);
+        /* InvalidXLogRecPtr, from a standby that doesn't report this position. */
+        if (0 == lsn) {
+            continue;
+        }
+
+        replica->positions[i] = lsn;
+        bool is_sample_reached = false;
+        size_t *read_index = &replica->sample_read_indexes[i];
+        if (replica->is_overflowed[i]) {
+            replica->lag_nsec[i] = now_epoch_nsec() - replica->overflowed[i].sent_nsec;
+            if (replica->overflowed[i].lsn > lsn) {
+                continue;
+            }
+
+            replica->is_overflowed[i] = false;
+            *read_index = (replica->sample_write_index + 1) % REPLICATION_NUM_LAG_SAMPLES;
+            is_sample_reached = true;
+        }
+
+        while ((*read_index != replica->sample_write_index) && (replica->samples[*read_index].lsn <= lsn)) {
+            replica->lag_nsec[i] = now_epoch_nsec() - replica->samples[*read_index].sent_nsec;
+            *read_index = (*read_index + 1) % REPLICATION_NUM_LAG_SAMPLES;
+            is_sample_reached = true;
+        }
+
+        if (!is_sample_reached && (lsn >= replica->sent_lsn)) {
+            replica->lag_nsec[i] = 0;
+        }
+    }
+}
+
+/* 0 for a position that the standby hasn't reported. */
+static inline uint64_t replication_replica_lag_bytes(const replication_replica_t *replica, replication_position_t position) {
+    uint64_t lsn = replica->positions[position];
+    return ((lsn != 0) && (replica->sent_lsn > lsn)) ? replica->sent_lsn - lsn : 0;
+}
+
+/* A line or record per replica that's streaming. */
+static void replication_stats_print_summary(const replication_stats_t *stats, FILE *fp) {
+    ASSERT(stats);
+    size_t i = 0;
+    for (; i < REPLICATION_MAX_REPLICAS; ++i) {
+        const replication_replica_t *replica = &stats->replicas[i];
+        if (!replica->is_active) {
+            continue;
+        }
+
+        const char *application = session_tags_name(&global_session_tags, replica->application_id);
+        if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+            message_json_writer_t writer;
+            message_json_writer_init(&writer);
+            message_json_writer_write_raw(&writer, "{\"ts\":");
+            message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+            message_json_writer_write_uint_field(&writer, "port", replica->fe_port);
+            message_json_writer_write_key(&writer, "type");
+            message_json_writer_write_raw(&writer, "\"ReplicationSummary\"");
+            message_json_writer_write_string_field(&writer, "application", (const uint8_t *)application, strlen(application));
+            message_json_writer_write_uint_field(&writer, "sent_lsn", replica->sent_lsn);
+            message_json_writer_write_uint_field(&writer, "wal_bytes", replica->num_wal_bytes);
+            size_t j = 0;
+            for (; j < REPLICATION_NUM_POSITIONS; ++j) {
+                char key[32];
+                sprintf(key, "%s_lag_bytes", replication_position_names[j]);
+                message_json_writer_write_uint_field(&writer, key, replication_replica_lag_bytes(replica, j));
+                sprintf(key, "%s_lag_nsec", replication_position_names[j]);
+                message_json_writer_write_uint_field(&writer, key, replica->lag_nsec[j]);
+            }
+            *writer.p++ = '}';
+            *writer.p++ = '\n';
+            fwrite(writer.data, writer.p - writer.data, 1, fp);
+            continue;
+        }
+
+        LOG("replication summary: fe_port=%u application=%s sent_lsn=%X/%X wal_bytes=%llu write_lag_bytes=%llu "
+            "flush_lag_bytes=%llu apply_lag_bytes=%llu write_lag_nsec=%llu flush_lag_nsec=%llu apply_lag_nsec=%llu",
+            replica->fe_port, application, (uint32_t)(replica->sent_lsn >> 32), (uint32_t)replica->sent_lsn, (unsigned long long)replica->num_wal_bytes,
+            (unsigned long long)replication_replica_lag_bytes(replica, REPLICATION_POSITION_WRITE),
+            (unsigned long long)replication_replica_lag_bytes(replica, REPLICATION_POSITION_FLUSH),
+            (unsigned long long)replication_replica_lag_bytes(replica, REPLICATION_POSITION_APPLY),
+            (unsigned long long)replica->lag_nsec[REPLICATION_POSITION_WRITE],
+            (unsigned long long)replica->lag_nsec[REPLICATION_POSITION_FLUSH],
+            (unsigned long long)replica->lag_nsec[REPLICATION_POSITION_APPLY]);
+    }
+}
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef RING_OUTPUT_H
+#define RING_OUTPUT_H
+
+#include "shm_ring.h"
+
+/* 16MB of slots. */
+#define RING_OUTPUT_DEFAULT_NUM_SLOTS (64 * 1024)
+
+/* Publishes each message to the shared-memory ring in the -R file, see shm_ring.h, rather than printing it. */
+typedef struct {
+    /* NULL if we're not publishing. */
+    shm_ring_header_t *header;
+    size_t size;
+    const char *path;
+    uint64_t write_seq;
+} ring_output_t;
+
+ring_output_t global_ring_output;
+
+/* Whether header is a ring of num_slots that this writer can carry on with. */
+static bool ring_output_is_reusable(const shm_ring_header_t *header, uint64_t num_slots) {
+    return (memcmp(header->magic, SHM_RING_MAGIC, SHM_RING_MAGIC_SIZE) == 0) && (SHM_RING_VERSION == header->version) &&
+           (SHM_RING_SLOT_SIZE == header->slot_size) && (num_slots == header->num_slots);
+}
+
+/* Sets up an empty ring in the size bytes at header, which must be shm_ring_file_size(num_slots) of zeroes, as a newly
+   sized file is, or a ring of num_slots that a previous writer left behind. */
+static void ring_output_init(ring_output_t *ring, shm_ring_header_t *header, size_t size, uint64_t num_slots) {
+    ASSERT(ring);
+    ASSERT(header);
+    ASSERT((num_slots > 0) && ((num_slots & (num_slots - 1)) == 0));
+    ASSERT(size == shm_ring_file_size(num_slots));
+    ring->header = header;
+    ring->size = size;
+    ring->write_seq = 0;
+    if (ring_output_is_reusable(header, num_slots)) {
+        /* Readers may still be attached, so they're moved to the next generation rather than the ring being set up
+           again.  write_seq first, so that a reader that sees the new generation never sees the old write_seq. */
+        __atomic_store_n(&header->write_seq, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&header->generation, header->generation + 1, __ATOMIC_RELEASE);
+        return;
+    }
+
+    header->version = SHM_RING_VERSION;
+    header->slot_size = SHM_RING_SLOT_SIZE;
+    header->num_slots = num_slots;
+    /* The magic last, so that a reader never sees a ring that's half set up. */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(header->magic, SHM_RING_MAGIC, SHM_RING_MAGIC_SIZE);
+}
+
+/* Opens the ring file at path, reusing it if it's already a ring of num_slots.  Anything else that's there is replaced
+   by way of a temporary file rather than truncated, since readers that have it mapped would fault. */
+static void ring_output_open(ring_output_t *ring, const char *path, uint64_t num_slots) {
+    ASSERT(ring);
+    ASSERT(path);
+    size_t size = shm_ring_file_size(num_slots);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        FATAL("Can't open ring file: %s.  errno=%d", path, errno);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        FATAL("Can't stat ring file: %s.  errno=%d", path, errno);
+    }
+
+    shm_ring_header_t existing;
+    bool is_reusable = ((size_t)st.st_size == size) && (pread(fd, &existing, sizeof(existing), 0) == sizeof(existing)) &&
+                       ring_output_is_reusable(&existing, num_slots);
+    if (!is_reusable && (st.st_size != 0)) {
+        close(fd);
+        char tmp_path[4096];
+        if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+            FATAL("Ring file path is too long: %s", path);
+        }
+
+        fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            FATAL("Can't open ring file: %s.  errno=%d", tmp_path, errno);
+        }
+
+        if (rename(tmp_path, path) != 0) {
+            FATAL("Can't rename ring file %s to %s.  errno=%d", tmp_path, path, errno);
+        }
+    }
+
+    if (!is_reusable && (ftruncate(fd, size) != 0)) {
+        FATAL("Can't size ring file: %s.  errno=%d", path, errno);
+    }
+
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == p) {
+        FATAL("Can't map ring file: %s.  errno=%d", path, errno);
+    }
+
+    close(fd);
+    ring->path = path;
+    ring_output_init(ring, (shm_ring_header_t *)p, size, num_slots);
+}
+
+/* The file is left behind for readers that are still catching up. */
+static void ring_output_close(ring_output_t *ring) {
+    ASSERT(ring);
+    if (ring->header) {
+        munmap(ring->header, ring->size);
+        ring->header = NULL;
+    }
+}
+
+/* A message_sink callback, see message_sink.h. */
+static void ring_output_on_message(const pgtrace_message_t *message, void *arg) {
+    ring_output_t *ring = (ring_output_t *)arg;
+    uint64_t seq = ++ring->write_seq;
+    shm_ring_record_t *slot = shm_ring_slot(ring->header, seq);
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->start_nsec = message->start_nsec;
+    slot->end_nsec = message->end_nsec;
+    slot->fe_address = message->key.fe_address;
+    slot->be_address = message->key.be_address;
+    slot->fe_port = message->key.fe_port;
+    slot->be_port = message->key.be_port;
+    slot->direction = message->direction;
+    slot->type = message->type;
+    slot->length = message->length;
+    slot->reserved = 0;
+    size_t payload_size = message->payload_size;
+    if (payload_size > SHM_RING_MAX_PAYLOAD_SIZE) {
+        payload_size = SHM_RING_MAX_PAYLOAD_SIZE;
+        global_metrics.num_ring_truncated_payloads++;
+    }
+
+    slot->is_payload_complete = message->is_payload_complete && (payload_size == message->payload_size);
+    slot->payload_size = payload_size;
+    memcpy(slot->payload, message->payload, payload_size);
+
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->write_seq, seq, __ATOMIC_RELEASE);
+    global_metrics.num_ring_records++;
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef ROLLUP_FORMAT_H
+#define ROLLUP_FORMAT_H
+
+/* The rollup files that pgtrace -w writes and pgrollup reads: for each interval (a second by default), per series,
+   how many messages or requests there were, their bytes, how many requests failed and a latency histogram.  A series
+   is a message type, a statement or an application, see rollup_series_kind_t.
+
+   The data file is a header, magic(8) version(4) interval_nsec(8), and then blocks that are only ever appended.  Each
+   block covers up to ROLLUP_BLOCK_MAX_INTERVALS intervals and stands alone: a header, a dictionary of the block's
+   series and then its rows a column at a time, so that similar values sit together.
+
+   The block header is start_nsec(8) end_nsec(8) num_series(4) num_rows(4) and the size in bytes of the dictionary and
+   of each column(4 each).  start_nsec is the start of the block's first interval and end_nsec the end of its last.
+   Each dictionary entry is kind(1) key(varint) name_length(varint) name.  Rows are in order of interval and then
+   series, and each row's values are varints:
+
+     interval      intervals since the previous row's, or since start_nsec for the first row
+     series        for the first row of an interval its index in the dictionary, otherwise how much more than the
+                   previous row's it is
+     count, bytes, errors, latency_sum_nsec, latency_max_nsec
+     buckets       the number of non-empty latency histogram buckets, see histogram.h, then for each of them its
+                   index less the previous one's (or 0 for the first) and its count
+
+   The index file, the data file's path with ROLLUP_INDEX_SUFFIX, is a header, magic(8) version(4), and an entry per
+   block, start_nsec(8) end_nsec(8) offset(8), written once the block is, so a reader can go straight to the blocks
+   for a time range.  Fixed-size fields are big-endian and varints are LEB128, 7 bits a byte, least significant
+   first. */
+#define ROLLUP_FILE_MAGIC "PGTRROLL"
+#define ROLLUP_INDEX_MAGIC "PGTRRIDX"
+#define ROLLUP_MAGIC_SIZE 8
+#define ROLLUP_VERSION 1
+#define ROLLUP_FILE_HEADER_SIZE (ROLLUP_MAGIC_SIZE + 4 + 8)
+#define ROLLUP_INDEX_HEADER_SIZE (ROLLUP_MAGIC_SIZE + 4)
+#define ROLLUP_INDEX_ENTRY_SIZE 24
+#define ROLLUP_INDEX_SUFFIX ".idx"
+
+#define ROLLUP_BLOCK_MAX_INTERVALS 60
+/* Distinct series in a block.  Statements and applications past this in a block aren't rolled up. */
+#define ROLLUP_MAX_SERIES 1024
+#define ROLLUP_MAX_VARINT_SIZE 10
+
+typedef enum {
+    ROLLUP_COLUMN_INTERVAL,
+    ROLLUP_COLUMN_SERIES,
+    ROLLUP_COLUMN_COUNT,
+    ROLLUP_COLUMN_BYTES,
+    ROLLUP_COLUMN_ERRORS,
+    ROLLUP_COLUMN_LATENCY_SUM,
+    ROLLUP_COLUMN_LATENCY_MAX,
+    ROLLUP_COLUMN_BUCKETS,
+    ROLLUP_NUM_COLUMNS,
+} rollup_column_t;
+
+#define ROLLUP_BLOCK_HEADER_SIZE (8 + 8 + 4 + 4 + 4 * (1 + ROLLUP_NUM_COLUMNS))
+
+typedef enum {
+    /* Keyed by sender (0 front-end, 1 back-end) << 8 | message type, and named for the message type.  count & bytes
+       are messages, and latency & errors are for the front-end's requests, e.g. Query or Execute, from being sent to
+       being answered. */
+    ROLLUP_SERIES_KIND_MESSAGE = 'M',
+    /* Keyed by the statement text's hash, see top_statements.h, and named for the start of it.  count, latency &
+       errors are for the Queries & Executes that ran it. */
+    ROLLUP_SERIES_KIND_STATEMENT = 'S',
+    /* Named for the application_name.  count & bytes are messages both ways, latency is from the first front-end
+       message after a ReadyForQuery to the next ReadyForQuery, and errors are failed requests. */
+    ROLLUP_SERIES_KIND_APPLICATION = 'A',
+} rollup_series_kind_t;
+
+static inline void rollup_format_put_uint(uint8_t *p, uint64_t value, size_t num_bytes) {
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        p[i] = (uint8_t)(value >> (8 * (num_bytes - 1 - i)));
+    }
+}
+
+static inline uint64_t rollup_format_get_uint(const uint8_t *p, size_t num_bytes) {
+    uint64_t value = 0;
+    size_t i = 0;
+    for (; i < num_bytes; ++i) {
+        value = (value << 8) | p[i];
+    }
+
+    return value;
+}
+
+/* Returns just past the varint, which needs at most ROLLUP_MAX_VARINT_SIZE bytes. */
+static inline uint8_t *rollup_format_put_varint(uint8_t *p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+/* Returns just past the varint, or NULL if it runs past end. */
+static inline const uint8_t *rollup_format_get_varint(const uint8_t *p, const uint8_t *end, uint64_t *value) {
+    *value = 0;
+    unsigned int shift = 0;
+    for (; (p < end) && (shift < 64); shift += 7) {
+        uint8_t byte = *p++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,474 @@
+#ifndef ROLLUP_WRITER_H
+#define ROLLUP_WRITER_H
+
+/* Appends rollups to the -w file and its index, see rollup_format.h.  Intervals are in packet time, and one ends when
+   the first packet after it arrives.  A block is written once it has ROLLUP_BLOCK_MAX_INTERVALS intervals or half of
+   ROLLUP_MAX_SERIES series, and at exit. */
+
+#define ROLLUP_NUM_STATEMENT_SLOTS (2 * ROLLUP_MAX_SERIES)
+#define ROLLUP_DICTIONARY_ENTRY_MAX_SIZE (1 + 2 * ROLLUP_MAX_VARINT_SIZE + STATEMENT_TEXT_MAX_LENGTH)
+
+typedef struct {
+    rollup_series_kind_t kind;
+    uint64_t key;
+    uint8_t name_length;
+    char name[STATEMENT_TEXT_MAX_LENGTH + 1];
+    /* The interval so far. */
+    bool is_touched;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t errors;
+    histogram_t latency_nsec;
+} rollup_series_t;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} rollup_column_buffer_t;
+
+typedef struct {
+    /* NULL if we're not writing rollups. */
+    FILE *fp;
+    FILE *index_fp;
+    const char *path;
+    char *index_path;
+    /* Where the next block goes. */
+    uint64_t offset;
+    uint64_t interval_nsec;
+    /* The interval that's being counted, the block's first and the last that has rows, as intervals since the epoch.
+       block_start_interval is 0 while the block has no rows. */
+    uint64_t interval;
+    uint64_t block_start_interval;
+    uint64_t last_row_interval;
+    size_t num_rows;
+    /* The block's series, which are its dictionary. */
+    rollup_series_t series[ROLLUP_MAX_SERIES];
+    size_t num_series;
+    /* Indexes + 1 into series, or 0 if the block doesn't have the series yet. */
+    uint16_t message_series[2][256];
+    uint16_t application_series[SESSION_TAGS_CAPACITY];
+    /* Open addressing by statement hash. */
+    uint16_t statement_slots[ROLLUP_NUM_STATEMENT_SLOTS];
+    rollup_column_buffer_t columns[ROLLUP_NUM_COLUMNS];
+    uint8_t dictionary[ROLLUP_MAX_SERIES * ROLLUP_DICTIONARY_ENTRY_MAX_SIZE];
+} rollup_writer_t;
+
+rollup_writer_t global_rollup_writer;
+
+static inline bool rollup_writer_is_enabled(const rollup_writer_t *writer) {
+    return writer->fp != NULL;
+}
+
+/* Opens path for appending, writing its header if it's new, or checks that it's a rollup file with the same
+   interval if it isn't. */
+static FILE *rollup_writer_open_file(const char *path, const uint8_t *header, size_t header_size) {
+    FILE *fp = fopen(path, "a+b");
+    if (!fp) {
+        FATAL("Can't open rollup file: %s.  errno=%d", path, errno);
+    }
+
+    uint8_t existing[ROLLUP_FILE_HEADER_SIZE];
+    rewind(fp);
+    size_t num_read = fread(existing, 1, header_size, fp);
+    if (0 == num_read) {
+        if ((fwrite(header, header_size, 1, fp) != 1) || (fflush(fp) != 0)) {
+            FATAL("Can't write rollup file: %s.  errno=%d", path, errno);
+        }
+    } else if ((num_read != header_size) || (memcmp(existing, header, header_size) != 0)) {
+        FATAL("%s isn't a version %d rollup file with the same interval, so can't be appended to", path, ROLLUP_VERSION);
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        FATAL("Can't seek in rollup file: %s.  errno=%d", path, errno);
+    }
+
+    return fp;
+}
+
+static void rollup_writer_open(rollup_writer_t *writer, const char *path, uint64_t interval_nsec) {
+    ASSERT(writer);
+    ASSERT(path);
+    ASSERT(interval_nsec > 0);
+    uint8_t header[ROLLUP_FILE_HEADER_SIZE];
+    memcpy(header, ROLLUP_FILE_MAGIC, ROLLUP_MAGIC_SIZE);
+    rollup_format_put_uint(header + ROLLUP_MAGIC_SIZE, ROLLUP_VERSION, 4);
+    rollup_format_put_uint(header + ROLLUP_MAGIC_SIZE + 4, interval_nsec, 8);
+    writer->fp = rollup_writer_open_file(path, header, sizeof(header));
+    long offset = ftell(writer->fp);
+    if (offset < 0) {
+        FATAL("Can't seek in rollup file: %s.  errno=%d", path, errno);
+    }
+
+    if ((writer->index_path = malloc(strlen(path) + sizeof(ROLLUP_INDEX_SUFFIX))) == NULL) {
+        FATAL("Can't allocate the path of %s's index", path);
+    }
+
+    sprintf(writer->index_path, "%s%s", path, ROLLUP_INDEX_SUFFIX);
+    uint8_t index_header[ROLLUP_INDEX_HEADER_SIZE];
+    memcpy(index_header, ROLLUP_INDEX_MAGIC, ROLLUP_MAGIC_SIZE);
+    rollup_format_put_uint(index_header + ROLLUP_MAGIC_SIZE, ROLLUP_VERSION, 4);
+    writer->index_fp = rollup_writer_open_file(writer->index_path, index_header, sizeof(index_header));
+    writer->path = path;
+    writer->offset = offset;
+    writer->interval_nsec = interval_nsec;
+    writer->interval = 0;
+    writer->block_start_interval = 0;
+    writer->last_row_interval = 0;
+    writer->num_rows = 0;
+    writer->num_series = 0;
+}
+
+/* Frees the columns, which must have been written. */
+static void rollup_writer_free_columns(rollup_writer_t *writer) {
+    size_t i = 0;
+    for (; i < ROLLUP_NUM_COLUMNS; ++i) {
+        free(writer->columns[i].data);
+        if (writer->columns[i].capacity > 0) {
+            memory_budget_release(&global_memory_budget, MEMORY_SUBSYSTEM_AGGREGATION, writer->columns[i].capacity);
+        }
+
+        writer->columns[i].data = NULL;
+        writer->columns[i].size = 0;
+        writer->columns[i].capacity = 0;
+    }
+}
+
+static void rollup_writer_stop(rollup_writer_t *writer) {
+    fclose(writer->fp);
+    fclose(writer->index_fp);
+    writer->fp = NULL;
+    writer->index_fp = NULL;
+    free(writer->index_path);
+    writer->index_path = NULL;
+    rollup_writer_free_columns(writer);
+}
+
+/* Makes room for num_bytes more in the column.  Returns false if the memory budget won't allow it. */
+static bool rollup_writer_reserve(rollup_column_buffer_t *column, size_t num_bytes) {
+    if (column->size + num_bytes <= column->capacity) {
+        return true;
+    }
+
+    size_t capacity = column->capacity ? column->capacity : 4096;
+    while (capacity < column->size + num_bytes) {
+        capacity *= 2;
+    }
+
+    if (!memory_budget_try_charge(&global_memory_budget, MEMORY_SUBSYSTEM_AGGREGATION, capacity - column->capacity)) {
+        return false;
+    }
+
+    uint8_t *data = realloc(column->data, capacity);
+    if (!data) {
+        FATAL("Can't allocate %zu bytes for a rollup column", capacity);
+    }
+
+    column->data = data;
+    column->capacity = capacity;
+    return true;
+}
+
+static inline void rollup_writer_put_varint(rollup_column_buffer_t *column, uint64_t value) {
+    column->size = rollup_format_put_varint(column->data + column->size, value) - column->data;
+}
+
+/* Forgets the block's series and rows, once they've been written. */
+static void rollup_writer_reset_block(rollup_writer_t *writer) {
+    writer->block_start_interval = 0;
+    writer->num_rows = 0;
+    writer->num_series = 0;
+    memset(writer->message_series, 0, sizeof(writer->message_series));
+    memset(writer->application_series, 0, sizeof(writer->application_series));
+    memset(writer->statement_slots, 0, sizeof(writer->statement_slots));
+    size_t i = 0;
+    for (; i < ROLLUP_NUM_COLUMNS; ++i) {
+        writer->columns[i].size = 0;
+    }
+}
+
+/* Writes the block, and then its index entry so that readers only ever find whole blocks. */
+static void rollup_writer_write_block(rollup_writer_t *writer) {
+    if (0 == writer->num_rows) {
+        rollup_writer_reset_block(writer);
+        return;
+    }
+
+    uint8_t *p = writer->dictionary;
+    size_t i = 0;
+    for (; i < writer->num_series; ++i) {
+        const rollup_series_t *series = &writer->series[i];
+        *p++ = series->kind;
+        p = rollup_format_put_varint(p, series->key);
+        p = rollup_format_put_varint(p, series->name_length);
+        memcpy(p, series->name, series->name_length);
+        p += series->name_length;
+    }
+
+    size_t dictionary_size = p - writer->dictionary;
+    uint64_t start_nsec = writer->block_start_interval * writer->interval_nsec;
+    uint64_t end_nsec = (writer->last_row_interval + 1) * writer->interval_nsec;
+    uint8_t header[ROLLUP_BLOCK_HEADER_SIZE];
+    rollup_format_put_uint(header, start_nsec, 8);
+    rollup_format_put_uint(header + 8, end_nsec, 8);
+    rollup_format_put_uint(header + 16, writer->num_series, 4);
+    rollup_format_put_uint(header + 20, writer->num_rows, 4);
+    rollup_format_put_uint(header + 24, dictionary_size, 4);
+    uint64_t block_size = sizeof(header) + dictionary_size;
+    for (i = 0; i < ROLLUP_NUM_COLUMNS; ++i) {
+        rollup_format_put_uint(header + 28 + 4 * i, writer->columns[i].size, 4);
+        block_size += writer->columns[i].size;
+    }
+
+    bool is_ok = (fwrite(header, sizeof(header), 1, writer->fp) == 1) &&
+                 (fwrite(writer->dictionary, dictionary_size, 1, writer->fp) == 1);
+    for (i = 0; is_ok && (i < ROLLUP_NUM_COLUMNS); ++i) {
+        is_ok = (fwrite(writer->columns[i].data, writer->columns[i].size, 1, writer->fp) == 1);
+    }
+
+    uint8_t entry[ROLLUP_INDEX_ENTRY_SIZE];
+    rollup_format_put_uint(entry, start_nsec, 8);
+    rollup_format_put_uint(entry + 8, end_nsec, 8);
+    rollup_format_put_uint(entry + 16, writer->offset, 8);
+    if (!is_ok || (fflush(writer->fp) != 0) ||
+        (fwrite(entry, sizeof(entry), 1, writer->index_fp) != 1) || (fflush(writer->index_fp) != 0)) {
+        LOG("Can't write rollup file: %s.  errno=%d.  Stopped writing rollups.", writer->path, errno);
+        rollup_writer_stop(writer);
+        return;
+    }
+
+    writer->offset += block_size;
+    global_metrics.num_rollup_blocks++;
+    global_metrics.num_rollup_rows += writer->num_rows;
+    rollup_writer_reset_block(writer);
+}
+
+/* Adds a row to the block for each series that had anything in the interval, and starts them afresh. */
+static void rollup_writer_end_interval(rollup_writer_t *writer) {
+    bool is_first_row = true;
+    size_t previous_index = 0;
+    size_t i = 0;
+    for (; i < writer->num_series; ++i) {
+        rollup_series_t *series = &writer->series[i];
+        if (!series->is_touched) {
+            continue;
+        }
+
+        size_t num_buckets = 0;
+        size_t j = 0;
+        for (; j < HISTOGRAM_NUM_BUCKETS; ++j) {
+            num_buckets += (series->latency_nsec.buckets[j] != 0);
+        }
+
+        bool is_reserved = true;
+        for (j = 0; is_reserved && (j < ROLLUP_COLUMN_BUCKETS); ++j) {
+            is_reserved = rollup_writer_reserve(&writer->columns[j], ROLLUP_MAX_VARINT_SIZE);
+        }
+
+        if (!is_reserved ||
+            !rollup_writer_reserve(&writer->columns[ROLLUP_COLUMN_BUCKETS], (1 + 2 * num_buckets) * ROLLUP_MAX_VARINT_SIZE)) {
+            global_metrics.num_rollup_dropped++;
+        } else {
+            if (0 == writer->num_rows) {
+                writer->block_start_interval = writer->interval;
+                writer->last_row_interval = writer->interval;
+            }
+
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_INTERVAL],
+                                     is_first_row ? writer->interval - writer->last_row_interval : 0);
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_SERIES], is_first_row ? i : i - previous_index);
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_COUNT], series->count);
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_BYTES], series->bytes);
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_ERRORS], series->errors);
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_LATENCY_SUM], series->latency_nsec.sum);
+            rollup_writer_put_varint(&writer->columns[ROLLUP_COLUMN_LATENCY_MAX], series->latency_nsec.max);
+            rollup_column_buffer_t *buckets = &writer->columns[ROLLUP_COLUMN_BUCKETS];
+            rollup_writer_put_varint(buckets, num_buckets);
+            size_t previous_bucket = 0;
+            for (j = 0; j < HISTOGRAM_NUM_BUCKETS; ++j) {
+                if (series->latency_nsec.buckets[j] != 0) {
+                    rollup_writer_put_varint(buckets, j - previous_bucket);
+                    rollup_writer_put_varint(buckets, series->latency_nsec.buckets[j]);
+                    previous_bucket = j;
+                }
+            }
+
+            writer->last_row_interval = writer->interval;
+            writer->num_rows++;
+            is_first_row = false;
+            previous_index = i;
+        }
+
+        series->is_touched = false;
+        series->count = 0;
+        series->bytes = 0;
+        series->errors = 0;
+        histogram_init(&series->latency_nsec);
+    }
+}
+
+/* Packet time has moved on to now_nsec, which may end the interval and the block.  Short of memory, every interval is
+   a block, and the columns are freed once it's written. */
+static inline void rollup_writer_on_time(rollup_writer_t *writer, uint64_t now_nsec) {
+    uint64_t interval = now_nsec / writer->interval_nsec;
+    if (interval <= writer->interval) {
+        return;
+    }
+
+    if (writer->interval != 0) {
+        rollup_writer_end_interval(writer);
+    }
+
+    writer->interval = interval;
+    bool is_flushing = (global_memory_budget.level >= MEMORY_LEVEL_FLUSH_ROLLUPS);
+    if ((writer->num_rows > 0) &&
+        ((interval - writer->block_start_interval >= ROLLUP_BLOCK_MAX_INTERVALS) || (writer->num_series >= ROLLUP_MAX_SERIES / 2) ||
+         is_flushing)) {
+        rollup_writer_write_block(writer);
+    }
+
+    if (is_flushing && rollup_writer_is_enabled(writer)) {
+        rollup_writer_free_columns(writer);
+    }
+}
+
+/* Writes what's been counted so far. */
+static void rollup_writer_close(rollup_writer_t *writer) {
+    ASSERT(writer);
+    if (!rollup_writer_is_enabled(writer)) {
+        return;
+    }
+
+    if (writer->interval != 0) {
+        rollup_writer_end_interval(writer);
+    }
+
+    rollup_writer_write_block(writer);
+    if (rollup_writer_is_enabled(writer)) {
+        rollup_writer_stop(writer);
+    }
+}
+
+/* Adds the series to the block, or returns NULL if the block is full. */
+static rollup_series_t *rollup_writer_add_series(rollup_writer_t *writer,
+                                                 uint16_t *index,
+                                                 rollup_series_kind_t kind,
+                                                 uint64_t key,
+                                                 const char *name,
+                                                 size_t name_length) {
+    if (ROLLUP_MAX_SERIES == writer->num_series) {
+        global_metrics.num_rollup_dropped++;
+        return NULL;
+    }
+
+    rollup_series_t *series = &writer->series[writer->num_series++];
+    *index = writer->num_series;
+    series->kind = kind;
+    series->key = key;
+    series->name_length = (name_length < STATEMENT_TEXT_MAX_LENGTH) ? name_length : STATEMENT_TEXT_MAX_LENGTH;
+    memcpy(series->name, name, series->name_length);
+    series->is_touched = false;
+    series->count = 0;
+    series->bytes = 0;
+    series->errors = 0;
+    histogram_init(&series->latency_nsec);
+    return series;
+}
+
+static inline rollup_series_t *rollup_writer_message_series(rollup_writer_t *writer,
+                                                            sender_type_t sender_type,
+                                                            uint8_t message_type,
+                                                            const char *message_name) {
+    uint16_t *index = &writer->message_series[sender_type][message_type];
+    if (*index != 0) {
+        return &writer->series[*index - 1];
+    }
+
+    return rollup_writer_add_series(writer, index, ROLLUP_SERIES_KIND_MESSAGE, (sender_type << 8) | message_type,
+                                    message_name ? message_name : "", message_name ? strlen(message_name) : 0);
+}
+
+static inline rollup_series_t *rollup_writer_application_series(rollup_writer_t *writer, session_tag_id_t application_id) {
+    uint16_t *index = &writer->application_series[application_id];
+    if (*index != 0) {
+        return &writer->series[*index - 1];
+    }
+
+    const char *name = session_tags_name(&global_session_tags, application_id);
+    return rollup_writer_add_series(writer, index, ROLLUP_SERIES_KIND_APPLICATION, application_id, name, strlen(name));
+}
+
+static rollup_series_t *rollup_writer_statement_series(rollup_writer_t *writer, const statement_text_t *statement) {
+    size_t slot = statement->hash % ROLLUP_NUM_STATEMENT_SLOTS;
+    for (; writer->statement_slots[slot] != 0; slot = (slot + 1) % ROLLUP_NUM_STATEMENT_SLOTS) {
+        rollup_series_t *series = &writer->series[writer->statement_slots[slot] - 1];
+        if (series->key == statement->hash) {
+            return series;
+        }
+    }
+
+    return rollup_writer_add_series(writer, &writer->statement_slots[slot], ROLLUP_SERIES_KIND_STATEMENT,
+                                    statement->hash, statement->text, statement->length);
+}
+
+/* A whole message of length bytes, by its length field. */
+static inline void rollup_writer_on_message(rollup_writer_t *writer,
+                                            sender_type_t sender_type,
+                                            uint8_t message_type,
+                                            const char *message_name,
+                                            uint64_t length,
+                                            session_tag_id_t application_id) {
+    rollup_series_t *series = rollup_writer_message_series(writer, sender_type, message_type, message_name);
+    if (series) {
+        series->is_touched = true;
+        series->count++;
+        series->bytes += length;
+    }
+
+    if ((series = rollup_writer_application_series(writer, application_id)) != NULL) {
+        series->is_touched = true;
+        series->count++;
+        series->bytes += length;
+    }
+}
+
+static inline void rollup_series_on_latency(rollup_series_t *series, uint64_t latency_nsec, bool is_failed) {
+    series->is_touched = true;
+    histogram_add(&series->latency_nsec, latency_nsec);
+    series->errors += is_failed;
+}
+
+/* The back-end has answered a request from the front-end, which ran statement if it isn't NULL. */
+static void rollup_writer_on_request(rollup_writer_t *writer,
+                                     uint8_t request_type,
+                                     uint64_t response_nsec,
+                                     bool is_failed,
+                                     const statement_text_t *statement,
+                                     session_tag_id_t application_id) {
+    rollup_series_t *series = rollup_writer_message_series(writer, SENDER_TYPE_FE, request_type,
+                                                           global_metrics.fe_message_names[request_type]);
+    if (series) {
+        rollup_series_on_latency(series, response_nsec, is_failed);
+    }
+
+    if (statement && ((series = rollup_writer_statement_series(writer, statement)) != NULL)) {
+        series->count++;
+        rollup_series_on_latency(series, response_nsec, is_failed);
+    }
+
+    if (is_failed && ((series = rollup_writer_application_series(writer, application_id)) != NULL)) {
+        series->is_touched = true;
+        series->errors++;
+    }
+}
+
+/* The back-end is ready for the next query, request_nsec after the first front-end message since it last was. */
+static inline void rollup_writer_on_ready_for_query(rollup_writer_t *writer, uint64_t request_nsec, session_tag_id_t application_id) {
+    rollup_series_t *series = rollup_writer_application_series(writer, application_id);
+    if (series) {
+        series->is_touched = true;
+        histogram_add(&series->latency_nsec, request_nsec);
+    }
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef SESSION_TAGS_H
+#define SESSION_TAGS_H
+
+/* Longer user, database & application names are cut to this, which is Postgres's own limit (NAMEDATALEN - 1). */
+#define SESSION_TAG_MAX_LENGTH 63
+
+/* Distinct names that get their own ids.  Past this, new names are all SESSION_TAG_ID_OTHER. */
+#define SESSION_TAGS_CAPACITY 4096
+#define SESSION_TAGS_NUM_SLOTS (2 * SESSION_TAGS_CAPACITY)
+
+#define SESSION_TAG_ID_UNKNOWN 0
+#define SESSION_TAG_ID_OTHER 1
+
+#define SESSION_TAGS_FNV_OFFSET_BASIS 2166136261u
+#define SESSION_TAGS_FNV_PRIME 16777619u
+
+typedef uint16_t session_tag_id_t;
+
+/* Every user, database & application name that's been seen, each once, so that connections and the records about
+   them can carry small ids rather than strings.  Names are never forgotten, so an id means the same thing for the
+   life of the process, and a name can be read from another thread once its id has been published. */
+typedef struct {
+    char names[SESSION_TAGS_CAPACITY][SESSION_TAG_MAX_LENGTH + 1];
+    size_t num_names;
+    /* Open addressing, holding ids.  0 is an empty slot. */
+    session_tag_id_t slots[SESSION_TAGS_NUM_SLOTS];
+    uint64_t num_overflows;
+} session_tags_t;
+
+ENGINE_STATE(session_tags_t, global_session_tags);
+#define global_session_tags ENGINE_STATE_OF(global_session_tags)
+
+/* Which user, database & application each connection that we saw start is for, by front-end port. */
+typedef struct {
+    session_tag_id_t user_id;
+    session_tag_id_t database_id;
+    session_tag_id_t application_id;
+    /* Where the connection's aggregates are broken down, see metrics.h.  0 if they aren't. */
+    uint8_t breakdown_index;
+} session_t;
+
+typedef session_t session_table_t[0x10000];
+
+ENGINE_STATE(session_table_t, global_sessions);
+#define global_sessions ENGINE_STATE_OF(global_sessions)
+
+static void session_tags_init(session_tags_t *tags) {
+    ASSERT(tags);
+    memset(tags->slots, 0, sizeof(tags->slots));
+    strcpy(tags->names[SESSION_TAG_ID_UNKNOWN], "");
+    strcpy(tags->names[SESSION_TAG_ID_OTHER], "[other]");
+    tags->num_names = 2;
+    tags->num_overflows = 0;
+}
+
+static inline const char *session_tags_name(const session_tags_t *tags, session_tag_id_t id) {
+    return tags->names[id];
+}
+
+/* The id of the name, which is added if it's new. */
+static session_tag_id_t session_tags_intern(session_tags_t *tags, const char *name, size_t name_len, bool *is_new) {
+    ASSERT(tags);
+    ASSERT(is_new);
+    *is_new = false;
+    ASSERT(name_len <= SESSION_TAG_MAX_LENGTH);
+    uint32_t hash = SESSION_TAGS_FNV_OFFSET_BASIS;
+    size_t i = 0;
+    for (; i < name_len; ++i) {
+        hash = (hash ^ (uint8_t)name[i]) * SESSION_TAGS_FNV_PRIME;
+    }
+
+    size_t slot = hash % SESSION_TAGS_NUM_SLOTS;
+    for (; tags->slots[slot] != 0; slot = (slot + 1) % SESSION_TAGS_NUM_SLOTS) {
+        const char *existing = tags->names[tags->slots[slot]];
+        if ((strlen(existing) == name_len) && (memcmp(existing, name, name_len) == 0)) {
+            return tags->slots[slot];
+        }
+    }
+
+    if (SESSION_TAGS_CAPACITY == tags->num_names) {
+        tags->num_overflows++;
+        return SESSION_TAG_ID_OTHER;
+    }
+
+    session_tag_id_t id = tags->num_names;
+    memcpy(tags->names[id], name, name_len);
+    tags->names[id][name_len] = '\0';
+    tags->num_names++;
+    tags->slots[slot] = id;
+    *is_new = true;
+    return id;
+}
+
+#endif
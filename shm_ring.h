@@ -0,0 +1,178 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+/* The layout of the shared-memory ring that pgtrace -R publishes messages to, and a reader for it.  This header stands
+   alone so that consumers can include it.
+
+   The file is a header followed by a power of two of fixed-size slots, and message n (from 1) goes in slot
+   (n - 1) % num_slots.  There's one writer, which never waits: each slot is a seqlock whose seq is 0 while it's being
+   written and n once message n is in it, and write_seq is the last message published.  Any number of readers can
+   follow it, each at its own pace, and a reader that falls more than num_slots behind loses the messages that were
+   overwritten and counts them as dropped.  A writer that restarts on a file that's already a ring of the same size
+   reuses it rather than truncating it under its readers, starting again from message 1 in the next generation, and
+   readers follow it there.  The integers are in the host's byte order. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_RING_MAGIC "PGTRING\0"
+#define SHM_RING_MAGIC_SIZE 8
+#define SHM_RING_VERSION 1
+#define SHM_RING_SLOT_SIZE 256
+#define SHM_RING_HEADER_SIZE 128
+
+typedef struct {
+    char magic[SHM_RING_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t slot_size;
+    uint64_t num_slots;
+    /* Incremented each time a writer restarts on the ring, after it's reset write_seq to 0. */
+    uint64_t generation;
+    /* On a cache line of its own, it's the one that's always changing. */
+    uint8_t padding[64 - SHM_RING_MAGIC_SIZE - 24];
+    uint64_t write_seq;
+} shm_ring_header_t;
+
+/* Messages whose payloads are longer than SHM_RING_MAX_PAYLOAD_SIZE have just the start of them, with
+   is_payload_complete 0.  The fields match pgtrace_message_t's, see libpgtrace.h. */
+typedef struct {
+    uint64_t seq;
+    uint64_t start_nsec;
+    uint64_t end_nsec;
+    uint32_t fe_address;
+    uint32_t be_address;
+    uint16_t fe_port;
+    uint16_t be_port;
+    /* 0 from the front-end, 1 from the back-end. */
+    uint8_t direction;
+    uint8_t type;
+    uint8_t is_payload_complete;
+    uint8_t reserved;
+    int32_t length;
+    uint32_t payload_size;
+    uint8_t payload[SHM_RING_SLOT_SIZE - 48];
+} shm_ring_record_t;
+
+#define SHM_RING_MAX_PAYLOAD_SIZE (sizeof(((shm_ring_record_t *)0)->payload))
+
+typedef char shm_ring_header_size_check[(sizeof(shm_ring_header_t) <= SHM_RING_HEADER_SIZE) ? 1 : -1];
+typedef char shm_ring_record_size_check[(sizeof(shm_ring_record_t) == SHM_RING_SLOT_SIZE) ? 1 : -1];
+
+static inline size_t shm_ring_file_size(uint64_t num_slots) {
+    return SHM_RING_HEADER_SIZE + num_slots * SHM_RING_SLOT_SIZE;
+}
+
+static inline shm_ring_record_t *shm_ring_slot(shm_ring_header_t *header, uint64_t seq) {
+    return (shm_ring_record_t *)((uint8_t *)header + SHM_RING_HEADER_SIZE) + ((seq - 1) & (header->num_slots - 1));
+}
+
+typedef struct {
+    shm_ring_header_t *header;
+    size_t size;
+    /* The generation that next_seq is in. */
+    uint64_t generation;
+    /* The next message to read. */
+    uint64_t next_seq;
+    uint64_t num_dropped;
+} shm_ring_reader_t;
+
+/* Starts reading the ring at header, from the next message that's published.  Returns -1 if it isn't a ring that
+   this reader understands. */
+static inline int shm_ring_reader_init(shm_ring_reader_t *reader, shm_ring_header_t *header, size_t size) {
+    if ((size < SHM_RING_HEADER_SIZE) || (memcmp(header->magic, SHM_RING_MAGIC, SHM_RING_MAGIC_SIZE) != 0) ||
+        (header->version != SHM_RING_VERSION) || (header->slot_size != SHM_RING_SLOT_SIZE) ||
+        (0 == header->num_slots) || ((header->num_slots & (header->num_slots - 1)) != 0) ||
+        (size < shm_ring_file_size(header->num_slots))) {
+        return -1;
+    }
+
+    reader->header = header;
+    reader->size = size;
+    reader->generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+    reader->next_seq = __atomic_load_n(&header->write_seq, __ATOMIC_ACQUIRE) + 1;
+    reader->num_dropped = 0;
+    return 0;
+}
+
+/* Maps the ring file at path read-only and starts reading it.  Returns -1, with errno set if it can, if that fails. */
+static inline int shm_ring_reader_open(shm_ring_reader_t *reader, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct stat st;
+    void *p = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && (st.st_size >= SHM_RING_HEADER_SIZE)) {
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    close(fd);
+    if (MAP_FAILED == p) {
+        return -1;
+    }
+
+    if (shm_ring_reader_init(reader, (shm_ring_header_t *)p, st.st_size) != 0) {
+        munmap(p, st.st_size);
+        return -1;
+    }
+
+    return 0;
+}
+
+static inline void shm_ring_reader_close(shm_ring_reader_t *reader) {
+    munmap(reader->header, reader->size);
+    reader->header = NULL;
+}
+
+/* Copies the next message into record.  Returns 0 if there isn't one yet, otherwise 1.  Messages that were overwritten
+   before they could be read are skipped and added to num_dropped, and a writer's restart is followed from its first
+   message. */
+static inline int shm_ring_reader_next(shm_ring_reader_t *reader, shm_ring_record_t *record) {
+    shm_ring_header_t *header = reader->header;
+    for (;;) {
+        uint64_t generation = __atomic_load_n(&header->generation, __ATOMIC_ACQUIRE);
+        if (generation != reader->generation) {
+            reader->generation = generation;
+            reader->next_seq = 1;
+        }
+
+        uint64_t write_seq = __atomic_load_n(&header->write_seq, __ATOMIC_ACQUIRE);
+        if (reader->next_seq > write_seq) {
+            return 0;
+        }
+
+        if (write_seq - reader->next_seq >= header->num_slots) {
+            uint64_t oldest_seq = write_seq - header->num_slots + 1;
+            reader->num_dropped += oldest_seq - reader->next_seq;
+            reader->next_seq = oldest_seq;
+        }
+
+        shm_ring_record_t *slot = shm_ring_slot(header, reader->next_seq);
+        uint64_t seq_before = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq_before == reader->next_seq) {
+            memcpy(record, slot, sizeof(*record));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&header->generation, __ATOMIC_RELAXED) != generation) {
+                /* It's from the writer's restart, not the generation that we were reading. */
+                continue;
+            }
+
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq_before) {
+                reader->next_seq++;
+                return 1;
+            }
+        }
+
+        /* The writer has lapped us and is writing over it, or has written over it. */
+        reader->num_dropped++;
+        reader->next_seq++;
+    }
+}
+
+#endif
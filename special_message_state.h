@@ -1,31 +1,180 @@
 #ifndef SPECIAL_MESSAGE_STATE_H
 #define SPECIAL_MESSAGE_STATE_H
 
+/* The request codes that follow the length of a special message.  A StartupMessage's is its protocol version, 3.x. */
+#define SPECIAL_MESSAGE_CODE_CANCEL_REQUEST 80877102
+#define SPECIAL_MESSAGE_CODE_SSL_REQUEST 80877103
+#define SPECIAL_MESSAGE_CODE_GSSENC_REQUEST 80877104
+#define SPECIAL_MESSAGE_PROTOCOL_MAJOR_VERSION 3
+
 typedef enum {
     SPECIAL_MESSAGE_TYPE_UNKNOWN,
     SPECIAL_MESSAGE_TYPE_CANCEL_REQUEST,
     SPECIAL_MESSAGE_TYPE_SSL_REQUEST,
+    SPECIAL_MESSAGE_TYPE_GSSENC_REQUEST,
     SPECIAL_MESSAGE_TYPE_STARTUP_MESSAGE,
 } special_message_type_t;
 
 
-typedef struct {    
+/* Decodes the request code, and a StartupMessage's parameters, a byte at a time so that they're seen however much
+   of the message fits in the trace buffer. */
+typedef struct {
     special_message_type_t message_type;
+    int32_state_t code_state;
+    bool is_in_value;
+    /* The parameter whose value is being read.  Longer names than fit are still counted so that they match nothing. */
+    char name[SESSION_TAG_MAX_LENGTH + 1];
+    size_t name_len;
+    char value[SESSION_TAG_MAX_LENGTH + 1];
+    size_t value_len;
+    /* The StartupMessage's user, database & application. */
+    session_t session;
+    /* The StartupMessage asks for a walsender. */
+    bool is_replication;
+    /* The CancelRequest's pid & key. */
+    cancel_key_state_t cancel_key;
     generic_message_state_t generic_message_state;
 } special_message_state_t;
 
+static special_message_type_t special_message_type_from_code(int32_t code) {
+    switch (code) {
+        case SPECIAL_MESSAGE_CODE_CANCEL_REQUEST:
+            return SPECIAL_MESSAGE_TYPE_CANCEL_REQUEST;
+
+        case SPECIAL_MESSAGE_CODE_SSL_REQUEST:
+            return SPECIAL_MESSAGE_TYPE_SSL_REQUEST;
+
+        case SPECIAL_MESSAGE_CODE_GSSENC_REQUEST:
+            return SPECIAL_MESSAGE_TYPE_GSSENC_REQUEST;
+
+        default:
+            return ((code >> 16) == SPECIAL_MESSAGE_PROTOCOL_MAJOR_VERSION) ? SPECIAL_MESSAGE_TYPE_STARTUP_MESSAGE :
+                                                                              SPECIAL_MESSAGE_TYPE_UNKNOWN;
+    }
+}
+
+static bool special_message_state_is_parameter(const special_message_state_t *state, const char *name) {
+    return (strlen(name) == state->name_len) && (memcmp(state->name, name, state->name_len) == 0);
+}
+
+/* Says what a new id means, so that records can carry just the id. */
+static void special_message_state_print_session_tag(session_tag_id_t id, const char *name) {
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"SessionTag\"");
+        message_json_writer_write_uint_field(&writer, "id", id);
+        message_json_writer_write_string_field(&writer, "name", (const uint8_t *)name, strlen(name));
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, stdout);
+        return;
+    }
+
+    LOG("session tag: id=%u name=%s", id, name);
+}
+
+static session_tag_id_t special_message_state_intern_value(special_message_state_t *state) {
+    bool is_new;
+    session_tag_id_t id = session_tags_intern(&global_session_tags, state->value, state->value_len, &is_new);
+    if (is_new) {
+        special_message_state_print_session_tag(id, session_tags_name(&global_session_tags, id));
+    }
+
+    return id;
+}
+
+static void special_message_state_on_parameter(special_message_state_t *state) {
+    if (special_message_state_is_parameter(state, "user")) {
+        state->session.user_id = special_message_state_intern_value(state);
+    } else if (special_message_state_is_parameter(state, "database")) {
+        state->session.database_id = special_message_state_intern_value(state);
+    } else if (special_message_state_is_parameter(state, "application_name")) {
+        state->session.application_id = special_message_state_intern_value(state);
+    } else if (special_message_state_is_parameter(state, "replication")) {
+        /* "database" for logical replication, a boolean for physical. */
+        state->value[state->value_len] = '\0';
+        state->is_replication = (strcmp(state->value, "false") != 0) && (strcmp(state->value, "off") != 0) &&
+                                (strcmp(state->value, "no") != 0) && (strcmp(state->value, "0") != 0);
+    }
+}
+
+static void special_message_state_on_payload_byte(special_message_state_t *state, uint8_t byte) {
+    if (state->code_state.offset < 4) {
+        if (int32_state_on_byte(&state->code_state, byte)) {
+            state->message_type = special_message_type_from_code(int32_state_value_get(&state->code_state));
+        }
+        return;
+    }
+
+    if (SPECIAL_MESSAGE_TYPE_CANCEL_REQUEST == state->message_type) {
+        cancel_key_state_on_byte(&state->cancel_key, byte);
+        return;
+    }
+
+    if (state->message_type != SPECIAL_MESSAGE_TYPE_STARTUP_MESSAGE) {
+        return;
+    }
+
+    if (!state->is_in_value) {
+        if ('\0' == byte) {
+            /* An empty name ends the parameters. */
+            state->is_in_value = (state->name_len > 0);
+        } else {
+            if (state->name_len < SESSION_TAG_MAX_LENGTH) {
+                state->name[state->name_len] = byte;
+            }
+            state->name_len++;
+        }
+        return;
+    }
+
+    if ('\0' == byte) {
+        special_message_state_on_parameter(state);
+        state->is_in_value = false;
+        state->name_len = 0;
+        state->value_len = 0;
+    } else if (state->value_len < SESSION_TAG_MAX_LENGTH) {
+        state->value[state->value_len++] = byte;
+    }
+}
+
 static bool special_message_state_on_byte(special_message_state_t *state, uint16_t fe_port, uint8_t byte, FILE *trace_fp) {
+    if (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->generic_message_state.state_type) {
+        special_message_state_on_payload_byte(state, byte);
+    }
+
     return generic_message_state_on_byte(&state->generic_message_state, fe_port, byte, trace_fp);
 }
 
+/* The StartupMessage's session, with the database defaulting to the user like Postgres does. */
+static session_t special_message_state_session(const special_message_state_t *state) {
+    session_t session = state->session;
+    if (SESSION_TAG_ID_UNKNOWN == session.database_id) {
+        session.database_id = session.user_id;
+    }
+
+    return session;
+}
+
 static void special_message_state_on_new_message(special_message_state_t *state,
                                                  uint16_t fe_port,
                                                  sender_type_t sender_type,
                                                  const char *message_name) {
     ASSERT(state);
     state->message_type = SPECIAL_MESSAGE_TYPE_UNKNOWN;
-    generic_message_state_on_new_message(&state->generic_message_state, fe_port, sender_type, message_name);
-    
+    int32_state_init(&state->code_state);
+    state->is_in_value = false;
+    state->name_len = 0;
+    state->value_len = 0;
+    memset(&state->session, 0, sizeof(state->session));
+    state->is_replication = false;
+    cancel_key_state_init(&state->cancel_key);
+    generic_message_state_on_new_message(&state->generic_message_state, fe_port, sender_type, FE_MESSAGE_TYPE_SPECIAL, message_name);
+
     /* Special messages have no type byte, the first byte is part of the length, and it's always 0. */
     special_message_state_on_byte(state, fe_port, 0, stderr);
 }
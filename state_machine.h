@@ -1,12 +1,46 @@
 #ifndef STATE_MACHINE_H
 #define STATE_MACHINE_H
 
+#include "message_type.h"
 #include "int32_state.h"
 #include "message_trace_buffer.h"
+#include "payload_reader.h"
+#include "session_tags.h"
+#include "message_json_writer.h"
+#include "histogram.h"
+#include "transaction_stats.h"
+#include "pipeline_stats.h"
+#include "pooler_stats.h"
+#include "connection_setup_stats.h"
+#include "cancel_keys.h"
+#include "memory_budget.h"
+#include "overload_controller.h"
+#include "bypass_rules.h"
+#include "opaque_state.h"
+#include "replication_state.h"
+#include "metrics.h"
+#include "rollup_format.h"
+#include "trace_store_format.h"
+#include "trace_store.h"
 #include "generic_message_state.h"
+#include "error_stats.h"
+#include "error_response_state.h"
 #include "special_message_state.h"
+#include "bulk_transfer_state.h"
+#include "top_statements.h"
+#include "statement_message_state.h"
 #include "fe_state.h"
 #include "be_state.h"
+#include "transaction_state.h"
+#include "statement_state.h"
+#include "pipeline_state.h"
+#include "replay_script.h"
+#include "replay_recorder.h"
+#include "rollup_writer.h"
+#include "pooler_state.h"
+#include "connection_setup_state.h"
+#include "cancel_state.h"
+#include "message_sink.h"
 #include "connection_state.h"
 
 
@@ -14,7 +48,8 @@ typedef struct {
     connection_state_t connections[0xffff];
 } pgtrace_state_t;
 
-pgtrace_state_t global_state;
+ENGINE_STATE(pgtrace_state_t, global_state);
+#define global_state ENGINE_STATE_OF(global_state)
 
 static connection_state_t *get_first_connection_state() {
     return global_state.connections;
@@ -38,20 +73,113 @@ static void state_machine_init() {
 }
 
 
-static inline void state_machine_fe_next(uint16_t sender_port,
-                                         uint16_t receiver_port,
-                                         uint8_t byte,
-                                         size_t packet_payload_size,
-                                         FILE *trace_fp) {
-    connection_state_on_fe_byte(sender_port, get_connection_state(sender_port), byte, trace_fp);
+/* The front-end has sent a SYN. */
+static void state_machine_on_connection_open(uint16_t fe_port) {
+    memset(&global_sessions[fe_port], 0, sizeof(global_sessions[fe_port]));
+    cancel_keys_on_open(&global_cancel_keys, fe_port);
+    connection_state_on_open(get_connection_state(fe_port));
 }
 
-static inline void state_machine_be_next(uint16_t sender_port,
-                                         uint16_t receiver_port,
-                                         uint8_t byte,
-                                         size_t packet_payload_size,
-                                         FILE *trace_fp) {
-    connection_state_on_be_byte(receiver_port, get_connection_state(receiver_port), byte, packet_payload_size, trace_fp);    
+/* The back-end has answered the front-end's SYN. */
+static void state_machine_on_syn_ack(uint16_t fe_port) {
+    connection_setup_on_syn_ack(&get_connection_state(fe_port)->setup);
+}
+
+/* Either end has sent a FIN or RST. */
+static void state_machine_on_connection_close(uint16_t fe_port) {
+    connection_state_on_close(fe_port, get_connection_state(fe_port));
+}
+
+/* There's a packet on the connection, in either direction. */
+static inline void state_machine_on_packet(uint16_t fe_port, bool is_from_be, uint32_t seq, uint32_t ack, bool has_ack, size_t size_payload) {
+    connection_state_t *state = get_connection_state(fe_port);
+    state->last_packet_nsec = now_epoch_nsec();
+    if (!is_from_be && has_ack) {
+        connection_setup_on_fe_ack(&state->setup);
+    }
+
+    if (opaque_connection_is_opaque(&state->opaque)) {
+        global_metrics.opaque.num_packets++;
+        uint64_t rtt_nsec = opaque_connection_on_packet(&state->opaque, is_from_be, seq, ack, has_ack, size_payload);
+        if (rtt_nsec != 0) {
+            histogram_add(&global_metrics.opaque.rtt_nsec, rtt_nsec);
+        }
+    }
+}
+
+/* Whether the connection has had packets, but not for idle_nsec. */
+static inline bool state_machine_is_idle(uint16_t fe_port, uint64_t idle_nsec) {
+    uint64_t last_packet_nsec = get_connection_state(fe_port)->last_packet_nsec;
+    return (last_packet_nsec != 0) && (last_packet_nsec + idle_nsec < now_epoch_nsec());
+}
+
+/* The connection's first packet has come from or gone to this client address, in host order. */
+static inline void state_machine_on_client_address(uint16_t fe_port, uint32_t address) {
+    connection_state_t *state = get_connection_state(fe_port);
+    if (!state->bypass.is_address_checked) {
+        state->bypass.is_address_checked = true;
+        connection_state_bypass(fe_port, state, bypass_rules_match_address(&global_bypass_rules, address));
+    }
+}
+
+static void state_machine_evict(uint16_t fe_port) {
+    connection_state_evict(get_connection_state(fe_port));
+}
+
+/* Ends every replay recording and frees its buffer. */
+static void state_machine_drop_reassembly() {
+    connection_state_t *cs_p = get_first_connection_state();
+    connection_state_t *cs_end = get_end_connection_state();
+    for (; cs_p < cs_end; ++cs_p) {
+        replay_connection_stop(&global_replay_recorder, &cs_p->replay);
+    }
+}
+
+/* Each of these takes the next byte, or a run of bytes if the payload is being skipped, and returns how many bytes it
+   took. */
+static inline size_t state_machine_fe_next(uint16_t sender_port,
+                                           uint16_t receiver_port,
+                                           const uint8_t *bytes,
+                                           size_t num_bytes,
+                                           size_t packet_payload_size,
+                                           FILE *trace_fp) {
+    connection_state_t *state = get_connection_state(sender_port);
+    if (state->is_unparsed) {
+        return connection_state_on_unparsed_bytes(state, SENDER_TYPE_FE, num_bytes);
+    }
+
+    if (pooler_is_enabled(&global_pooler)) {
+        state->pooler.is_client = (receiver_port == global_pooler.port);
+    }
+
+    return connection_state_on_fe_bytes(sender_port, state, bytes, num_bytes, trace_fp);
+}
+
+static inline size_t state_machine_be_next(uint16_t sender_port,
+                                           uint16_t receiver_port,
+                                           const uint8_t *bytes,
+                                           size_t num_bytes,
+                                           size_t packet_payload_size,
+                                           FILE *trace_fp) {
+    connection_state_t *state = get_connection_state(receiver_port);
+    if (state->is_unparsed) {
+        return connection_state_on_unparsed_bytes(state, SENDER_TYPE_BE, num_bytes);
+    }
+
+    if (pooler_is_enabled(&global_pooler)) {
+        state->pooler.is_client = (sender_port == global_pooler.port);
+    }
+
+    return connection_state_on_be_bytes(receiver_port, state, bytes, num_bytes, packet_payload_size, trace_fp);
+}
+
+/* Each of these is for bytes that were sent but not captured, see connection_state_on_fe_lost. */
+static void state_machine_fe_lost(uint16_t fe_port, size_t num_bytes, FILE *trace_fp) {
+    connection_state_on_fe_lost(fe_port, get_connection_state(fe_port), num_bytes, trace_fp);
+}
+
+static void state_machine_be_lost(uint16_t fe_port, size_t num_bytes, FILE *trace_fp) {
+    connection_state_on_be_lost(fe_port, get_connection_state(fe_port), num_bytes, trace_fp);
 }
 
 #endif
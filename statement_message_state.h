@@ -0,0 +1,145 @@
+#ifndef STATEMENT_MESSAGE_STATE_H
+#define STATEMENT_MESSAGE_STATE_H
+
+#define STATEMENT_TEXT_STATE_FNV_OFFSET_BASIS 14695981039346656037ULL
+#define STATEMENT_TEXT_STATE_FNV_PRIME 1099511628211ULL
+
+typedef enum {
+    /* Parse's statement name, which isn't part of the text. */
+    STATEMENT_TEXT_STATE_TYPE_NAME,
+    STATEMENT_TEXT_STATE_TYPE_TEXT,
+    STATEMENT_TEXT_STATE_TYPE_DONE,
+} statement_text_state_type_t;
+
+/* Hashes and keeps the start of the SQL in a Query or Parse one byte at a time, so it sees all of the text however
+   much of it fits in the trace buffer.  Runs of whitespace count as a single space so that statements that only
+   differ in their formatting are the same statement. */
+typedef struct {
+    statement_text_state_type_t state_type;
+    bool is_after_whitespace;
+    /* The hash of Parse's statement name. */
+    uint64_t name_hash;
+    statement_text_t statement;
+} statement_text_state_t;
+
+static void statement_text_state_init(statement_text_state_t *state, bool has_name) {
+    ASSERT(state);
+    state->state_type = has_name ? STATEMENT_TEXT_STATE_TYPE_NAME : STATEMENT_TEXT_STATE_TYPE_TEXT;
+    state->is_after_whitespace = false;
+    state->name_hash = STATEMENT_TEXT_STATE_FNV_OFFSET_BASIS;
+    statement_text_init(&state->statement);
+    state->statement.hash = STATEMENT_TEXT_STATE_FNV_OFFSET_BASIS;
+}
+
+static inline void statement_text_state_append(statement_text_state_t *state, uint8_t byte) {
+    state->statement.hash = (state->statement.hash ^ byte) * STATEMENT_TEXT_STATE_FNV_PRIME;
+    if (state->statement.length < STATEMENT_TEXT_MAX_LENGTH) {
+        state->statement.text[state->statement.length++] = byte;
+    }
+}
+
+/* Drops a UTF-8 sequence that was cut off by STATEMENT_TEXT_MAX_LENGTH so that the kept text is still valid. */
+static void statement_text_state_trim_partial_character(statement_text_state_t *state) {
+    statement_text_t *statement = &state->statement;
+    size_t start = statement->length;
+    while ((start > 0) && (((uint8_t)statement->text[start - 1] & 0xc0) == 0x80)) {
+        --start;
+    }
+
+    if (0 == start) {
+        return;
+    }
+
+    uint8_t lead = (uint8_t)statement->text[start - 1];
+    size_t sequence_length = (lead >= 0xf0) ? 4 : (lead >= 0xe0) ? 3 : (lead >= 0xc0) ? 2 : 1;
+    if (statement->length - (start - 1) < sequence_length) {
+        statement->length = start - 1;
+    }
+}
+
+static inline void statement_text_state_on_byte(statement_text_state_t *state, uint8_t byte) {
+    ASSERT(state);
+
+    switch (state->state_type) {
+        case STATEMENT_TEXT_STATE_TYPE_NAME:
+            if ('\0' == byte) {
+                state->state_type = STATEMENT_TEXT_STATE_TYPE_TEXT;
+            } else {
+                state->name_hash = (state->name_hash ^ byte) * STATEMENT_TEXT_STATE_FNV_PRIME;
+            }
+            return;
+
+        case STATEMENT_TEXT_STATE_TYPE_TEXT:
+            if ('\0' == byte) {
+                if (STATEMENT_TEXT_MAX_LENGTH == state->statement.length) {
+                    statement_text_state_trim_partial_character(state);
+                }
+
+                state->statement.text[state->statement.length] = '\0';
+                state->state_type = STATEMENT_TEXT_STATE_TYPE_DONE;
+                return;
+            }
+
+            if ((' ' == byte) || ('\t' == byte) || ('\n' == byte) || ('\r' == byte)) {
+                state->is_after_whitespace = true;
+                return;
+            }
+
+            /* Leading and trailing whitespace is dropped altogether. */
+            if (state->is_after_whitespace && (state->statement.length > 0)) {
+                statement_text_state_append(state, ' ');
+            }
+
+            state->is_after_whitespace = false;
+            statement_text_state_append(state, byte);
+            return;
+
+        case STATEMENT_TEXT_STATE_TYPE_DONE:
+            return;
+    }
+}
+
+
+typedef struct {
+    generic_message_state_t generic;
+    statement_text_state_t text;
+} statement_message_state_t;
+
+static void statement_message_state_on_new_message(statement_message_state_t *state,
+                                                   uint16_t fe_port,
+                                                   sender_type_t sender_type,
+                                                   uint8_t message_type,
+                                                   const char *message_name) {
+    ASSERT(state);
+    statement_text_state_init(&state->text, FE_MESSAGE_TYPE_PARSE == message_type);
+    generic_message_state_on_new_message(&state->generic, fe_port, sender_type, message_type, message_name);
+}
+
+static inline bool statement_message_state_on_byte(statement_message_state_t *state, uint16_t fe_port, uint8_t byte, FILE *trace_fp) {
+    ASSERT(state);
+    if (GENERIC_MESSAGE_STATE_TYPE_IN_PAYLOAD == state->generic.state_type) {
+        statement_text_state_on_byte(&state->text, byte);
+    }
+
+    return generic_message_state_on_byte(&state->generic, fe_port, byte, trace_fp);
+}
+
+/* The statement from the message that has just completed, or NULL if the message was cut short. */
+static const statement_text_t *statement_message_state_statement(const statement_message_state_t *state) {
+    ASSERT(state);
+    return (STATEMENT_TEXT_STATE_TYPE_DONE == state->text.state_type) ? &state->text.statement : NULL;
+}
+
+/* Whether all of a Parse's statement name was seen, in which case *name_hash is set to its hash. */
+static bool statement_message_state_name_hash(const statement_message_state_t *state, uint64_t *name_hash) {
+    ASSERT(state);
+    ASSERT(name_hash);
+    if (STATEMENT_TEXT_STATE_TYPE_NAME == state->text.state_type) {
+        return false;
+    }
+
+    *name_hash = state->text.name_hash;
+    return true;
+}
+
+#endif
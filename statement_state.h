@@ -0,0 +1,215 @@
+#ifndef STATEMENT_STATE_H
+#define STATEMENT_STATE_H
+
+/* Statement texts kept per connection, for prepared statements and for Queries and Executes that haven't been
+   answered yet.  The least recently used is given up first, so a driver's cached statements stay while they're used. */
+#define STATEMENT_STATE_NUM_STATEMENTS 8
+
+/* Portals kept per connection.  Most drivers only use the unnamed portal. */
+#define STATEMENT_STATE_NUM_PORTALS 4
+
+/* Bind starts with a portal name and a statement name, Execute with a portal name. */
+#define STATEMENT_STATE_MAX_NAMES 2
+
+typedef struct {
+    /* The hash of the prepared statement's name, which is the empty string for the unnamed statement. */
+    uint64_t name_hash;
+    /* A Parse's statement that hasn't been parsed again under the same name since, rather than a Query's. */
+    bool is_prepared;
+    /* Counts reuses of the slot, so that a reference to what it used to hold comes to nothing. */
+    uint8_t generation;
+    /* When the statement was last parsed, bound or queried, in state->num_uses.  0 if the slot has never been used. */
+    uint32_t last_use;
+    statement_text_t statement;
+} statement_slot_t;
+
+typedef struct {
+    uint64_t name_hash;
+    bool is_bound;
+    /* The statement that the portal runs, see statement_state_ref. */
+    uint16_t statement_ref;
+} statement_portal_t;
+
+/* The text of each connection's prepared statements and recent Queries, with which statement each portal was bound
+   to, so that an Execute is credited to the statement that it actually runs.  Statement and portal names are only
+   kept as hashes. */
+typedef struct {
+    statement_slot_t slots[STATEMENT_STATE_NUM_STATEMENTS];
+    statement_portal_t portals[STATEMENT_STATE_NUM_PORTALS];
+    uint8_t next_portal;
+    uint32_t num_uses;
+    /* The names that start the Bind or Execute in progress, hashed as they arrive. */
+    uint64_t name_hashes[STATEMENT_STATE_MAX_NAMES];
+    uint8_t num_names;
+    uint8_t num_names_read;
+} statement_state_t;
+
+static void statement_state_init(statement_state_t *state) {
+    ASSERT(state);
+    memset(state, 0, sizeof(*state));
+    size_t i = 0;
+    for (; i < STATEMENT_STATE_NUM_STATEMENTS; ++i) {
+        statement_text_init(&state->slots[i].statement);
+    }
+}
+
+/* A reference to what a slot holds now, which stays valid until the slot is reused. */
+static inline uint16_t statement_state_ref(const statement_state_t *state, const statement_slot_t *slot) {
+    return (uint16_t)(((uint16_t)slot->generation << 8) | (uint16_t)(slot - state->slots));
+}
+
+static inline void statement_state_use(statement_state_t *state, statement_slot_t *slot) {
+    slot->last_use = ++state->num_uses;
+}
+
+/* Takes over the least recently used slot for statement, and returns it. */
+static statement_slot_t *statement_state_add_slot(statement_state_t *state, const statement_text_t *statement) {
+    statement_slot_t *slot = &state->slots[0];
+    size_t i = 1;
+    for (; i < STATEMENT_STATE_NUM_STATEMENTS; ++i) {
+        if (state->slots[i].last_use < slot->last_use) {
+            slot = &state->slots[i];
+        }
+    }
+
+    slot->is_prepared = false;
+    slot->generation++;
+    slot->statement = *statement;
+    statement_state_use(state, slot);
+    return slot;
+}
+
+/* The prepared statement with the given name, or NULL if it's not kept. */
+static statement_slot_t *statement_state_find_prepared(statement_state_t *state, uint64_t name_hash) {
+    size_t i = 0;
+    for (; i < STATEMENT_STATE_NUM_STATEMENTS; ++i) {
+        statement_slot_t *slot = &state->slots[i];
+        if (slot->is_prepared && (slot->name_hash == name_hash)) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/* Returns a reference to a Query's statement. */
+static uint16_t statement_state_add(statement_state_t *state, const statement_text_t *statement) {
+    ASSERT(state);
+    ASSERT(statement);
+    return statement_state_ref(state, statement_state_add_slot(state, statement));
+}
+
+/* A Parse of the statement named name_hash.  The statement it replaces keeps its slot for a while, since pipelined
+   Executes of it may not have been answered yet. */
+static void statement_state_on_parse(statement_state_t *state, uint64_t name_hash, const statement_text_t *statement) {
+    ASSERT(state);
+    ASSERT(statement);
+    statement_slot_t *replaced = statement_state_find_prepared(state, name_hash);
+    if (replaced) {
+        replaced->is_prepared = false;
+    }
+
+    statement_slot_t *slot = statement_state_add_slot(state, statement);
+    slot->name_hash = name_hash;
+    slot->is_prepared = true;
+}
+
+/* A Parse whose statement we didn't get, so the name no longer says what runs. */
+static void statement_state_on_unknown_parse(statement_state_t *state, uint64_t name_hash) {
+    ASSERT(state);
+    statement_slot_t *replaced = statement_state_find_prepared(state, name_hash);
+    if (replaced) {
+        replaced->is_prepared = false;
+    }
+}
+
+static statement_portal_t *statement_state_find_portal(statement_state_t *state, uint64_t name_hash) {
+    size_t i = 0;
+    for (; i < STATEMENT_STATE_NUM_PORTALS; ++i) {
+        statement_portal_t *portal = &state->portals[i];
+        if (portal->is_bound && (portal->name_hash == name_hash)) {
+            return portal;
+        }
+    }
+
+    return NULL;
+}
+
+/* A Bind of the portal named portal_hash to the statement named statement_hash. */
+static void statement_state_on_bind(statement_state_t *state, uint64_t portal_hash, uint64_t statement_hash) {
+    ASSERT(state);
+    statement_portal_t *portal = statement_state_find_portal(state, portal_hash);
+    statement_slot_t *slot = statement_state_find_prepared(state, statement_hash);
+    if (!slot) {
+        if (portal) {
+            portal->is_bound = false;
+        }
+        return;
+    }
+
+    if (!portal) {
+        portal = &state->portals[state->next_portal];
+        state->next_portal = (state->next_portal + 1) % STATEMENT_STATE_NUM_PORTALS;
+    }
+
+    statement_state_use(state, slot);
+    portal->name_hash = portal_hash;
+    portal->is_bound = true;
+    portal->statement_ref = statement_state_ref(state, slot);
+}
+
+/* A Bind whose names we didn't get, so any portal may have been rebound. */
+static void statement_state_on_unknown_bind(statement_state_t *state) {
+    ASSERT(state);
+    size_t i = 0;
+    for (; i < STATEMENT_STATE_NUM_PORTALS; ++i) {
+        state->portals[i].is_bound = false;
+    }
+}
+
+/* Whether the portal named portal_hash is bound to a statement, which *statement_ref is then set to. */
+static bool statement_state_on_execute(statement_state_t *state, uint64_t portal_hash, uint16_t *statement_ref) {
+    ASSERT(state);
+    ASSERT(statement_ref);
+    const statement_portal_t *portal = statement_state_find_portal(state, portal_hash);
+    if (!portal) {
+        return false;
+    }
+
+    *statement_ref = portal->statement_ref;
+    return true;
+}
+
+/* The statement that statement_ref refers to, or NULL if its slot has since been reused. */
+static const statement_text_t *statement_state_get(statement_state_t *state, uint16_t statement_ref) {
+    ASSERT(state);
+    const statement_slot_t *slot = &state->slots[(statement_ref & 0xff) % STATEMENT_STATE_NUM_STATEMENTS];
+    return (slot->generation == (statement_ref >> 8)) ? &slot->statement : NULL;
+}
+
+/* A new front-end message has started.  The names at the start of a Bind or Execute are read from its payload. */
+static inline void statement_state_on_message_start(statement_state_t *state, fe_message_type_t message_type) {
+    state->num_names = (FE_MESSAGE_TYPE_BIND == message_type) ? 2 : (FE_MESSAGE_TYPE_EXECUTE == message_type) ? 1 : 0;
+    state->num_names_read = 0;
+    state->name_hashes[0] = STATEMENT_TEXT_STATE_FNV_OFFSET_BASIS;
+    state->name_hashes[1] = STATEMENT_TEXT_STATE_FNV_OFFSET_BASIS;
+}
+
+static inline bool statement_state_is_reading_names(const statement_state_t *state) {
+    return state->num_names_read < state->num_names;
+}
+
+/* Payload bytes of the message in progress. */
+static inline void statement_state_on_payload_bytes(statement_state_t *state, const uint8_t *bytes, size_t num_bytes) {
+    size_t i = 0;
+    for (; (i < num_bytes) && statement_state_is_reading_names(state); ++i) {
+        if ('\0' == bytes[i]) {
+            state->num_names_read++;
+        } else {
+            uint64_t *hash = &state->name_hashes[state->num_names_read];
+            *hash = (*hash ^ bytes[i]) * STATEMENT_TEXT_STATE_FNV_PRIME;
+        }
+    }
+}
+
+#endif
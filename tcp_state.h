@@ -83,5 +83,11 @@ static void tcp_state_set_be_seq_range(tcp_state_t *state, uint16_t fe_port, u_i
     tcp_state_set_seq_range(state->be, fe_port, ack, window);
 }
 
+/* Accepts whatever comes next on the connection in either direction. */
+static void tcp_state_forget(tcp_state_t *state, uint16_t fe_port) {
+    ASSERT(state);
+    memset(&state->fe[fe_port], 0, sizeof(state->fe[fe_port]));
+    memset(&state->be[fe_port], 0, sizeof(state->be[fe_port]));
+}
 
 #endif
@@ -1,7 +1,33 @@
 #include "test_int32_state.h"
 #include "test_generic_message_state.h"
+#include "test_message_json_writer.h"
+#include "test_error_response_state.h"
+#include "test_top_statements.h"
+#include "test_statement_state.h"
+#include "test_checkpoint.h"
+#include "test_session_tags.h"
+#include "test_shm_ring.h"
+#include "test_trace_store.h"
+#include "test_replication_state.h"
+#include "test_cancel_keys.h"
+#include "test_pipeline_state.h"
+#include "test_pooler_state.h"
+#include "test_message_sink.h"
 
 static void test() {
     test_int32_state();
     test_generic_message_state();
+    test_message_json_writer();
+    test_error_response_state();
+    test_top_statements();
+    test_statement_state();
+    test_checkpoint();
+    test_session_tags();
+    test_shm_ring();
+    test_trace_store();
+    test_replication_state();
+    test_cancel_keys();
+    test_pipeline_state();
+    test_pooler_state();
+    test_message_sink();
 }
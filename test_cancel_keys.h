@@ -0,0 +1,59 @@
+#ifndef TEST_CANCEL_KEYS_H
+#define TEST_CANCEL_KEYS_H
+
+#include "common.h"
+#include "cancel_keys.h"
+
+static cancel_key_t test_cancel_key(uint32_t pid, uint32_t key) {
+    cancel_key_state_t state;
+    cancel_key_state_init(&state);
+    int i = 24;
+    for (; i >= 0; i -= 8) {
+        cancel_key_state_on_byte(&state, (uint8_t)(pid >> i));
+    }
+
+    ASSERT(!cancel_key_state_is_complete(&state));
+    for (i = 24; i >= 0; i -= 8) {
+        cancel_key_state_on_byte(&state, (uint8_t)(key >> i));
+    }
+
+    ASSERT(cancel_key_state_is_complete(&state));
+    ASSERT(state.key.pid == pid);
+    return state.key;
+}
+
+static void test_cancel_keys() {
+    /* Too big for the stack. */
+    static cancel_keys_t keys;
+    cancel_keys_init(&keys);
+    uint16_t fe_port;
+    ASSERT(!cancel_keys_find(&keys, test_cancel_key(100, 999), &fe_port));
+    cancel_keys_add(&keys, 41000, test_cancel_key(100, 999));
+    cancel_keys_add(&keys, 41001, test_cancel_key(101, 999));
+    ASSERT(cancel_keys_find(&keys, test_cancel_key(100, 999), &fe_port));
+    ASSERT(41000 == fe_port);
+    ASSERT(cancel_keys_find(&keys, test_cancel_key(101, 999), &fe_port));
+    ASSERT(41001 == fe_port);
+    /* Only the whole key will do. */
+    ASSERT(!cancel_keys_find(&keys, test_cancel_key(100, 998), &fe_port));
+
+    /* A new connection on the port forgets the old one's key, and another connection can have it after. */
+    cancel_keys_on_open(&keys, 41000);
+    ASSERT(!cancel_keys_find(&keys, test_cancel_key(100, 999), &fe_port));
+    cancel_keys_add(&keys, 41002, test_cancel_key(100, 999));
+    ASSERT(cancel_keys_find(&keys, test_cancel_key(100, 999), &fe_port));
+    ASSERT(41002 == fe_port);
+
+    /* Every port's key at once still fits. */
+    uint32_t port = 0;
+    for (; port < CANCEL_KEYS_NUM_PORTS; ++port) {
+        cancel_keys_add(&keys, port, test_cancel_key(port, 7));
+    }
+
+    for (port = 0; port < CANCEL_KEYS_NUM_PORTS; ++port) {
+        ASSERT(cancel_keys_find(&keys, test_cancel_key(port, 7), &fe_port));
+        ASSERT(port == fe_port);
+    }
+}
+
+#endif
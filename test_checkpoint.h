@@ -0,0 +1,49 @@
+#ifndef TEST_CHECKPOINT_H
+#define TEST_CHECKPOINT_H
+
+#include "common.h"
+#include "checkpoint.h"
+
+/* Connections survive a round trip through the file format, and a flipped bit is caught. */
+static void test_checkpoint() {
+    checkpoint_connection_t connection;
+    memset(&connection, 0, sizeof(connection));
+    connection.fe_port = 0xfffe;
+    connection.is_open = true;
+    connection.transaction_status = TRANSACTION_STATUS_IN_TRANSACTION;
+    connection.fe_channel.min_seq = 0xfffffff0;
+    connection.fe_channel.max_seq = 0x10;
+    connection.be_channel.min_seq = 1;
+    connection.be_channel.max_seq = 65536;
+    connection.fe.message_type = FE_MESSAGE_TYPE_UNKNOWN;
+    connection.be.message_type = BE_MESSAGE_TYPE_DATA_ROW;
+    connection.be.length_offset = 4;
+    connection.be.length_value = 0x01020304;
+    connection.be.message_bytes_read = 1000;
+
+    uint8_t buf[256];
+    FILE *fp = fmemopen(buf, sizeof(buf), "w+");
+    checkpoint_io_t io;
+    checkpoint_io_init(&io, fp);
+    checkpoint_write_connection(&io, &connection);
+    uint32_t checksum = io.checksum;
+    ASSERT(io.is_ok);
+
+    rewind(fp);
+    checkpoint_io_init(&io, fp);
+    checkpoint_connection_t read_connection;
+    memset(&read_connection, 0, sizeof(read_connection));
+    checkpoint_read_connection(&io, &read_connection);
+    ASSERT(io.is_ok);
+    ASSERT(io.checksum == checksum);
+    ASSERT(memcmp(&connection, &read_connection, sizeof(connection)) == 0);
+
+    buf[5] ^= 0x40;
+    rewind(fp);
+    checkpoint_io_init(&io, fp);
+    checkpoint_read_connection(&io, &read_connection);
+    ASSERT(io.checksum != checksum);
+    fclose(fp);
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef TEST_ERROR_RESPONSE_STATE_H
+#define TEST_ERROR_RESPONSE_STATE_H
+
+#include "common.h"
+#include "error_response_state.h"
+
+static void test_error_response_state_helper(const char *payload,
+                                             size_t payload_length,
+                                             const char *expected_severity,
+                                             const char *expected_sqlstate) {
+    error_fields_state_t state;
+    error_fields_state_init(&state);
+    const char *payload_p = payload;
+    const char *payload_end = payload + payload_length;
+    for (; payload_p < payload_end; ++payload_p) {
+        ASSERT(state.state_type != ERROR_FIELDS_STATE_TYPE_DONE);
+        error_fields_state_on_byte(&state, *payload_p);
+    }
+
+//    fprintf(stderr, "severity=%s sqlstate=%s\n", state.severity, state.sqlstate);
+    ASSERT(ERROR_FIELDS_STATE_TYPE_DONE == state.state_type);
+    ASSERT(strcmp(state.severity, expected_severity) == 0);
+    ASSERT(strcmp(state.sqlstate, expected_sqlstate) == 0);
+}
+
+static void test_error_response_state() {
+    test_error_response_state_helper("SERROR\0VERROR\0C22012\0Mdivision by zero\0\0", 40, "ERROR", "22012");
+
+    /* The non-localized severity wins whichever order the fields are in. */
+    test_error_response_state_helper("VFATAL\0SSCHWERWIEGEND\0C57P01\0\0", 30, "FATAL", "57P01");
+    test_error_response_state_helper("SFEHLER\0VERROR\0C23505\0\0", 23, "ERROR", "23505");
+
+    /* Servers before 9.6 don't send V. */
+    test_error_response_state_helper("SWARNING\0C01000\0\0", 17, "WARNING", "01000");
+
+    /* Over-long values are cut off rather than overrunning. */
+    test_error_response_state_helper("SA_VERY_LONG_SEVERITY_INDEED\0C1234567\0\0", 39, "A_VERY_LONG_SEV", "12345");
+}
+
+#endif
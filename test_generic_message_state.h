@@ -5,9 +5,11 @@ static void test_generic_message_state_helper(const char *message,
                                               size_t message_length,
                                               const char *expected_trace_message_suffix) {
     const uint16_t fe_port = 0xff;
+    output_format_t output_format = global_output_format;
+    global_output_format = OUTPUT_FORMAT_TEXT;
     generic_message_state_t state;
     generic_message_state_init(&state);
-    generic_message_state_on_new_message(&state, fe_port, SENDER_TYPE_FE, "test");
+    generic_message_state_on_new_message(&state, fe_port, SENDER_TYPE_FE, FE_MESSAGE_TYPE_QUERY, "test");
     
     char buf[1024];
     buf[0] = '\0';
@@ -21,6 +23,7 @@ static void test_generic_message_state_helper(const char *message,
     }
     
     fclose(trace_fp);
+    global_output_format = output_format;
     
     size_t actual_trace_message_len = strlen(buf);
     size_t expected_trace_message_suffix_len = strlen(expected_trace_message_suffix);
@@ -37,6 +40,33 @@ static void test_generic_message_state_helper(const char *message,
     ASSERT(strcmp(actual_suffix, expected_trace_message_suffix) == 0);
 }
 
+/* A skipped payload is taken in as few steps as the bytes allow and isn't printed. */
+static void test_generic_message_state_skip() {
+    const uint16_t fe_port = 0xff;
+    generic_message_state_t state;
+    generic_message_state_init(&state);
+    generic_message_state_on_new_message(&state, fe_port, SENDER_TYPE_BE, BE_MESSAGE_TYPE_DATA_ROW, "test");
+    generic_message_state_skip_payload(&state);
+
+    char buf[1024];
+    buf[0] = '\0';
+    FILE *trace_fp = fmemopen(buf, sizeof(buf), "w");
+    const char *length = "\x00\x00\x00\x0E";
+    const char *length_end = length + 4;
+    for (; length < length_end; ++length) {
+        ASSERT(!generic_message_state_on_byte(&state, fe_port, *length, trace_fp));
+    }
+
+    bool is_complete;
+    ASSERT(generic_message_state_is_skipping(&state));
+    ASSERT(4 == generic_message_state_skip(&state, 4, &is_complete));
+    ASSERT(!is_complete);
+    ASSERT(6 == generic_message_state_skip(&state, 100, &is_complete));
+    ASSERT(is_complete);
+    fclose(trace_fp);
+    ASSERT('\0' == buf[0]);
+}
+
 static void test_generic_message_state() {
     /* AuthenticationMD5Password */
     test_generic_message_state_helper("R\x00\x00\x00\x0C\x00\x00\x00\x05\x01\x02\x03\x04", 13, " 255 fe test 12 ........\n");
@@ -49,4 +79,6 @@ static void test_generic_message_state() {
     test_generic_message_state_helper("E\x00\x00\x01\x36SERROR012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789",
                                       311,
                                       " 255 fe test 310 SERROR012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789012345678901234567890123456789\n");
+
+    test_generic_message_state_skip();
 }
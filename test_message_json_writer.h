@@ -0,0 +1,67 @@
+#ifndef TEST_MESSAGE_JSON_WRITER_H
+#define TEST_MESSAGE_JSON_WRITER_H
+
+#include "common.h"
+#include "message_json_writer.h"
+
+static void test_message_json_writer_helper(sender_type_t sender_type,
+                                            const char *message,
+                                            size_t message_length,
+                                            const char *expected_json_suffix) {
+    const uint16_t fe_port = 0xff;
+    output_format_t output_format = global_output_format;
+    global_output_format = OUTPUT_FORMAT_NDJSON;
+    generic_message_state_t state;
+    generic_message_state_init(&state);
+    generic_message_state_on_new_message(&state, fe_port, sender_type, message[0], "test");
+
+    char buf[1024];
+    memset(buf, 0, sizeof(buf));
+    FILE *trace_fp = fmemopen(buf, sizeof(buf), "w");
+    const char *message_p = message + 1;
+    const char *message_end = message + message_length;
+    for (; message_p < message_end; ++message_p) {
+        generic_message_state_on_byte(&state, fe_port, *message_p, trace_fp);
+    }
+
+    fclose(trace_fp);
+    global_output_format = output_format;
+
+    size_t actual_json_len = strlen(buf);
+    size_t expected_json_suffix_len = strlen(expected_json_suffix);
+//    fprintf(stderr, "Actual: %sExpected suffix: %s\n", buf, expected_json_suffix);
+    ASSERT(actual_json_len > expected_json_suffix_len);
+    ASSERT(strcmp(&buf[actual_json_len - expected_json_suffix_len], expected_json_suffix) == 0);
+}
+
+static void test_message_json_writer() {
+    /* Escaping */
+    test_message_json_writer_helper(SENDER_TYPE_FE, "Q\x00\x00\x00\x13SELECT \"a\\\"\n\t\x01\x00", 20,
+                                    "\"port\":255,\"sender\":\"fe\",\"type\":\"test\",\"length\":19,\"query\":\"SELECT \\\"a\\\\\\\"\\n\\t\\u0001\"}\n");
+
+    /* Parse */
+    test_message_json_writer_helper(SENDER_TYPE_FE, "P\x00\x00\x00\x17s1\x00SELECT $1\x00\x00\x01\x00\x00\x00\x17", 24,
+                                    "\"length\":23,\"statement\":\"s1\",\"query\":\"SELECT $1\",\"param_types\":[23]}\n");
+
+    /* Bind */
+    test_message_json_writer_helper(SENDER_TYPE_FE, "B\x00\x00\x00\x15\x00s1\x00\x00\x01\x00\x00\x00\x01\x00\x00\x00\x01""5\x00\x00", 22,
+                                    "\"length\":21,\"portal\":\"\",\"statement\":\"s1\",\"param_count\":1}\n");
+
+    /* CommandComplete */
+    test_message_json_writer_helper(SENDER_TYPE_BE, "C\x00\x00\x00\x0fINSERT 0 5\x00", 16,
+                                    "\"length\":15,\"tag\":\"INSERT 0 5\",\"rows\":5}\n");
+    test_message_json_writer_helper(SENDER_TYPE_BE, "C\x00\x00\x00\x0a""BEGIN\x00", 11,
+                                    "\"length\":10,\"tag\":\"BEGIN\"}\n");
+
+    /* ErrorResponse */
+    test_message_json_writer_helper(SENDER_TYPE_BE, "E\x00\x00\x00\x25SFEHLER\x00VERROR\x00""C22012\x00Mdivision\x00\x00", 38,
+                                    "\"length\":37,\"severity\":\"ERROR\",\"sqlstate\":\"22012\",\"message\":\"division\"}\n");
+
+    /* ReadyForQuery */
+    test_message_json_writer_helper(SENDER_TYPE_BE, "Z\x00\x00\x00\x05T", 6, "\"length\":5,\"status\":\"T\"}\n");
+
+    /* Truncated Query (no NUL) */
+    test_message_json_writer_helper(SENDER_TYPE_FE, "Q\x00\x00\x00\x07""abc", 8, "\"query\":\"abc\",\"truncated\":true}\n");
+}
+
+#endif
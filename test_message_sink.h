@@ -0,0 +1,94 @@
+#ifndef TEST_MESSAGE_SINK_H
+#define TEST_MESSAGE_SINK_H
+
+#include "common.h"
+#include "packet_processor.h"
+
+#define TEST_MESSAGE_SINK_FE_PORT 40000
+
+typedef struct {
+    size_t num_messages;
+    pgtrace_message_t message;
+    uint8_t payload[8192];
+} test_message_sink_t;
+
+static void test_message_sink_on_message(const pgtrace_message_t *message, void *arg) {
+    test_message_sink_t *sink = (test_message_sink_t *)arg;
+    ASSERT(message->payload_size <= sizeof(sink->payload));
+    sink->num_messages++;
+    sink->message = *message;
+    memcpy(sink->payload, message->payload, message->payload_size);
+}
+
+/* Feeds bytes as one segment from the front-end, and returns how many messages ended in it. */
+static size_t test_message_sink_feed(test_message_sink_t *sink, const uint8_t *bytes, size_t size) {
+    pgtrace_connection_key_t key = { 0x0a000002, 0x0a000001, TEST_MESSAGE_SINK_FE_PORT, 5432 };
+    size_t num_messages = sink->num_messages;
+    on_segment(&key, false, bytes, size);
+    return sink->num_messages - num_messages;
+}
+
+/* A CopyFail with payload_size bytes of payload. */
+static size_t test_message_sink_copy_fail(uint8_t *bytes, size_t payload_size) {
+    uint32_t length = payload_size + 4;
+    bytes[0] = FE_MESSAGE_TYPE_COPY_FAIL;
+    bytes[1] = length >> 24;
+    bytes[2] = length >> 16;
+    bytes[3] = length >> 8;
+    bytes[4] = length;
+    size_t i = 0;
+    for (; i < payload_size; ++i) {
+        bytes[5 + i] = 'a' + i % 26;
+    }
+
+    return 5 + payload_size;
+}
+
+/* A message that's all in the segment it ends in is passed without a copy, and one that isn't is passed from the
+   trace buffer, complete if it fits. */
+static void test_message_sink() {
+    /* Too big for the stack. */
+    static test_message_sink_t sink;
+    static uint8_t bytes[2 * 8192];
+    message_sink_t saved_sink = global_message_sink;
+    output_format_t saved_output_format = global_output_format;
+    bool saved_is_bulk_accounting_enabled = global_is_bulk_accounting_enabled;
+    uint64_t saved_now_nsec = global_now_nsec;
+    global_output_format = OUTPUT_FORMAT_NONE;
+    global_is_bulk_accounting_enabled = false;
+    global_now_nsec = 1700000000000000000ULL;
+    message_sink_init(&global_message_sink, test_message_sink_on_message, &sink);
+    connection_state_init(get_connection_state(TEST_MESSAGE_SINK_FE_PORT));
+    state_machine_on_connection_open(TEST_MESSAGE_SINK_FE_PORT);
+
+    size_t size = test_message_sink_copy_fail(bytes, 5);
+    size += test_message_sink_copy_fail(bytes + size, 3);
+    ASSERT(2 == test_message_sink_feed(&sink, bytes, size));
+    ASSERT((PGTRACE_DIRECTION_FE_TO_BE == sink.message.direction) && (FE_MESSAGE_TYPE_COPY_FAIL == sink.message.type));
+    ASSERT((0x0a000002 == sink.message.key.fe_address) && (TEST_MESSAGE_SINK_FE_PORT == sink.message.key.fe_port));
+    ASSERT((7 == sink.message.length) && (3 == sink.message.payload_size) && sink.message.is_payload_complete);
+    ASSERT(bytes + 10 + 5 == sink.message.payload);
+
+    size = test_message_sink_copy_fail(bytes, 5);
+    ASSERT(0 == test_message_sink_feed(&sink, bytes, 7));
+    ASSERT(1 == test_message_sink_feed(&sink, bytes + 7, size - 7));
+    ASSERT((5 == sink.message.payload_size) && sink.message.is_payload_complete);
+    ASSERT((sink.message.payload < bytes) || (sink.message.payload >= bytes + size));
+    ASSERT(memcmp(sink.payload, "abcde", 5) == 0);
+
+    /* Too long for the trace buffer. */
+    size = test_message_sink_copy_fail(bytes, 8000);
+    ASSERT(0 == test_message_sink_feed(&sink, bytes, 4000));
+    ASSERT(1 == test_message_sink_feed(&sink, bytes + 4000, size - 4000));
+    ASSERT((8004 == sink.message.length) && !sink.message.is_payload_complete);
+    ASSERT((sink.message.payload_size > 0) && (sink.message.payload_size < 8000));
+    ASSERT(memcmp(sink.payload, bytes + 5, sink.message.payload_size) == 0);
+
+    state_machine_on_connection_close(TEST_MESSAGE_SINK_FE_PORT);
+    global_message_sink = saved_sink;
+    global_output_format = saved_output_format;
+    global_is_bulk_accounting_enabled = saved_is_bulk_accounting_enabled;
+    global_now_nsec = saved_now_nsec;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef TEST_PIPELINE_STATE_H
+#define TEST_PIPELINE_STATE_H
+
+#include "common.h"
+#include "pipeline_state.h"
+
+static void test_pipeline_state() {
+    uint64_t saved_now_nsec = global_now_nsec;
+    pipeline_stats_t saved_stats = global_pipeline_stats;
+    uint64_t saved_num_desyncs = global_pipeline_stats.num_desyncs;
+    uint64_t saved_metrics_num_desyncs = global_metrics.pipeline.num_desyncs;
+    pipeline_state_t state;
+    pipeline_state_init(&state);
+
+    /* A full pipeline loses only its oldest requests, and the rest are still answered with their own timings. */
+    uint64_t i = 0;
+    for (; i < PIPELINE_STATE_MAX_REQUESTS + 6; ++i) {
+        pipeline_state_push(&state, FE_MESSAGE_TYPE_PARSE, false, 0, 1000 + i);
+    }
+
+    ASSERT(PIPELINE_STATE_MAX_REQUESTS == state.num_requests);
+    ASSERT(saved_num_desyncs + 6 == global_pipeline_stats.num_desyncs);
+    ASSERT(1006 == pipeline_state_oldest(&state)->sent_nsec);
+    global_now_nsec = 2000;
+    pipeline_request_t request;
+    uint64_t response_nsec = 0;
+    ASSERT(pipeline_state_on_be_message(&state, BE_MESSAGE_TYPE_PARSE_COMPLETE, &request, &response_nsec));
+    ASSERT(1006 == request.sent_nsec);
+    ASSERT(994 == response_nsec);
+    ASSERT(PIPELINE_STATE_MAX_REQUESTS - 1 == state.num_requests);
+
+    /* The back-end answers a whole batch at its Sync, so the Execute's time runs from when it was sent rather than from
+       the ParseComplete & BindComplete that come with it, and the next Execute's from when the first one finished. */
+    pipeline_state_init(&state);
+    uint8_t batch[] = { FE_MESSAGE_TYPE_PARSE, FE_MESSAGE_TYPE_BIND, FE_MESSAGE_TYPE_EXECUTE,
+                        FE_MESSAGE_TYPE_BIND, FE_MESSAGE_TYPE_EXECUTE, FE_MESSAGE_TYPE_SYNC };
+    for (i = 0; i < sizeof(batch); ++i) {
+        pipeline_state_push(&state, batch[i], false, 0, 1000);
+    }
+
+    be_message_type_t answers[] = { BE_MESSAGE_TYPE_PARSE_COMPLETE, BE_MESSAGE_TYPE_BIND_COMPLETE,
+                                    BE_MESSAGE_TYPE_COMMAND_COMPLETE, BE_MESSAGE_TYPE_BIND_COMPLETE,
+                                    BE_MESSAGE_TYPE_COMMAND_COMPLETE, BE_MESSAGE_TYPE_READY_FOR_QUERY };
+    uint64_t expected_nsec[] = { 2000, 2000, 2000, 2000, 2000, 0 };
+    for (i = 0; i < sizeof(batch); ++i) {
+        global_now_nsec = (i < 3) ? 3000 : 5000;
+        ASSERT(pipeline_state_on_be_message(&state, answers[i], &request, &response_nsec));
+        ASSERT((batch[i] == request.message_type) && (expected_nsec[i] == response_nsec));
+    }
+
+    global_pipeline_stats = saved_stats;
+    global_metrics.pipeline.num_desyncs = saved_metrics_num_desyncs;
+    global_now_nsec = saved_now_nsec;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef TEST_POOLER_STATE_H
+#define TEST_POOLER_STATE_H
+
+#include "common.h"
+#include "pooler_state.h"
+
+/* Feeds a Bind of the unnamed portal to the named statement, with one parameter, to the leg a byte at a time. */
+static void test_pooler_state_bind(pooler_t *pooler, pooler_leg_t *leg, const char *statement_name, const char *value) {
+    uint8_t bytes[128];
+    size_t name_length = strlen(statement_name) + 1;
+    size_t value_length = strlen(value);
+    size_t length = 4 + 1 + name_length + 2 + 2 + 4 + value_length + 2;
+    uint8_t *p = bytes;
+    *p++ = FE_MESSAGE_TYPE_BIND;
+    *p++ = length >> 24;
+    *p++ = length >> 16;
+    *p++ = length >> 8;
+    *p++ = length;
+    *p++ = '\0';
+    memcpy(p, statement_name, name_length);
+    p += name_length;
+    memcpy(p, "\0\0\0\1\0\0\0", 7);
+    p += 7;
+    *p++ = value_length;
+    memcpy(p, value, value_length);
+    p += value_length;
+    *p++ = '\0';
+    *p++ = '\0';
+    ASSERT((size_t)(p - bytes) == 1 + length);
+
+    size_t i = 0;
+    for (; i < (size_t)(p - bytes); ++i) {
+        pooler_leg_on_fe_bytes(leg, 0 == i, bytes + i, 1);
+    }
+
+    pooler_leg_on_fe_message(pooler, leg, FE_MESSAGE_TYPE_BIND, NULL, 0);
+}
+
+static void test_pooler_state_execute(pooler_t *pooler, pooler_leg_t *leg, const statement_text_t *statement, uint64_t sent_nsec) {
+    static const uint8_t bytes[] = { FE_MESSAGE_TYPE_EXECUTE, 0, 0, 0, 9, '\0', 0, 0, 0, 0 };
+    pooler_leg_on_fe_bytes(leg, true, bytes, sizeof(bytes));
+    pooler_leg_on_fe_message(pooler, leg, FE_MESSAGE_TYPE_EXECUTE, statement, sent_nsec);
+}
+
+/* Executes are matched across a pooler that renames prepared statements, oldest first. */
+static void test_pooler_state() {
+    /* Too big for the stack. */
+    static pooler_t pooler;
+    pooler_stats_t saved_stats = global_pooler_stats;
+    pooler_stats_t saved_metrics = global_metrics.pooler;
+    pooler_init(&pooler, 6432);
+    pooler_leg_t client;
+    pooler_leg_t server;
+    pooler_leg_init(&client);
+    pooler_leg_init(&server);
+    client.is_client = true;
+    statement_text_t statement;
+    statement_text_init(&statement);
+    statement.hash = 42;
+
+    test_pooler_state_bind(&pooler, &client, "S_1", "7");
+    test_pooler_state_bind(&pooler, &server, "PGBOUNCER_12", "7");
+    ASSERT(client.bind_hash == server.bind_hash);
+    test_pooler_state_bind(&pooler, &server, "PGBOUNCER_12", "8");
+    ASSERT(client.bind_hash != server.bind_hash);
+
+    test_pooler_state_bind(&pooler, &client, "S_1", "7");
+    test_pooler_state_execute(&pooler, &client, &statement, 1000);
+    test_pooler_state_execute(&pooler, &client, &statement, 2000);
+    test_pooler_state_execute(&pooler, &client, NULL, 2500);
+    ASSERT(3 == pooler.num_pending);
+
+    global_pooler_stats.num_matched = 0;
+    histogram_init(&global_pooler_stats.queue_nsec);
+    test_pooler_state_bind(&pooler, &server, "PGBOUNCER_12", "7");
+    test_pooler_state_execute(&pooler, &server, &statement, 3000);
+    ASSERT((1 == global_pooler_stats.num_matched) && (2000 == global_pooler_stats.queue_nsec.max));
+    ASSERT(2 == pooler.num_pending);
+    test_pooler_state_execute(&pooler, &server, &statement, 3000);
+    ASSERT((2 == global_pooler_stats.num_matched) && (1 == pooler.num_pending));
+    test_pooler_state_execute(&pooler, &server, &statement, 3000);
+    ASSERT(2 == global_pooler_stats.num_matched);
+
+    /* More than fit, so the oldest are dropped and the rest can still be matched. */
+    size_t i = 0;
+    for (; i < POOLER_MAX_PENDING + 10; ++i) {
+        test_pooler_state_execute(&pooler, &client, &statement, 4000 + i);
+    }
+
+    ASSERT(POOLER_MAX_PENDING == pooler.num_pending);
+    test_pooler_state_execute(&pooler, &server, &statement, 4000 + POOLER_MAX_PENDING + 10);
+    ASSERT((3 == global_pooler_stats.num_matched) && (POOLER_MAX_PENDING == global_pooler_stats.queue_nsec.max));
+
+    global_pooler_stats = saved_stats;
+    global_metrics.pooler = saved_metrics;
+}
+
+#endif
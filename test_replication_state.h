@@ -0,0 +1,74 @@
+#ifndef TEST_REPLICATION_STATE_H
+#define TEST_REPLICATION_STATE_H
+
+#include "common.h"
+#include "replication_state.h"
+
+static void test_replication_put_uint64(uint8_t *p, uint64_t value) {
+    int i = 7;
+    for (; i >= 0; --i, value >>= 8) {
+        p[i] = (uint8_t)value;
+    }
+}
+
+/* An XLogData of num_wal_bytes from start_lsn. */
+static void test_replication_xlog_data(replication_stats_t *stats, const replication_connection_t *connection,
+                                       uint64_t start_lsn, int32_t num_wal_bytes) {
+    uint8_t header[REPLICATION_XLOG_DATA_HEADER_SIZE] = { REPLICATION_MESSAGE_XLOG_DATA };
+    test_replication_put_uint64(header + 1, start_lsn);
+    replication_on_be_header(stats, connection, header, 4 + REPLICATION_XLOG_DATA_HEADER_SIZE + num_wal_bytes);
+}
+
+static void test_replication_status_update(replication_stats_t *stats, const replication_connection_t *connection,
+                                           uint64_t write_lsn, uint64_t flush_lsn, uint64_t apply_lsn) {
+    uint8_t header[REPLICATION_STANDBY_STATUS_UPDATE_SIZE] = { REPLICATION_MESSAGE_STANDBY_STATUS_UPDATE };
+    test_replication_put_uint64(header + 1, write_lsn);
+    test_replication_put_uint64(header + 9, flush_lsn);
+    test_replication_put_uint64(header + 17, apply_lsn);
+    replication_on_fe_header(stats, connection, header);
+}
+
+static void test_replication_state() {
+    /* Headers are put together from however the payload is split, and bytes that don't follow on are ignored. */
+    replication_decoder_t decoder;
+    uint8_t header[REPLICATION_XLOG_DATA_HEADER_SIZE] = { REPLICATION_MESSAGE_XLOG_DATA };
+    test_replication_put_uint64(header + 1, 0x1234);
+    ASSERT(!replication_decoder_on_payload(&decoder, 0, header, 10));
+    ASSERT(!replication_decoder_on_payload(&decoder, 11, header + 11, sizeof(header) - 11));
+    ASSERT(replication_decoder_on_payload(&decoder, 10, header + 10, sizeof(header) - 10));
+    ASSERT(replication_decoder_is_xlog_data(&decoder));
+    ASSERT(0x1234 == replication_get_uint64(decoder.header + 1));
+
+    uint64_t saved_now_nsec = global_now_nsec;
+    static replication_stats_t stats;
+    replication_stats_init(&stats);
+    replication_connection_t connection;
+    replication_connection_start(&connection, &stats, 40000, 0);
+    replication_replica_t *replica = &stats.replicas[connection.replica_number - 1];
+
+    /* Like pg_receivewal: write is reported a message behind, flush only from the 100th message on and stuck at its end,
+       and apply never.  However long that goes on for, write lag keeps up. */
+    uint64_t i = 1;
+    for (; i <= 4 * REPLICATION_NUM_LAG_SAMPLES; ++i) {
+        global_now_nsec = i * 1000;
+        test_replication_xlog_data(&stats, &connection, (i - 1) * 100, 100);
+        global_now_nsec += 300;
+        test_replication_status_update(&stats, &connection, (i - 1) * 100, (i < 100) ? 0 : 100 * 100, 0);
+        ASSERT((1 == i) || (1300 == replica->lag_nsec[REPLICATION_POSITION_WRITE]));
+        ASSERT((1 == i) || (100 == replication_replica_lag_bytes(replica, REPLICATION_POSITION_WRITE)));
+        ASSERT(0 == replica->lag_nsec[REPLICATION_POSITION_APPLY]);
+        ASSERT(0 == replication_replica_lag_bytes(replica, REPLICATION_POSITION_APPLY));
+        /* Flush had overflowed before it was first reported, so it carries on from the oldest sample left. */
+        ASSERT((i != 100) || (300 == replica->lag_nsec[REPLICATION_POSITION_FLUSH]));
+    }
+
+    /* Flush has overflowed again, so its lag is from the oldest sample that it hasn't reached, the 101st. */
+    ASSERT(global_now_nsec - 101 * 1000 == replica->lag_nsec[REPLICATION_POSITION_FLUSH]);
+    test_replication_status_update(&stats, &connection, (i - 1) * 100, 200 * 100, 0);
+    ASSERT(global_now_nsec - 200 * 1000 == replica->lag_nsec[REPLICATION_POSITION_FLUSH]);
+
+    replication_connection_stop(&connection, &stats);
+    global_now_nsec = saved_now_nsec;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef TEST_SESSION_TAGS_H
+#define TEST_SESSION_TAGS_H
+
+#include "common.h"
+#include "session_tags.h"
+
+static void test_session_tags() {
+    /* Too big for the stack. */
+    static session_tags_t tags;
+    session_tags_init(&tags);
+    bool is_new;
+    session_tag_id_t alice = session_tags_intern(&tags, "alice", 5, &is_new);
+    ASSERT(is_new);
+    ASSERT(alice > SESSION_TAG_ID_OTHER);
+    ASSERT(strcmp(session_tags_name(&tags, alice), "alice") == 0);
+    session_tag_id_t shop = session_tags_intern(&tags, "shop", 4, &is_new);
+    ASSERT(is_new);
+    ASSERT(shop != alice);
+    ASSERT(session_tags_intern(&tags, "alice", 5, &is_new) == alice);
+    ASSERT(!is_new);
+    /* A prefix is a different name. */
+    ASSERT(session_tags_intern(&tags, "ali", 3, &is_new) != alice);
+    ASSERT(is_new);
+
+    char name[16];
+    while (tags.num_names < SESSION_TAGS_CAPACITY) {
+        sprintf(name, "name%zu", tags.num_names);
+        session_tags_intern(&tags, name, strlen(name), &is_new);
+        ASSERT(is_new);
+    }
+
+    ASSERT(session_tags_intern(&tags, "one too many", 12, &is_new) == SESSION_TAG_ID_OTHER);
+    ASSERT(!is_new);
+    ASSERT(1 == tags.num_overflows);
+    ASSERT(session_tags_intern(&tags, "shop", 4, &is_new) == shop);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef TEST_SHM_RING_H
+#define TEST_SHM_RING_H
+
+#include "common.h"
+#include "ring_output.h"
+
+static void test_shm_ring_publish(ring_output_t *ring, uint8_t type, size_t payload_size) {
+    static const uint8_t payload[SHM_RING_SLOT_SIZE];
+    pgtrace_message_t message;
+    memset(&message, 0, sizeof(message));
+    message.key.fe_port = 40000;
+    message.key.be_port = 5432;
+    message.direction = PGTRACE_DIRECTION_BE_TO_FE;
+    message.type = type;
+    message.length = payload_size + 4;
+    message.payload = payload;
+    message.payload_size = payload_size;
+    message.is_payload_complete = 1;
+    ring_output_on_message(&message, ring);
+}
+
+/* A reader sees messages in order, counts the ones that it was lapped for, and follows the writer's restart. */
+static void test_shm_ring() {
+    static uint64_t memory[(SHM_RING_HEADER_SIZE + 4 * SHM_RING_SLOT_SIZE) / sizeof(uint64_t)];
+    ring_output_t ring;
+    ring_output_init(&ring, (shm_ring_header_t *)memory, sizeof(memory), 4);
+    shm_ring_reader_t reader;
+    ASSERT(shm_ring_reader_init(&reader, (shm_ring_header_t *)memory, sizeof(memory)) == 0);
+    shm_ring_record_t record;
+    ASSERT(!shm_ring_reader_next(&reader, &record));
+
+    test_shm_ring_publish(&ring, 'Z', 1);
+    ASSERT(shm_ring_reader_next(&reader, &record));
+    ASSERT((1 == record.seq) && ('Z' == record.type) && (5 == record.length) && (1 == record.payload_size));
+    ASSERT((40000 == record.fe_port) && (5432 == record.be_port) && (1 == record.direction) && record.is_payload_complete);
+    ASSERT(!shm_ring_reader_next(&reader, &record));
+
+    uint8_t type = 'A';
+    for (; type < 'G'; ++type) {
+        test_shm_ring_publish(&ring, type, 0);
+    }
+
+    ASSERT(shm_ring_reader_next(&reader, &record));
+    ASSERT((2 == reader.num_dropped) && ('C' == record.type));
+    ASSERT(shm_ring_reader_next(&reader, &record) && shm_ring_reader_next(&reader, &record));
+    ASSERT(shm_ring_reader_next(&reader, &record) && ('F' == record.type));
+    ASSERT(!shm_ring_reader_next(&reader, &record));
+
+    test_shm_ring_publish(&ring, 'D', SHM_RING_SLOT_SIZE);
+    ASSERT(shm_ring_reader_next(&reader, &record));
+    ASSERT((SHM_RING_MAX_PAYLOAD_SIZE == record.payload_size) && !record.is_payload_complete);
+
+    /* A writer that restarts on the ring starts the next generation from message 1, and the reader follows it. */
+    ring_output_init(&ring, (shm_ring_header_t *)memory, sizeof(memory), 4);
+    ASSERT(!shm_ring_reader_next(&reader, &record));
+    test_shm_ring_publish(&ring, 'Q', 0);
+    ASSERT(shm_ring_reader_next(&reader, &record));
+    ASSERT((1 == record.seq) && ('Q' == record.type) && (2 == reader.num_dropped) && (1 == reader.generation));
+    ASSERT(!shm_ring_reader_next(&reader, &record));
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef TEST_STATEMENT_STATE_H
+#define TEST_STATEMENT_STATE_H
+
+#include "common.h"
+#include "statement_state.h"
+
+static uint64_t test_statement_state_name_hash(const char *name) {
+    statement_state_t state;
+    statement_state_on_message_start(&state, FE_MESSAGE_TYPE_EXECUTE);
+    statement_state_on_payload_bytes(&state, (const uint8_t *)name, strlen(name) + 1);
+    ASSERT(!statement_state_is_reading_names(&state));
+    return state.name_hashes[0];
+}
+
+static void test_statement_state_text(statement_text_t *statement, const char *text) {
+    statement_text_init(statement);
+    statement->hash = strlen(text);
+    statement->length = strlen(text);
+    strcpy(statement->text, text);
+}
+
+/* Whether an Execute of the portal runs the statement with the given text. */
+static bool test_statement_state_executes(statement_state_t *state, const char *portal, const char *text) {
+    uint16_t statement_ref;
+    if (!statement_state_on_execute(state, test_statement_state_name_hash(portal), &statement_ref)) {
+        return false;
+    }
+
+    const statement_text_t *statement = statement_state_get(state, statement_ref);
+    return statement && (strcmp(statement->text, text) == 0);
+}
+
+static void test_statement_state_bind(statement_state_t *state, const char *portal, const char *name) {
+    statement_state_on_message_start(state, FE_MESSAGE_TYPE_BIND);
+    /* The names, then parameter formats and values that must not be taken for names. */
+    uint8_t payload[128];
+    size_t length = strlen(portal) + 1;
+    memcpy(payload, portal, length);
+    memcpy(payload + length, name, strlen(name) + 1);
+    length += strlen(name) + 1;
+    memcpy(payload + length, "\0\0\0\0\0\0", 6);
+    statement_state_on_payload_bytes(state, payload, length + 6);
+    ASSERT(!statement_state_is_reading_names(state));
+    statement_state_on_bind(state, state->name_hashes[0], state->name_hashes[1]);
+}
+
+/* Executes are credited to the statement that their portal was bound to, not the last one parsed. */
+static void test_statement_state() {
+    static statement_state_t state;
+    statement_state_init(&state);
+    statement_text_t statement;
+    test_statement_state_text(&statement, "select a");
+    statement_state_on_parse(&state, test_statement_state_name_hash("S_1"), &statement);
+    test_statement_state_text(&statement, "select b");
+    statement_state_on_parse(&state, test_statement_state_name_hash("S_2"), &statement);
+
+    test_statement_state_bind(&state, "", "S_1");
+    ASSERT(test_statement_state_executes(&state, "", "select a"));
+    test_statement_state_bind(&state, "C_1", "S_2");
+    ASSERT(test_statement_state_executes(&state, "C_1", "select b"));
+    ASSERT(test_statement_state_executes(&state, "", "select a"));
+    ASSERT(!test_statement_state_executes(&state, "C_2", "select a"));
+
+    /* A pipelined Execute of the unnamed statement still has its text once the statement's been parsed again. */
+    test_statement_state_text(&statement, "select c");
+    statement_state_on_parse(&state, test_statement_state_name_hash(""), &statement);
+    test_statement_state_bind(&state, "", "");
+    uint16_t statement_ref;
+    ASSERT(statement_state_on_execute(&state, test_statement_state_name_hash(""), &statement_ref));
+    test_statement_state_text(&statement, "select d");
+    statement_state_on_parse(&state, test_statement_state_name_hash(""), &statement);
+    test_statement_state_bind(&state, "", "");
+    ASSERT(strcmp(statement_state_get(&state, statement_ref)->text, "select c") == 0);
+    ASSERT(test_statement_state_executes(&state, "", "select d"));
+
+    /* Statements that are used outlast ones that aren't, however many Queries there are. */
+    size_t i = 0;
+    for (; i < 4 * STATEMENT_STATE_NUM_STATEMENTS; ++i) {
+        test_statement_state_text(&statement, "select 1");
+        statement_state_add(&state, &statement);
+        test_statement_state_bind(&state, "", "S_1");
+    }
+
+    ASSERT(test_statement_state_executes(&state, "", "select a"));
+    test_statement_state_bind(&state, "", "S_2");
+    ASSERT(!test_statement_state_executes(&state, "", "select b"));
+}
+
+#endif
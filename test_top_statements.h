@@ -0,0 +1,94 @@
+#ifndef TEST_TOP_STATEMENTS_H
+#define TEST_TOP_STATEMENTS_H
+
+#include "common.h"
+#include "top_statements.h"
+#include "statement_message_state.h"
+
+static void test_top_statements_text_helper(const char *payload,
+                                            size_t payload_length,
+                                            bool has_name,
+                                            const char *expected_text) {
+    statement_text_state_t state;
+    statement_text_state_init(&state, has_name);
+    const char *payload_p = payload;
+    const char *payload_end = payload + payload_length;
+    for (; payload_p < payload_end; ++payload_p) {
+        statement_text_state_on_byte(&state, *payload_p);
+    }
+
+//    fprintf(stderr, "text='%s'\n", state.statement.text);
+    ASSERT(STATEMENT_TEXT_STATE_TYPE_DONE == state.state_type);
+    ASSERT(strcmp(state.statement.text, expected_text) == 0);
+}
+
+static uint64_t test_top_statements_hash(const char *payload, size_t payload_length, bool has_name) {
+    statement_text_state_t state;
+    statement_text_state_init(&state, has_name);
+    size_t i = 0;
+    for (; i < payload_length; ++i) {
+        statement_text_state_on_byte(&state, payload[i]);
+    }
+
+    return state.statement.hash;
+}
+
+static void test_top_statements_sketch() {
+    space_saving_t sketch;
+    space_saving_init(&sketch);
+    statement_text_t heavy;
+    statement_text_init(&heavy);
+    heavy.hash = 1;
+
+    /* Far more distinct light statements than there are counters, with a heavy one in amongst them. */
+    uint64_t i = 0;
+    for (; i < 100 * TOP_STATEMENTS_CAPACITY; ++i) {
+        statement_text_t light;
+        statement_text_init(&light);
+        light.hash = i + 2;
+        space_saving_add(&sketch, &light, 1, 1);
+        if (0 == i % 4) {
+            space_saving_add(&sketch, &heavy, 1, 1);
+        }
+    }
+
+    ASSERT(TOP_STATEMENTS_CAPACITY == sketch.num_counters);
+    top_statements_counter_t *heaviest = &sketch.counters[0];
+    for (i = 1; i < sketch.num_counters; ++i) {
+        if (sketch.counters[i].weight > heaviest->weight) {
+            heaviest = &sketch.counters[i];
+        }
+    }
+
+    ASSERT(1 == heaviest->statement.hash);
+    ASSERT(heaviest->weight - heaviest->error <= 25 * TOP_STATEMENTS_CAPACITY);
+    ASSERT(heaviest->weight >= 25 * TOP_STATEMENTS_CAPACITY);
+}
+
+static void test_top_statements() {
+    test_top_statements_text_helper("SELECT 1\0", 9, false, "SELECT 1");
+    test_top_statements_text_helper("s1\0SELECT $1\0\0\0", 15, true, "SELECT $1");
+
+    /* Formatting doesn't matter. */
+    test_top_statements_text_helper("  SELECT\n\t*  FROM t \n\0", 22, false, "SELECT * FROM t");
+    ASSERT(test_top_statements_hash("SELECT\n  *\nFROM t\0", 18, false) == test_top_statements_hash("SELECT * FROM t\0", 16, false));
+    ASSERT(test_top_statements_hash("SELECT * FROM t\0", 16, false) != test_top_statements_hash("SELECT * FROM u\0", 16, false));
+
+    /* Long text is cut off on a character boundary but all of it is hashed. */
+    char payload[STATEMENT_TEXT_MAX_LENGTH + 3];
+    memset(payload, 'x', sizeof(payload));
+    payload[STATEMENT_TEXT_MAX_LENGTH - 1] = (char)0xc3;
+    payload[STATEMENT_TEXT_MAX_LENGTH] = (char)0xa9;
+    payload[sizeof(payload) - 1] = '\0';
+    char expected_text[STATEMENT_TEXT_MAX_LENGTH];
+    memset(expected_text, 'x', sizeof(expected_text) - 1);
+    expected_text[sizeof(expected_text) - 1] = '\0';
+    test_top_statements_text_helper(payload, sizeof(payload), false, expected_text);
+    uint64_t hash = test_top_statements_hash(payload, sizeof(payload), false);
+    payload[sizeof(payload) - 2] = 'y';
+    ASSERT(test_top_statements_hash(payload, sizeof(payload), false) != hash);
+
+    test_top_statements_sketch();
+}
+
+#endif
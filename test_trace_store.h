@@ -0,0 +1,40 @@
+#ifndef TEST_TRACE_STORE_H
+#define TEST_TRACE_STORE_H
+
+#include "common.h"
+#include "trace_store_format.h"
+
+/* Blocks come back as they went in, ones that don't compress are left alone, and damaged ones are caught. */
+static void test_trace_store() {
+    static uint32_t table[TRACE_STORE_HASH_SIZE];
+    static uint8_t in[8192];
+    static uint8_t out[sizeof(in)];
+    static uint8_t back[sizeof(in)];
+    size_t size = 0;
+    unsigned int i = 0;
+    for (; size + 64 < sizeof(in); ++i) {
+        size += sprintf((char *)in + size, "SELECT * FROM accounts WHERE id = %u;aaaaaaaaaaaaaaaa", i % 7);
+    }
+
+    size_t compressed_size = trace_store_compress(in, size, out, table);
+    ASSERT((compressed_size > 0) && (compressed_size < size / 4));
+    ASSERT(trace_store_decompress(out, compressed_size, back, size));
+    ASSERT(memcmp(in, back, size) == 0);
+    ASSERT(!trace_store_decompress(out, compressed_size, back, size - 1));
+    ASSERT(!trace_store_decompress(out, compressed_size - 1, back, size));
+
+    uint32_t random = 1;
+    for (i = 0; i < sizeof(in); ++i) {
+        random = random * 1103515245 + 12345;
+        in[i] = (uint8_t)(random >> 16);
+    }
+
+    ASSERT(0 == trace_store_compress(in, sizeof(in), out, table));
+    ASSERT(0 == trace_store_compress(in, 3, out, table));
+
+    ASSERT(trace_store_unzigzag(trace_store_zigzag(-5)) == -5);
+    ASSERT(trace_store_zigzag(-1) == 1);
+    ASSERT(trace_store_unzigzag(trace_store_zigzag(INT64_MAX)) == INT64_MAX);
+}
+
+#endif
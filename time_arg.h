@@ -0,0 +1,57 @@
+#ifndef TIME_ARG_H
+#define TIME_ARG_H
+
+/* For the from & to times that pgrollup and pgtracequery take.  Parses epoch seconds, a local "YYYY-MM-DD HH:MM[:SS]",
+   or a local "HH:MM[:SS]" on the day of day_nsec.  Returns false if it's none of those. */
+static bool time_arg_parse(const char *s, uint64_t day_nsec, uint64_t *nsec) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    char extra;
+    int num_parsed;
+    if ((num_parsed = sscanf(s, "%d-%d-%d%*[ T]%d:%d:%d%c", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                             &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &extra)) >= 5) {
+        if (7 == num_parsed) {
+            return false;
+        }
+
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+    } else if ((num_parsed = sscanf(s, "%d:%d:%d%c", &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &extra)) >= 2) {
+        if (4 == num_parsed) {
+            return false;
+        }
+
+        time_t day_sec = day_nsec / 1000000000;
+        struct tm day;
+        localtime_r(&day_sec, &day);
+        tm.tm_year = day.tm_year;
+        tm.tm_mon = day.tm_mon;
+        tm.tm_mday = day.tm_mday;
+    } else {
+        char *end;
+        errno = 0;
+        unsigned long long sec = strtoull(s, &end, 10);
+        if ((errno != 0) || (end == s) || (*end != '\0')) {
+            return false;
+        }
+
+        *nsec = sec * 1000000000;
+        return true;
+    }
+
+    if ((tm.tm_mon < 0) || (tm.tm_mon > 11) || (tm.tm_mday < 1) || (tm.tm_mday > 31) || (tm.tm_hour < 0) ||
+        (tm.tm_hour > 23) || (tm.tm_min < 0) || (tm.tm_min > 59) || (tm.tm_sec < 0) || (tm.tm_sec > 60)) {
+        return false;
+    }
+
+    tm.tm_isdst = -1;
+    time_t sec = mktime(&tm);
+    if (sec < 0) {
+        return false;
+    }
+
+    *nsec = (uint64_t)sec * 1000000000;
+    return true;
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef TOP_STATEMENTS_H
+#define TOP_STATEMENTS_H
+
+/* Enough of a statement to recognise it in a summary.  The hash covers all of the text, not just what's kept. */
+#define STATEMENT_TEXT_MAX_LENGTH 127
+
+/* Counters per ranking per minute.  A statement can only be missed if it's outside the top TOP_STATEMENTS_CAPACITY
+   in every minute of the window. */
+#define TOP_STATEMENTS_CAPACITY 64
+
+/* Enough minutes for the longest window. */
+#define TOP_STATEMENTS_NUM_MINUTES 15
+
+#define TOP_STATEMENTS_USEC_PER_MINUTE (60 * (uint64_t)1000000)
+
+typedef struct {
+    uint64_t hash;
+    uint8_t length;
+    char text[STATEMENT_TEXT_MAX_LENGTH + 1];
+} statement_text_t;
+
+static void statement_text_init(statement_text_t *statement) {
+    ASSERT(statement);
+    statement->hash = 0;
+    statement->length = 0;
+    statement->text[0] = '\0';
+}
+
+typedef enum {
+    TOP_STATEMENTS_RANKING_TIME,
+    TOP_STATEMENTS_RANKING_CALLS,
+    TOP_STATEMENTS_NUM_RANKINGS,
+} top_statements_ranking_t;
+
+static const char *top_statements_ranking_names[TOP_STATEMENTS_NUM_RANKINGS] = {"time", "calls"};
+
+/* A Space-Saving counter.  weight is what the statement is ranked by and may overestimate by up to error, calls
+   and total_usec only count since the statement last took over the counter. */
+typedef struct {
+    statement_text_t statement;
+    uint64_t weight;
+    uint64_t error;
+    uint64_t calls;
+    uint64_t total_usec;
+} top_statements_counter_t;
+
+/* Space-Saving: when there's no counter for a statement it takes over the one with the least weight.  Linear scans
+   are fine at this capacity and keep it all in a few cache lines' worth of hashes. */
+typedef struct {
+    top_statements_counter_t counters[TOP_STATEMENTS_CAPACITY];
+    size_t num_counters;
+} space_saving_t;
+
+static void space_saving_init(space_saving_t *sketch) {
+    ASSERT(sketch);
+    sketch->num_counters = 0;
+}
+
+static void space_saving_add(space_saving_t *sketch, const statement_text_t *statement, uint64_t weight, uint64_t usec) {
+    ASSERT(sketch);
+    ASSERT(statement);
+    top_statements_counter_t *min_counter = NULL;
+    size_t i = 0;
+    for (; i < sketch->num_counters; ++i) {
+        top_statements_counter_t *counter = &sketch->counters[i];
+        if (counter->statement.hash == statement->hash) {
+            counter->weight += weight;
+            counter->calls++;
+            counter->total_usec += usec;
+            return;
+        }
+
+        if (!min_counter || (counter->weight < min_counter->weight)) {
+            min_counter = counter;
+        }
+    }
+
+    top_statements_counter_t *counter;
+    if (sketch->num_counters < TOP_STATEMENTS_CAPACITY) {
+        counter = &sketch->counters[sketch->num_counters++];
+        counter->error = 0;
+        counter->weight = weight;
+    } else {
+        counter = min_counter;
+        counter->error = counter->weight;
+        counter->weight += weight;
+    }
+
+    counter->statement = *statement;
+    counter->calls = 1;
+    counter->total_usec = usec;
+}
+
+
+typedef struct {
+    /* Minutes since the epoch, in packet time. */
+    uint64_t minute;
+    space_saving_t rankings[TOP_STATEMENTS_NUM_RANKINGS];
+} top_statements_minute_t;
+
+/* The statements with the most total time and the most calls over sliding windows, in constant memory however many
+   distinct statements there are.  Each minute gets its own sketches in a ring, and a window is the merge of its
+   minutes. */
+typedef struct {
+    /* How many statements to report per ranking per window, or 0 if we're not tracking statements at all. */
+    size_t n;
+    uint64_t first_usec;
+    top_statements_minute_t minutes[TOP_STATEMENTS_NUM_MINUTES];
+} top_statements_t;
+
+ENGINE_STATE(top_statements_t, global_top_statements);
+#define global_top_statements ENGINE_STATE_OF(global_top_statements)
+
+static const unsigned int top_statements_window_minutes[] = {1, 5, 15};
+
+static void top_statements_init(top_statements_t *top, size_t n) {
+    ASSERT(top);
+    ASSERT(n <= TOP_STATEMENTS_CAPACITY);
+    top->n = n;
+    top->first_usec = 0;
+    size_t i = 0;
+    for (; i < TOP_STATEMENTS_NUM_MINUTES; ++i) {
+        top->minutes[i].minute = 0;
+        size_t j = 0;
+        for (; j < TOP_STATEMENTS_NUM_RANKINGS; ++j) {
+            space_saving_init(&top->minutes[i].rankings[j]);
+        }
+    }
+}
+
+static inline bool top_statements_is_enabled(const top_statements_t *top) {
+    return top->n > 0;
+}
+
+/* A statement has completed. */
+static void top_statements_add(top_statements_t *top, const statement_text_t *statement, uint64_t duration_usec) {
+    ASSERT(top);
+    ASSERT(statement);
+    if (!top_statements_is_enabled(top)) {
+        return;
+    }
+
+    uint64_t now_usec = now_epoch_usec();
+    if (0 == top->first_usec) {
+        top->first_usec = now_usec;
+    }
+
+    uint64_t minute = now_usec / TOP_STATEMENTS_USEC_PER_MINUTE;
+    top_statements_minute_t *slot = &top->minutes[minute % TOP_STATEMENTS_NUM_MINUTES];
+    if (slot->minute != minute) {
+        slot->minute = minute;
+        size_t i = 0;
+        for (; i < TOP_STATEMENTS_NUM_RANKINGS; ++i) {
+            space_saving_init(&slot->rankings[i]);
+        }
+    }
+
+    space_saving_add(&slot->rankings[TOP_STATEMENTS_RANKING_TIME], statement, duration_usec, duration_usec);
+    space_saving_add(&slot->rankings[TOP_STATEMENTS_RANKING_CALLS], statement, 1, duration_usec);
+}
+
+static int top_statements_compare_counters(const void *a, const void *b) {
+    const top_statements_counter_t *ca = a;
+    const top_statements_counter_t *cb = b;
+    return (ca->weight < cb->weight) - (ca->weight > cb->weight);
+}
+
+/* Merges the sketches for the window's minutes into merged, heaviest first, and returns how many there are.  The
+   errors add up because each minute's error bound is independent. */
+static size_t top_statements_merge(top_statements_t *top,
+                                   top_statements_ranking_t ranking,
+                                   unsigned int window_minutes,
+                                   top_statements_counter_t *merged) {
+    uint64_t now_minute = now_epoch_usec() / TOP_STATEMENTS_USEC_PER_MINUTE;
+    size_t num_merged = 0;
+    size_t i = 0;
+    for (; i < TOP_STATEMENTS_NUM_MINUTES; ++i) {
+        const top_statements_minute_t *slot = &top->minutes[i];
+        if ((slot->minute > now_minute) || (slot->minute + window_minutes <= now_minute)) {
+            continue;
+        }
+
+        const space_saving_t *sketch = &slot->rankings[ranking];
+        size_t j = 0;
+        for (; j < sketch->num_counters; ++j) {
+            const top_statements_counter_t *counter = &sketch->counters[j];
+            size_t k = 0;
+            for (; (k < num_merged) && (merged[k].statement.hash != counter->statement.hash); ++k) {
+            }
+
+            if (k == num_merged) {
+                merged[num_merged++] = *counter;
+            } else {
+                merged[k].weight += counter->weight;
+                merged[k].error += counter->error;
+                merged[k].calls += counter->calls;
+                merged[k].total_usec += counter->total_usec;
+            }
+        }
+    }
+
+    qsort(merged, num_merged, sizeof(*merged), top_statements_compare_counters);
+    return num_merged;
+}
+
+/* How much time the window really covers, which is less than the whole window if we haven't been running that long. */
+static uint64_t top_statements_window_usec(top_statements_t *top, unsigned int window_minutes) {
+    uint64_t now_usec = now_epoch_usec();
+    uint64_t start_usec = (now_usec / TOP_STATEMENTS_USEC_PER_MINUTE + 1 - window_minutes) * TOP_STATEMENTS_USEC_PER_MINUTE;
+    if (start_usec < top->first_usec) {
+        start_usec = top->first_usec;
+    }
+
+    return (now_usec > start_usec) ? now_usec - start_usec : 1;
+}
+
+static void top_statements_print_text(top_statements_t *top,
+                                      top_statements_ranking_t ranking,
+                                      unsigned int window_minutes,
+                                      uint64_t window_usec,
+                                      const top_statements_counter_t *counters,
+                                      size_t num_counters) {
+    size_t i = 0;
+    for (; i < num_counters; ++i) {
+        const top_statements_counter_t *counter = &counters[i];
+        char text[STATEMENT_TEXT_MAX_LENGTH + 1];
+        size_t j = 0;
+        for (; j < counter->statement.length; ++j) {
+            uint8_t byte = (uint8_t)counter->statement.text[j];
+            text[j] = ((byte < 32) || (127 == byte)) ? '.' : byte;
+        }
+
+        text[j] = '\0';
+        LOG("top statements: window_sec=%u by=%s rank=%zu calls=%llu calls_per_sec=%.3f total_usec=%llu error=%llu text=%s",
+            window_minutes * 60,
+            top_statements_ranking_names[ranking],
+            i + 1,
+            (unsigned long long)counter->calls,
+            counter->calls * 1000000.0 / window_usec,
+            (unsigned long long)counter->total_usec,
+            (unsigned long long)counter->error,
+            text);
+    }
+}
+
+/* A record per statement rather than one per ranking, since the texts are clients' and escaping can make each one
+   several times longer, so that a whole ranking could be more than a writer holds. */
+static void top_statements_print_json(top_statements_t *top,
+                                      top_statements_ranking_t ranking,
+                                      unsigned int window_minutes,
+                                      uint64_t window_usec,
+                                      const top_statements_counter_t *counters,
+                                      size_t num_counters,
+                                      FILE *fp) {
+    const char *by = top_statements_ranking_names[ranking];
+    size_t i = 0;
+    for (; i < num_counters; ++i) {
+        const top_statements_counter_t *counter = &counters[i];
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"TopStatement\"");
+        message_json_writer_write_uint_field(&writer, "window_sec", window_minutes * 60);
+        message_json_writer_write_uint_field(&writer, "window_usec", window_usec);
+        message_json_writer_write_string_field(&writer, "by", (const uint8_t *)by, strlen(by));
+        message_json_writer_write_uint_field(&writer, "rank", i + 1);
+        message_json_writer_write_string_field(&writer, "text", (const uint8_t *)counter->statement.text,
+                                               counter->statement.length);
+        message_json_writer_write_uint_field(&writer, "calls", counter->calls);
+        message_json_writer_write_uint_field(&writer, "total_usec", counter->total_usec);
+        message_json_writer_write_uint_field(&writer, "error", counter->error);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, fp);
+    }
+}
+
+/* Prints the top statements by each ranking for each window.  Nothing is reset, the windows just slide along. */
+static void top_statements_print(top_statements_t *top, FILE *fp) {
+    ASSERT(top);
+    if (!top_statements_is_enabled(top)) {
+        return;
+    }
+
+    static top_statements_counter_t merged[TOP_STATEMENTS_NUM_MINUTES * TOP_STATEMENTS_CAPACITY];
+    size_t i = 0;
+    for (; i < sizeof(top_statements_window_minutes)/sizeof(top_statements_window_minutes[0]); ++i) {
+        unsigned int window_minutes = top_statements_window_minutes[i];
+        uint64_t window_usec = top_statements_window_usec(top, window_minutes);
+        top_statements_ranking_t ranking = 0;
+        for (; ranking < TOP_STATEMENTS_NUM_RANKINGS; ++ranking) {
+            size_t num_merged = top_statements_merge(top, ranking, window_minutes, merged);
+            if (num_merged > top->n) {
+                num_merged = top->n;
+            }
+
+            if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+                top_statements_print_json(top, ranking, window_minutes, window_usec, merged, num_merged, fp);
+            } else {
+                top_statements_print_text(top, ranking, window_minutes, window_usec, merged, num_merged);
+            }
+        }
+    }
+}
+
+#endif
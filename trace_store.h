@@ -0,0 +1,233 @@
+#ifndef TRACE_STORE_H
+#define TRACE_STORE_H
+
+/* Appends each traced message to the -x trace store and its index, see trace_store_format.h.  A block is written when it's
+   full, once its first message is TRACE_STORE_BLOCK_MAX_NSEC old in packet time, and at exit. */
+
+#define TRACE_STORE_BLOCK_MAX_NSEC (10ULL * 1000000000)
+#define TRACE_STORE_NUM_PORTS 65536
+
+typedef struct {
+    /* NULL if we're not storing messages. */
+    FILE *fp;
+    FILE *index_fp;
+    const char *path;
+    char *index_path;
+    /* Where the next block goes. */
+    uint64_t offset;
+    /* The block's earliest & latest message start times, the last record's, and when its first record was added. */
+    uint64_t start_nsec;
+    uint64_t end_nsec;
+    uint64_t previous_nsec;
+    uint64_t opened_nsec;
+    size_t num_records;
+    size_t raw_size;
+    /* The fe_ports that the block has messages for. */
+    uint64_t ports[TRACE_STORE_NUM_PORTS / 64];
+    uint8_t raw[TRACE_STORE_BLOCK_SIZE];
+    uint8_t stored[TRACE_STORE_BLOCK_SIZE];
+    uint32_t hash_table[TRACE_STORE_HASH_SIZE];
+    uint8_t index_entry[TRACE_STORE_INDEX_ENTRY_HEADER_SIZE + TRACE_STORE_NUM_PORTS * 3];
+} trace_store_t;
+
+trace_store_t global_trace_store;
+
+static inline bool trace_store_is_enabled(const trace_store_t *store) {
+    return store->fp != NULL;
+}
+
+/* Opens path for appending, writing its header if it's new, or checks that it's a trace store if it isn't. */
+static FILE *trace_store_open_file(const char *path, const char *magic) {
+    uint8_t header[TRACE_STORE_HEADER_SIZE];
+    memcpy(header, magic, TRACE_STORE_MAGIC_SIZE);
+    rollup_format_put_uint(header + TRACE_STORE_MAGIC_SIZE, TRACE_STORE_VERSION, 4);
+    FILE *fp = fopen(path, "a+b");
+    if (!fp) {
+        FATAL("Can't open trace store: %s.  errno=%d", path, errno);
+    }
+
+    uint8_t existing[TRACE_STORE_HEADER_SIZE];
+    rewind(fp);
+    size_t num_read = fread(existing, 1, sizeof(existing), fp);
+    if (0 == num_read) {
+        if ((fwrite(header, sizeof(header), 1, fp) != 1) || (fflush(fp) != 0)) {
+            FATAL("Can't write trace store: %s.  errno=%d", path, errno);
+        }
+    } else if ((num_read != sizeof(header)) || (memcmp(existing, header, sizeof(header)) != 0)) {
+        FATAL("%s isn't a version %d trace store, so can't be appended to", path, TRACE_STORE_VERSION);
+    }
+
+    if (fseek(fp, 0, SEEK_END) != 0) {
+        FATAL("Can't seek in trace store: %s.  errno=%d", path, errno);
+    }
+
+    return fp;
+}
+
+static void trace_store_open(trace_store_t *store, const char *path) {
+    ASSERT(store);
+    ASSERT(path);
+    store->fp = trace_store_open_file(path, TRACE_STORE_FILE_MAGIC);
+    long offset = ftell(store->fp);
+    if (offset < 0) {
+        FATAL("Can't seek in trace store: %s.  errno=%d", path, errno);
+    }
+
+    if ((store->index_path = malloc(strlen(path) + sizeof(TRACE_STORE_INDEX_SUFFIX))) == NULL) {
+        FATAL("Can't allocate the path of %s's index", path);
+    }
+
+    sprintf(store->index_path, "%s%s", path, TRACE_STORE_INDEX_SUFFIX);
+    store->index_fp = trace_store_open_file(store->index_path, TRACE_STORE_INDEX_MAGIC);
+    store->path = path;
+    store->offset = offset;
+    store->num_records = 0;
+    store->raw_size = 0;
+    memset(store->ports, 0, sizeof(store->ports));
+}
+
+static void trace_store_stop(trace_store_t *store) {
+    fclose(store->fp);
+    fclose(store->index_fp);
+    store->fp = NULL;
+    store->index_fp = NULL;
+    free(store->index_path);
+    store->index_path = NULL;
+}
+
+/* Compresses the block and writes it, and then its index entry so that readers only ever find whole blocks. */
+static void trace_store_write_block(trace_store_t *store) {
+    if (0 == store->num_records) {
+        return;
+    }
+
+    const uint8_t *stored = store->stored;
+    size_t stored_size = trace_store_compress(store->raw, store->raw_size, store->stored, store->hash_table);
+    uint8_t compression = TRACE_STORE_COMPRESSION_LZ;
+    if (0 == stored_size) {
+        stored = store->raw;
+        stored_size = store->raw_size;
+        compression = TRACE_STORE_COMPRESSION_NONE;
+    }
+
+    uint8_t header[TRACE_STORE_BLOCK_HEADER_SIZE];
+    rollup_format_put_uint(header, store->start_nsec, 8);
+    rollup_format_put_uint(header + 8, store->end_nsec, 8);
+    rollup_format_put_uint(header + 16, store->num_records, 4);
+    rollup_format_put_uint(header + 20, store->raw_size, 4);
+    rollup_format_put_uint(header + 24, stored_size, 4);
+    header[28] = compression;
+
+    uint8_t *p = store->index_entry + TRACE_STORE_INDEX_ENTRY_HEADER_SIZE;
+    size_t previous_port = 0;
+    size_t i = 0;
+    for (; i < TRACE_STORE_NUM_PORTS / 64; ++i) {
+        uint64_t word = store->ports[i];
+        for (; word != 0; word &= word - 1) {
+            size_t port = 64 * i + __builtin_ctzll(word);
+            p = rollup_format_put_varint(p, port - previous_port);
+            previous_port = port;
+        }
+    }
+
+    rollup_format_put_uint(store->index_entry, store->start_nsec, 8);
+    rollup_format_put_uint(store->index_entry + 8, store->end_nsec, 8);
+    rollup_format_put_uint(store->index_entry + 16, store->offset, 8);
+    rollup_format_put_uint(store->index_entry + 24, p - store->index_entry - TRACE_STORE_INDEX_ENTRY_HEADER_SIZE, 4);
+    if ((fwrite(header, sizeof(header), 1, store->fp) != 1) || (fwrite(stored, stored_size, 1, store->fp) != 1) ||
+        (fflush(store->fp) != 0) || (fwrite(store->index_entry, p - store->index_entry, 1, store->index_fp) != 1) ||
+        (fflush(store->index_fp) != 0)) {
+        LOG("Can't write trace store: %s.  errno=%d.  Stopped storing messages.", store->path, errno);
+        trace_store_stop(store);
+        return;
+    }
+
+    store->offset += sizeof(header) + stored_size;
+    global_metrics.num_trace_store_blocks++;
+    global_metrics.num_trace_store_records += store->num_records;
+    global_metrics.num_trace_store_raw_bytes += store->raw_size;
+    global_metrics.num_trace_store_stored_bytes += sizeof(header) + stored_size;
+    store->num_records = 0;
+    store->raw_size = 0;
+    memset(store->ports, 0, sizeof(store->ports));
+}
+
+/* Packet time has moved on to now_nsec, which may make the block old enough to write. */
+static inline void trace_store_on_time(trace_store_t *store, uint64_t now_nsec) {
+    if ((store->num_records > 0) && (now_nsec - store->opened_nsec >= TRACE_STORE_BLOCK_MAX_NSEC)) {
+        trace_store_write_block(store);
+    }
+}
+
+/* A message that's being traced, with as much of its payload as buf holds. */
+static void trace_store_on_message(trace_store_t *store,
+                                   uint64_t start_nsec,
+                                   uint16_t fe_port,
+                                   sender_type_t sender_type,
+                                   uint8_t message_type,
+                                   const char *name,
+                                   int32_t length,
+                                   message_trace_buffer_t *buf) {
+    if (store->raw_size + TRACE_STORE_MAX_RECORD_SIZE > sizeof(store->raw)) {
+        trace_store_write_block(store);
+        if (!trace_store_is_enabled(store)) {
+            return;
+        }
+    }
+
+    if (0 == store->num_records) {
+        store->start_nsec = start_nsec;
+        store->end_nsec = start_nsec;
+        store->previous_nsec = start_nsec;
+        store->opened_nsec = now_epoch_nsec();
+    } else if (start_nsec < store->start_nsec) {
+        store->start_nsec = start_nsec;
+    } else if (start_nsec > store->end_nsec) {
+        store->end_nsec = start_nsec;
+    }
+
+    size_t name_length = strlen(name);
+    if (name_length > 255) {
+        name_length = 255;
+    }
+
+    size_t payload_size = message_trace_buffer_payload_size(buf);
+    uint8_t flags = (SENDER_TYPE_BE == sender_type) ? TRACE_STORE_FLAG_BE : 0;
+    if (buf->is_truncated) {
+        flags |= TRACE_STORE_FLAG_TRUNCATED;
+    }
+
+    uint8_t *p = store->raw + store->raw_size;
+    p = rollup_format_put_varint(p, trace_store_zigzag((int64_t)(start_nsec - store->previous_nsec)));
+    rollup_format_put_uint(p, fe_port, 2);
+    p += 2;
+    *p++ = flags;
+    *p++ = message_type;
+    p = rollup_format_put_varint(p, (uint32_t)length);
+    *p++ = (uint8_t)name_length;
+    memcpy(p, name, name_length);
+    p += name_length;
+    p = rollup_format_put_varint(p, payload_size);
+    memcpy(p, message_trace_buffer_payload(buf), payload_size);
+    p += payload_size;
+
+    store->raw_size = p - store->raw;
+    store->previous_nsec = start_nsec;
+    store->num_records++;
+    store->ports[fe_port / 64] |= 1ULL << (fe_port % 64);
+}
+
+/* Writes what's been stored so far. */
+static void trace_store_close(trace_store_t *store) {
+    ASSERT(store);
+    if (!trace_store_is_enabled(store)) {
+        return;
+    }
+
+    trace_store_write_block(store);
+    if (trace_store_is_enabled(store)) {
+        trace_store_stop(store);
+    }
+}
+
+#endif
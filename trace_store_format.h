@@ -0,0 +1,166 @@
+#ifndef TRACE_STORE_FORMAT_H
+#define TRACE_STORE_FORMAT_H
+
+/* The trace stores that pgtrace -x writes and pgtracequery reads: each message that pgtrace traces, as it traces it,
+   whether or not it's printed, in compressed blocks with an index of each block's time range and connections, so that
+   one connection's messages around a time can be found without reading the rest.
+
+   The data file is a header, magic(8) version(4), and then blocks that are only ever appended.  A block header is
+   start_nsec(8) end_nsec(8) num_records(4) raw_size(4) stored_size(4) compression(1), the earliest and latest message
+   start times in it and the size of its records before and after compression, then stored_size bytes of records.
+   Each record is:
+
+     start_nsec     varint, zigzag-encoded nanoseconds since the previous record's, or since the block's start_nsec
+                    for the first record
+     fe_port(2)
+     flags(1)       TRACE_STORE_FLAG_*
+     type(1)        the message type, or 0 for messages without one, e.g. StartupMessage
+     length         varint, the message's length field, or 1 for a lone byte that doesn't have one, e.g. the answer
+                    to an SSLRequest
+     name_length(1) name, the message name that pgtrace traces it with
+     payload_size   varint, then that many bytes of payload, which is as much as pgtrace's trace buffer held
+
+   The index file, the data file's path with TRACE_STORE_INDEX_SUFFIX, is a header, magic(8) version(4), and an entry
+   per block, start_nsec(8) end_nsec(8) offset(8) ports_size(4) and then ports_size bytes of the fe_ports that the block
+   has messages for, in order as varints, each less the one before it.  An entry is written once its block is.
+   Fixed-size fields and varints are as in rollup_format.h. */
+#define TRACE_STORE_FILE_MAGIC "PGTRSTOR"
+#define TRACE_STORE_INDEX_MAGIC "PGTRSIDX"
+#define TRACE_STORE_MAGIC_SIZE 8
+#define TRACE_STORE_VERSION 1
+#define TRACE_STORE_HEADER_SIZE (TRACE_STORE_MAGIC_SIZE + 4)
+#define TRACE_STORE_BLOCK_HEADER_SIZE (8 + 8 + 4 + 4 + 4 + 1)
+#define TRACE_STORE_INDEX_ENTRY_HEADER_SIZE (8 + 8 + 8 + 4)
+#define TRACE_STORE_INDEX_SUFFIX ".idx"
+
+/* Records before compression.  A block is written when the next record won't fit. */
+#define TRACE_STORE_BLOCK_SIZE (1024 * 1024)
+#define TRACE_STORE_MAX_RECORD_SIZE (2 * ROLLUP_MAX_VARINT_SIZE + 2 + 1 + 1 + 1 + 255 + sizeof(((message_trace_buffer_t *)0)->data))
+
+#define TRACE_STORE_FLAG_BE 0x01
+/* The payload is only the start of the message's. */
+#define TRACE_STORE_FLAG_TRUNCATED 0x02
+
+typedef enum {
+    TRACE_STORE_COMPRESSION_NONE,
+    /* See trace_store_compress. */
+    TRACE_STORE_COMPRESSION_LZ,
+} trace_store_compression_t;
+
+/* The compressor's hash table, of positions + 1 of the last 4 bytes seen with each hash. */
+#define TRACE_STORE_HASH_BITS 16
+#define TRACE_STORE_HASH_SIZE (1 << TRACE_STORE_HASH_BITS)
+/* Shorter matches can cost more than the literals they replace. */
+#define TRACE_STORE_MIN_MATCH 8
+
+static inline uint32_t trace_store_hash(const uint8_t *p) {
+    uint32_t value = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    return (value * 2654435761U) >> (32 - TRACE_STORE_HASH_BITS);
+}
+
+/* LZ77 with no entropy coding, which is quick and does well enough on traces, where the same statements & column
+   values come up again and again.  The output is a run of sequences, each a varint count of literals and the literals,
+   then, unless that was the end, a varint match length less TRACE_STORE_MIN_MATCH and a varint offset back to copy the
+   match from.  Returns the compressed size, or 0 if it wouldn't be smaller than size.  out must hold size bytes and
+   table TRACE_STORE_HASH_SIZE entries. */
+static size_t trace_store_compress(const uint8_t *in, size_t size, uint8_t *out, uint32_t *table) {
+    memset(table, 0, TRACE_STORE_HASH_SIZE * sizeof(*table));
+    uint8_t *p = out;
+    const uint8_t *out_end = out + size;
+    size_t literal_start = 0;
+    size_t i = 0;
+    while (i + TRACE_STORE_MIN_MATCH <= size) {
+        uint32_t hash = trace_store_hash(in + i);
+        size_t candidate = table[hash];
+        table[hash] = i + 1;
+        if ((0 == candidate) || (memcmp(in + candidate - 1, in + i, TRACE_STORE_MIN_MATCH) != 0)) {
+            ++i;
+            continue;
+        }
+
+        --candidate;
+        size_t match_length = TRACE_STORE_MIN_MATCH;
+        while ((i + match_length < size) && (in[candidate + match_length] == in[i + match_length])) {
+            ++match_length;
+        }
+
+        size_t num_literals = i - literal_start;
+        if ((size_t)(out_end - p) < num_literals + 3 * ROLLUP_MAX_VARINT_SIZE) {
+            return 0;
+        }
+
+        p = rollup_format_put_varint(p, num_literals);
+        memcpy(p, in + literal_start, num_literals);
+        p += num_literals;
+        p = rollup_format_put_varint(p, match_length - TRACE_STORE_MIN_MATCH);
+        p = rollup_format_put_varint(p, i - candidate);
+        i += match_length;
+        literal_start = i;
+        /* So that whatever follows a match can match from just before it. */
+        if (i + 4 <= size) {
+            table[trace_store_hash(in + i - 2)] = i - 1;
+        }
+    }
+
+    size_t num_literals = size - literal_start;
+    if (num_literals > 0) {
+        if ((size_t)(out_end - p) <= num_literals + ROLLUP_MAX_VARINT_SIZE) {
+            return 0;
+        }
+
+        p = rollup_format_put_varint(p, num_literals);
+        memcpy(p, in + literal_start, num_literals);
+        p += num_literals;
+    }
+
+    return (p < out_end) ? (size_t)(p - out) : 0;
+}
+
+/* Undoes trace_store_compress into out, which holds out_size bytes.  Returns false unless it comes to exactly
+   out_size. */
+static bool trace_store_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t out_size) {
+    const uint8_t *end = in + size;
+    size_t num_out = 0;
+    while (in < end) {
+        uint64_t num_literals;
+        if (((in = rollup_format_get_varint(in, end, &num_literals)) == NULL) ||
+            (num_literals > (uint64_t)(end - in)) || (num_literals > out_size - num_out)) {
+            return false;
+        }
+
+        memcpy(out + num_out, in, num_literals);
+        in += num_literals;
+        num_out += num_literals;
+        if (in == end) {
+            break;
+        }
+
+        uint64_t match_length, offset;
+        if (((in = rollup_format_get_varint(in, end, &match_length)) == NULL) ||
+            ((in = rollup_format_get_varint(in, end, &offset)) == NULL) || (0 == offset) || (offset > num_out) ||
+            ((match_length += TRACE_STORE_MIN_MATCH) > out_size - num_out)) {
+            return false;
+        }
+
+        /* A byte at a time, since the match can run into what it's making. */
+        const uint8_t *from = out + num_out - offset;
+        size_t i = 0;
+        for (; i < match_length; ++i) {
+            out[num_out + i] = from[i];
+        }
+
+        num_out += match_length;
+    }
+
+    return num_out == out_size;
+}
+
+static inline uint64_t trace_store_zigzag(int64_t value) {
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t trace_store_unzigzag(uint64_t value) {
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+#endif
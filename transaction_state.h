@@ -0,0 +1,93 @@
+#ifndef TRANSACTION_STATE_H
+#define TRANSACTION_STATE_H
+
+/* The transaction status byte at the end of ReadyForQuery. */
+typedef enum {
+    TRANSACTION_STATUS_UNKNOWN = 0,
+    TRANSACTION_STATUS_IDLE = 'I',
+    TRANSACTION_STATUS_IN_TRANSACTION = 'T',
+    TRANSACTION_STATUS_FAILED = 'E',
+} transaction_status_t;
+
+typedef struct {
+    transaction_status_t status;
+    bool is_aborted;
+    /* 0 if we joined part way through the transaction and don't know when it started. */
+    uint64_t start_nsec;
+    /* When the front-end sent the first message after the last ReadyForQuery, or 0 if it hasn't yet. */
+    uint64_t request_start_nsec;
+    /* When the back-end said it was ready while in a transaction, or 0 if it isn't idle in a transaction. */
+    uint64_t idle_start_nsec;
+    uint32_t num_statements;
+} transaction_state_t;
+
+static void transaction_state_init(transaction_state_t *state) {
+    ASSERT(state);
+    state->status = TRANSACTION_STATUS_UNKNOWN;
+    state->is_aborted = false;
+    state->start_nsec = 0;
+    state->request_start_nsec = 0;
+    state->idle_start_nsec = 0;
+    state->num_statements = 0;
+}
+
+static inline bool transaction_status_is_in_transaction(transaction_status_t status) {
+    return (TRANSACTION_STATUS_IN_TRANSACTION == status) || (TRANSACTION_STATUS_FAILED == status);
+}
+
+static inline void transaction_state_on_fe_message(transaction_state_t *state, fe_message_type_t message_type) {
+    ASSERT(state);
+    uint64_t now_nsec = now_epoch_nsec();
+    if (0 == state->request_start_nsec) {
+        state->request_start_nsec = now_nsec;
+    }
+
+    if (state->idle_start_nsec != 0) {
+        transaction_stats_on_idle_in_transaction(&global_transaction_stats, now_nsec - state->idle_start_nsec);
+        transaction_stats_on_idle_in_transaction(&global_metrics.transactions, now_nsec - state->idle_start_nsec);
+        state->idle_start_nsec = 0;
+    }
+
+    if ((FE_MESSAGE_TYPE_QUERY == message_type) || (FE_MESSAGE_TYPE_EXECUTE == message_type)) {
+        state->num_statements++;
+    }
+}
+
+static void transaction_state_on_ready_for_query(transaction_state_t *state, uint8_t status_byte) {
+    ASSERT(state);
+    transaction_status_t status = (transaction_status_t)status_byte;
+    if ((status != TRANSACTION_STATUS_IDLE) && !transaction_status_is_in_transaction(status)) {
+        LOG("Unexpected ReadyForQuery transaction status 0x%02x", (unsigned int)status_byte);
+        return;
+    }
+
+    uint64_t now_nsec = now_epoch_nsec();
+    if (transaction_status_is_in_transaction(status) && !transaction_status_is_in_transaction(state->status)) {
+        /* If we don't know what the status was then we don't know when the transaction started either. */
+        state->start_nsec = (TRANSACTION_STATUS_IDLE == state->status) ? state->request_start_nsec : 0;
+        state->is_aborted = false;
+    }
+
+    if (TRANSACTION_STATUS_FAILED == status) {
+        state->is_aborted = true;
+    }
+
+    if ((TRANSACTION_STATUS_IDLE == status) && transaction_status_is_in_transaction(state->status)) {
+        bool is_start_known = (state->start_nsec != 0);
+        uint64_t duration_nsec = now_nsec - state->start_nsec;
+        transaction_stats_on_transaction(&global_transaction_stats, state->is_aborted, is_start_known, duration_nsec, state->num_statements);
+        transaction_stats_on_transaction(&global_metrics.transactions, state->is_aborted, is_start_known, duration_nsec, state->num_statements);
+    }
+
+    if (TRANSACTION_STATUS_IDLE == status) {
+        state->num_statements = 0;
+        state->idle_start_nsec = 0;
+    } else {
+        state->idle_start_nsec = now_nsec;
+    }
+
+    state->status = status;
+    state->request_start_nsec = 0;
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef TRANSACTION_STATS_H
+#define TRANSACTION_STATS_H
+
+/* Explicit (BEGIN ... COMMIT/ROLLBACK) transactions.  Autocommit statements go straight from idle to idle and aren't
+   counted.  The global stats are reset for each summary, the metrics' copy isn't. */
+typedef struct {
+    uint64_t num_transactions;
+    /* Transactions that went into the failed state before they ended. */
+    uint64_t num_aborted_transactions;
+    /* From the request that started the transaction to the ReadyForQuery that said it was over. */
+    histogram_t duration_nsec;
+    /* Query and Execute messages per transaction. */
+    histogram_t num_statements;
+    /* From a ReadyForQuery in a transaction to the front-end's next message, i.e. the time that the transaction sat
+       holding its locks while the client did something else. */
+    histogram_t idle_in_transaction_nsec;
+} transaction_stats_t;
+
+ENGINE_STATE(transaction_stats_t, global_transaction_stats);
+#define global_transaction_stats ENGINE_STATE_OF(global_transaction_stats)
+
+static void transaction_stats_init(transaction_stats_t *stats) {
+    ASSERT(stats);
+    stats->num_transactions = 0;
+    stats->num_aborted_transactions = 0;
+    histogram_init(&stats->duration_nsec);
+    histogram_init(&stats->num_statements);
+    histogram_init(&stats->idle_in_transaction_nsec);
+}
+
+static void transaction_stats_on_transaction(transaction_stats_t *stats,
+                                            bool is_aborted,
+                                            bool is_start_known,
+                                            uint64_t duration_nsec,
+                                            uint32_t num_statements) {
+    ASSERT(stats);
+    stats->num_transactions++;
+    if (is_aborted) {
+        stats->num_aborted_transactions++;
+    }
+
+    if (is_start_known) {
+        histogram_add(&stats->duration_nsec, duration_nsec);
+        histogram_add(&stats->num_statements, num_statements);
+    }
+}
+
+static inline void transaction_stats_on_idle_in_transaction(transaction_stats_t *stats, uint64_t idle_nsec) {
+    histogram_add(&stats->idle_in_transaction_nsec, idle_nsec);
+}
+
+static void transaction_stats_print_summary(transaction_stats_t *stats, FILE *fp) {
+    ASSERT(stats);
+    if (OUTPUT_FORMAT_NDJSON == global_output_format) {
+        message_json_writer_t writer;
+        message_json_writer_init(&writer);
+        message_json_writer_write_raw(&writer, "{\"ts\":");
+        message_json_writer_write_timestamp(&writer, now_epoch_nsec());
+        message_json_writer_write_key(&writer, "type");
+        message_json_writer_write_raw(&writer, "\"TransactionSummary\"");
+        message_json_writer_write_uint_field(&writer, "transactions", stats->num_transactions);
+        message_json_writer_write_uint_field(&writer, "aborted", stats->num_aborted_transactions);
+        histogram_write_json_field(&stats->duration_nsec, "duration_nsec", &writer);
+        histogram_write_json_field(&stats->num_statements, "statements", &writer);
+        histogram_write_json_field(&stats->idle_in_transaction_nsec, "idle_in_transaction_nsec", &writer);
+        *writer.p++ = '}';
+        *writer.p++ = '\n';
+        fwrite(writer.data, writer.p - writer.data, 1, fp);
+        return;
+    }
+
+    char duration_str[256];
+    char num_statements_str[256];
+    char idle_in_transaction_str[256];
+    LOG("transaction summary: transactions=%llu aborted=%llu duration_nsec=%s statements=%s idle_in_transaction_nsec=%s",
+        (unsigned long long)stats->num_transactions,
+        (unsigned long long)stats->num_aborted_transactions,
+        histogram_to_str(&stats->duration_nsec, duration_str),
+        histogram_to_str(&stats->num_statements, num_statements_str),
+        histogram_to_str(&stats->idle_in_transaction_nsec, idle_in_transaction_str));
+}
+
+#endif